@@ -884,7 +884,7 @@ static int fdb_flush(int argc, char **argv)
 
 int do_fdb(int argc, char **argv)
 {
-	ll_init_map(&rth);
+	ll_init_map();
 	timestamp = 0;
 
 	if (argc > 0) {
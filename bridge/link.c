@@ -748,7 +748,7 @@ static int brlink_show_isolated(int argc, char **argv)
 
 int do_link(int argc, char **argv)
 {
-	ll_init_map(&rth);
+	ll_init_map();
 	timestamp = 0;
 
 	if (argc > 0) {
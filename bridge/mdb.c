@@ -1078,7 +1078,7 @@ static int mdb_flush(int argc, char **argv)
 
 int do_mdb(int argc, char **argv)
 {
-	ll_init_map(&rth);
+	ll_init_map();
 	timestamp = 0;
 
 	if (argc > 0) {
@@ -74,6 +74,42 @@ void print_headers(FILE *fp, const char *label)
 		fprintf(fp, "%s", label);
 }
 
+/* Have the kernel drop all but the bridge notifications printed above;
+ * the default groups carry routes, addresses and neighbours as well.
+ */
+static void monitor_select(void)
+{
+	static const struct {
+		__u16	type;
+		__u8	hdrlen;
+		__u8	family;
+	} sel[] = {
+		{ RTM_NEWLINK,	 sizeof(struct ifinfomsg),	AF_UNSPEC },
+		{ RTM_NEWLINK,	 sizeof(struct ifinfomsg),	AF_BRIDGE },
+		{ RTM_DELLINK,	 sizeof(struct ifinfomsg),	AF_UNSPEC },
+		{ RTM_DELLINK,	 sizeof(struct ifinfomsg),	AF_BRIDGE },
+		{ RTM_NEWNEIGH,	 sizeof(struct ndmsg),		AF_BRIDGE },
+		{ RTM_DELNEIGH,	 sizeof(struct ndmsg),		AF_BRIDGE },
+		{ RTM_NEWMDB },
+		{ RTM_DELMDB },
+		{ RTM_NEWVLAN },
+		{ RTM_DELVLAN },
+		{ RTM_NEWTUNNEL },
+		{ RTM_DELTUNNEL },
+	};
+	struct rtnl_listen_sel rs[ARRAY_SIZE(sel)] = {};
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(sel); i++) {
+		rs[i].type = sel[i].type;
+		rs[i].hdrlen = sel[i].hdrlen;
+		if (sel[i].hdrlen)
+			rtnl_sel_field(&rs[i], 0, 1, sel[i].family);
+	}
+
+	rtnl_listen_select(&rth, rs, ARRAY_SIZE(rs), true);
+}
+
 int do_monitor(int argc, char **argv)
 {
 	char *file = NULL;
@@ -157,7 +193,8 @@ int do_monitor(int argc, char **argv)
 		exit(1);
 	}
 
-	ll_init_map(&rth);
+	ll_init_map();
+	monitor_select();
 
 	if (rtnl_listen(&rth, accept_msg, stdout) < 0)
 		exit(2);
@@ -244,7 +244,7 @@ static int mst_set(int argc, char **argv)
 
 int do_mst(int argc, char **argv)
 {
-	ll_init_map(&rth);
+	ll_init_map();
 
 	if (argc > 0) {
 		if (matches(*argv, "set") == 0)
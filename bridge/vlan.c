@@ -1363,7 +1363,7 @@ static int vlan_global(int argc, char **argv)
 
 int do_vlan(int argc, char **argv)
 {
-	ll_init_map(&rth);
+	ll_init_map();
 	timestamp = 0;
 
 	if (argc > 0) {
@@ -387,7 +387,7 @@ static int vni_show(int argc, char **argv)
 
 int do_vni(int argc, char **argv)
 {
-	ll_init_map(&rth);
+	ll_init_map();
 	timestamp = 0;
 
 	if (argc > 0) {
@@ -4,6 +4,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <stdbool.h>
 #include <endian.h>
 #include <asm/types.h>
 #include <linux/netlink.h>
@@ -14,6 +15,17 @@
 #include <linux/netconf.h>
 #include <arpa/inet.h>
 
+struct rtnl_stats {
+	__u64			recv_calls;
+	__u64			recv_bytes;
+	__u64			recv_msgs;
+	__u32			rbuf_allocs;
+	__u64			overruns;	/* of the receive queue */
+	__u64			lost;		/* notifications, if known */
+};
+
+struct rtnl_pipe;
+
 struct rtnl_handle {
 	int			fd;
 	struct sockaddr_nl	local;
@@ -26,6 +38,27 @@ struct rtnl_handle {
 #define RTNL_HANDLE_F_SUPPRESS_NLERR		0x02
 #define RTNL_HANDLE_F_STRICT_CHK		0x04
 	int			flags;
+	char		       *rbuf;
+	size_t			rbuf_len;
+	struct rtnl_stats	stats;
+	struct rtnl_pipe       *pipe;
+};
+
+/* Bulk deletion of dumped objects, see rtnl_flush_open() */
+struct rtnl_flush {
+	struct rtnl_handle	rth;
+	char		       *buf;
+	unsigned int	       *clen;	/* bytes queued in each chunk */
+	unsigned int		nchunks; /* chunks allocated */
+	unsigned int		chunks;	/* chunks in use */
+	unsigned int		vlen;	/* chunks per sendmmsg() */
+	unsigned int		queued;
+	unsigned int		noop;	/* already deleted or present */
+	unsigned int		errors;
+	int			error;	/* first unexpected errno */
+	bool			early;	/* sent while the dump was running */
+	bool			lost;	/* errors were dropped by the socket */
+	__u64			start;
 };
 
 struct nlmsg_list {
@@ -45,6 +78,7 @@ struct ipstats_req {
 };
 
 extern int rcvbuf;
+extern int show_nlstats;
 
 int rtnl_open(struct rtnl_handle *rth, unsigned int subscriptions)
 	__attribute__((warn_unused_result));
@@ -185,6 +219,23 @@ int rtnl_send(struct rtnl_handle *rth, const void *buf, int)
 	__attribute__((warn_unused_result));
 int rtnl_send_check(struct rtnl_handle *rth, const void *buf, int)
 	__attribute__((warn_unused_result));
+int rtnl_pipeline_start(struct rtnl_handle *rth, unsigned int window,
+			const char *name)
+	__attribute__((warn_unused_result));
+int rtnl_pipeline_buffer(struct rtnl_handle *rth, unsigned int size);
+int rtnl_pipeline_flush(struct rtnl_handle *rth);
+unsigned int rtnl_pipeline_errors(const struct rtnl_handle *rth);
+void rtnl_pipeline_stop(struct rtnl_handle *rth);
+int rtnl_flush_open(struct rtnl_flush *f)
+	__attribute__((warn_unused_result));
+int rtnl_flush_queue(struct rtnl_flush *f, const struct nlmsghdr *n,
+		     __u16 type);
+int rtnl_flush_queue_flags(struct rtnl_flush *f, const struct nlmsghdr *n,
+			   __u16 type, __u16 flags);
+int rtnl_flush_commit(struct rtnl_flush *f);
+void rtnl_flush_report(const struct rtnl_flush *f, const char *verb,
+		       const char *what, FILE *fp);
+void rtnl_flush_close(struct rtnl_flush *f);
 int nl_dump_ext_ack(const struct nlmsghdr *nlh, nl_ext_ack_fn_t errfn);
 int nl_dump_ext_ack_done(const struct nlmsghdr *nlh, unsigned int offset, int error);
 
@@ -302,6 +353,34 @@ static inline int rta_type(const struct rtattr *rta)
 }
 
 int rtnl_listen_all_nsid(struct rtnl_handle *);
+typedef int (*rtnl_overrun_t)(struct rtnl_handle *, unsigned int lost,
+			      void *);
+int rtnl_set_rcvbuf(struct rtnl_handle *rth, int size);
+typedef int (*rtnl_batch_done_t)(struct rtnl_handle *, void *);
+int rtnl_listen_overrun(struct rtnl_handle *, rtnl_listen_filter_t handler,
+			rtnl_overrun_t overrun, void *jarg);
+int rtnl_listen_batch(struct rtnl_handle *, rtnl_listen_filter_t handler,
+		      rtnl_overrun_t overrun, rtnl_batch_done_t done,
+		      void *jarg);
+
+/* Notifications of one type let through by rtnl_listen_select() */
+#define RTNL_SEL_CHECKS		4
+struct rtnl_listen_sel {
+	__u16	type;
+	__u8	hdrlen;		/* of the family header */
+	__u8	nchecks;
+	struct {
+		__u16	attr;	/* __u32 attribute, or */
+		__u8	off;	/* field in the family header */
+		__u8	size;
+		__u32	val;
+	} check[RTNL_SEL_CHECKS];
+};
+void rtnl_sel_field(struct rtnl_listen_sel *sel, __u8 off, __u8 size,
+		    __u32 val);
+void rtnl_sel_attr(struct rtnl_listen_sel *sel, __u16 attr, __u32 val);
+int rtnl_listen_select(struct rtnl_handle *rth,
+		       const struct rtnl_listen_sel *sel, int n, bool strict);
 int rtnl_listen(struct rtnl_handle *, rtnl_listen_filter_t handler,
 		void *jarg);
 int rtnl_from_file(FILE *, rtnl_listen_filter_t handler,
@@ -0,0 +1,8 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef __LZ_H__
+#define __LZ_H__ 1
+
+int lz_compress(const void *src, int len, void *dst, int cap);
+int lz_decompress(const void *src, int len, void *dst, int cap);
+
+#endif /* __LZ_H__ */
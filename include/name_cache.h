@@ -0,0 +1,30 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef __NAME_CACHE_H__
+#define __NAME_CACHE_H__ 1
+
+#include <stdbool.h>
+#include <linux/types.h>
+
+/* Key "family" of service names: the port in network order followed by
+ * the protocol name.
+ */
+#define NAME_CACHE_SERVICE	255
+
+/* Seconds names are kept for, positive and negative */
+#define NAME_CACHE_TTL		3600
+#define NAME_CACHE_NEG_TTL	300
+#define NAME_CACHE_SERV_TTL	86400
+
+const char *name_cache_get(int af, int len, const void *key, bool *found);
+const char *name_cache_set(int af, int len, const void *key,
+			   const char *name, unsigned int ttl);
+
+struct name_query {
+	int		af;
+	int		len;
+	__u8		addr[16];
+};
+
+void name_cache_resolve(const struct name_query *q, unsigned int n);
+
+#endif /* __NAME_CACHE_H__ */
@@ -0,0 +1,61 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef __NETEM_DIST_H__
+#define __NETEM_DIST_H__ 1
+
+/*
+ * Binary netem distribution tables, the ".bdist" files next to the
+ * text ".dist" ones.  A header is followed by the table entries, all
+ * little endian, so that the file can be handed to the kernel as it is
+ * mapped on most hosts.  The checksum covers the entries.
+ */
+
+#include <stddef.h>
+#include <endian.h>
+#include <linux/types.h>
+
+#define NETEM_DIST_MAGIC	0x4d54454e	/* "NETM" */
+#define NETEM_DIST_VERSION	1
+
+struct netem_dist_hdr {
+	__le32	magic;
+	__le16	version;
+	__le16	hdr_len;
+	__le32	count;		/* of __le16 entries */
+	__le32	check;		/* netem_dist_check() of the entries */
+};
+
+static inline __u32 netem_dist_check(const void *data, size_t len)
+{
+	const __u8 *p = data;
+	__u32 h = 2166136261U;
+
+	while (len--)
+		h = (h ^ *p++) * 16777619U;
+	return h;
+}
+
+/*
+ * Number of entries of the table of @size bytes at @map, -1 if it is
+ * not a valid table.
+ */
+static inline int netem_dist_valid(const void *map, size_t size)
+{
+	const struct netem_dist_hdr *h = map;
+	size_t hdr_len, count;
+
+	if (size < sizeof(*h) || le32toh(h->magic) != NETEM_DIST_MAGIC ||
+	    le16toh(h->version) != NETEM_DIST_VERSION)
+		return -1;
+
+	/* the entries are read in place, so they must be aligned */
+	hdr_len = le16toh(h->hdr_len);
+	count = le32toh(h->count);
+	if (hdr_len < sizeof(*h) || hdr_len % sizeof(__le16) ||
+	    hdr_len > size || count > (size - hdr_len) / sizeof(__le16) ||
+	    netem_dist_check((const char *)map + hdr_len,
+			     count * sizeof(__le16)) != le32toh(h->check))
+		return -1;
+	return count;
+}
+
+#endif /* __NETEM_DIST_H__ */
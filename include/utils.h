@@ -339,8 +339,14 @@ char *sprint_time(__u32 time, char *buf);
 char *sprint_time64(__s64 time, char *buf);
 void print_num(FILE *fp, unsigned int width, uint64_t count);
 
+ssize_t getcmdline(char **linep, size_t *lenp, FILE *in);
+int makeargs(char *line, char *argv[], int maxargs);
 int do_batch(const char *name, bool force,
 	     int (*cmd)(int argc, char *argv[], void *user), void *user);
+int do_batch_pipelined(const char *name, bool force,
+		       int (*cmd)(int argc, char *argv[], void *user),
+		       void *user, struct rtnl_handle *rth,
+		       unsigned int window);
 
 int parse_one_of(const char *msg, const char *realval, const char * const *list,
 		 size_t len, int *p_err);
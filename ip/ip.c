@@ -37,6 +37,7 @@ int echo_request;
 int force;
 int max_flush_loops = 10;
 int batch_mode;
+static unsigned int batch_window;
 bool do_all;
 
 struct rtnl_handle rth = { .fd = -1 };
@@ -58,7 +59,7 @@ static void usage(void)
 {
 	fprintf(stderr,
 		"Usage: ip [ OPTIONS ] OBJECT { COMMAND | help }\n"
-		"       ip [ -force ] -batch filename\n"
+		"       ip [ -force ] [ -pipeline window ] -batch filename\n"
 		"where  OBJECT := { address | addrlabel | fou | help | ila | ioam | l2tp | link |\n"
 		"                   macsec | maddress | monitor | mptcp | mroute | mrule |\n"
 		"                   neighbor | neighbour | netconf | netns | nexthop | ntable |\n"
@@ -71,7 +72,7 @@ static void usage(void)
 		"                    -l[oops] { maximum-addr-flush-attempts } | -echo | -br[ief] |\n"
 		"                    -o[neline] | -t[imestamp] | -ts[hort] | -b[atch] [filename] |\n"
 		"                    -rc[vbuf] [size] | -n[etns] name | -N[umeric] | -a[ll] |\n"
-		"                    -c[olor]}\n");
+		"                    -c[olor] | -nlstats }\n");
 	exit(-1);
 }
 
@@ -155,7 +156,11 @@ static int batch(const char *name)
 	}
 
 	batch_mode = 1;
-	ret = do_batch(name, force, ip_batch_cmd, &orig_family);
+	if (batch_window)
+		ret = do_batch_pipelined(name, force, ip_batch_cmd,
+					 &orig_family, &rth, batch_window);
+	else
+		ret = do_batch(name, force, ip_batch_cmd, &orig_family);
 
 	rtnl_close(&rth);
 	return ret;
@@ -264,6 +269,16 @@ int main(int argc, char **argv)
 			++json;
 		} else if (matches(opt, "-pretty") == 0) {
 			++pretty;
+		} else if (matches(opt, "-pipeline") == 0) {
+			argc--;
+			argv++;
+			if (argc <= 1)
+				missarg("pipeline window");
+			if (get_unsigned(&batch_window, argv[1], 0)) {
+				fprintf(stderr, "Invalid pipeline window '%s'\n",
+					argv[1]);
+				exit(-1);
+			}
 		} else if (matches(opt, "-rcvbuf") == 0) {
 			unsigned int size;
 
@@ -288,6 +303,8 @@ int main(int argc, char **argv)
 			++numeric;
 		} else if (matches(opt, "-all") == 0) {
 			do_all = true;
+		} else if (strcmp(opt, "-nlstats") == 0) {
+			++show_nlstats;
 		} else if (strcmp(opt, "-echo") == 0) {
 			++echo_request;
 		} else {
@@ -19,9 +19,7 @@ struct link_filter {
 	int down;
 	char *label;
 	int flushed;
-	char *flushb;
-	int flushp;
-	int flushe;
+	struct rtnl_flush *flush;
 	int group;
 	int master;
 	char *kind;
@@ -98,6 +96,7 @@ int iplink_get(char *name, __u32 filt_mask);
 int iplink_ifla_xstats(int argc, char **argv);
 
 int ip_link_list(req_filter_fn_t filter_fn, struct nlmsg_chain *linfo);
+int store_nlmsg(struct nlmsghdr *n, void *arg);
 void free_nlmsg_chain(struct nlmsg_chain *info);
 
 static inline int rtm_get_table(struct rtmsg *r, struct rtattr **tb)
@@ -1338,26 +1338,6 @@ int print_linkinfo(struct nlmsghdr *n, void *arg)
 	return 1;
 }
 
-static int flush_update(void)
-{
-
-	/*
-	 * Note that the kernel may delete multiple addresses for one
-	 * delete request (e.g. if ipv4 address promotion is disabled).
-	 * Since a flush operation is really a series of delete requests
-	 * its possible that we may request an address delete that has
-	 * already been done by the kernel. Therefore, ignore EADDRNOTAVAIL
-	 * errors returned from a flush request
-	 */
-	if ((rtnl_send_check(&rth, filter.flushb, filter.flushp) < 0) &&
-	    (errno != EADDRNOTAVAIL)) {
-		perror("Failed to send flush request");
-		return -1;
-	}
-	filter.flushp = 0;
-	return 0;
-}
-
 static int set_lifetime(unsigned int *lifetime, char *argv)
 {
 	if (strcmp(argv, "forever") == 0)
@@ -1517,7 +1497,7 @@ int print_addrinfo(struct nlmsghdr *n, void *arg)
 		return -1;
 	}
 
-	if (filter.flushb && n->nlmsg_type != RTM_NEWADDR)
+	if (filter.flush && n->nlmsg_type != RTM_NEWADDR)
 		return 0;
 
 	parse_rtattr(rta_tb, IFA_MAX, IFA_RTA(ifa),
@@ -1549,19 +1529,15 @@ int print_addrinfo(struct nlmsghdr *n, void *arg)
 	if (inet_addr_match_rta(&filter.pfx, rta_tb[IFA_LOCAL]))
 		return 0;
 
-	if (filter.flushb) {
-		struct nlmsghdr *fn;
-
-		if (NLMSG_ALIGN(filter.flushp) + n->nlmsg_len > filter.flushe) {
-			if (flush_update())
-				return -1;
-		}
-		fn = (struct nlmsghdr *)(filter.flushb + NLMSG_ALIGN(filter.flushp));
-		memcpy(fn, n, n->nlmsg_len);
-		fn->nlmsg_type = RTM_DELADDR;
-		fn->nlmsg_flags = NLM_F_REQUEST;
-		fn->nlmsg_seq = ++rth.seq;
-		filter.flushp = (((char *)fn) + n->nlmsg_len) - filter.flushb;
+	if (filter.flush) {
+		/*
+		 * Note that the kernel may delete multiple addresses for one
+		 * delete request (e.g. if ipv4 address promotion is disabled),
+		 * so some of these may fail with EADDRNOTAVAIL, which the
+		 * flush counts as already deleted.
+		 */
+		if (rtnl_flush_queue(filter.flush, n, RTM_DELADDR) < 0)
+			return -1;
 		filter.flushed++;
 		if (show_stats < 2)
 			return 0;
@@ -1577,7 +1553,7 @@ int print_addrinfo(struct nlmsghdr *n, void *arg)
 	if (!brief) {
 		const char *name;
 
-		if (filter.oneline || filter.flushb || echo_request) {
+		if (filter.oneline || filter.flush || echo_request) {
 			const char *dev = ll_index_to_name(ifa->ifa_index);
 
 			if (is_json_context()) {
@@ -1718,23 +1694,220 @@ brief_exit:
 	return 0;
 }
 
-static int print_selected_addrinfo(struct ifinfomsg *ifi,
-				   struct nlmsg_list *ainfo, FILE *fp)
+/* Addresses of a dump, indexed by interface.
+ *
+ * Messages are appended to one growing buffer instead of being copied
+ * into individual allocations, and addresses that cannot match the
+ * filter are not stored at all. Each interface seen in the dump gets
+ * a slot in an open addressing table keyed by ifindex that chains its
+ * addresses in dump order, so that filtering links and printing their
+ * addresses is linear in the size of the dump.
+ */
+struct addr_ent {
+	size_t		off;	/* message offset in buf */
+	int		next;	/* next address of the same link or -1 */
+};
+
+struct addr_link {
+	int		ifindex;	/* 0 for an unused slot */
+	int		head;		/* first matching address or -1 */
+	int		tail;
+};
+
+struct addr_index {
+	char		 *buf;
+	size_t		 len;
+	size_t		 size;
+	struct addr_ent	 *ent;
+	int		 nent;
+	int		 szent;
+	struct addr_link *link;
+	unsigned int	 nlink;
+	unsigned int	 szlink;	/* power of 2 */
+};
+
+static struct addr_link *addr_index_find(const struct addr_index *ai,
+					 int ifindex)
 {
-	open_json_array(PRINT_JSON, "addr_info");
-	for ( ; ainfo ;  ainfo = ainfo->next) {
-		struct nlmsghdr *n = &ainfo->h;
-		struct ifaddrmsg *ifa = NLMSG_DATA(n);
+	unsigned int h;
+
+	if (!ai->szlink)
+		return NULL;
+
+	for (h = ifindex & (ai->szlink - 1); ai->link[h].ifindex;
+	     h = (h + 1) & (ai->szlink - 1)) {
+		if (ai->link[h].ifindex == ifindex)
+			return &ai->link[h];
+	}
+
+	return NULL;
+}
+
+static int addr_index_grow_links(struct addr_index *ai)
+{
+	struct addr_link *old = ai->link;
+	unsigned int i, oldsz = ai->szlink;
+
+	ai->szlink = oldsz ? oldsz * 2 : 256;
+	ai->link = calloc(ai->szlink, sizeof(*ai->link));
+	if (!ai->link) {
+		ai->link = old;
+		ai->szlink = oldsz;
+		return -1;
+	}
 
-		if (n->nlmsg_type != RTM_NEWADDR)
+	for (i = 0; i < oldsz; i++) {
+		unsigned int h;
+
+		if (!old[i].ifindex)
 			continue;
+		h = old[i].ifindex & (ai->szlink - 1);
+		while (ai->link[h].ifindex)
+			h = (h + 1) & (ai->szlink - 1);
+		ai->link[h] = old[i];
+	}
+	free(old);
+
+	return 0;
+}
+
+static struct addr_link *addr_index_link(struct addr_index *ai, int ifindex)
+{
+	struct addr_link *al;
+	unsigned int h;
+
+	al = addr_index_find(ai, ifindex);
+	if (al)
+		return al;
+
+	/* keep the table at most half full */
+	if (2 * (ai->nlink + 1) > ai->szlink && addr_index_grow_links(ai))
+		return NULL;
+
+	h = ifindex & (ai->szlink - 1);
+	while (ai->link[h].ifindex)
+		h = (h + 1) & (ai->szlink - 1);
+
+	al = &ai->link[h];
+	al->ifindex = ifindex;
+	al->head = al->tail = -1;
+	ai->nlink++;
+
+	return al;
+}
+
+static struct nlmsghdr *addr_index_msg(const struct addr_index *ai, int i)
+{
+	return (struct nlmsghdr *)(ai->buf + ai->ent[i].off);
+}
+
+/* Same address selection as print_addrinfo(), except for proto which
+ * does not affect whether the link is shown.
+ */
+static bool ipaddr_match(struct nlmsghdr *n)
+{
+	struct ifaddrmsg *ifa = NLMSG_DATA(n);
+	struct rtattr *tb[IFA_MAX + 1];
+	unsigned int ifa_flags;
+
+	if (filter.family && filter.family != ifa->ifa_family)
+		return false;
+	if ((filter.scope^ifa->ifa_scope)&filter.scopemask)
+		return false;
+
+	parse_rtattr(tb, IFA_MAX, IFA_RTA(ifa), IFA_PAYLOAD(n));
+	ifa_flags = get_ifa_flags(ifa, tb[IFA_FLAGS]);
+
+	if ((filter.flags ^ ifa_flags) & filter.flagmask)
+		return false;
+
+	if (ifa_label_match_rta(ifa->ifa_index, tb[IFA_LABEL]))
+		return false;
+
+	if (!tb[IFA_LOCAL])
+		tb[IFA_LOCAL] = tb[IFA_ADDRESS];
+	if (inet_addr_match_rta(&filter.pfx, tb[IFA_LOCAL]))
+		return false;
+
+	return true;
+}
+
+static int store_addr(struct nlmsghdr *n, void *arg)
+{
+	struct addr_index *ai = arg;
+	struct ifaddrmsg *ifa = NLMSG_DATA(n);
+	struct addr_link *al;
+	struct addr_ent *e;
+	size_t len;
+
+	if (n->nlmsg_type != RTM_NEWADDR)
+		return 0;
+	if (n->nlmsg_len < NLMSG_LENGTH(sizeof(*ifa)))
+		return -1;
+
+	al = addr_index_link(ai, ifa->ifa_index);
+	if (!al)
+		return -1;
 
-		if (n->nlmsg_len < NLMSG_LENGTH(sizeof(*ifa)))
+	if (!ipaddr_match(n))
+		return 0;
+
+	len = NLMSG_ALIGN(n->nlmsg_len);
+	if (ai->len + len > ai->size) {
+		size_t size = ai->size ? ai->size : 65536;
+		char *buf;
+
+		while (ai->len + len > size)
+			size *= 2;
+		buf = realloc(ai->buf, size);
+		if (!buf)
 			return -1;
+		ai->buf = buf;
+		ai->size = size;
+	}
 
-		if (ifa->ifa_index != ifi->ifi_index ||
-		    (filter.family && filter.family != ifa->ifa_family))
-			continue;
+	if (ai->nent == ai->szent) {
+		int szent = ai->szent ? ai->szent * 2 : 1024;
+
+		e = realloc(ai->ent, szent * sizeof(*e));
+		if (!e)
+			return -1;
+		ai->ent = e;
+		ai->szent = szent;
+	}
+
+	e = &ai->ent[ai->nent];
+	e->off = ai->len;
+	e->next = -1;
+	memcpy(ai->buf + ai->len, n, n->nlmsg_len);
+	ai->len += len;
+
+	if (al->tail >= 0)
+		ai->ent[al->tail].next = ai->nent;
+	else
+		al->head = ai->nent;
+	al->tail = ai->nent++;
+
+	return 0;
+}
+
+static void addr_index_free(struct addr_index *ai)
+{
+	free(ai->buf);
+	free(ai->ent);
+	free(ai->link);
+	memset(ai, 0, sizeof(*ai));
+}
+
+static int print_selected_addrinfo(struct ifinfomsg *ifi,
+				   const struct addr_index *ai, FILE *fp)
+{
+	const struct addr_link *al = addr_index_find(ai, ifi->ifi_index);
+	int i;
+
+	open_json_array(PRINT_JSON, "addr_info");
+	for (i = al ? al->head : -1; i >= 0; i = ai->ent[i].next) {
+		struct nlmsghdr *n = addr_index_msg(ai, i);
 
 		if (filter.up && !(ifi->ifi_flags&IFF_UP))
 			continue;
@@ -1755,8 +1928,7 @@ static int print_selected_addrinfo(struct ifinfomsg *ifi,
 	return 0;
 }
 
-
-static int store_nlmsg(struct nlmsghdr *n, void *arg)
+int store_nlmsg(struct nlmsghdr *n, void *arg)
 {
 	struct nlmsg_chain *lchain = (struct nlmsg_chain *)arg;
 	struct nlmsg_list *h;
@@ -1870,7 +2042,7 @@ static int restore_handler(struct rtnl_ctrl_data *ctrl,
 
 	n->nlmsg_flags |= NLM_F_REQUEST | NLM_F_CREATE | NLM_F_ACK;
 
-	ll_init_map(&rth);
+	ll_init_map();
 
 	ret = rtnl_talk(&rth, n, NULL);
 	if ((ret < 0) && (errno == EEXIST))
@@ -1897,51 +2069,23 @@ void free_nlmsg_chain(struct nlmsg_chain *info)
 	}
 }
 
-static void ipaddr_filter(struct nlmsg_chain *linfo, struct nlmsg_chain *ainfo)
+static void ipaddr_filter(struct nlmsg_chain *linfo,
+			  const struct addr_index *ai)
 {
 	struct nlmsg_list *l, **lp;
 
 	lp = &linfo->head;
 	while ((l = *lp) != NULL) {
-		int ok = 0;
-		int missing_net_address = 1;
 		struct ifinfomsg *ifi = NLMSG_DATA(&l->h);
-		struct nlmsg_list *a;
-
-		for (a = ainfo->head; a; a = a->next) {
-			struct nlmsghdr *n = &a->h;
-			struct ifaddrmsg *ifa = NLMSG_DATA(n);
-			struct rtattr *tb[IFA_MAX + 1];
-			unsigned int ifa_flags;
-
-			if (ifa->ifa_index != ifi->ifi_index)
-				continue;
-			missing_net_address = 0;
-			if (filter.family && filter.family != ifa->ifa_family)
-				continue;
-			if ((filter.scope^ifa->ifa_scope)&filter.scopemask)
-				continue;
-
-			parse_rtattr(tb, IFA_MAX, IFA_RTA(ifa), IFA_PAYLOAD(n));
-			ifa_flags = get_ifa_flags(ifa, tb[IFA_FLAGS]);
-
-			if ((filter.flags ^ ifa_flags) & filter.flagmask)
-				continue;
+		const struct addr_link *al;
+		int ok;
 
-			if (ifa_label_match_rta(ifa->ifa_index, tb[IFA_LABEL]))
-				continue;
-
-			if (!tb[IFA_LOCAL])
-				tb[IFA_LOCAL] = tb[IFA_ADDRESS];
-			if (inet_addr_match_rta(&filter.pfx, tb[IFA_LOCAL]))
-				continue;
-
-			ok = 1;
-			break;
-		}
-		if (missing_net_address &&
-		    (filter.family == AF_UNSPEC || filter.family == AF_PACKET))
-			ok = 1;
+		al = addr_index_find(ai, ifi->ifi_index);
+		if (al)
+			ok = al->head >= 0;
+		else
+			ok = filter.family == AF_UNSPEC ||
+			     filter.family == AF_PACKET;
 		if (!ok) {
 			*lp = l->next;
 			free(l);
@@ -1961,12 +2105,13 @@ static int ipaddr_dump_filter(struct nlmsghdr *nlh, int reqlen)
 
 static int ipaddr_flush(void)
 {
+	struct rtnl_flush flush;
 	int round = 0;
-	char flushb[4096-512];
+	int ret = 1;
 
-	filter.flushb = flushb;
-	filter.flushp = 0;
-	filter.flushe = sizeof(flushb);
+	if (rtnl_flush_open(&flush) < 0)
+		return 1;
+	filter.flush = &flush;
 
 	while ((max_flush_loops == 0) || (round < max_flush_loops)) {
 		if (rtnl_addrdump_req(&rth, filter.family,
@@ -1989,28 +2134,40 @@ static int ipaddr_flush(void)
 					printf("*** Flush is complete after %d round%s ***\n", round, round > 1?"s":"");
 			}
 			fflush(stdout);
-			return 0;
+			ret = 0;
+			goto out;
 		}
 		round++;
-		if (flush_update() < 0)
-			return 1;
+		ret = rtnl_flush_commit(&flush);
+		if (ret < 0) {
+			perror("Failed to send flush request");
+			ret = 1;
+			goto out;
+		}
 
 		if (show_stats) {
 			printf("\n*** Round %d, deleting %d addresses ***\n", round, filter.flushed);
 			fflush(stdout);
 		}
 
-		/* If we are flushing, and specifying primary, then we
-		 * want to flush only a single round.  Otherwise, we'll
-		 * start flushing secondaries that were promoted to
-		 * primaries.
+		/* Every delete went through, no need to look again. If we
+		 * are flushing, and specifying primary, then we want to
+		 * flush only a single round.  Otherwise, we'll start
+		 * flushing secondaries that were promoted to primaries.
 		 */
-		if (!(filter.flags & IFA_F_SECONDARY) && (filter.flagmask & IFA_F_SECONDARY))
+		if (ret == 0 ||
+		    (!(filter.flags & IFA_F_SECONDARY) && (filter.flagmask & IFA_F_SECONDARY)))
 			goto flush_done;
 	}
 	fprintf(stderr, "*** Flush remains incomplete after %d rounds. ***\n", max_flush_loops);
 	fflush(stderr);
-	return 1;
+	ret = 1;
+out:
+	if (show_stats && flush.queued)
+		rtnl_flush_report(&flush, "Deleted", "addresses", stdout);
+	filter.flush = NULL;
+	rtnl_flush_close(&flush);
+	return ret;
 }
 
 static int iplink_filter_req(struct nlmsghdr *nlh, int reqlen)
@@ -2101,14 +2258,14 @@ int ip_link_list(req_filter_fn_t filter_fn, struct nlmsg_chain *linfo)
 	return 0;
 }
 
-static int ip_addr_list(struct nlmsg_chain *ainfo)
+static int ip_addr_list(struct addr_index *ai)
 {
 	if (rtnl_addrdump_req(&rth, filter.family, ipaddr_dump_filter) < 0) {
 		perror("Cannot send dump request");
 		return 1;
 	}
 
-	if (rtnl_dump_filter(&rth, store_nlmsg, ainfo) < 0) {
+	if (rtnl_dump_filter(&rth, store_addr, ai) < 0) {
 		fprintf(stderr, "Dump terminated\n");
 		return 1;
 	}
@@ -2119,7 +2276,7 @@ static int ip_addr_list(struct nlmsg_chain *ainfo)
 static int ipaddr_list_flush_or_save(int argc, char **argv, int action)
 {
 	struct nlmsg_chain linfo = { NULL, NULL};
-	struct nlmsg_chain _ainfo = { NULL, NULL}, *ainfo = &_ainfo;
+	struct addr_index ai = {};
 	struct nlmsg_list *l;
 	char *filter_dev = NULL;
 	int no_link = 0;
@@ -2288,10 +2445,10 @@ static int ipaddr_list_flush_or_save(int argc, char **argv, int action)
 		if (filter.oneline)
 			no_link = 1;
 
-		if (ip_addr_list(ainfo) != 0)
+		if (ip_addr_list(&ai) != 0)
 			goto out;
 
-		ipaddr_filter(&linfo, ainfo);
+		ipaddr_filter(&linfo, &ai);
 	}
 
 	for (l = linfo.head; l; l = l->next) {
@@ -2303,7 +2460,7 @@ static int ipaddr_list_flush_or_save(int argc, char **argv, int action)
 		if (brief || !no_link)
 			res = print_linkinfo(n, stdout);
 		if (res >= 0 && filter.family != AF_PACKET)
-			print_selected_addrinfo(ifi, ainfo->head, stdout);
+			print_selected_addrinfo(ifi, &ai, stdout);
 		if (res > 0 && !do_link && show_stats)
 			print_link_stats(stdout, n);
 		close_json_object();
@@ -2311,7 +2468,7 @@ static int ipaddr_list_flush_or_save(int argc, char **argv, int action)
 	fflush(stdout);
 
 out:
-	free_nlmsg_chain(ainfo);
+	addr_index_free(&ai);
 	free_nlmsg_chain(&linfo);
 	delete_json_obj();
 	return 0;
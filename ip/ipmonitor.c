@@ -29,7 +29,7 @@ static void usage(void)
 {
 	fprintf(stderr,
 		"Usage: ip monitor [ all | OBJECTS ] [ FILE ] [ label ] [ all-nsid ]\n"
-		"                  [ dev DEVICE ]\n"
+		"                  [ dev DEVICE ] [ resync ]\n"
 		"OBJECTS :=  address | link | mroute | maddress | acaddress | neigh |\n"
 		"            netconf | nexthop | nsid | prefix | route | rule | stats\n"
 		"FILE := file FILENAME\n");
@@ -190,13 +190,195 @@ static int accept_msg(struct rtnl_ctrl_data *ctrl,
 
 #define IPMON_L_ALL		(~0)
 
+static int resync_addr_req(struct rtnl_handle *rth, int family)
+{
+	return rtnl_addrdump_req(rth, family, NULL);
+}
+
+static int resync_route_req(struct rtnl_handle *rth, int family)
+{
+	return rtnl_routedump_req(rth, family, NULL);
+}
+
+static int resync_nexthop_req(struct rtnl_handle *rth, int family)
+{
+	return rtnl_nexthopdump_req(rth, family, NULL);
+}
+
+static int resync_neigh_req(struct rtnl_handle *rth, int family)
+{
+	return rtnl_neighdump_req(rth, family, NULL);
+}
+
+/* Objects whose state can be dumped again after notifications were lost */
+static const struct {
+	unsigned int	lmask;
+	const char	*name;
+	int		(*req)(struct rtnl_handle *rth, int family);
+} resync_dumps[] = {
+	{ IPMON_LLINK,		"link",		rtnl_linkdump_req },
+	{ IPMON_LADDR,		"address",	resync_addr_req },
+	{ IPMON_LROUTE,		"route",	resync_route_req },
+	{ IPMON_LNEXTHOP,	"nexthop",	resync_nexthop_req },
+	{ IPMON_LNEIGH,		"neigh",	resync_neigh_req },
+	{ IPMON_LRULE,		"rule",		rtnl_ruledump_req },
+	{ IPMON_LNETCONF,	"netconf",	rtnl_netconfdump_req },
+};
+
+static unsigned int resync_mask;
+static struct rtnl_handle resync_rth = { .fd = -1 };
+
+/* Dump one object type, again while the kernel reports that it changed
+ * under the dump, so that what is printed is a consistent snapshot.
+ */
+static int resync_dump(int i, FILE *fp)
+{
+	struct rtnl_ctrl_data ctrl = { .nsid = -1 };
+	struct nlmsg_chain chain;
+	struct nlmsg_list *l;
+	int tries = 3;
+	bool intr;
+
+	do {
+		memset(&chain, 0, sizeof(chain));
+		if (resync_dumps[i].req(&resync_rth, preferred_family) < 0 ||
+		    rtnl_dump_filter(&resync_rth, store_nlmsg, &chain) < 0) {
+			fprintf(stderr, "Cannot dump %s for resync\n",
+				resync_dumps[i].name);
+			free_nlmsg_chain(&chain);
+			return -1;
+		}
+
+		intr = false;
+		for (l = chain.head; l; l = l->next)
+			intr |= !!(l->h.nlmsg_flags & NLM_F_DUMP_INTR);
+		if (intr && --tries)
+			free_nlmsg_chain(&chain);
+	} while (intr && tries);
+
+	for (l = chain.head; l; l = l->next)
+		accept_msg(&ctrl, &l->h, fp);
+	free_nlmsg_chain(&chain);
+	return 0;
+}
+
+static int monitor_overrun(struct rtnl_handle *rth, unsigned int lost,
+			   void *arg)
+{
+	unsigned int stale = 0;
+	socklen_t optlen = sizeof(int);
+	long drained = 0;
+	int rcvbuf;
+	FILE *fp = arg;
+	int i;
+
+	if (lost)
+		fprintf(stderr, "Overrun: %u notifications lost, %llu in total\n",
+			lost, (unsigned long long)rth->stats.lost);
+	else
+		fprintf(stderr, "Overrun: notifications lost\n");
+
+	if (!resync_mask)
+		return 0;
+
+	if (resync_rth.fd < 0 && rtnl_open(&resync_rth, 0) < 0)
+		return -1;
+
+	/* Whatever is still queued predates the dumps below.  The queue
+	 * holds no more than its receive buffer, so stop there rather than
+	 * chase notifications that keep arriving meanwhile.
+	 */
+	if (getsockopt(rth->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &optlen) < 0)
+		rcvbuf = 0;
+	while (drained < rcvbuf) {
+		ssize_t len = recv(rth->fd, NULL, 0, MSG_DONTWAIT | MSG_TRUNC);
+
+		if (len < 0)
+			break;
+		drained += len;
+		stale++;
+	}
+
+	print_headers(fp, "[RESYNC]");
+	fprintf(fp, "Resync begin, %u queued notifications skipped\n", stale);
+	for (i = 0; i < ARRAY_SIZE(resync_dumps); i++) {
+		if (!(resync_mask & resync_dumps[i].lmask))
+			continue;
+		if (resync_dump(i, fp) < 0)
+			return -1;
+	}
+	print_headers(fp, "[RESYNC]");
+	fprintf(fp, "Resync end\n");
+	fflush(fp);
+	return 0;
+}
+
+static void monitor_sel(struct rtnl_listen_sel *sel, int *n, __u16 type,
+			__u8 hdrlen, int family, int ifindex, __u8 idx_off,
+			__u16 idx_attr)
+{
+	struct rtnl_listen_sel *s = &sel[(*n)++];
+
+	memset(s, 0, sizeof(*s));
+	s->type = type;
+	s->hdrlen = hdrlen;
+	if (family != AF_UNSPEC)
+		rtnl_sel_field(s, 0, 1, family);
+	if (ifindex && idx_attr)
+		rtnl_sel_attr(s, idx_attr, ifindex);
+	else if (ifindex)
+		rtnl_sel_field(s, idx_off, 4, ifindex);
+	if (!s->nchecks)
+		(*n)--;
+}
+
+/* Have the kernel drop the notifications the printers below would skip
+ * for their family or device anyway.  Links all pass, as they keep the
+ * link cache current for the flags of peers and masters.
+ */
+static void monitor_select(unsigned int lmask, int ifindex)
+{
+	struct rtnl_listen_sel sel[9];
+	int route_family = preferred_family;
+	int n = 0;
+
+	/* multicast routes come in families of their own */
+	if (lmask & IPMON_LMROUTE)
+		route_family = AF_UNSPEC;
+
+	monitor_sel(sel, &n, RTM_NEWADDR, sizeof(struct ifaddrmsg), AF_UNSPEC,
+		    ifindex, offsetof(struct ifaddrmsg, ifa_index), 0);
+	monitor_sel(sel, &n, RTM_DELADDR, sizeof(struct ifaddrmsg), AF_UNSPEC,
+		    ifindex, offsetof(struct ifaddrmsg, ifa_index), 0);
+	monitor_sel(sel, &n, RTM_NEWROUTE, sizeof(struct rtmsg), route_family,
+		    ifindex, 0, RTA_OIF);
+	monitor_sel(sel, &n, RTM_DELROUTE, sizeof(struct rtmsg), route_family,
+		    ifindex, 0, RTA_OIF);
+	monitor_sel(sel, &n, RTM_NEWNEIGH, sizeof(struct ndmsg), preferred_family,
+		    ifindex, offsetof(struct ndmsg, ndm_ifindex), 0);
+	monitor_sel(sel, &n, RTM_DELNEIGH, sizeof(struct ndmsg), preferred_family,
+		    ifindex, offsetof(struct ndmsg, ndm_ifindex), 0);
+	monitor_sel(sel, &n, RTM_GETNEIGH, sizeof(struct ndmsg), preferred_family,
+		    ifindex, offsetof(struct ndmsg, ndm_ifindex), 0);
+	monitor_sel(sel, &n, RTM_NEWNETCONF, sizeof(struct netconfmsg),
+		    AF_UNSPEC, ifindex, 0, NETCONFA_IFINDEX);
+	monitor_sel(sel, &n, RTM_DELNETCONF, sizeof(struct netconfmsg),
+		    AF_UNSPEC, ifindex, 0, NETCONFA_IFINDEX);
+
+	/* without a filter the printers still do the job */
+	if (n)
+		rtnl_listen_select(&rth, sel, n, false);
+}
+
 int do_ipmonitor(int argc, char **argv)
 {
 	unsigned int groups = 0, lmask = 0;
 	/* "needed" mask, failure to enable is an error */
 	unsigned int nmask;
 	char *file = NULL;
+	bool resync = false;
 	int ifindex = 0;
+	int i;
 
 	rtnl_close(&rth);
 	do_monitor = 1;
@@ -237,6 +419,8 @@ int do_ipmonitor(int argc, char **argv)
 			prefix_banner = 1;
 		} else if (matches(*argv, "all-nsid") == 0) {
 			listen_all_nsid = 1;
+		} else if (strcmp(*argv, "resync") == 0) {
+			resync = true;
 		} else if (matches(*argv, "help") == 0) {
 			usage();
 		} else if (strcmp(*argv, "dev") == 0) {
@@ -326,6 +510,14 @@ int do_ipmonitor(int argc, char **argv)
 	if (rtnl_open(&rth, groups) < 0)
 		exit(1);
 
+	/* -rcvbuf may exceed rmem_max for a busy monitor */
+	rtnl_set_rcvbuf(&rth, rcvbuf);
+
+	if (resync) {
+		for (i = 0; i < ARRAY_SIZE(resync_dumps); i++)
+			resync_mask |= lmask & resync_dumps[i].lmask;
+	}
+
 	if (lmask & IPMON_LNEXTHOP &&
 	    rtnl_add_nl_group(&rth, RTNLGRP_NEXTHOP) < 0) {
 		fprintf(stderr, "Failed to add nexthop group to list\n");
@@ -366,11 +558,13 @@ int do_ipmonitor(int argc, char **argv)
 	if (listen_all_nsid && rtnl_listen_all_nsid(&rth) < 0)
 		exit(1);
 
-	ll_init_map(&rth);
+	monitor_select(lmask, ifindex);
+
+	ll_init_map();
 	netns_nsid_socket_init();
 	netns_map_init();
 
-	if (rtnl_listen(&rth, accept_msg, stdout) < 0)
+	if (rtnl_listen_overrun(&rth, accept_msg, monitor_overrun, stdout) < 0)
 		exit(2);
 
 	return 0;
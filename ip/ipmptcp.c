@@ -117,7 +117,7 @@ static int mptcp_parse_opt(int argc, char **argv, struct nlmsghdr *n, int cmd)
 	__u16 port = 0;
 	__u8 id = 0;
 
-	ll_init_map(&rth);
+	ll_init_map();
 	while (argc > 0) {
 		if (get_flags(*argv, &flags) == 0) {
 			if (adding &&
@@ -294,7 +294,7 @@ static int print_mptcp_addr(struct nlmsghdr *n, void *arg)
 	if (!addrinfo)
 		return -1;
 
-	ll_init_map(&rth);
+	ll_init_map();
 	return print_mptcp_addrinfo(addrinfo);
 }
 
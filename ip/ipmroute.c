@@ -285,7 +285,7 @@ static int mroute_list(int argc, char **argv)
 		argc--; argv++;
 	}
 
-	ll_init_map(&rth);
+	ll_init_map();
 
 	if (id)  {
 		int idx;
@@ -31,9 +31,7 @@ static struct
 	int unused_only;
 	inet_prefix pfx;
 	int flushed;
-	char *flushb;
-	int flushp;
-	int flushe;
+	struct rtnl_flush *flush;
 	int master;
 	int protocol;
 	__u8 ndm_flags;
@@ -87,17 +85,6 @@ static int nud_state_a2n(unsigned int *state, const char *arg)
 	return 0;
 }
 
-static int flush_update(void)
-{
-	if (rtnl_send_check(&rth, filter.flushb, filter.flushp) < 0) {
-		perror("Failed to send flush request");
-		return -1;
-	}
-	filter.flushp = 0;
-	return 0;
-}
-
-
 static int ipneigh_modify(int cmd, int flags, int argc, char **argv)
 {
 	struct {
@@ -201,7 +188,7 @@ static int ipneigh_modify(int cmd, int flags, int argc, char **argv)
 			return -1;
 	}
 
-	ll_init_map(&rth);
+	ll_init_map();
 
 	if (dev) {
 		req.ndm.ndm_ifindex = ll_name_to_index(dev);
@@ -324,7 +311,7 @@ int print_neigh(struct nlmsghdr *n, void *arg)
 		return -1;
 	}
 
-	if (filter.flushb && n->nlmsg_type != RTM_NEWNEIGH)
+	if (filter.flush && n->nlmsg_type != RTM_NEWNEIGH)
 		return 0;
 
 	if (filter.family && filter.family != r->ndm_family)
@@ -365,19 +352,9 @@ int print_neigh(struct nlmsghdr *n, void *arg)
 			return 0;
 	}
 
-	if (filter.flushb) {
-		struct nlmsghdr *fn;
-
-		if (NLMSG_ALIGN(filter.flushp) + n->nlmsg_len > filter.flushe) {
-			if (flush_update())
-				return -1;
-		}
-		fn = (struct nlmsghdr *)(filter.flushb + NLMSG_ALIGN(filter.flushp));
-		memcpy(fn, n, n->nlmsg_len);
-		fn->nlmsg_type = RTM_DELNEIGH;
-		fn->nlmsg_flags = NLM_F_REQUEST;
-		fn->nlmsg_seq = ++rth.seq;
-		filter.flushp = (((char *)fn) + n->nlmsg_len) - filter.flushb;
+	if (filter.flush) {
+		if (rtnl_flush_queue(filter.flush, n, RTM_DELNEIGH) < 0)
+			return -1;
 		filter.flushed++;
 		if (show_stats < 2)
 			return 0;
@@ -592,7 +569,7 @@ static int do_show_or_flush(int argc, char **argv, int flush)
 		argc--; argv++;
 	}
 
-	ll_init_map(&rth);
+	ll_init_map();
 
 	if (filter_dev) {
 		filter.index = ll_name_to_index(filter_dev);
@@ -601,12 +578,13 @@ static int do_show_or_flush(int argc, char **argv, int flush)
 	}
 
 	if (flush) {
+		struct rtnl_flush flush;
 		int round = 0;
-		char flushb[4096-512];
+		int ret;
 
-		filter.flushb = flushb;
-		filter.flushp = 0;
-		filter.flushe = sizeof(flushb);
+		if (rtnl_flush_open(&flush) < 0)
+			exit(1);
+		filter.flush = &flush;
 
 		while (round < MAX_ROUNDS) {
 			if (rtnl_neighdump_req(&rth, filter.family,
@@ -620,26 +598,39 @@ static int do_show_or_flush(int argc, char **argv, int flush)
 				exit(1);
 			}
 			if (filter.flushed == 0) {
+ flush_done:
 				if (show_stats) {
 					if (round == 0)
 						printf("Nothing to flush.\n");
 					else
 						printf("*** Flush is complete after %d round%s ***\n", round, round > 1?"s":"");
+					if (flush.queued)
+						rtnl_flush_report(&flush, "Deleted",
+								  "entries",
+								  stdout);
 				}
 				fflush(stdout);
+				rtnl_flush_close(&flush);
 				return 0;
 			}
 			round++;
-			if (flush_update() < 0)
+			ret = rtnl_flush_commit(&flush);
+			if (ret < 0) {
+				perror("Failed to send flush request");
 				exit(1);
+			}
 			if (show_stats) {
 				printf("\n*** Round %d, deleting %d entries ***\n", round, filter.flushed);
 				fflush(stdout);
 			}
+			/* every delete went through, no need to look again */
+			if (ret == 0)
+				goto flush_done;
 			filter.state &= ~NUD_FAILED;
 		}
 		printf("*** Flush not complete bailing out after %d rounds\n",
 			MAX_ROUNDS);
+		rtnl_flush_close(&flush);
 		return 1;
 	}
 
@@ -184,7 +184,7 @@ static int do_show(int argc, char **argv)
 		argv++; argc--;
 	}
 
-	ll_init_map(&rth);
+	ll_init_map();
 
 	if (filter.ifindex && filter.family != AF_UNSPEC) {
 		struct nlmsghdr *answer;
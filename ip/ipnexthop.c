@@ -17,7 +17,7 @@
 #include "nh_common.h"
 
 static struct {
-	unsigned int flushed;
+	struct rtnl_flush *flush;
 	unsigned int groups;
 	unsigned int ifindex;
 	unsigned int master;
@@ -163,6 +163,14 @@ static int flush_nexthop(struct nlmsghdr *nlh, void *arg)
 {
 	struct nhmsg *nhm = NLMSG_DATA(nlh);
 	struct rtattr *tb[NHA_MAX+1];
+	struct {
+		struct nlmsghdr	n;
+		struct nhmsg	nhm;
+		char		buf[64];
+	} req = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct nhmsg)),
+		.nhm.nh_family = AF_UNSPEC,
+	};
 	__u32 id = 0;
 	int len;
 
@@ -178,15 +186,20 @@ static int flush_nexthop(struct nlmsghdr *nlh, void *arg)
 	parse_rtattr(tb, NHA_MAX, RTM_NHA(nhm), len);
 	if (tb[NHA_ID])
 		id = rta_getattr_u32(tb[NHA_ID]);
+	if (!id)
+		return 0;
 
-	if (id && !delete_nexthop(id))
-		filter.flushed++;
+	addattr32(&req.n, sizeof(req), NHA_ID, id);
+	if (rtnl_flush_queue(filter.flush, &req.n, RTM_DELNEXTHOP) < 0)
+		return -1;
 
 	return 0;
 }
 
 static int ipnh_flush(unsigned int all)
 {
+	struct rtnl_flush flush;
+	unsigned int deleted;
 	int rc = -2;
 
 	if (all) {
@@ -195,10 +208,11 @@ static int ipnh_flush(unsigned int all)
 		filter.master = 0;
 	}
 
-	if (rtnl_open(&rth_del, 0) < 0) {
+	if (rtnl_flush_open(&flush) < 0) {
 		fprintf(stderr, "Cannot open rtnetlink\n");
 		return EXIT_FAILURE;
 	}
+	filter.flush = &flush;
 again:
 	if (rtnl_nexthopdump_req(&rth, preferred_family, nh_dump_filter) < 0) {
 		perror("Cannot send dump request");
@@ -210,6 +224,11 @@ again:
 		goto out;
 	}
 
+	if (rtnl_flush_commit(&flush) < 0) {
+		perror("Failed to flush nexthops");
+		goto out;
+	}
+
 	/* if deleting all, then remove groups first */
 	if (all && filter.groups) {
 		filter.groups = 0;
@@ -218,12 +237,16 @@ again:
 
 	rc = 0;
 out:
-	rtnl_close(&rth_del);
-	if (!filter.flushed)
+	deleted = flush.queued - flush.noop - flush.errors;
+	if (!deleted)
 		printf("Nothing to flush\n");
 	else
-		printf("Flushed %d nexthops\n", filter.flushed);
+		printf("Flushed %u nexthops\n", deleted);
+	if (show_stats && deleted)
+		rtnl_flush_report(&flush, "Deleted", "nexthops", stdout);
 
+	filter.flush = NULL;
+	rtnl_flush_close(&flush);
 	return rc;
 }
 
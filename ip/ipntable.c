@@ -665,7 +665,7 @@ static int ipntable_show(int argc, char **argv)
 
 int do_ipntable(int argc, char **argv)
 {
-	ll_init_map(&rth);
+	ll_init_map();
 
 	if (argc > 0) {
 		if (matches(*argv, "change") == 0 ||
@@ -13,6 +13,8 @@
 #include <time.h>
 #include <sys/time.h>
 #include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
 #include <arpa/inet.h>
@@ -24,6 +26,7 @@
 #include "utils.h"
 #include "ip_common.h"
 #include "nh_common.h"
+#include "lz.h"
 
 #ifndef RTAX_RTTVAR
 #define RTAX_RTTVAR RTAX_HOPS
@@ -33,6 +36,9 @@ enum list_action {
 	IPROUTE_LIST,
 	IPROUTE_FLUSH,
 	IPROUTE_SAVE,
+	IPROUTE_SYNC,
+	IPROUTE_RESTORE,
+	IPROUTE_SHOWDUMP,
 };
 static const char *mx_names[RTAX_MAX+1] = {
 	[RTAX_MTU]			= "mtu",
@@ -58,9 +64,9 @@ static void usage(void)
 {
 	fprintf(stderr,
 		"Usage: ip route { list | flush } SELECTOR\n"
-		"       ip route save SELECTOR\n"
-		"       ip route restore\n"
-		"       ip route showdump\n"
+		"       ip route save [ format { v1 | v2 } ] [ compress ] SELECTOR\n"
+		"       ip route { restore | showdump } [ SELECTOR ]\n"
+		"       ip route sync FILE [ dryrun ] SELECTOR\n"
 		"       ip route get [ ROUTE_GET_FLAGS ] [ to ] ADDRESS\n"
 		"                            [ from ADDRESS iif STRING ]\n"
 		"                            [ oif STRING ] [ tos TOS ]\n"
@@ -124,9 +130,7 @@ static struct
 	unsigned int tb;
 	int cloned;
 	int flushed;
-	char *flushb;
-	int flushp;
-	int flushe;
+	struct rtnl_flush *flush;
 	int protocol, protocolmask;
 	int scope, scopemask;
 	__u64 typemask;
@@ -144,16 +148,6 @@ static struct
 	inet_prefix msrc;
 } filter;
 
-static int flush_update(void)
-{
-	if (rtnl_send_check(&rth, filter.flushb, filter.flushp) < 0) {
-		perror("Failed to send flush request");
-		return -2;
-	}
-	filter.flushp = 0;
-	return 0;
-}
-
 static bool filter_multipath(const struct rtattr *rta)
 {
 	const struct rtnexthop *nh = RTA_DATA(rta);
@@ -354,7 +348,7 @@ static int filter_nlmsg(struct nlmsghdr *n, struct rtattr **tb, int host_len)
 		if ((metric ^ filter.metric) & filter.metricmask)
 			return 0;
 	}
-	if (filter.flushb &&
+	if (filter.flush &&
 	    r->rtm_family == AF_INET6 &&
 	    r->rtm_dst_len == 0 &&
 	    r->rtm_type == RTN_UNREACHABLE &&
@@ -773,7 +767,6 @@ int print_route(struct nlmsghdr *n, void *arg)
 	struct rtattr *tb[RTA_MAX+1];
 	int family, color, host_len;
 	__u32 table;
-	int ret;
 
 	SPRINT_BUF(b1);
 	SPRINT_BUF(b2);
@@ -783,7 +776,7 @@ int print_route(struct nlmsghdr *n, void *arg)
 			n->nlmsg_len, n->nlmsg_type, n->nlmsg_flags);
 		return -1;
 	}
-	if (filter.flushb && n->nlmsg_type != RTM_NEWROUTE)
+	if (filter.flush && n->nlmsg_type != RTM_NEWROUTE)
 		return 0;
 	len -= NLMSG_LENGTH(sizeof(*r));
 	if (len < 0) {
@@ -799,20 +792,9 @@ int print_route(struct nlmsghdr *n, void *arg)
 	if (!filter_nlmsg(n, tb, host_len))
 		return 0;
 
-	if (filter.flushb) {
-		struct nlmsghdr *fn;
-
-		if (NLMSG_ALIGN(filter.flushp) + n->nlmsg_len > filter.flushe) {
-			ret = flush_update();
-			if (ret < 0)
-				return ret;
-		}
-		fn = (struct nlmsghdr *)(filter.flushb + NLMSG_ALIGN(filter.flushp));
-		memcpy(fn, n, n->nlmsg_len);
-		fn->nlmsg_type = RTM_DELROUTE;
-		fn->nlmsg_flags = NLM_F_REQUEST;
-		fn->nlmsg_seq = ++rth.seq;
-		filter.flushp = (((char *)fn) + n->nlmsg_len) - filter.flushb;
+	if (filter.flush) {
+		if (rtnl_flush_queue(filter.flush, n, RTM_DELROUTE) < 0)
+			return -2;
 		filter.flushed++;
 		if (show_stats < 2)
 			return 0;
@@ -1654,6 +1636,157 @@ static int iproute_flush_cache(void)
 
 static __u32 route_dump_magic = 0x45311224;
 
+/* Version 2 dumps start with a header and keep the messages in blocks
+ * of one family and table each, optionally compressed, followed by an
+ * index of the blocks and a trailer that locates it.  Readers map the
+ * file and only look at the blocks the selector can match.
+ */
+static __u32 route_dump_magic_v2 = 0x45311225;
+
+#define ROUTE_DUMP_BLOCK	(64 * 1024)
+#define ROUTE_DUMP_F_LZ		0x1
+
+struct route_dump_hdr {
+	__u32	magic;
+	__u16	version;
+	__u16	flags;
+};
+
+struct route_dump_blk {
+	__u64	off;		/* from the start of the file */
+	__u32	len;		/* compressed if less than raw_len */
+	__u32	raw_len;
+	__u32	table;
+	__u32	count;
+	__u8	family;
+	__u8	pad[7];
+	__u8	min[16];	/* range of destinations */
+	__u8	max[16];
+};
+
+struct route_dump_tail {
+	__u64	index_off;
+	__u32	nblocks;
+	__u32	magic;
+};
+
+static struct {
+	bool			v2;
+	bool			compress;
+	char			*raw;
+	char			*zbuf;
+	struct route_dump_blk	cur;
+	struct route_dump_blk	*index;
+	unsigned int		nblocks;
+	unsigned int		alloc;
+	__u64			off;
+} route_save;
+
+static int route_save_write(const void *buf, size_t len)
+{
+	const char *p = buf;
+
+	while (len) {
+		ssize_t ret = write(STDOUT_FILENO, p, len);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("Cannot write route dump");
+			return -1;
+		}
+		p += ret;
+		len -= ret;
+		route_save.off += ret;
+	}
+	return 0;
+}
+
+static int route_save_block(void)
+{
+	static const char pad[8];
+	struct route_dump_blk *b = &route_save.cur;
+	const char *data = route_save.raw;
+	int len;
+
+	if (!b->raw_len)
+		return 0;
+
+	if (route_save.nblocks == route_save.alloc) {
+		unsigned int alloc = route_save.alloc ? route_save.alloc * 2 : 64;
+		struct route_dump_blk *index;
+
+		index = realloc(route_save.index, alloc * sizeof(*index));
+		if (!index) {
+			fprintf(stderr, "Not enough memory for the route index\n");
+			return -1;
+		}
+		route_save.index = index;
+		route_save.alloc = alloc;
+	}
+
+	b->len = b->raw_len;
+	if (route_save.compress) {
+		len = lz_compress(route_save.raw, b->raw_len,
+				  route_save.zbuf, b->raw_len - 1);
+		if (len > 0) {
+			data = route_save.zbuf;
+			b->len = len;
+		}
+	}
+
+	b->off = route_save.off;
+	if (route_save_write(data, b->len) < 0 ||
+	    route_save_write(pad, -b->len & 7) < 0)
+		return -1;
+
+	route_save.index[route_save.nblocks++] = *b;
+	memset(b, 0, sizeof(*b));
+	return 0;
+}
+
+static int route_save_add(struct nlmsghdr *n, struct rtattr **tb)
+{
+	struct route_dump_blk *b = &route_save.cur;
+	struct rtmsg *r = NLMSG_DATA(n);
+	unsigned int len = NLMSG_ALIGN(n->nlmsg_len);
+	__u32 table = rtm_get_table(r, tb);
+	__u8 dst[16] = {};
+
+	if (len > ROUTE_DUMP_BLOCK) {
+		fprintf(stderr, "Route of %u bytes is too large to save\n", len);
+		return -1;
+	}
+
+	if (b->raw_len &&
+	    (b->family != r->rtm_family || b->table != table ||
+	     b->raw_len + len > ROUTE_DUMP_BLOCK) &&
+	    route_save_block() < 0)
+		return -1;
+
+	if (tb[RTA_DST])
+		memcpy(dst, RTA_DATA(tb[RTA_DST]),
+		       MIN(RTA_PAYLOAD(tb[RTA_DST]), sizeof(dst)));
+
+	if (!b->raw_len) {
+		b->family = r->rtm_family;
+		b->table = table;
+		memcpy(b->min, dst, sizeof(dst));
+		memcpy(b->max, dst, sizeof(dst));
+	} else if (memcmp(dst, b->min, sizeof(dst)) < 0) {
+		memcpy(b->min, dst, sizeof(dst));
+	} else if (memcmp(dst, b->max, sizeof(dst)) > 0) {
+		memcpy(b->max, dst, sizeof(dst));
+	}
+
+	memcpy(route_save.raw + b->raw_len, n, n->nlmsg_len);
+	memset(route_save.raw + b->raw_len + n->nlmsg_len, 0,
+	       len - n->nlmsg_len);
+	b->raw_len += len;
+	b->count++;
+	return 0;
+}
+
 static int save_route(struct nlmsghdr *n, void *arg)
 {
 	int ret;
@@ -1669,6 +1802,9 @@ static int save_route(struct nlmsghdr *n, void *arg)
 	if (!filter_nlmsg(n, tb, host_len))
 		return 0;
 
+	if (route_save.v2)
+		return route_save_add(n, tb);
+
 	ret = write(STDOUT_FILENO, n, n->nlmsg_len);
 	if ((ret > 0) && (ret != n->nlmsg_len)) {
 		fprintf(stderr, "Short write while saving nlmsg\n");
@@ -1680,6 +1816,10 @@ static int save_route(struct nlmsghdr *n, void *arg)
 
 static int save_route_prep(void)
 {
+	struct route_dump_hdr hdr = {
+		.magic = route_dump_magic_v2,
+		.version = 2,
+	};
 	int ret;
 
 	if (isatty(STDOUT_FILENO)) {
@@ -1687,6 +1827,18 @@ static int save_route_prep(void)
 		return -1;
 	}
 
+	if (route_save.v2) {
+		route_save.raw = malloc(ROUTE_DUMP_BLOCK);
+		route_save.zbuf = malloc(ROUTE_DUMP_BLOCK);
+		if (!route_save.raw || !route_save.zbuf) {
+			fprintf(stderr, "Not enough memory for route blocks\n");
+			return -1;
+		}
+		if (route_save.compress)
+			hdr.flags |= ROUTE_DUMP_F_LZ;
+		return route_save_write(&hdr, sizeof(hdr));
+	}
+
 	ret = write(STDOUT_FILENO, &route_dump_magic, sizeof(route_dump_magic));
 	if (ret != sizeof(route_dump_magic)) {
 		fprintf(stderr, "Can't write magic to dump file\n");
@@ -1696,6 +1848,29 @@ static int save_route_prep(void)
 	return 0;
 }
 
+static int save_route_finish(void)
+{
+	struct route_dump_tail tail = { .magic = route_dump_magic_v2 };
+	int ret = -1;
+
+	if (route_save_block() < 0)
+		goto out;
+
+	tail.index_off = route_save.off;
+	tail.nblocks = route_save.nblocks;
+	if (route_save_write(route_save.index,
+			     route_save.nblocks * sizeof(*route_save.index)) < 0 ||
+	    route_save_write(&tail, sizeof(tail)) < 0)
+		goto out;
+
+	ret = 0;
+out:
+	free(route_save.raw);
+	free(route_save.zbuf);
+	free(route_save.index);
+	return ret;
+}
+
 static int iproute_dump_filter(struct nlmsghdr *nlh, int reqlen)
 {
 	struct rtmsg *rtm = NLMSG_DATA(nlh);
@@ -1723,7 +1898,7 @@ static int iproute_dump_filter(struct nlmsghdr *nlh, int reqlen)
 static int iproute_flush(int family, rtnl_filter_t filter_fn)
 {
 	time_t start = time(0);
-	char flushb[4096-512];
+	struct rtnl_flush flush;
 	int round = 0;
 	int ret;
 
@@ -1740,21 +1915,24 @@ static int iproute_flush(int family, rtnl_filter_t filter_fn)
 			return 0;
 	}
 
-	filter.flushb = flushb;
-	filter.flushp = 0;
-	filter.flushe = sizeof(flushb);
+	if (rtnl_flush_open(&flush) < 0)
+		return -2;
+	filter.flush = &flush;
 
 	for (;;) {
 		if (rtnl_routedump_req(&rth, family, iproute_dump_filter) < 0) {
 			perror("Cannot send dump request");
-			return -2;
+			ret = -2;
+			break;
 		}
 		filter.flushed = 0;
 		if (rtnl_dump_filter(&rth, filter_fn, stdout) < 0) {
 			fprintf(stderr, "Flush terminated\n");
-			return -2;
+			ret = -2;
+			break;
 		}
 		if (filter.flushed == 0) {
+ flush_done:
 			if (show_stats) {
 				if (round == 0 &&
 				    (!filter.cloned || family == AF_INET6))
@@ -1764,17 +1942,15 @@ static int iproute_flush(int family, rtnl_filter_t filter_fn)
 					       round, round > 1 ? "s" : "");
 			}
 			fflush(stdout);
-			return 0;
+			ret = 0;
+			break;
 		}
 		round++;
-		ret = flush_update();
-		if (ret < 0)
-			return ret;
-
-		if (time(0) - start > 30) {
-			printf("\n*** Flush not completed after %ld seconds, %d entries remain ***\n",
-			       (long)(time(0) - start), filter.flushed);
-			return -1;
+		ret = rtnl_flush_commit(&flush);
+		if (ret < 0) {
+			perror("Failed to send flush request");
+			ret = -2;
+			break;
 		}
 
 		if (show_stats) {
@@ -1782,7 +1958,24 @@ static int iproute_flush(int family, rtnl_filter_t filter_fn)
 			       round, filter.flushed);
 			fflush(stdout);
 		}
+
+		/* every delete went through, no need to look again */
+		if (ret == 0)
+			goto flush_done;
+
+		if (time(0) - start > 30) {
+			printf("\n*** Flush not completed after %ld seconds, %d entries remain ***\n",
+			       (long)(time(0) - start), filter.flushed);
+			ret = -1;
+			break;
+		}
 	}
+
+	if (show_stats && flush.queued)
+		rtnl_flush_report(&flush, "Deleted", "routes", stdout);
+	filter.flush = NULL;
+	rtnl_flush_close(&flush);
+	return ret;
 }
 
 static int save_route_errhndlr(struct nlmsghdr *n, void *arg)
@@ -1797,6 +1990,10 @@ static int save_route_errhndlr(struct nlmsghdr *n, void *arg)
 	return RTNL_LET_NLERR;
 }
 
+static int iproute_sync(int family, const char *file, bool dryrun);
+static int iproute_restore(void);
+static int iproute_showdump(void);
+
 static int iproute_list_flush_or_save(int argc, char **argv, int action)
 {
 	int dump_family = preferred_family;
@@ -1804,17 +2001,27 @@ static int iproute_list_flush_or_save(int argc, char **argv, int action)
 	char *od = NULL;
 	unsigned int mark = 0;
 	rtnl_filter_t filter_fn;
+	const char *file = NULL;
+	bool dryrun = false;
 
-	if (action == IPROUTE_SAVE) {
-		if (save_route_prep())
+	if (action == IPROUTE_SYNC) {
+		if (argc <= 0) {
+			fprintf(stderr, "\"ip route sync\" requires a file.\n");
 			return -1;
+		}
+		file = *argv;
+		argc--; argv++;
+	}
 
+	if (action == IPROUTE_SAVE)
 		filter_fn = save_route;
-	} else
+	else
 		filter_fn = print_route;
 
 	iproute_reset_filter(0);
-	filter.tb = RT_TABLE_MAIN;
+	/* dumps are restored and shown whole unless told otherwise */
+	if (action != IPROUTE_RESTORE && action != IPROUTE_SHOWDUMP)
+		filter.tb = RT_TABLE_MAIN;
 
 	if ((action == IPROUTE_FLUSH) && argc <= 0) {
 		fprintf(stderr, "\"ip route flush\" requires arguments.\n");
@@ -1822,7 +2029,19 @@ static int iproute_list_flush_or_save(int argc, char **argv, int action)
 	}
 
 	while (argc > 0) {
-		if (matches(*argv, "table") == 0) {
+		if (action == IPROUTE_SYNC && strcmp(*argv, "dryrun") == 0) {
+			dryrun = true;
+		} else if (action == IPROUTE_SAVE &&
+			   strcmp(*argv, "format") == 0) {
+			NEXT_ARG();
+			if (strcmp(*argv, "v2") == 0)
+				route_save.v2 = true;
+			else if (strcmp(*argv, "v1") != 0)
+				invarg("unknown dump format", *argv);
+		} else if (action == IPROUTE_SAVE &&
+			   strcmp(*argv, "compress") == 0) {
+			route_save.v2 = route_save.compress = true;
+		} else if (matches(*argv, "table") == 0) {
 			__u32 tid;
 
 			NEXT_ARG();
@@ -2001,6 +2220,15 @@ static int iproute_list_flush_or_save(int argc, char **argv, int action)
 
 	if (action == IPROUTE_FLUSH)
 		return iproute_flush(dump_family, filter_fn);
+	if (action == IPROUTE_SYNC)
+		return iproute_sync(dump_family, file, dryrun);
+	if (action == IPROUTE_RESTORE)
+		return iproute_restore();
+	if (action == IPROUTE_SHOWDUMP)
+		return iproute_showdump();
+
+	if (action == IPROUTE_SAVE && save_route_prep())
+		return -1;
 
 	if (rtnl_routedump_req(&rth, dump_family, iproute_dump_filter) < 0) {
 		perror("Cannot send dump request");
@@ -2016,6 +2244,9 @@ static int iproute_list_flush_or_save(int argc, char **argv, int action)
 		return -2;
 	}
 
+	if (action == IPROUTE_SAVE && route_save.v2 && save_route_finish() < 0)
+		return -2;
+
 	delete_json_obj();
 	fflush(stdout);
 	return 0;
@@ -2283,92 +2514,328 @@ static int rtattr_cmp(const struct rtattr *rta1, const struct rtattr *rta2)
 	return memcmp(RTA_DATA(rta1), RTA_DATA(rta2), RTA_PAYLOAD(rta1));
 }
 
+/* Restore routes in correct order:
+ * 0. ones for local addresses,
+ * 1. ones for local networks,
+ * 2. others (remote networks/hosts).
+ */
+static int restore_prio(struct rtattr **tb)
+{
+	if (tb[RTA_GATEWAY])
+		return 2;
+	if (tb[RTA_PREFSRC] && rtattr_cmp(tb[RTA_PREFSRC], tb[RTA_DST]))
+		return 1;
+	return 0;
+}
+
+struct route_restore {
+	int			prio;
+	struct rtnl_flush	flush;
+};
+
 static int restore_handler(struct rtnl_ctrl_data *ctrl,
 			   struct nlmsghdr *n, void *arg)
 {
+	struct route_restore *rr = arg;
 	struct rtmsg *r = NLMSG_DATA(n);
 	struct rtattr *tb[RTA_MAX+1];
 	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
-	int ret, prio = *(int *)arg;
 
 	parse_rtattr(tb, RTA_MAX, RTM_RTA(r), len);
 
-	/* Restore routes in correct order:
-	 * 0. ones for local addresses,
-	 * 1. ones for local networks,
-	 * 2. others (remote networks/hosts).
-	 */
-	if (!prio && !tb[RTA_GATEWAY] && (!tb[RTA_PREFSRC] ||
-	    !rtattr_cmp(tb[RTA_PREFSRC], tb[RTA_DST])))
-		goto restore;
-	else if (prio == 1 && !tb[RTA_GATEWAY] && tb[RTA_PREFSRC] &&
-		 rtattr_cmp(tb[RTA_PREFSRC], tb[RTA_DST]))
-		goto restore;
-	else if (prio == 2 && tb[RTA_GATEWAY])
-		goto restore;
-
-	return 0;
-
-restore:
-	n->nlmsg_flags |= NLM_F_REQUEST | NLM_F_CREATE | NLM_F_ACK;
+	if (!filter_nlmsg(n, tb, af_bit_len(r->rtm_family)))
+		return 0;
 
-	ll_init_map(&rth);
+	if (restore_prio(tb) != rr->prio)
+		return 0;
 
-	ret = rtnl_talk(&rth, n, NULL);
-	if ((ret < 0) && (errno == EEXIST))
-		ret = 0;
+	/* state of the link at save time, refused by the kernel */
+	r->rtm_flags &= ~(RTNH_F_DEAD | RTNH_F_LINKDOWN);
 
-	return ret;
+	/* routes that exist already are skipped by the flush queue */
+	return rtnl_flush_queue_flags(&rr->flush, n, RTM_NEWROUTE,
+				      NLM_F_CREATE);
 }
 
-static int route_dump_check_magic(void)
+static int route_dump_check_magic(FILE *fp)
 {
 	int ret;
 	__u32 magic = 0;
 
-	if (isatty(STDIN_FILENO)) {
+	if (isatty(fileno(fp))) {
 		fprintf(stderr, "Can't restore route dump from a terminal\n");
 		return -1;
 	}
 
-	ret = fread(&magic, sizeof(magic), 1, stdin);
-	if (magic != route_dump_magic) {
-		fprintf(stderr, "Magic mismatch (%d elems, %x magic)\n", ret, magic);
-		return -1;
+	ret = fread(&magic, sizeof(magic), 1, fp);
+	if (magic == route_dump_magic)
+		return 1;
+	if (magic == route_dump_magic_v2)
+		return 2;
+
+	fprintf(stderr, "Magic mismatch (%d elems, %x magic)\n", ret, magic);
+	return -1;
+}
+
+struct route_dump {
+	FILE				*fp;
+	long				pos;	/* v1: start of the messages */
+	unsigned int			walks;
+	char				*map;	/* v2: the whole dump */
+	size_t				len;
+	bool				mmapped;
+	const struct route_dump_blk	*index;
+	__u32				nblocks;
+	char				*raw;
+};
+
+static void route_dump_close(struct route_dump *d)
+{
+	if (d->mmapped)
+		munmap(d->map, d->len);
+	else
+		free(d->map);
+	free(d->raw);
+}
+
+/* Pipes are read into memory, files are mapped copy-on-write, as the
+ * handlers may scribble on the messages.
+ */
+static int route_dump_load(struct route_dump *d)
+{
+	int fd = fileno(d->fp);
+	struct stat st;
+	size_t size;
+
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+		d->len = st.st_size;
+		d->map = mmap(NULL, d->len, PROT_READ | PROT_WRITE,
+			      MAP_PRIVATE, fd, 0);
+		if (d->map == MAP_FAILED) {
+			d->map = NULL;
+			perror("Cannot map route dump");
+			return -1;
+		}
+		d->mmapped = true;
+		return 0;
 	}
 
+	size = 1024 * 1024;
+	d->map = malloc(size);
+	if (!d->map)
+		goto nomem;
+	memcpy(d->map, &route_dump_magic_v2, sizeof(route_dump_magic_v2));
+	d->len = sizeof(route_dump_magic_v2);
+
+	for (;;) {
+		size_t n;
+
+		if (d->len == size) {
+			char *map = realloc(d->map, size * 2);
+
+			if (!map)
+				goto nomem;
+			d->map = map;
+			size *= 2;
+		}
+		n = fread(d->map + d->len, 1, size - d->len, d->fp);
+		if (!n)
+			break;
+		d->len += n;
+	}
+	if (ferror(d->fp)) {
+		perror("Cannot read route dump");
+		return -1;
+	}
 	return 0;
+
+nomem:
+	fprintf(stderr, "Not enough memory for the route dump\n");
+	return -1;
 }
 
-static int iproute_restore(void)
+static int route_dump_open(struct route_dump *d, FILE *fp)
 {
-	int pos, prio;
+	const struct route_dump_hdr *hdr;
+	struct route_dump_tail tail;
+	__u32 i;
 
-	if (route_dump_check_magic())
-		return -1;
+	memset(d, 0, sizeof(*d));
+	d->fp = fp;
 
-	pos = ftell(stdin);
-	if (pos == -1) {
-		perror("Failed to restore: ftell");
+	switch (route_dump_check_magic(fp)) {
+	case 1:
+		d->pos = ftell(fp);
+		return 0;
+	case 2:
+		break;
+	default:
 		return -1;
 	}
 
-	for (prio = 0; prio < 3; prio++) {
-		int err;
+	if (route_dump_load(d) < 0)
+		goto err;
+
+	if (d->len < sizeof(*hdr) + sizeof(tail))
+		goto bad;
+	hdr = (const struct route_dump_hdr *)d->map;
+	memcpy(&tail, d->map + d->len - sizeof(tail), sizeof(tail));
+	if (hdr->version != 2 || tail.magic != route_dump_magic_v2 ||
+	    tail.index_off % 8 || tail.index_off > d->len - sizeof(tail) ||
+	    tail.nblocks > (d->len - sizeof(tail) - tail.index_off) /
+			   sizeof(*d->index))
+		goto bad;
+
+	d->index = (const struct route_dump_blk *)(d->map + tail.index_off);
+	d->nblocks = tail.nblocks;
+	for (i = 0; i < d->nblocks; i++) {
+		const struct route_dump_blk *b = &d->index[i];
+
+		if (b->off < sizeof(*hdr) || b->off % 8 ||
+		    b->off > tail.index_off ||
+		    b->len > tail.index_off - b->off ||
+		    b->len > b->raw_len || b->raw_len > ROUTE_DUMP_BLOCK)
+			goto bad;
+	}
+
+	if (hdr->flags & ROUTE_DUMP_F_LZ) {
+		d->raw = malloc(ROUTE_DUMP_BLOCK);
+		if (!d->raw) {
+			fprintf(stderr, "Not enough memory for route blocks\n");
+			goto err;
+		}
+	}
+	return 0;
 
-		err = rtnl_from_file(stdin, &restore_handler, &prio);
-		if (err)
-			return -2;
+bad:
+	fprintf(stderr, "Corrupt route dump\n");
+err:
+	route_dump_close(d);
+	return -1;
+}
+
+static void route_dump_range(const inet_prefix *p, __u8 *lo, __u8 *hi)
+{
+	const __u8 *a = (const __u8 *)p->data;
+	int i;
+
+	memset(lo, 0, 16);
+	memset(hi, 0, 16);
+	for (i = 0; i < p->bytelen && i < 16; i++) {
+		int bits = p->bitlen - i * 8;
+		__u8 mask = bits >= 8 ? 0xff : bits <= 0 ? 0 : 0xff << (8 - bits);
+
+		lo[i] = a[i] & mask;
+		hi[i] = a[i] | ~mask;
+	}
+}
+
+/* Whether the selector can match any route in block @b */
+static bool route_dump_want(const struct route_dump_blk *b)
+{
+	__u8 lo[16], hi[16];
+
+	if (preferred_family != AF_UNSPEC && b->family != preferred_family)
+		return false;
+	if (filter.tb > 0 && b->table != filter.tb)
+		return false;
+
+	if (filter.rdst.family) {
+		if (b->family != filter.rdst.family)
+			return false;
+		route_dump_range(&filter.rdst, lo, hi);
+		if (memcmp(b->max, lo, 16) < 0 || memcmp(b->min, hi, 16) > 0)
+			return false;
+	}
+	if (filter.mdst.family) {
+		if (b->family != filter.mdst.family)
+			return false;
+		/* routes covering an address start at or below it */
+		route_dump_range(&filter.mdst, lo, hi);
+		memcpy(lo, filter.mdst.data, MIN(filter.mdst.bytelen, 16));
+		if (memcmp(b->min, lo, 16) > 0)
+			return false;
+	}
+	return true;
+}
+
+/* Run @handler on each message of the dump that can match the selector */
+static int route_dump_walk(struct route_dump *d, rtnl_listen_filter_t handler,
+			   void *arg)
+{
+	__u32 i;
 
-		if (fseek(stdin, pos, SEEK_SET) == -1) {
-			perror("Failed to restore: fseek");
+	if (!d->map) {
+		if (d->walks++ && (d->pos < 0 ||
+				   fseek(d->fp, d->pos, SEEK_SET) == -1)) {
+			perror("Cannot rewind route dump");
 			return -1;
 		}
+		return rtnl_from_file(d->fp, handler, arg);
 	}
 
+	for (i = 0; i < d->nblocks; i++) {
+		const struct route_dump_blk *b = &d->index[i];
+		struct nlmsghdr *h = (struct nlmsghdr *)(d->map + b->off);
+		int len = b->raw_len;
+
+		if (!route_dump_want(b))
+			continue;
+
+		if (b->len < b->raw_len) {
+			if (!d->raw ||
+			    lz_decompress(h, b->len, d->raw,
+					  ROUTE_DUMP_BLOCK) != b->raw_len) {
+				fprintf(stderr, "Corrupt route dump block at %llu\n",
+					(unsigned long long)b->off);
+				return -1;
+			}
+			h = (struct nlmsghdr *)d->raw;
+		}
+
+		for (; NLMSG_OK(h, len); h = NLMSG_NEXT(h, len)) {
+			int err = handler(NULL, h, arg);
+
+			if (err < 0)
+				return err;
+		}
+	}
 	return 0;
 }
 
+static int iproute_restore(void)
+{
+	struct route_restore rr;
+	struct route_dump d;
+	int ret = -2;
+
+	if (route_dump_open(&d, stdin) < 0)
+		return -1;
+
+	if (rtnl_flush_open(&rr.flush) < 0)
+		goto out;
+
+	for (rr.prio = 0; rr.prio < 3; rr.prio++) {
+		if (route_dump_walk(&d, restore_handler, &rr) < 0)
+			goto out_flush;
+	}
+
+	if (rtnl_flush_commit(&rr.flush) < 0) {
+		fprintf(stderr, "Failed to restore %u routes: %s\n",
+			rr.flush.errors, strerror(errno));
+		goto out_flush;
+	}
+	if (show_stats)
+		rtnl_flush_report(&rr.flush, "Restored", "routes", stdout);
+	ret = 0;
+
+out_flush:
+	rtnl_flush_close(&rr.flush);
+out:
+	route_dump_close(&d);
+	return ret;
+}
+
 static int show_handler(struct rtnl_ctrl_data *ctrl,
 			struct nlmsghdr *n, void *arg)
 {
@@ -2378,15 +2845,434 @@ static int show_handler(struct rtnl_ctrl_data *ctrl,
 
 static int iproute_showdump(void)
 {
-	if (route_dump_check_magic())
+	struct route_dump d;
+	int ret = 0;
+
+	if (route_dump_open(&d, stdin) < 0)
 		return -1;
 
-	if (rtnl_from_file(stdin, &show_handler, NULL))
-		return -2;
+	if (route_dump_walk(&d, show_handler, NULL) < 0)
+		ret = -2;
+
+	route_dump_close(&d);
+	return ret;
+}
+
+/* ip route sync: the desired routes, read from a route dump, sit in
+ * one arena and are hashed on what tells routes apart in the kernel.
+ * The kernel table is then dumped once: routes found in both with the
+ * same attributes are left alone, the others are replaced, deleted or
+ * added, all through one batched rtnl_flush queue.
+ */
+enum {
+	ROUTE_SYNC_ADD,
+	ROUTE_SYNC_KEEP,
+	ROUTE_SYNC_REPLACE,
+};
+
+struct route_sync_ent {
+	size_t		off;
+	unsigned int	hash;
+	int		state;
+};
+
+static struct {
+	char			*buf;
+	size_t			len;
+	size_t			size;
+	struct route_sync_ent	*ent;
+	unsigned int		count;
+	unsigned int		alloc;
+	unsigned int		*slot;	/* ent index + 1, 0 if free */
+	unsigned int		mask;
+	int			family;
+	bool			dryrun;
+	struct rtnl_flush	*flush;
+	unsigned int		added, replaced, deleted, kept;
+} route_sync;
+
+struct route_key {
+	__u8			family;
+	__u8			dst_len;
+	__u8			src_len;
+	__u8			tos;
+	__u32			table;
+	__u32			metric;
+	const struct rtattr	*dst;
+	const struct rtattr	*src;
+};
+
+static void route_key_get(struct nlmsghdr *n, struct rtattr **tb,
+			  struct route_key *k)
+{
+	struct rtmsg *r = NLMSG_DATA(n);
+
+	k->family = r->rtm_family;
+	k->dst_len = r->rtm_dst_len;
+	k->src_len = r->rtm_src_len;
+	k->tos = r->rtm_tos;
+	k->table = rtm_get_table(r, tb);
+	k->metric = tb[RTA_PRIORITY] ? rta_getattr_u32(tb[RTA_PRIORITY]) : 0;
+	k->dst = tb[RTA_DST];
+	k->src = tb[RTA_SRC];
+}
+
+static unsigned int route_hash_bytes(unsigned int h, const void *data,
+				     int len)
+{
+	const unsigned char *p = data;
+
+	/* FNV-1a */
+	while (len-- > 0)
+		h = (h ^ *p++) * 16777619;
+	return h;
+}
+
+static unsigned int route_key_hash(const struct route_key *k)
+{
+	__u32 fields[3] = {
+		k->family | k->dst_len << 8 | k->src_len << 16 | k->tos << 24,
+		k->table,
+		k->metric,
+	};
+	unsigned int h = route_hash_bytes(2166136261U, fields, sizeof(fields));
+
+	if (k->dst)
+		h = route_hash_bytes(h, RTA_DATA(k->dst), RTA_PAYLOAD(k->dst));
+	if (k->src)
+		h = route_hash_bytes(h, RTA_DATA(k->src), RTA_PAYLOAD(k->src));
+
+	/* the low bits index the table, fold the high ones in */
+	return h ^ h >> 16;
+}
+
+static bool route_rta_eq(const struct rtattr *a, const struct rtattr *b)
+{
+	return (!a && !b) || !rtattr_cmp(a, b);
+}
+
+static bool route_key_eq(const struct route_key *a, const struct route_key *b)
+{
+	return a->family == b->family && a->dst_len == b->dst_len &&
+	       a->src_len == b->src_len && a->tos == b->tos &&
+	       a->table == b->table && a->metric == b->metric &&
+	       route_rta_eq(a->dst, b->dst) && route_rta_eq(a->src, b->src);
+}
+
+/* Nexthop flags such as linkdown are state, not configuration */
+static bool route_multipath_eq(const struct rtattr *a, const struct rtattr *b)
+{
+	const struct rtnexthop *na, *nb;
+	int len;
+
+	if (!a || !b)
+		return !a && !b;
+	if (a->rta_len != b->rta_len)
+		return false;
+
+	na = RTA_DATA(a);
+	nb = RTA_DATA(b);
+	len = RTA_PAYLOAD(a);
+	while (len >= (int)sizeof(*na)) {
+		if (na->rtnh_len != nb->rtnh_len ||
+		    na->rtnh_len < sizeof(*na) || na->rtnh_len > len ||
+		    na->rtnh_hops != nb->rtnh_hops ||
+		    na->rtnh_ifindex != nb->rtnh_ifindex ||
+		    (na->rtnh_flags ^ nb->rtnh_flags) & ~RTNH_COMPARE_MASK ||
+		    memcmp(RTNH_DATA(na), RTNH_DATA(nb),
+			   na->rtnh_len - sizeof(*na)))
+			return false;
+		len -= NLMSG_ALIGN(na->rtnh_len);
+		na = RTNH_NEXT(na);
+		nb = RTNH_NEXT(nb);
+	}
+	return true;
+}
+
+static bool route_attrs_eq(struct nlmsghdr *a, struct rtattr **ta,
+			   struct nlmsghdr *b, struct rtattr **tb)
+{
+	struct rtmsg *ra = NLMSG_DATA(a);
+	struct rtmsg *rb = NLMSG_DATA(b);
+	int i;
+
+	if (ra->rtm_protocol != rb->rtm_protocol ||
+	    ra->rtm_scope != rb->rtm_scope ||
+	    ra->rtm_type != rb->rtm_type)
+		return false;
+
+	for (i = 1; i <= RTA_MAX; i++) {
+		switch (i) {
+		case RTA_CACHEINFO:
+		case RTA_EXPIRES:
+			/* usage counters and timers */
+			continue;
+		case RTA_MULTIPATH:
+			if (!route_multipath_eq(ta[i], tb[i]))
+				return false;
+			continue;
+		}
+		if (!route_rta_eq(ta[i], tb[i]))
+			return false;
+	}
+	return true;
+}
+
+static struct nlmsghdr *route_sync_msg(unsigned int i)
+{
+	return (struct nlmsghdr *)(route_sync.buf + route_sync.ent[i].off);
+}
+
+static int route_sync_parse(struct nlmsghdr *n, struct rtattr **tb)
+{
+	struct rtmsg *r = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
+
+	if (n->nlmsg_type != RTM_NEWROUTE || len < 0)
+		return -1;
+
+	parse_rtattr(tb, RTA_MAX, RTM_RTA(r), len);
+	if (!filter_nlmsg(n, tb, af_bit_len(r->rtm_family)))
+		return -1;
+
+	return 0;
+}
+
+static int route_sync_load(struct rtnl_ctrl_data *ctrl,
+			   struct nlmsghdr *n, void *arg)
+{
+	struct rtmsg *r = NLMSG_DATA(n);
+	struct rtattr *tb[RTA_MAX+1];
+	struct route_sync_ent *e;
+	struct route_key k;
+
+	if (route_sync.family != AF_UNSPEC &&
+	    r->rtm_family != route_sync.family)
+		return 0;
+	if (route_sync_parse(n, tb) < 0)
+		return 0;
+
+	if (route_sync.len + NLMSG_ALIGN(n->nlmsg_len) > route_sync.size) {
+		size_t size = route_sync.size ? : 1024 * 1024;
+		char *buf;
+
+		while (route_sync.len + NLMSG_ALIGN(n->nlmsg_len) > size)
+			size *= 2;
+		buf = realloc(route_sync.buf, size);
+		if (!buf)
+			return -ENOMEM;
+		route_sync.buf = buf;
+		route_sync.size = size;
+	}
+
+	if (route_sync.count == route_sync.alloc) {
+		unsigned int alloc = route_sync.alloc ? route_sync.alloc * 2 : 1024;
+
+		e = realloc(route_sync.ent, alloc * sizeof(*e));
+		if (!e)
+			return -ENOMEM;
+		route_sync.ent = e;
+		route_sync.alloc = alloc;
+	}
+
+	route_key_get(n, tb, &k);
+	e = &route_sync.ent[route_sync.count++];
+	e->off = route_sync.len;
+	e->hash = route_key_hash(&k);
+	e->state = ROUTE_SYNC_ADD;
+
+	memcpy(route_sync.buf + route_sync.len, n, n->nlmsg_len);
+	route_sync.len += NLMSG_ALIGN(n->nlmsg_len);
+	return 0;
+}
+
+static int route_sync_index(void)
+{
+	unsigned int size = 2;
+	unsigned int i, h;
+
+	while (size < route_sync.count * 2)
+		size *= 2;
+
+	route_sync.slot = calloc(size, sizeof(*route_sync.slot));
+	if (!route_sync.slot)
+		return -1;
+	route_sync.mask = size - 1;
+
+	for (i = 0; i < route_sync.count; i++) {
+		h = route_sync.ent[i].hash & route_sync.mask;
+		while (route_sync.slot[h])
+			h = (h + 1) & route_sync.mask;
+		route_sync.slot[h] = i + 1;
+	}
+	return 0;
+}
+
+static void route_sync_print(const char *action, struct nlmsghdr *n)
+{
+	printf("%s ", action);
+	print_route(n, stdout);
+}
+
+static int route_sync_dump(struct nlmsghdr *n, void *arg)
+{
+	struct rtattr *tb[RTA_MAX+1], *te[RTA_MAX+1];
+	struct route_key k, ke;
+	unsigned int h, hash;
+	int first = -1;
+
+	if (route_sync_parse(n, tb) < 0)
+		return 0;
+
+	route_key_get(n, tb, &k);
+	hash = route_key_hash(&k);
+
+	for (h = hash & route_sync.mask; route_sync.slot[h];
+	     h = (h + 1) & route_sync.mask) {
+		unsigned int i = route_sync.slot[h] - 1;
+		struct nlmsghdr *en = route_sync_msg(i);
+
+		if (route_sync.ent[i].hash != hash ||
+		    route_sync.ent[i].state != ROUTE_SYNC_ADD)
+			continue;
 
+		route_sync_parse(en, te);
+		route_key_get(en, te, &ke);
+		if (!route_key_eq(&k, &ke))
+			continue;
+
+		if (route_attrs_eq(n, tb, en, te)) {
+			route_sync.ent[i].state = ROUTE_SYNC_KEEP;
+			route_sync.kept++;
+			return 0;
+		}
+		if (first < 0)
+			first = i;
+	}
+
+	if (first >= 0) {
+		route_sync.ent[first].state = ROUTE_SYNC_REPLACE;
+		return 0;
+	}
+
+	route_sync.deleted++;
+	if (route_sync.dryrun) {
+		route_sync_print("delete", n);
+		return 0;
+	}
+	return rtnl_flush_queue(route_sync.flush, n, RTM_DELROUTE);
+}
+
+/* Add and replace in restore order, so that gateways are reachable */
+static int route_sync_apply(void)
+{
+	struct rtattr *tb[RTA_MAX+1];
+	unsigned int i;
+	int prio;
+
+	for (prio = 0; prio < 3; prio++) {
+		for (i = 0; i < route_sync.count; i++) {
+			struct nlmsghdr *n = route_sync_msg(i);
+			int state = route_sync.ent[i].state;
+
+			if (state == ROUTE_SYNC_KEEP)
+				continue;
+
+			route_sync_parse(n, tb);
+			if (restore_prio(tb) != prio)
+				continue;
+
+			if (state == ROUTE_SYNC_ADD)
+				route_sync.added++;
+			else
+				route_sync.replaced++;
+
+			if (route_sync.dryrun) {
+				route_sync_print(state == ROUTE_SYNC_ADD ?
+						 "add" : "replace", n);
+				continue;
+			}
+			if (rtnl_flush_queue_flags(route_sync.flush, n,
+						   RTM_NEWROUTE,
+						   NLM_F_CREATE | NLM_F_REPLACE) < 0)
+				return -1;
+		}
+	}
 	return 0;
 }
 
+static int iproute_sync(int family, const char *file, bool dryrun)
+{
+	struct route_dump d;
+	struct rtnl_flush flush;
+	FILE *fp = stdin;
+	int ret = -2;
+
+	if (strcmp(file, "-") != 0) {
+		fp = fopen(file, "r");
+		if (!fp) {
+			fprintf(stderr, "Cannot open file \"%s\": %s\n",
+				file, strerror(errno));
+			return -1;
+		}
+	}
+
+	route_sync.family = family;
+	route_sync.dryrun = dryrun;
+	if (route_dump_open(&d, fp) < 0)
+		goto out;
+	ret = route_dump_walk(&d, route_sync_load, NULL);
+	route_dump_close(&d);
+	if (ret < 0 || route_sync_index() < 0) {
+		fprintf(stderr, "Failed to load routes from \"%s\"\n", file);
+		ret = -2;
+		goto out;
+	}
+	ret = -2;
+
+	if (!dryrun) {
+		if (rtnl_flush_open(&flush) < 0)
+			goto out;
+		route_sync.flush = &flush;
+	}
+
+	if (rtnl_routedump_req(&rth, family, iproute_dump_filter) < 0) {
+		perror("Cannot send dump request");
+		goto out_flush;
+	}
+	if (rtnl_dump_filter(&rth, route_sync_dump, NULL) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		goto out_flush;
+	}
+
+	if (route_sync_apply() < 0)
+		goto out_flush;
+
+	if (!dryrun && rtnl_flush_commit(&flush) < 0) {
+		perror("Failed to sync routes");
+		goto out_flush;
+	}
+
+	if (dryrun || show_stats)
+		printf("%u to add, %u to replace, %u to delete, %u unchanged\n",
+		       route_sync.added, route_sync.replaced,
+		       route_sync.deleted, route_sync.kept);
+	if (!dryrun && show_stats && flush.queued)
+		rtnl_flush_report(&flush, "Applied", "changes", stdout);
+	ret = 0;
+
+out_flush:
+	if (!dryrun)
+		rtnl_flush_close(&flush);
+out:
+	free(route_sync.buf);
+	free(route_sync.ent);
+	free(route_sync.slot);
+	if (fp != stdin)
+		fclose(fp);
+	return ret;
+}
+
 void iproute_reset_filter(int ifindex)
 {
 	memset(&filter, 0, sizeof(filter));
@@ -2433,9 +3319,12 @@ int do_iproute(int argc, char **argv)
 	if (matches(*argv, "save") == 0)
 		return iproute_list_flush_or_save(argc-1, argv+1, IPROUTE_SAVE);
 	if (matches(*argv, "restore") == 0)
-		return iproute_restore();
+		return iproute_list_flush_or_save(argc-1, argv+1, IPROUTE_RESTORE);
 	if (matches(*argv, "showdump") == 0)
-		return iproute_showdump();
+		return iproute_list_flush_or_save(argc-1, argv+1,
+						  IPROUTE_SHOWDUMP);
+	if (strcmp(*argv, "sync") == 0)
+		return iproute_list_flush_or_save(argc-1, argv+1, IPROUTE_SYNC);
 	if (matches(*argv, "help") == 0)
 		usage();
 
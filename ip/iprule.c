@@ -942,7 +942,7 @@ static int restore_handler(struct rtnl_ctrl_data *ctrl,
 
 	n->nlmsg_flags |= NLM_F_REQUEST | NLM_F_CREATE | NLM_F_ACK;
 
-	ll_init_map(&rth);
+	ll_init_map();
 
 	ret = rtnl_talk(&rth, n, NULL);
 	if ((ret < 0) && (errno == EEXIST))
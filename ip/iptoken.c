@@ -181,7 +181,7 @@ static int iptoken_set(int argc, char **argv, bool delete)
 
 int do_iptoken(int argc, char **argv)
 {
-	ll_init_map(&rth);
+	ll_init_map();
 
 	if (argc < 1) {
 		return iptoken_list(0, NULL);
@@ -17,10 +17,12 @@
 #include <errno.h>
 #include <time.h>
 #include <sys/uio.h>
+#include <linux/filter.h>
 #include <linux/fib_rules.h>
 #include <linux/if_addrlabel.h>
 #include <linux/if_bridge.h>
 #include <linux/nexthop.h>
+#include <linux/sock_diag.h>
 
 #include "libnetlink.h"
 #include "utils.h"
@@ -38,6 +40,14 @@
 #endif
 
 int rcvbuf = 1024 * 1024;
+int show_nlstats;
+
+/* Initial size of the per-handle receive buffer. Dump datagrams are
+ * capped at about 32K by the kernel, but single messages (e.g. links
+ * with many VFs) can be much larger. Pages are only touched as
+ * datagrams fill them, so a large buffer costs address space only.
+ */
+#define RTNL_RBUF_SIZE		(1024 * 1024)
 
 #ifdef HAVE_LIBMNL
 #include <libmnl/libmnl.h>
@@ -181,12 +191,19 @@ int rtnl_add_nl_group(struct rtnl_handle *rth, unsigned int group)
 			  &group, sizeof(group));
 }
 
+static void rtnl_pipe_free(struct rtnl_pipe *pipe);
+
 void rtnl_close(struct rtnl_handle *rth)
 {
 	if (rth->fd >= 0) {
 		close(rth->fd);
 		rth->fd = -1;
 	}
+	free(rth->rbuf);
+	rth->rbuf = NULL;
+	rth->rbuf_len = 0;
+	rtnl_pipe_free(rth->pipe);
+	rth->pipe = NULL;
 }
 
 int rtnl_open_byproto(struct rtnl_handle *rth, unsigned int subscriptions,
@@ -645,8 +662,332 @@ int rtnl_statsdump_req_filter(struct rtnl_handle *rth, int fam,
 	return send(rth->fd, &req, sizeof(req), 0);
 }
 
+static int rtnl_rbuf_alloc(struct rtnl_handle *rth, size_t len)
+{
+	char *buf;
+
+	buf = realloc(rth->rbuf, len);
+	if (!buf) {
+		fprintf(stderr, "malloc error: not enough buffer\n");
+		return -ENOMEM;
+	}
+
+	rth->rbuf = buf;
+	rth->rbuf_len = len;
+	rth->stats.rbuf_allocs++;
+	return 0;
+}
+
+static void rtnl_talk_error(struct nlmsghdr *h, struct nlmsgerr *err,
+			    nl_ext_ack_fn_t errfn)
+{
+	if (nl_dump_ext_ack(h, errfn))
+		return;
+
+	fprintf(stderr, "RTNETLINK answers: %s\n",
+		strerror(-err->error));
+}
+
+/* Requests sent by rtnl_talk() without waiting for their ACK.
+ *
+ * rtnetlink requests are processed synchronously in sendmsg(), so the
+ * kernel state is already up to date when rtnl_talk() returns; only
+ * the ACK is collected later, many of them per recvmmsg() call. Each
+ * pending request remembers the batch line it came from so errors can
+ * be reported against it.
+ *
+ * With a send buffer (rtnl_pipeline_buffer()) requests are instead
+ * queued and go out many per send(), which the kernel processes one
+ * after another as if sent separately. They are pushed out before
+ * waiting for any ACK and before any other request on the socket.
+ */
+struct rtnl_pipe_ent {
+	__u32		seq;
+	int		lineno;
+};
+
+struct rtnl_pipe {
+	const char		*name;
+	unsigned int		window;
+	unsigned int		head;
+	unsigned int		count;
+	unsigned int		errors;
+	char			*sbuf;
+	unsigned int		ssize;
+	unsigned int		slen;
+	unsigned int		queued;	/* requests in sbuf */
+	struct rtnl_pipe_ent	ent[];
+};
+
+/* ACKs are received into slots of the handle receive buffer */
+#define RTNL_PIPE_SLOT		8192
+#define RTNL_PIPE_SLOTS		(RTNL_RBUF_SIZE / RTNL_PIPE_SLOT)
+
+/* Rough receive queue cost of one ACK, used to bound the window so
+ * that ACKs are not dropped by a full socket.
+ */
+#define RTNL_PIPE_ACK_COST	2048
+
+static void rtnl_pipe_free(struct rtnl_pipe *pipe)
+{
+	if (pipe)
+		free(pipe->sbuf);
+	free(pipe);
+}
+
+static void rtnl_pipe_fail(struct rtnl_handle *rth, int lineno)
+{
+	struct rtnl_pipe *pipe = rth->pipe;
+
+	pipe->errors++;
+	fprintf(stderr, "Command failed %s:%d\n", pipe->name, lineno);
+}
+
+static void rtnl_pipe_ack(struct rtnl_handle *rth, struct nlmsghdr *h)
+{
+	struct rtnl_pipe *pipe = rth->pipe;
+	struct rtnl_pipe_ent *e = &pipe->ent[pipe->head];
+	struct nlmsgerr *err = NLMSG_DATA(h);
+
+	if (h->nlmsg_type != NLMSG_ERROR || !pipe->count ||
+	    h->nlmsg_pid != rth->local.nl_pid || h->nlmsg_seq != e->seq)
+		return;
+
+	pipe->head = (pipe->head + 1) % pipe->window;
+	pipe->count--;
+
+	if (h->nlmsg_len < NLMSG_LENGTH(sizeof(*err))) {
+		fprintf(stderr, "ERROR truncated\n");
+		rtnl_pipe_fail(rth, e->lineno);
+		return;
+	}
+
+	if (!err->error) {
+		nl_dump_ext_ack(h, NULL);
+		return;
+	}
+
+	errno = -err->error;
+	rtnl_talk_error(h, err, NULL);
+	rtnl_pipe_fail(rth, e->lineno);
+}
+
+/* Send the queued requests */
+static int rtnl_pipe_push(struct rtnl_handle *rth)
+{
+	struct rtnl_pipe *pipe = rth->pipe;
+	unsigned int i;
+	int err = 0;
+
+	if (!pipe->queued)
+		return 0;
+
+	if (send(rth->fd, pipe->sbuf, pipe->slen, 0) < 0) {
+		perror("Cannot talk to rtnetlink");
+		/* they are the newest entries */
+		pipe->count -= pipe->queued;
+		for (i = pipe->count; i < pipe->count + pipe->queued; i++)
+			rtnl_pipe_fail(rth, pipe->ent[(pipe->head + i) %
+						      pipe->window].lineno);
+		err = -1;
+	}
+
+	pipe->slen = 0;
+	pipe->queued = 0;
+	return err;
+}
+
+/* Collect ACKs until no more than @limit requests are outstanding */
+static int rtnl_pipe_wait(struct rtnl_handle *rth, unsigned int limit)
+{
+	struct rtnl_pipe *pipe = rth->pipe;
+	struct mmsghdr msgs[RTNL_PIPE_SLOTS];
+	struct iovec iov[RTNL_PIPE_SLOTS];
+	int i, n;
+
+	rtnl_pipe_push(rth);
+	if (pipe->count <= limit)
+		return 0;
+
+	if (!rth->rbuf && rtnl_rbuf_alloc(rth, RTNL_RBUF_SIZE) < 0)
+		return -ENOMEM;
+
+	for (i = 0; i < RTNL_PIPE_SLOTS; i++) {
+		iov[i].iov_base = rth->rbuf + i * RTNL_PIPE_SLOT;
+		iov[i].iov_len = RTNL_PIPE_SLOT;
+		memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	while (pipe->count > limit) {
+		/* Never read past the last pending ACK: whatever follows
+		 * belongs to the next request on this socket.
+		 */
+		n = MIN(pipe->count, RTNL_PIPE_SLOTS);
+		n = recvmmsg(rth->fd, msgs, n, MSG_WAITFORONE, NULL);
+		rth->stats.recv_calls++;
+		if (n < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			if (errno == ENOBUFS) {
+				fprintf(stderr,
+					"Lost ACKs for %u requests, their status is unknown\n",
+					pipe->count);
+				pipe->errors += pipe->count;
+				pipe->count = 0;
+				return -1;
+			}
+			fprintf(stderr, "netlink receive error %s (%d)\n",
+				strerror(errno), errno);
+			return -errno;
+		}
+
+		for (i = 0; i < n; i++) {
+			struct nlmsghdr *h = iov[i].iov_base;
+			int len = msgs[i].msg_len;
+
+			rth->stats.recv_bytes += len;
+			for (; NLMSG_OK(h, len); h = NLMSG_NEXT(h, len))
+				rtnl_pipe_ack(rth, h);
+		}
+	}
+
+	return 0;
+}
+
+static void rtnl_pipe_sync(struct rtnl_handle *rth)
+{
+	if (rth->pipe)
+		rtnl_pipe_wait(rth, 0);
+}
+
+static int rtnl_pipe_send(struct rtnl_handle *rth, struct nlmsghdr *n)
+{
+	struct rtnl_pipe *pipe = rth->pipe;
+	struct rtnl_pipe_ent *e;
+
+	if (pipe->count == pipe->window &&
+	    rtnl_pipe_wait(rth, pipe->window - 1) < 0 &&
+	    pipe->count == pipe->window)
+		return -1;
+
+	n->nlmsg_seq = ++rth->seq;
+	n->nlmsg_flags |= NLM_F_ACK;
+
+	if (pipe->sbuf && pipe->slen + NLMSG_ALIGN(n->nlmsg_len) > pipe->ssize)
+		rtnl_pipe_push(rth);
+
+	if (pipe->sbuf && NLMSG_ALIGN(n->nlmsg_len) <= pipe->ssize) {
+		memcpy(pipe->sbuf + pipe->slen, n, n->nlmsg_len);
+		pipe->slen += NLMSG_ALIGN(n->nlmsg_len);
+		pipe->queued++;
+	} else if (send(rth->fd, n, n->nlmsg_len, 0) < 0) {
+		perror("Cannot talk to rtnetlink");
+		return -1;
+	}
+
+	e = &pipe->ent[(pipe->head + pipe->count) % pipe->window];
+	e->seq = n->nlmsg_seq;
+	e->lineno = cmdlineno;
+	pipe->count++;
+
+	return 0;
+}
+
+/* Let rtnl_talk() calls that do not want an answer return as soon as
+ * the request is sent, with up to @window ACKs outstanding. Failures
+ * are reported against the batch line they were sent from.
+ */
+int rtnl_pipeline_start(struct rtnl_handle *rth, unsigned int window,
+			const char *name)
+{
+	struct rtnl_pipe *pipe;
+	socklen_t len = sizeof(int);
+	int one = 1;
+	int size;
+
+	if (!window)
+		return 0;
+
+	/* Error ACKs do not need to carry the request back */
+	setsockopt(rth->fd, SOL_NETLINK, NETLINK_CAP_ACK, &one, sizeof(one));
+
+	if (getsockopt(rth->fd, SOL_SOCKET, SO_RCVBUF, &size, &len) == 0 &&
+	    window > size / RTNL_PIPE_ACK_COST)
+		window = size / RTNL_PIPE_ACK_COST ? : 1;
+
+	pipe = calloc(1, sizeof(*pipe) + window * sizeof(pipe->ent[0]));
+	if (!pipe) {
+		fprintf(stderr, "malloc error: not enough buffer\n");
+		return -1;
+	}
+
+	pipe->name = name ? : "-";
+	pipe->window = window;
+	rth->pipe = pipe;
+	return 0;
+}
+
+/* Queue pipelined requests into a buffer of up to @size bytes, sent
+ * with one send() when full. Requests are then only processed by the
+ * kernel once their buffer is pushed out.
+ */
+int rtnl_pipeline_buffer(struct rtnl_handle *rth, unsigned int size)
+{
+	struct rtnl_pipe *pipe = rth->pipe;
+	socklen_t len = sizeof(int);
+	int sndbuf = size;
+	char *buf;
+
+	if (!pipe || pipe->sbuf)
+		return 0;
+
+	/* A send() larger than the socket buffer fails */
+	setsockopt(rth->fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+	if (getsockopt(rth->fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, &len) == 0 &&
+	    size > sndbuf / 2)
+		size = sndbuf / 2;
+
+	buf = malloc(size);
+	if (!buf) {
+		fprintf(stderr, "malloc error: not enough buffer\n");
+		return -1;
+	}
+
+	pipe->sbuf = buf;
+	pipe->ssize = size;
+	return 0;
+}
+
+/* Wait for all outstanding ACKs, returns the number of failed requests */
+int rtnl_pipeline_flush(struct rtnl_handle *rth)
+{
+	if (!rth->pipe)
+		return 0;
+
+	rtnl_pipe_wait(rth, 0);
+	return rth->pipe->errors;
+}
+
+unsigned int rtnl_pipeline_errors(const struct rtnl_handle *rth)
+{
+	return rth->pipe ? rth->pipe->errors : 0;
+}
+
+void rtnl_pipeline_stop(struct rtnl_handle *rth)
+{
+	if (!rth->pipe)
+		return;
+
+	rtnl_pipeline_flush(rth);
+	rtnl_pipe_free(rth->pipe);
+	rth->pipe = NULL;
+}
+
 int rtnl_send(struct rtnl_handle *rth, const void *buf, int len)
 {
+	rtnl_pipe_sync(rth);
 	return send(rth->fd, buf, len, 0);
 }
 
@@ -656,6 +997,7 @@ int rtnl_send_check(struct rtnl_handle *rth, const void *buf, int len)
 	int status;
 	char resp[1024];
 
+	rtnl_pipe_sync(rth);
 	status = send(rth->fd, buf, len, 0);
 	if (status < 0)
 		return status;
@@ -684,6 +1026,296 @@ int rtnl_send_check(struct rtnl_handle *rth, const void *buf, int len)
 	return 0;
 }
 
+/* Delete requests are packed into chunks that fit a single datagram,
+ * and up to vlen chunks go out with each sendmmsg().  Nothing is sent
+ * while the dump that produced them is still running, so the dump is
+ * not disturbed and one round suffices, unless more than
+ * RTNL_FLUSH_MAX_CHUNKS chunks pile up.
+ */
+#define RTNL_FLUSH_CHUNK	32768
+#define RTNL_FLUSH_CHUNKS	64
+#define RTNL_FLUSH_MAX_CHUNKS	2048
+#define RTNL_FLUSH_RCVBUF	(16 * 1024 * 1024)
+
+static __u64 rtnl_flush_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Use a socket of its own, so that the error replies to deletes do
+ * not mix with the dump being filtered.
+ */
+int rtnl_flush_open(struct rtnl_flush *f)
+{
+	int one = 1;
+
+	memset(f, 0, sizeof(*f));
+	if (rtnl_open(&f->rth, 0) < 0)
+		return -1;
+
+	/* Error replies do not need to carry the request back */
+	setsockopt(f->rth.fd, SOL_NETLINK, NETLINK_CAP_ACK, &one, sizeof(one));
+
+	/* A chunk of creates that all exist already answers with one error
+	 * per request, more than the default buffer holds.
+	 */
+	rtnl_set_rcvbuf(&f->rth, RTNL_FLUSH_RCVBUF);
+
+	f->nchunks = RTNL_FLUSH_CHUNKS;
+	f->buf = malloc(f->nchunks * RTNL_FLUSH_CHUNK);
+	f->clen = calloc(f->nchunks, sizeof(*f->clen));
+	if (!f->buf || !f->clen ||
+	    rtnl_rbuf_alloc(&f->rth, RTNL_RBUF_SIZE) < 0) {
+		fprintf(stderr, "malloc error: not enough buffer\n");
+		rtnl_flush_close(f);
+		return -1;
+	}
+
+	f->vlen = RTNL_FLUSH_CHUNKS;
+	f->start = rtnl_flush_now();
+	return 0;
+}
+
+void rtnl_flush_close(struct rtnl_flush *f)
+{
+	free(f->buf);
+	free(f->clen);
+	f->buf = NULL;
+	f->clen = NULL;
+	if (f->rth.fd >= 0)
+		rtnl_close(&f->rth);
+}
+
+/* A delete may find the object removed already, by the kernel or an
+ * earlier delete, and a create may find it present; the low two bits
+ * of rtnetlink message types tell creates and deletes apart.
+ */
+static bool rtnl_flush_noop(const struct nlmsgerr *err)
+{
+	switch (err->msg.nlmsg_type & 3) {
+	case 0:
+		return err->error == -EEXIST;
+	case 1:
+		switch (-err->error) {
+		case ENOENT:
+		case ESRCH:
+		case EADDRNOTAVAIL:
+			return true;
+		}
+	}
+	return false;
+}
+
+/* rtnetlink handles requests within sendmsg(), so every error the
+ * last batch caused is already queued.  Returns how many were read.
+ */
+static unsigned int rtnl_flush_errors(struct rtnl_flush *f)
+{
+	struct mmsghdr msgs[RTNL_PIPE_SLOTS];
+	struct iovec iov[RTNL_PIPE_SLOTS];
+	unsigned int seen = 0;
+	int i, n;
+
+	for (i = 0; i < RTNL_PIPE_SLOTS; i++) {
+		iov[i].iov_base = f->rth.rbuf + i * RTNL_PIPE_SLOT;
+		iov[i].iov_len = RTNL_PIPE_SLOT;
+		memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	for (;;) {
+		n = recvmmsg(f->rth.fd, msgs, RTNL_PIPE_SLOTS, MSG_DONTWAIT,
+			     NULL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == ENOBUFS) {
+				f->lost = true;
+				continue;
+			}
+			if (errno != EAGAIN) {
+				perror("netlink receive error");
+				f->lost = true;
+			}
+			return seen;
+		}
+
+		for (i = 0; i < n; i++) {
+			struct nlmsghdr *h = iov[i].iov_base;
+			int len = msgs[i].msg_len;
+
+			for (; NLMSG_OK(h, len); h = NLMSG_NEXT(h, len)) {
+				struct nlmsgerr *err = NLMSG_DATA(h);
+
+				if (h->nlmsg_type != NLMSG_ERROR ||
+				    h->nlmsg_len < NLMSG_LENGTH(sizeof(*err)) ||
+				    !err->error)
+					continue;
+
+				seen++;
+				if (rtnl_flush_noop(err)) {
+					f->noop++;
+					continue;
+				}
+				if (!f->errors++)
+					f->error = -err->error;
+			}
+		}
+	}
+}
+
+static int rtnl_flush_send(struct rtnl_flush *f)
+{
+	struct mmsghdr *msgs;
+	struct iovec *iov;
+	unsigned int i, done = 0;
+	int ret = 0;
+
+	if (!f->chunks)
+		return 0;
+
+	msgs = calloc(f->chunks, sizeof(*msgs));
+	iov = calloc(f->chunks, sizeof(*iov));
+	if (!msgs || !iov) {
+		fprintf(stderr, "malloc error: not enough buffer\n");
+		ret = -1;
+		goto out;
+	}
+
+	for (i = 0; i < f->chunks; i++) {
+		iov[i].iov_base = f->buf + i * RTNL_FLUSH_CHUNK;
+		iov[i].iov_len = f->clen[i];
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	while (done < f->chunks) {
+		int n = sendmmsg(f->rth.fd, msgs + done,
+				 MIN(f->vlen, f->chunks - done), 0);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("Failed to send flush request");
+			ret = -1;
+			goto out;
+		}
+		done += n;
+
+		/* Errors take receive queue space: send less at once while
+		 * they come back, so that they are not dropped.
+		 */
+		if (rtnl_flush_errors(f))
+			f->vlen = f->vlen / 2 ? : 1;
+		else if (f->vlen < RTNL_FLUSH_CHUNKS)
+			f->vlen *= 2;
+	}
+
+	f->chunks = 0;
+out:
+	free(msgs);
+	free(iov);
+	return ret;
+}
+
+static int rtnl_flush_grow(struct rtnl_flush *f)
+{
+	unsigned int nchunks = f->nchunks * 2;
+	unsigned int *clen;
+	char *buf;
+
+	buf = realloc(f->buf, nchunks * RTNL_FLUSH_CHUNK);
+	if (!buf)
+		return -1;
+	f->buf = buf;
+
+	clen = realloc(f->clen, nchunks * sizeof(*clen));
+	if (!clen)
+		return -1;
+	f->clen = clen;
+
+	f->nchunks = nchunks;
+	return 0;
+}
+
+/* Queue @n as a request of type @type with @flags */
+int rtnl_flush_queue_flags(struct rtnl_flush *f, const struct nlmsghdr *n,
+			   __u16 type, __u16 flags)
+{
+	unsigned int len = NLMSG_ALIGN(n->nlmsg_len);
+	struct nlmsghdr *fn;
+
+	if (len > RTNL_FLUSH_CHUNK) {
+		fprintf(stderr, "Flush request too large: %u bytes\n", len);
+		return -1;
+	}
+
+	if (!f->chunks || f->clen[f->chunks - 1] + len > RTNL_FLUSH_CHUNK) {
+		if (f->chunks == f->nchunks &&
+		    (f->nchunks >= RTNL_FLUSH_MAX_CHUNKS ||
+		     rtnl_flush_grow(f) < 0)) {
+			if (rtnl_flush_send(f) < 0)
+				return -1;
+			f->early = true;
+		}
+		f->clen[f->chunks++] = 0;
+	}
+
+	fn = (struct nlmsghdr *)(f->buf + (f->chunks - 1) * RTNL_FLUSH_CHUNK +
+				 f->clen[f->chunks - 1]);
+	memcpy(fn, n, n->nlmsg_len);
+	fn->nlmsg_type = type;
+	fn->nlmsg_flags = NLM_F_REQUEST | flags;
+	fn->nlmsg_seq = ++f->rth.seq;
+	f->clen[f->chunks - 1] += len;
+	f->queued++;
+
+	return 0;
+}
+
+/* Queue a delete of type @type for the object dumped in @n */
+int rtnl_flush_queue(struct rtnl_flush *f, const struct nlmsghdr *n,
+		     __u16 type)
+{
+	return rtnl_flush_queue_flags(f, n, type, 0);
+}
+
+/* Send whatever is queued. Returns -1 with errno set if a request
+ * failed for another reason than having nothing to do, 1 if the
+ * objects should be dumped again to find out whether any are left, and
+ * 0 if all requests are known to have gone through.
+ */
+int rtnl_flush_commit(struct rtnl_flush *f)
+{
+	int ret;
+
+	if (rtnl_flush_send(f) < 0)
+		return -1;
+
+	if (f->errors) {
+		errno = f->error;
+		return -1;
+	}
+
+	ret = f->early || f->lost;
+	f->early = f->lost = false;
+	return ret;
+}
+
+void rtnl_flush_report(const struct rtnl_flush *f, const char *verb,
+		       const char *what, FILE *fp)
+{
+	double secs = (rtnl_flush_now() - f->start) / 1e9;
+	unsigned int done = f->queued - f->noop - f->errors;
+
+	fprintf(fp, "*** %s %u %s in %.3f seconds (%.0f/s) ***\n",
+		verb, done, what, secs, secs > 0 ? done / secs : 0.);
+}
+
 int rtnl_dump_request(struct rtnl_handle *rth, int type, void *req, int len)
 {
 	struct nlmsghdr nlh = {
@@ -818,44 +1450,99 @@ static int __rtnl_recvmsg(int fd, struct msghdr *msg, int flags)
 	return len;
 }
 
-static int rtnl_recvmsg(int fd, struct msghdr *msg, char **answer)
+/* Give a receive buffer taken with rtnl_recvmsg() back to the handle.
+ * If a nested receive on the same handle allocated a new one in the
+ * meantime, keep the larger of the two.
+ */
+static void rtnl_rbuf_put(struct rtnl_handle *rth, char *buf, size_t len)
+{
+	if (rth->rbuf && rth->rbuf_len >= len) {
+		free(buf);
+		return;
+	}
+
+	free(rth->rbuf);
+	rth->rbuf = buf;
+	rth->rbuf_len = len;
+}
+
+/* Receive one datagram into the persistent buffer of the handle.
+ *
+ * The buffer is detached from the handle and returned in @answer
+ * together with its size in @answer_len; callers hand it back with
+ * rtnl_rbuf_put() or take ownership of it. The buffer is never smaller
+ * than RTNL_RBUF_SIZE.
+ *
+ * Dump datagrams are filled by the kernel up to 32K, or up to the
+ * largest single message of the dump, far below that size, so they
+ * are received with a single recvmsg(). A reply to a request is one
+ * message of any size, so with @peek its length is looked at first
+ * and the buffer grown before the datagram is taken off the socket.
+ */
+static int rtnl_recvmsg(struct rtnl_handle *rth, struct msghdr *msg,
+			char **answer, size_t *answer_len, bool peek)
 {
 	struct iovec *iov = msg->msg_iov;
-	char *buf;
+	size_t size = RTNL_RBUF_SIZE;
 	int len;
 
-	iov->iov_base = NULL;
-	iov->iov_len = 0;
+	if (peek) {
+		iov->iov_base = NULL;
+		iov->iov_len = 0;
 
-	len = __rtnl_recvmsg(fd, msg, MSG_PEEK | MSG_TRUNC);
-	if (len < 0)
-		return len;
+		len = __rtnl_recvmsg(rth->fd, msg, MSG_PEEK | MSG_TRUNC);
+		rth->stats.recv_calls++;
+		if (len < 0)
+			return len;
+		if ((size_t)len > size)
+			size = len;
+	}
 
-	if (len < 32768)
-		len = 32768;
-	buf = malloc(len);
-	if (!buf) {
-		fprintf(stderr, "malloc error: not enough buffer\n");
+	if (rth->rbuf_len < size && rtnl_rbuf_alloc(rth, size) < 0)
 		return -ENOMEM;
-	}
 
-	iov->iov_base = buf;
-	iov->iov_len = len;
+	iov->iov_base = rth->rbuf;
+	iov->iov_len = rth->rbuf_len;
 
-	len = __rtnl_recvmsg(fd, msg, 0);
-	if (len < 0) {
-		free(buf);
+	len = __rtnl_recvmsg(rth->fd, msg, 0);
+	rth->stats.recv_calls++;
+	if (len < 0)
 		return len;
-	}
+	rth->stats.recv_bytes += len;
 
-	if (answer)
-		*answer = buf;
-	else
-		free(buf);
+	*answer = rth->rbuf;
+	*answer_len = rth->rbuf_len;
+	rth->rbuf = NULL;
+	rth->rbuf_len = 0;
 
 	return len;
 }
 
+/* Copy a reply out of the receive buffer for the caller to free */
+static struct nlmsghdr *rtnl_answer_dup(const char *buf, int len)
+{
+	void *answer;
+
+	answer = malloc(len);
+	if (!answer) {
+		fprintf(stderr, "malloc error: not enough buffer\n");
+		return NULL;
+	}
+
+	return memcpy(answer, buf, len);
+}
+
+static void rtnl_print_stats(const struct rtnl_stats *now,
+			     const struct rtnl_stats *start)
+{
+	fprintf(stderr,
+		"Dump: %llu recvmsg calls, %llu messages, %llu bytes, %u buffer allocations\n",
+		(unsigned long long)(now->recv_calls - start->recv_calls),
+		(unsigned long long)(now->recv_msgs - start->recv_msgs),
+		(unsigned long long)(now->recv_bytes - start->recv_bytes),
+		now->rbuf_allocs - start->rbuf_allocs);
+}
+
 static int rtnl_dump_filter_l(struct rtnl_handle *rth,
 			      const struct rtnl_dump_filter_arg *arg)
 {
@@ -867,16 +1554,21 @@ static int rtnl_dump_filter_l(struct rtnl_handle *rth,
 		.msg_iov = &iov,
 		.msg_iovlen = 1,
 	};
+	struct rtnl_stats start = rth->stats;
+	size_t buflen;
 	char *buf;
 	int dump_intr = 0;
 
+	/* ACKs of pipelined requests precede the dump */
+	rtnl_pipe_sync(rth);
+
 	while (1) {
 		int status;
 		const struct rtnl_dump_filter_arg *a;
 		int found_done = 0;
 		int msglen = 0;
 
-		status = rtnl_recvmsg(rth->fd, &msg, &buf);
+		status = rtnl_recvmsg(rth, &msg, &buf, &buflen, false);
 		if (status < 0)
 			return status;
 
@@ -898,13 +1590,16 @@ static int rtnl_dump_filter_l(struct rtnl_handle *rth,
 				    h->nlmsg_seq != rth->dump)
 					goto skip_it;
 
+				if (a == arg)
+					rth->stats.recv_msgs++;
+
 				if (h->nlmsg_flags & NLM_F_DUMP_INTR)
 					dump_intr = 1;
 
 				if (h->nlmsg_type == NLMSG_DONE) {
 					err = rtnl_dump_done(h, a);
 					if (err < 0) {
-						free(buf);
+						rtnl_rbuf_put(rth, buf, buflen);
 						return -1;
 					}
 
@@ -915,7 +1610,7 @@ static int rtnl_dump_filter_l(struct rtnl_handle *rth,
 				if (h->nlmsg_type == NLMSG_ERROR) {
 					err = rtnl_dump_error(rth, h, a);
 					if (err < 0) {
-						free(buf);
+						rtnl_rbuf_put(rth, buf, buflen);
 						return -1;
 					}
 
@@ -925,7 +1620,7 @@ static int rtnl_dump_filter_l(struct rtnl_handle *rth,
 				if (!rth->dump_fp) {
 					err = a->filter(h, a->arg1);
 					if (err < 0) {
-						free(buf);
+						rtnl_rbuf_put(rth, buf, buflen);
 						return err;
 					}
 				}
@@ -934,12 +1629,14 @@ skip_it:
 				h = NLMSG_NEXT(h, msglen);
 			}
 		}
-		free(buf);
+		rtnl_rbuf_put(rth, buf, buflen);
 
 		if (found_done) {
 			if (dump_intr)
 				fprintf(stderr,
 					"Dump was interrupted and may be inconsistent.\n");
+			if (show_nlstats)
+				rtnl_print_stats(&rth->stats, &start);
 			return 0;
 		}
 
@@ -988,17 +1685,6 @@ int rtnl_dump_filter_errhndlr_nc(struct rtnl_handle *rth,
 	return rtnl_dump_filter_l(rth, a);
 }
 
-static void rtnl_talk_error(struct nlmsghdr *h, struct nlmsgerr *err,
-			    nl_ext_ack_fn_t errfn)
-{
-	if (nl_dump_ext_ack(h, errfn))
-		return;
-
-	fprintf(stderr, "RTNETLINK answers: %s\n",
-		strerror(-err->error));
-}
-
-
 static int __rtnl_talk_iov(struct rtnl_handle *rtnl, struct iovec *iov,
 			   size_t iovlen, struct nlmsghdr **answer,
 			   bool show_rtnl_err, nl_ext_ack_fn_t errfn)
@@ -1014,8 +1700,16 @@ static int __rtnl_talk_iov(struct rtnl_handle *rtnl, struct iovec *iov,
 	unsigned int seq = 0;
 	struct nlmsghdr *h;
 	int i, status;
+	size_t buflen;
+	int recvlen;
 	char *buf;
 
+	if (rtnl->pipe) {
+		if (iovlen == 1 && !answer && show_rtnl_err && !errfn)
+			return rtnl_pipe_send(rtnl, iov[0].iov_base);
+		rtnl_pipe_sync(rtnl);
+	}
+
 	for (i = 0; i < iovlen; i++) {
 		h = iov[i].iov_base;
 		h->nlmsg_seq = seq = ++rtnl->seq;
@@ -1035,11 +1729,12 @@ static int __rtnl_talk_iov(struct rtnl_handle *rtnl, struct iovec *iov,
 	i = 0;
 	while (1) {
 next:
-		status = rtnl_recvmsg(rtnl->fd, &msg, &buf);
+		status = rtnl_recvmsg(rtnl, &msg, &buf, &buflen, true);
 		++i;
 
 		if (status < 0)
 			return status;
+		recvlen = status;
 
 		if (msg.msg_namelen != sizeof(nladdr)) {
 			fprintf(stderr,
@@ -1054,7 +1749,7 @@ next:
 			if (l < 0 || len > status) {
 				if (msg.msg_flags & MSG_TRUNC) {
 					fprintf(stderr, "Truncated message\n");
-					free(buf);
+					rtnl_rbuf_put(rtnl, buf, buflen);
 					return -1;
 				}
 				fprintf(stderr,
@@ -1078,7 +1773,7 @@ next:
 
 				if (l < sizeof(struct nlmsgerr)) {
 					fprintf(stderr, "ERROR truncated\n");
-					free(buf);
+					rtnl_rbuf_put(rtnl, buf, buflen);
 					return -1;
 				}
 
@@ -1094,25 +1789,27 @@ next:
 				}
 
 				if (i < iovlen) {
-					free(buf);
+					rtnl_rbuf_put(rtnl, buf, buflen);
 					goto next;
 				}
 
 				if (error) {
-					free(buf);
+					rtnl_rbuf_put(rtnl, buf, buflen);
 					return -i;
 				}
 
 				if (answer)
-					*answer = (struct nlmsghdr *)buf;
-				else
-					free(buf);
+					*answer = rtnl_answer_dup(buf, recvlen);
+				rtnl_rbuf_put(rtnl, buf, buflen);
+				if (answer && !*answer)
+					return -1;
 				return 0;
 			}
 
 			if (answer) {
-				*answer = (struct nlmsghdr *)buf;
-				return 0;
+				*answer = rtnl_answer_dup(buf, recvlen);
+				rtnl_rbuf_put(rtnl, buf, buflen);
+				return *answer ? 0 : -1;
 			}
 
 			fprintf(stderr, "Unexpected reply!!!\n");
@@ -1120,7 +1817,7 @@ next:
 			status -= NLMSG_ALIGN(len);
 			h = (struct nlmsghdr *)((char *)h + NLMSG_ALIGN(len));
 		}
-		free(buf);
+		rtnl_rbuf_put(rtnl, buf, buflen);
 
 		if (msg.msg_flags & MSG_TRUNC) {
 			fprintf(stderr, "Message truncated\n");
@@ -1193,102 +1890,352 @@ int rtnl_listen_all_nsid(struct rtnl_handle *rth)
 	return 0;
 }
 
-int rtnl_listen(struct rtnl_handle *rtnl,
-		rtnl_listen_filter_t handler,
-		void *jarg)
+/* Size the receive queue beyond rmem_max where permitted */
+int rtnl_set_rcvbuf(struct rtnl_handle *rth, int size)
 {
-	int status;
-	struct nlmsghdr *h;
-	struct sockaddr_nl nladdr = { .nl_family = AF_NETLINK };
-	struct iovec iov;
-	struct msghdr msg = {
-		.msg_name = &nladdr,
-		.msg_namelen = sizeof(nladdr),
-		.msg_iov = &iov,
-		.msg_iovlen = 1,
-	};
-	char   buf[16384];
-	char   cmsgbuf[BUFSIZ];
+	socklen_t len = sizeof(size);
 
-	iov.iov_base = buf;
-	while (1) {
-		struct rtnl_ctrl_data ctrl;
-		struct cmsghdr *cmsg;
+	if (setsockopt(rth->fd, SOL_SOCKET, SO_RCVBUFFORCE,
+		       &size, sizeof(size)) < 0 &&
+	    setsockopt(rth->fd, SOL_SOCKET, SO_RCVBUF,
+		       &size, sizeof(size)) < 0) {
+		perror("SO_RCVBUF");
+		return -1;
+	}
 
-		if (rtnl->flags & RTNL_HANDLE_F_LISTEN_ALL_NSID) {
-			msg.msg_control = &cmsgbuf;
-			msg.msg_controllen = sizeof(cmsgbuf);
-		}
+	if (getsockopt(rth->fd, SOL_SOCKET, SO_RCVBUF, &size, &len) < 0)
+		return -1;
+	return size;
+}
 
-		iov.iov_len = sizeof(buf);
-		status = recvmsg(rtnl->fd, &msg, 0);
+/* Notifications the socket has dropped so far, or -1 if unknown */
+static long long rtnl_drops(const struct rtnl_handle *rth)
+{
+	__u32 mem[SK_MEMINFO_VARS];
+	socklen_t len = sizeof(mem);
 
-		if (status < 0) {
-			if (errno == EINTR || errno == EAGAIN)
-				continue;
-			fprintf(stderr, "netlink receive error %s (%d)\n",
-				strerror(errno), errno);
-			if (errno == ENOBUFS)
-				continue;
-			return -1;
-		}
-		if (status == 0) {
-			fprintf(stderr, "EOF on netlink\n");
-			return -1;
-		}
-		if (msg.msg_namelen != sizeof(nladdr)) {
-			fprintf(stderr,
-				"Sender address length == %d\n",
-				msg.msg_namelen);
-			exit(1);
+	if (getsockopt(rth->fd, SOL_SOCKET, SO_MEMINFO, mem, &len) < 0 ||
+	    len <= SK_MEMINFO_DROPS * sizeof(mem[0]))
+		return -1;
+	return mem[SK_MEMINFO_DROPS];
+}
+
+/* Notifications are received in batches into slots of the handle
+ * receive buffer, one datagram per slot.
+ */
+#define RTNL_LISTEN_SLOT	32768
+#define RTNL_LISTEN_SLOTS	(RTNL_RBUF_SIZE / RTNL_LISTEN_SLOT)
+
+/*
+ * Like rtnl_listen(), but tell @overrun whenever notifications were
+ * lost, with how many if the kernel can say.  The socket is switched
+ * to NETLINK_NO_ENOBUFS if its drop counter can be read instead, so
+ * that losses are found after each batch without a failed receive.
+ */
+int rtnl_listen_overrun(struct rtnl_handle *rtnl,
+			rtnl_listen_filter_t handler,
+			rtnl_overrun_t overrun, void *jarg)
+{
+	return rtnl_listen_batch(rtnl, handler, overrun, NULL, jarg);
+}
+
+/*
+ * Like rtnl_listen_overrun(), and call @done after each batch of
+ * notifications, so that output can be flushed once per batch rather
+ * than once per message.
+ */
+int rtnl_listen_batch(struct rtnl_handle *rtnl,
+		      rtnl_listen_filter_t handler,
+		      rtnl_overrun_t overrun, rtnl_batch_done_t done,
+		      void *jarg)
+{
+	struct sockaddr_nl nladdr[RTNL_LISTEN_SLOTS];
+	struct mmsghdr msgs[RTNL_LISTEN_SLOTS];
+	struct iovec iov[RTNL_LISTEN_SLOTS];
+	char cmsgbuf[RTNL_LISTEN_SLOTS][CMSG_SPACE(sizeof(int))];
+	long long drops = -1;
+	int i, n;
+
+	rtnl_pipe_sync(rtnl);
+
+	if (rtnl->rbuf_len < RTNL_RBUF_SIZE &&
+	    rtnl_rbuf_alloc(rtnl, RTNL_RBUF_SIZE) < 0)
+		return -1;
+
+	if (overrun) {
+		int one = 1;
+
+		drops = rtnl_drops(rtnl);
+		if (drops >= 0)
+			setsockopt(rtnl->fd, SOL_NETLINK, NETLINK_NO_ENOBUFS,
+				   &one, sizeof(one));
+	}
+
+	while (1) {
+		unsigned int lost = 0;
+		bool overran = false;
+
+		for (i = 0; i < RTNL_LISTEN_SLOTS; i++) {
+			struct msghdr *msg = &msgs[i].msg_hdr;
+
+			iov[i].iov_base = rtnl->rbuf + i * RTNL_LISTEN_SLOT;
+			iov[i].iov_len = RTNL_LISTEN_SLOT;
+			memset(msg, 0, sizeof(*msg));
+			msg->msg_name = &nladdr[i];
+			msg->msg_namelen = sizeof(nladdr[i]);
+			msg->msg_iov = &iov[i];
+			msg->msg_iovlen = 1;
+			if (rtnl->flags & RTNL_HANDLE_F_LISTEN_ALL_NSID) {
+				msg->msg_control = cmsgbuf[i];
+				msg->msg_controllen = sizeof(cmsgbuf[i]);
+			}
 		}
 
-		if (rtnl->flags & RTNL_HANDLE_F_LISTEN_ALL_NSID) {
-			memset(&ctrl, 0, sizeof(ctrl));
-			ctrl.nsid = -1;
-			for (cmsg = CMSG_FIRSTHDR(&msg); cmsg;
-			     cmsg = CMSG_NXTHDR(&msg, cmsg))
-				if (cmsg->cmsg_level == SOL_NETLINK &&
-				    cmsg->cmsg_type == NETLINK_LISTEN_ALL_NSID &&
-				    cmsg->cmsg_len == CMSG_LEN(sizeof(int))) {
-					int *data = (int *)CMSG_DATA(cmsg);
-
-					ctrl.nsid = *data;
+		n = recvmmsg(rtnl->fd, msgs, RTNL_LISTEN_SLOTS,
+			     MSG_WAITFORONE, NULL);
+		if (n < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			if (errno != ENOBUFS || !overrun) {
+				fprintf(stderr, "netlink receive error %s (%d)\n",
+					strerror(errno), errno);
+				if (errno == ENOBUFS) {
+					rtnl->stats.overruns++;
+					continue;
 				}
+				return -1;
+			}
+			overran = true;
+			n = 0;
 		}
+		rtnl->stats.recv_calls++;
+
+		for (i = 0; i < n; i++) {
+			struct msghdr *msg = &msgs[i].msg_hdr;
+			int status = msgs[i].msg_len;
+			struct rtnl_ctrl_data ctrl;
+			struct cmsghdr *cmsg;
+			struct nlmsghdr *h;
+
+			if (status == 0) {
+				fprintf(stderr, "EOF on netlink\n");
+				return -1;
+			}
+			if (msg->msg_namelen != sizeof(nladdr[i])) {
+				fprintf(stderr,
+					"Sender address length == %d\n",
+					msg->msg_namelen);
+				exit(1);
+			}
+			rtnl->stats.recv_bytes += status;
+
+			if (rtnl->flags & RTNL_HANDLE_F_LISTEN_ALL_NSID) {
+				memset(&ctrl, 0, sizeof(ctrl));
+				ctrl.nsid = -1;
+				for (cmsg = CMSG_FIRSTHDR(msg); cmsg;
+				     cmsg = CMSG_NXTHDR(msg, cmsg))
+					if (cmsg->cmsg_level == SOL_NETLINK &&
+					    cmsg->cmsg_type == NETLINK_LISTEN_ALL_NSID &&
+					    cmsg->cmsg_len == CMSG_LEN(sizeof(int))) {
+						int *data = (int *)CMSG_DATA(cmsg);
+
+						ctrl.nsid = *data;
+					}
+			}
 
-		for (h = (struct nlmsghdr *)buf; status >= sizeof(*h); ) {
-			int err;
-			int len = h->nlmsg_len;
-			int l = len - sizeof(*h);
+			for (h = iov[i].iov_base; status >= sizeof(*h); ) {
+				int err;
+				int len = h->nlmsg_len;
+				int l = len - sizeof(*h);
 
-			if (l < 0 || len > status) {
-				if (msg.msg_flags & MSG_TRUNC) {
-					fprintf(stderr, "Truncated message\n");
-					return -1;
+				if (l < 0 || len > status) {
+					if (msg->msg_flags & MSG_TRUNC) {
+						fprintf(stderr, "Truncated message\n");
+						return -1;
+					}
+					fprintf(stderr,
+						"!!!malformed message: len=%d\n",
+						len);
+					exit(1);
 				}
-				fprintf(stderr,
-					"!!!malformed message: len=%d\n",
-					len);
+
+				rtnl->stats.recv_msgs++;
+				err = handler(&ctrl, h, jarg);
+				if (err < 0)
+					return err;
+
+				status -= NLMSG_ALIGN(len);
+				h = (struct nlmsghdr *)((char *)h + NLMSG_ALIGN(len));
+			}
+			if (msg->msg_flags & MSG_TRUNC) {
+				fprintf(stderr, "Message truncated\n");
+				continue;
+			}
+			if (status) {
+				fprintf(stderr, "!!!Remnant of size %d\n", status);
 				exit(1);
 			}
+		}
+
+		if (drops >= 0) {
+			long long now = rtnl_drops(rtnl);
+
+			if (now > drops) {
+				lost = now - drops;
+				overran = true;
+			}
+			if (now >= 0)
+				drops = now;
+		}
+
+		if (overran) {
+			int err;
 
-			err = handler(&ctrl, h, jarg);
+			rtnl->stats.overruns++;
+			rtnl->stats.lost += lost;
+			err = overrun(rtnl, lost, jarg);
 			if (err < 0)
 				return err;
+			if (drops >= 0)
+				drops = rtnl_drops(rtnl);
+		}
 
-			status -= NLMSG_ALIGN(len);
-			h = (struct nlmsghdr *)((char *)h + NLMSG_ALIGN(len));
+		if (done) {
+			int err = done(rtnl, jarg);
+
+			if (err < 0)
+				return err;
 		}
-		if (msg.msg_flags & MSG_TRUNC) {
-			fprintf(stderr, "Message truncated\n");
-			continue;
+	}
+}
+
+/* Add a check that the __u8, __u16 or __u32 at @off into the family
+ * header of messages selected by @sel equals @val.
+ */
+void rtnl_sel_field(struct rtnl_listen_sel *sel, __u8 off, __u8 size,
+		    __u32 val)
+{
+	if (sel->nchecks < RTNL_SEL_CHECKS)
+		sel->check[sel->nchecks++] = (typeof(sel->check[0])) {
+			.off = off, .size = size, .val = val,
+		};
+}
+
+/* Add a check that the __u32 attribute @attr equals @val, if present */
+void rtnl_sel_attr(struct rtnl_listen_sel *sel, __u16 attr, __u32 val)
+{
+	if (sel->nchecks < RTNL_SEL_CHECKS)
+		sel->check[sel->nchecks++] = (typeof(sel->check[0])) {
+			.attr = attr, .val = val,
+		};
+}
+
+/* Instructions per selector: the type test, up to seven per check and
+ * the return.
+ */
+#define RTNL_SEL_INSNS		(2 + 7 * RTNL_SEL_CHECKS + 1)
+
+#define RTNL_BPF_STMT(code, k) \
+	((struct sock_filter) BPF_STMT(code, k))
+#define RTNL_BPF_JUMP(code, k, jt, jf) \
+	((struct sock_filter) BPF_JUMP(code, k, jt, jf))
+
+/*
+ * Attach a classic BPF filter letting through only the notifications
+ * that pass one of the @n selectors, so that others neither wake the
+ * listener nor get copied.  A message passes a selector of its type if
+ * it passes all of the selector's checks.  Messages of types no
+ * selector names pass unless @strict is set.  Notifications carry a
+ * single message, which the filter sees from its netlink header on.
+ */
+int rtnl_listen_select(struct rtnl_handle *rth,
+		       const struct rtnl_listen_sel *sel, int n, bool strict)
+{
+	const unsigned int hdr = NLMSG_HDRLEN;
+	struct sock_fprog prog;
+	struct sock_filter *f;
+	unsigned int len = 0;
+	int i, j, ret;
+
+	f = calloc(n * RTNL_SEL_INSNS + 2 * n + 2, sizeof(*f));
+	if (!f)
+		return -1;
+
+	for (i = 0; i < n; i++) {
+		const struct rtnl_listen_sel *s = &sel[i];
+		unsigned int fail[RTNL_SEL_CHECKS + 1];
+
+		f[len++] = RTNL_BPF_STMT(BPF_LD | BPF_H | BPF_ABS,
+					 offsetof(struct nlmsghdr, nlmsg_type));
+		fail[0] = len;
+		f[len++] = RTNL_BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+					 htons(s->type), 0, 0);
+
+		for (j = 0; j < s->nchecks; j++) {
+			const typeof(s->check[0]) *c = &s->check[j];
+
+			if (c->attr) {
+				f[len++] = RTNL_BPF_STMT(BPF_LDX | BPF_IMM,
+							 c->attr);
+				f[len++] = RTNL_BPF_STMT(BPF_LD | BPF_IMM,
+							 hdr + NLMSG_ALIGN(s->hdrlen));
+				f[len++] = RTNL_BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+							 SKF_AD_OFF + SKF_AD_NLATTR);
+				/* absent attributes do not reject */
+				f[len++] = RTNL_BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+							 0, 3, 0);
+				f[len++] = RTNL_BPF_STMT(BPF_MISC | BPF_TAX, 0);
+				f[len++] = RTNL_BPF_STMT(BPF_LD | BPF_W | BPF_IND,
+							 NLA_HDRLEN);
+				fail[j + 1] = len;
+				f[len++] = RTNL_BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+							 htonl(c->val), 0, 0);
+			} else {
+				__u16 size = c->size == 1 ? BPF_B :
+					     c->size == 2 ? BPF_H : BPF_W;
+				__u32 val = c->size == 1 ? c->val :
+					    c->size == 2 ? htons(c->val) :
+					    htonl(c->val);
+
+				f[len++] = RTNL_BPF_STMT(BPF_LD | size | BPF_ABS,
+							 hdr + c->off);
+				fail[j + 1] = len;
+				f[len++] = RTNL_BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+							 val, 0, 0);
+			}
 		}
-		if (status) {
-			fprintf(stderr, "!!!Remnant of size %d\n", status);
-			exit(1);
+		f[len++] = RTNL_BPF_STMT(BPF_RET | BPF_K, 0xffffffff);
+
+		/* on a mismatch, try the next selector */
+		for (j = 0; j <= s->nchecks; j++)
+			f[fail[j]].jf = len - (fail[j] + 1);
+	}
+
+	/* no selector passed: reject the types they name */
+	if (!strict) {
+		f[len++] = RTNL_BPF_STMT(BPF_LD | BPF_H | BPF_ABS,
+					 offsetof(struct nlmsghdr, nlmsg_type));
+		for (i = 0; i < n; i++) {
+			f[len++] = RTNL_BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+						 htons(sel[i].type), 0, 1);
+			f[len++] = RTNL_BPF_STMT(BPF_RET | BPF_K, 0);
 		}
 	}
+	f[len++] = RTNL_BPF_STMT(BPF_RET | BPF_K, strict ? 0 : 0xffffffff);
+
+	prog.len = len;
+	prog.filter = f;
+	ret = setsockopt(rth->fd, SOL_SOCKET, SO_ATTACH_FILTER,
+			 &prog, sizeof(prog));
+	free(f);
+	return ret;
+}
+
+int rtnl_listen(struct rtnl_handle *rtnl,
+		rtnl_listen_filter_t handler,
+		void *jarg)
+{
+	return rtnl_listen_overrun(rtnl, handler, NULL, jarg);
 }
 
 int rtnl_from_file(FILE *rtnl, rtnl_listen_filter_t handler,
@@ -24,20 +24,90 @@ struct ll_cache {
 	struct hlist_node name_hash;
 	unsigned	flags;
 	unsigned 	index;
+	unsigned	hash;	/* namehash(name) */
 	unsigned short	type;
 	struct list_head altnames_list;
 	char		name[];
 };
 
-#define IDXMAP_SIZE	1024
-static struct hlist_head idx_head[IDXMAP_SIZE];
-static struct hlist_head name_head[IDXMAP_SIZE];
+/* Both tables start small and double whenever they hold more entries
+ * than buckets, so that chains stay short with any number of links.
+ */
+#define IDXMAP_SIZE_MIN	1024
+static struct hlist_head *idx_head;
+static struct hlist_head *name_head;
+static unsigned int idxmap_size;
+static unsigned int idx_count;
+static unsigned int name_count;
+
+static struct hlist_head *ll_hash_alloc(unsigned int size)
+{
+	struct hlist_head *head = calloc(size, sizeof(*head));
+
+	if (!head) {
+		fprintf(stderr, "ll_map: cannot allocate %u hash buckets\n",
+			size);
+		exit(1);
+	}
+	return head;
+}
+
+static void ll_hash_init(void)
+{
+	idxmap_size = IDXMAP_SIZE_MIN;
+	idx_head = ll_hash_alloc(idxmap_size);
+	name_head = ll_hash_alloc(idxmap_size);
+}
+
+static void ll_hash_rehash(unsigned int size)
+{
+	struct hlist_head *old_idx = idx_head, *old_name = name_head;
+	unsigned int i, old_size = idxmap_size;
+
+	idx_head = ll_hash_alloc(size);
+	name_head = ll_hash_alloc(size);
+	idxmap_size = size;
+
+	for (i = 0; i < old_size; i++) {
+		struct hlist_node *n, *tmp;
+
+		hlist_for_each_safe(n, tmp, &old_idx[i]) {
+			struct ll_cache *im
+				= container_of(n, struct ll_cache, idx_hash);
+
+			hlist_add_head(&im->idx_hash,
+				       &idx_head[im->index & (size - 1)]);
+		}
+		hlist_for_each_safe(n, tmp, &old_name[i]) {
+			struct ll_cache *im
+				= container_of(n, struct ll_cache, name_hash);
+
+			hlist_add_head(&im->name_hash,
+				       &name_head[im->hash & (size - 1)]);
+		}
+	}
+
+	free(old_idx);
+	free(old_name);
+}
+
+static void ll_hash_grow(void)
+{
+	if (!idxmap_size)
+		ll_hash_init();
+	else if (idx_count > idxmap_size || name_count > idxmap_size)
+		ll_hash_rehash(idxmap_size * 2);
+}
 
 static struct ll_cache *ll_get_by_index(unsigned index)
 {
 	struct hlist_node *n;
-	unsigned h = index & (IDXMAP_SIZE - 1);
+	unsigned h;
+
+	if (!idxmap_size)
+		return NULL;
 
+	h = index & (idxmap_size - 1);
 	hlist_for_each(n, &idx_head[h]) {
 		struct ll_cache *im
 			= container_of(n, struct ll_cache, idx_hash);
@@ -61,19 +131,87 @@ unsigned namehash(const char *str)
 static struct ll_cache *ll_get_by_name(const char *name)
 {
 	struct hlist_node *n;
-	unsigned h = namehash(name) & (IDXMAP_SIZE - 1);
+	unsigned hash, h;
 
+	if (!idxmap_size)
+		return NULL;
+
+	hash = namehash(name);
+	h = hash & (idxmap_size - 1);
 	hlist_for_each(n, &name_head[h]) {
 		struct ll_cache *im
 			= container_of(n, struct ll_cache, name_hash);
 
-		if (strcmp(im->name, name) == 0)
+		if (im->hash == hash && strcmp(im->name, name) == 0)
 			return im;
 	}
 
 	return NULL;
 }
 
+/* Links the kernel does not know, see ll_init_map() */
+#define LL_MISS_HASH	64
+
+struct ll_miss {
+	struct hlist_node	hash;
+	unsigned int		index;	/* or 0 for a name */
+	char			name[];
+};
+
+static struct hlist_head ll_miss_head[LL_MISS_HASH];
+static unsigned int ll_miss_count;
+
+static unsigned int ll_miss_hash(const char *name, unsigned int index)
+{
+	return (name ? namehash(name) : index) & (LL_MISS_HASH - 1);
+}
+
+static bool ll_miss_find(const char *name, unsigned int index)
+{
+	struct hlist_node *n;
+
+	if (!ll_miss_count)
+		return false;
+
+	hlist_for_each(n, &ll_miss_head[ll_miss_hash(name, index)]) {
+		struct ll_miss *m = container_of(n, struct ll_miss, hash);
+
+		if (name ? !m->index && !strcmp(m->name, name) :
+			   m->index == index)
+			return true;
+	}
+	return false;
+}
+
+static void ll_miss_add(const char *name, unsigned int index)
+{
+	struct ll_miss *m;
+
+	m = malloc(sizeof(*m) + (name ? strlen(name) + 1 : 0));
+	if (!m)
+		return;
+	m->index = name ? 0 : index;
+	if (name)
+		strcpy(m->name, name);
+	hlist_add_head(&m->hash, &ll_miss_head[ll_miss_hash(name, index)]);
+	ll_miss_count++;
+}
+
+static void ll_miss_flush(void)
+{
+	unsigned int i;
+
+	for (i = 0; ll_miss_count && i < LL_MISS_HASH; i++) {
+		struct hlist_node *n, *tmp;
+
+		hlist_for_each_safe(n, tmp, &ll_miss_head[i]) {
+			hlist_del(n);
+			free(container_of(n, struct ll_miss, hash));
+			ll_miss_count--;
+		}
+	}
+}
+
 static struct ll_cache *ll_entry_create(struct ifinfomsg *ifi,
 					const char *ifname,
 					struct ll_cache *parent_im)
@@ -86,30 +224,38 @@ static struct ll_cache *ll_entry_create(struct ifinfomsg *ifi,
 		return NULL;
 	im->index = ifi->ifi_index;
 	strcpy(im->name, ifname);
+	im->hash = namehash(ifname);
 	im->type = ifi->ifi_type;
 	im->flags = ifi->ifi_flags;
 
+	ll_hash_grow();
+
 	if (parent_im) {
 		list_add_tail(&im->altnames_list, &parent_im->altnames_list);
 	} else {
 		/* This is parent, insert to index hash. */
-		h = ifi->ifi_index & (IDXMAP_SIZE - 1);
+		h = ifi->ifi_index & (idxmap_size - 1);
 		hlist_add_head(&im->idx_hash, &idx_head[h]);
 		INIT_LIST_HEAD(&im->altnames_list);
+		idx_count++;
 	}
 
-	h = namehash(ifname) & (IDXMAP_SIZE - 1);
+	h = im->hash & (idxmap_size - 1);
 	hlist_add_head(&im->name_hash, &name_head[h]);
+	name_count++;
 	return im;
 }
 
 static void ll_entry_destroy(struct ll_cache *im, bool im_is_parent)
 {
 	hlist_del(&im->name_hash);
-	if (im_is_parent)
+	name_count--;
+	if (im_is_parent) {
 		hlist_del(&im->idx_hash);
-	else
+		idx_count--;
+	} else {
 		list_del(&im->altnames_list);
+	}
 	free(im);
 }
 
@@ -122,7 +268,8 @@ static void ll_entry_update(struct ll_cache *im, struct ifinfomsg *ifi,
 	if (!strcmp(im->name, ifname))
 		return;
 	hlist_del(&im->name_hash);
-	h = namehash(ifname) & (IDXMAP_SIZE - 1);
+	im->hash = namehash(ifname);
+	h = im->hash & (idxmap_size - 1);
 	hlist_add_head(&im->name_hash, &name_head[h]);
 }
 
@@ -241,6 +388,7 @@ int ll_remember_index(struct nlmsghdr *n, void *arg)
 		ll_entries_update(im, ifi, tb);
 	else
 		ll_entries_create(ifi, tb);
+	ll_miss_flush();
 	return 0;
 }
 
@@ -261,6 +409,68 @@ static unsigned int ll_idx_a2n(const char *name)
 	return idx;
 }
 
+/* ll_init_map() does not dump the link table up front.  Lookups that
+ * miss the cache are resolved one at a time with RTM_GETLINK on a
+ * private handle, and only once more than LL_LAZY_MISSES of them have
+ * missed is the whole table dumped, so that commands touching a few
+ * devices do not pay for every link in the namespace.
+ *
+ * Links the kernel does not know are remembered as well, so asking
+ * again for the same missing index or name costs nothing.  They are
+ * forgotten when a link is added to the cache and by ll_reset_map().
+ */
+#define LL_LAZY_MISSES	32
+
+static enum {
+	LL_MAP_NONE,
+	LL_MAP_LAZY,
+	LL_MAP_FULL,
+} ll_map_state;
+static unsigned int ll_misses;
+static struct rtnl_handle ll_rth = { .fd = -1 };
+
+static struct rtnl_handle *ll_rth_get(void)
+{
+	if (ll_rth.fd < 0 && rtnl_open(&ll_rth, 0) < 0) {
+		ll_rth.fd = -1;
+		return NULL;
+	}
+	return &ll_rth;
+}
+
+static int ll_link_dump(struct rtnl_handle *rth)
+{
+	if (rtnl_linkdump_req_filter(rth, AF_UNSPEC,
+				     RTEXT_FILTER_SKIP_STATS) < 0) {
+		perror("Cannot send dump request");
+		return -1;
+	}
+
+	if (rtnl_dump_filter(rth, ll_remember_index, NULL) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		return -1;
+	}
+
+	ll_map_state = LL_MAP_FULL;
+	return 0;
+}
+
+/* Account a cache miss; returns true if it triggered the full dump. */
+static bool ll_lazy_miss(void)
+{
+	struct rtnl_handle *rth;
+
+	if (ll_map_state != LL_MAP_LAZY || ++ll_misses <= LL_LAZY_MISSES)
+		return false;
+
+	rth = ll_rth_get();
+	if (!rth)
+		return false;
+
+	/* a failed dump leaves us resolving names one by one */
+	return ll_link_dump(rth) == 0;
+}
+
 static int ll_link_get(const char *name, int index)
 {
 	struct {
@@ -273,12 +483,13 @@ static int ll_link_get(const char *name, int index)
 		.n.nlmsg_type = RTM_GETLINK,
 		.ifm.ifi_index = index,
 	};
-	__u32 filt_mask = RTEXT_FILTER_VF | RTEXT_FILTER_SKIP_STATS;
-	struct rtnl_handle rth = {};
+	__u32 filt_mask = RTEXT_FILTER_SKIP_STATS;
+	struct rtnl_handle *rth;
 	struct nlmsghdr *answer;
 	int rc = 0;
 
-	if (rtnl_open(&rth, 0) < 0)
+	rth = ll_rth_get();
+	if (!rth)
 		return 0;
 
 	addattr32(&req.n, sizeof(req), IFLA_EXT_MASK, filt_mask);
@@ -287,8 +498,8 @@ static int ll_link_get(const char *name, int index)
 			  !check_ifname(name) ? IFLA_IFNAME : IFLA_ALT_IFNAME,
 			  name, strlen(name) + 1);
 
-	if (rtnl_talk_suppress_rtnl_errmsg(&rth, &req.n, &answer) < 0)
-		goto out;
+	if (rtnl_talk_suppress_rtnl_errmsg(rth, &req.n, &answer) < 0)
+		return 0;
 
 	/* add entry to cache */
 	rc  = ll_remember_index(answer, NULL);
@@ -299,11 +510,32 @@ static int ll_link_get(const char *name, int index)
 	}
 
 	free(answer);
-out:
-	rtnl_close(&rth);
 	return rc;
 }
 
+static const struct ll_cache *ll_lookup_index(unsigned int idx)
+{
+	const struct ll_cache *im;
+
+	im = ll_get_by_index(idx);
+	if (im || ll_miss_find(NULL, idx))
+		return im;
+
+	if (ll_lazy_miss()) {
+		im = ll_get_by_index(idx);
+		if (im)
+			return im;
+	}
+
+	if (ll_link_get(NULL, idx) == idx)
+		return ll_get_by_index(idx);
+
+	/* only netlink can tell that the link does not exist */
+	if (ll_rth.fd >= 0)
+		ll_miss_add(NULL, idx);
+	return NULL;
+}
+
 const char *ll_index_to_name(unsigned int idx)
 {
 	static char buf[IFNAMSIZ];
@@ -312,17 +544,11 @@ const char *ll_index_to_name(unsigned int idx)
 	if (idx == 0)
 		return "*";
 
-	im = ll_get_by_index(idx);
+	im = ll_lookup_index(idx);
 	if (im)
 		return im->name;
 
-	if (ll_link_get(NULL, idx) == idx) {
-		im = ll_get_by_index(idx);
-		if (im)
-			return im->name;
-	}
-
-	if (if_indextoname(idx, buf) == NULL)
+	if (ll_rth.fd >= 0 || if_indextoname(idx, buf) == NULL)
 		snprintf(buf, IFNAMSIZ, "if%u", idx);
 
 	return buf;
@@ -335,7 +561,7 @@ int ll_index_to_type(unsigned idx)
 	if (idx == 0)
 		return -1;
 
-	im = ll_get_by_index(idx);
+	im = ll_lookup_index(idx);
 	return im ? im->type : -1;
 }
 
@@ -346,7 +572,7 @@ int ll_index_to_flags(unsigned idx)
 	if (idx == 0)
 		return 0;
 
-	im = ll_get_by_index(idx);
+	im = ll_lookup_index(idx);
 	return im ? im->flags : -1;
 }
 
@@ -361,12 +587,23 @@ unsigned ll_name_to_index(const char *name)
 	im = ll_get_by_name(name);
 	if (im)
 		return im->index;
+	if (ll_miss_find(name, 0))
+		return ll_idx_a2n(name);
+
+	if (ll_lazy_miss()) {
+		im = ll_get_by_name(name);
+		if (im)
+			return im->index;
+	}
 
 	idx = ll_link_get(name, 0);
-	if (idx == 0)
+	if (idx == 0 && ll_rth.fd < 0)
 		idx = if_nametoindex(name);
-	if (idx == 0)
+	if (idx == 0) {
+		if (ll_rth.fd >= 0)
+			ll_miss_add(name, 0);
 		idx = ll_idx_a2n(name);
+	}
 	return idx;
 }
 
@@ -380,26 +617,42 @@ void ll_drop_by_index(unsigned index)
 
 	hlist_del(&im->idx_hash);
 	hlist_del(&im->name_hash);
+	idx_count--;
+	name_count--;
 
 	free(im);
 }
 
-void ll_init_map(struct rtnl_handle *rth)
+/* Forget the links and the handle of the namespace we are leaving */
+void ll_reset_map(void)
 {
-	static int initialized;
+	unsigned int i;
 
-	if (initialized)
-		return;
+	for (i = 0; i < idxmap_size; i++) {
+		struct hlist_node *n, *tmp;
 
-	if (rtnl_linkdump_req(rth, AF_UNSPEC) < 0) {
-		perror("Cannot send dump request");
-		exit(1);
+		hlist_for_each_safe(n, tmp, &idx_head[i])
+			ll_entries_destroy(container_of(n, struct ll_cache,
+							idx_hash));
 	}
 
-	if (rtnl_dump_filter(rth, ll_remember_index, NULL) < 0) {
-		fprintf(stderr, "Dump terminated\n");
-		exit(1);
-	}
+	ll_miss_flush();
+	if (ll_rth.fd >= 0)
+		rtnl_close(&ll_rth);
 
-	initialized = 1;
+	if (ll_map_state != LL_MAP_NONE)
+		ll_map_state = LL_MAP_LAZY;
+	ll_misses = 0;
+}
+
+/* Nothing is dumped here, so this no longer exits when the link dump
+ * fails: a dump that fails later leaves names to be resolved one at a
+ * time, and lookups that cannot reach the kernel fall back to ifN
+ * names.  Lookups go through a private handle, as they happen in the
+ * middle of the caller's own dumps, so no handle is taken.
+ */
+void ll_init_map(void)
+{
+	if (ll_map_state == LL_MAP_NONE)
+		ll_map_state = LL_MAP_LAZY;
 }
@@ -0,0 +1,183 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * lz.c		LZ77 block compression, in the LZ4 block format.
+ *
+ * Each sequence is a token holding the literal and match lengths in
+ * its high and low nibble, the literal length continued in bytes of
+ * 255 when the nibble is 15, the literals, a two byte little endian
+ * offset back into the output and the match length continued the same
+ * way; matches are at least 4 bytes long.  The last sequence carries
+ * literals only.
+ */
+
+#include <string.h>
+#include <linux/types.h>
+
+#include "lz.h"
+
+#define LZ_MINMATCH	4
+#define LZ_MAXOFF	65535
+#define LZ_HASH_BITS	13
+/* no match starts in the last 12 bytes nor runs into the last 5 */
+#define LZ_MFLIMIT	12
+#define LZ_LASTLITERALS	5
+
+static __u32 lz_read32(const unsigned char *p)
+{
+	__u32 v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static unsigned int lz_hash(__u32 v)
+{
+	return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+static unsigned char *lz_put_len(unsigned char *op, unsigned int len)
+{
+	for (; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = len;
+	return op;
+}
+
+static unsigned char *lz_put_seq(unsigned char *op, unsigned char *oend,
+				 const unsigned char *lit, unsigned int nlit,
+				 unsigned int off, unsigned int mlen)
+{
+	unsigned char *token;
+
+	/* worst case for the token, lengths, literals and offset */
+	if (oend - op < 1 + nlit / 255 + 1 + nlit + 2 + mlen / 255 + 1)
+		return NULL;
+
+	token = op++;
+
+	*token = (nlit < 15 ? nlit : 15) << 4;
+	if (nlit >= 15)
+		op = lz_put_len(op, nlit - 15);
+	memcpy(op, lit, nlit);
+	op += nlit;
+
+	if (!off)
+		return op;
+
+	*op++ = off & 0xff;
+	*op++ = off >> 8;
+	*token |= mlen < 15 ? mlen : 15;
+	if (mlen >= 15)
+		op = lz_put_len(op, mlen - 15);
+	return op;
+}
+
+/* Returns the compressed length, or -1 if it would exceed @cap */
+int lz_compress(const void *src, int len, void *dst, int cap)
+{
+	const unsigned char *base = src;
+	const unsigned char *ip = base, *anchor = base;
+	const unsigned char *iend = base + len;
+	unsigned char *op = dst, *oend = op + cap;
+	int table[1 << LZ_HASH_BITS];
+
+	if (cap < 1)
+		return -1;
+
+	memset(table, 0xff, sizeof(table));
+
+	while (len > LZ_MFLIMIT && ip < iend - LZ_MFLIMIT) {
+		const unsigned char *mlimit = iend - LZ_LASTLITERALS;
+		const unsigned char *m, *p;
+		__u32 seq = lz_read32(ip);
+		unsigned int h = lz_hash(seq);
+		int ref = table[h];
+
+		table[h] = ip - base;
+		if (ref < 0 || ip - base - ref > LZ_MAXOFF ||
+		    lz_read32(base + ref) != seq) {
+			ip++;
+			continue;
+		}
+
+		m = base + ref + LZ_MINMATCH;
+		p = ip + LZ_MINMATCH;
+		while (p < mlimit && *p == *m) {
+			p++;
+			m++;
+		}
+
+		op = lz_put_seq(op, oend, anchor, ip - anchor,
+				ip - (base + ref), p - ip - LZ_MINMATCH);
+		if (!op)
+			return -1;
+		ip = anchor = p;
+	}
+
+	op = lz_put_seq(op, oend, anchor, iend - anchor, 0, 0);
+	if (!op)
+		return -1;
+	return op - (unsigned char *)dst;
+}
+
+static int lz_get_len(const unsigned char **ip, const unsigned char *iend,
+		      unsigned int *len)
+{
+	unsigned int b;
+
+	do {
+		if (*ip >= iend)
+			return -1;
+		b = *(*ip)++;
+		*len += b;
+	} while (b == 255);
+
+	return 0;
+}
+
+/* Returns the decompressed length, or -1 if the input is malformed
+ * or does not fit in @cap bytes.
+ */
+int lz_decompress(const void *src, int len, void *dst, int cap)
+{
+	const unsigned char *ip = src, *iend = ip + len;
+	unsigned char *base = dst, *op = base, *oend = base + cap;
+
+	while (ip < iend) {
+		unsigned int token = *ip++;
+		unsigned int nlit = token >> 4;
+		unsigned int mlen = token & 15;
+		unsigned int off;
+		const unsigned char *m;
+
+		if (nlit == 15 && lz_get_len(&ip, iend, &nlit) < 0)
+			return -1;
+		if (nlit > iend - ip || nlit > oend - op)
+			return -1;
+		memcpy(op, ip, nlit);
+		op += nlit;
+		ip += nlit;
+
+		if (ip == iend)
+			break;
+
+		if (iend - ip < 2)
+			return -1;
+		off = ip[0] | ip[1] << 8;
+		ip += 2;
+		if (!off || off > op - base)
+			return -1;
+
+		if (mlen == 15 && lz_get_len(&ip, iend, &mlen) < 0)
+			return -1;
+		mlen += LZ_MINMATCH;
+		if (mlen > oend - op)
+			return -1;
+
+		/* may overlap what is being written */
+		for (m = op - off; mlen--; )
+			*op++ = *m++;
+	}
+
+	return op - base;
+}
@@ -0,0 +1,345 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * name_cache.c	Host and service names, cached in memory and in a file
+ *		shared by every run of ip and ss.
+ *
+ * The file is a table of fixed size records mapped shared, indexed by
+ * a hash of the key and probed linearly over a few slots.  Each record
+ * carries a checksum of its contents, written last, so that a record
+ * being rewritten by another process reads as a miss rather than as
+ * garbage; writers serialise with flock().  Records expire after the
+ * TTL they were stored with, shorter for names that did not resolve.
+ * There is only a file if IPROUTE2_NAME_CACHE names one, and it is
+ * created private to its user.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <libgen.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <linux/types.h>
+
+#include "name_cache.h"
+
+#define NC_MAGIC	0x636e7069	/* "ipnc" */
+#define NC_VERSION	1
+#define NC_SLOTS	16384
+#define NC_PROBE	8
+#define NC_KEY_MAX	16
+#define NC_NAME_MAX	100
+
+struct nc_header {
+	__u32	magic;
+	__u32	version;
+	__u32	slots;
+	__u32	rec_size;
+};
+
+struct nc_rec {
+	__u32	check;		/* of the rest, 0 marks a free slot */
+	__u32	expires;	/* seconds since the epoch */
+	__u8	af;
+	__u8	len;
+	__u8	negative;
+	__u8	pad;
+	__u8	key[NC_KEY_MAX];
+	char	name[NC_NAME_MAX];
+};
+
+/* Names looked up by this process, found or not */
+struct nc_ent {
+	struct nc_ent	*next;
+	char		*name;
+	__u8		af;
+	__u8		len;
+	__u8		key[NC_KEY_MAX];
+};
+
+#define NC_HASH		1024
+
+static struct {
+	struct nc_ent	*hash[NC_HASH];
+	struct nc_rec	*rec;		/* of the file, if any */
+	void		*map;
+	size_t		size;
+	int		fd;
+	int		opened;
+	int		writable;
+} nc = { .fd = -1 };
+
+static __u32 nc_fnv(__u32 h, const void *data, size_t len)
+{
+	const __u8 *p = data;
+
+	while (len--)
+		h = (h ^ *p++) * 16777619U;
+	return h;
+}
+
+static __u32 nc_hash(int af, int len, const void *key)
+{
+	__u8 hdr[2] = { af, len };
+
+	return nc_fnv(nc_fnv(2166136261U, hdr, 2), key, len);
+}
+
+static __u32 nc_check(const struct nc_rec *r)
+{
+	__u32 h = nc_fnv(2166136261U, &r->expires,
+			 sizeof(*r) - offsetof(struct nc_rec, expires));
+
+	return h ? : 1;
+}
+
+static int nc_header_ok(const struct nc_header *h)
+{
+	return h->magic == NC_MAGIC && h->version == NC_VERSION &&
+	       h->slots == NC_SLOTS && h->rec_size == sizeof(struct nc_rec);
+}
+
+/* Size a new or stale file and write its header, under the lock */
+static int nc_init_file(int fd, size_t size)
+{
+	struct nc_header h = {
+		.magic = NC_MAGIC,
+		.version = NC_VERSION,
+		.slots = NC_SLOTS,
+		.rec_size = sizeof(struct nc_rec),
+	};
+	struct nc_header cur;
+	struct stat st;
+
+	if (fstat(fd, &st) == 0 && st.st_size == size &&
+	    pread(fd, &cur, sizeof(cur), 0) == sizeof(cur) &&
+	    nc_header_ok(&cur))
+		return 0;
+
+	if (ftruncate(fd, 0) < 0 || ftruncate(fd, size) < 0 ||
+	    pwrite(fd, &h, sizeof(h), 0) != sizeof(h))
+		return -1;
+	return 0;
+}
+
+static int nc_open_file(const char *path)
+{
+	int fd;
+
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd < 0 && errno == ENOENT) {
+		char dir[PATH_MAX];
+
+		strncpy(dir, path, sizeof(dir) - 1);
+		dir[sizeof(dir) - 1] = '\0';
+		if (mkdir(dirname(dir), 0700) == 0)
+			fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	}
+	if (fd >= 0) {
+		nc.writable = 1;
+		return fd;
+	}
+	return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+static void nc_open(void)
+{
+	const char *path = getenv("IPROUTE2_NAME_CACHE");
+	size_t size = sizeof(struct nc_header) +
+		      NC_SLOTS * sizeof(struct nc_rec);
+	struct stat st;
+	void *map;
+
+	nc.opened = 1;
+	if (!path || !*path)
+		return;
+
+	nc.fd = nc_open_file(path);
+	if (nc.fd < 0)
+		return;
+
+	if (nc.writable) {
+		int err;
+
+		flock(nc.fd, LOCK_EX);
+		err = nc_init_file(nc.fd, size);
+		flock(nc.fd, LOCK_UN);
+		if (err)
+			goto fail;
+	}
+
+	if (fstat(nc.fd, &st) < 0 || st.st_size != size)
+		goto fail;
+
+	map = mmap(NULL, size, PROT_READ | (nc.writable ? PROT_WRITE : 0),
+		   MAP_SHARED, nc.fd, 0);
+	if (map == MAP_FAILED)
+		goto fail;
+	if (!nc_header_ok(map)) {
+		munmap(map, size);
+		goto fail;
+	}
+
+	nc.map = map;
+	nc.size = size;
+	nc.rec = (struct nc_rec *)((struct nc_header *)map + 1);
+	return;
+fail:
+	close(nc.fd);
+	nc.fd = -1;
+}
+
+static int nc_rec_match(const struct nc_rec *r, int af, int len,
+			const void *key)
+{
+	return r->af == af && r->len == len && !memcmp(r->key, key, len);
+}
+
+/* Copy the live record for @key out of the file into @out */
+static int nc_file_get(int af, int len, const void *key, __u32 h,
+		       struct nc_rec *out)
+{
+	__u32 now = time(NULL);
+	int i;
+
+	for (i = 0; i < NC_PROBE; i++) {
+		*out = nc.rec[(h + i) & (NC_SLOTS - 1)];
+		if (!out->check || out->check != nc_check(out))
+			continue;
+		if (nc_rec_match(out, af, len, key))
+			return out->expires > now;
+	}
+	return 0;
+}
+
+static void nc_file_set(int af, int len, const void *key, __u32 h,
+			const char *name, unsigned int ttl)
+{
+	__u32 now = time(NULL);
+	struct nc_rec *r, *slot = NULL;
+	struct nc_rec new = {
+		.expires = now + ttl,
+		.af = af,
+		.len = len,
+		.negative = !name,
+	};
+	int i;
+
+	if (name && strlen(name) >= NC_NAME_MAX)
+		return;
+	memcpy(new.key, key, len);
+	if (name)
+		strcpy(new.name, name);
+	new.check = nc_check(&new);
+
+	flock(nc.fd, LOCK_EX);
+
+	/* the record of the same key, else a free or the oldest one */
+	for (i = 0; i < NC_PROBE; i++) {
+		r = &nc.rec[(h + i) & (NC_SLOTS - 1)];
+		if (!r->check || r->check != nc_check(r) ||
+		    nc_rec_match(r, af, len, key)) {
+			slot = r;
+			break;
+		}
+		if (!slot || r->expires < slot->expires)
+			slot = r;
+	}
+
+	__atomic_store_n(&slot->check, 0, __ATOMIC_RELEASE);
+	memcpy((char *)slot + sizeof(slot->check),
+	       (char *)&new + sizeof(new.check),
+	       sizeof(new) - sizeof(new.check));
+	__atomic_store_n(&slot->check, new.check, __ATOMIC_RELEASE);
+
+	flock(nc.fd, LOCK_UN);
+}
+
+static struct nc_ent *nc_find(int af, int len, const void *key, __u32 h)
+{
+	struct nc_ent *e;
+
+	for (e = nc.hash[h % NC_HASH]; e; e = e->next) {
+		if (e->af == af && e->len == len && !memcmp(e->key, key, len))
+			return e;
+	}
+	return NULL;
+}
+
+static struct nc_ent *nc_add(int af, int len, const void *key, __u32 h,
+			     const char *name)
+{
+	struct nc_ent *e = nc_find(af, len, key, h);
+
+	if (!e) {
+		e = calloc(1, sizeof(*e));
+		if (!e)
+			return NULL;
+		e->af = af;
+		e->len = len;
+		memcpy(e->key, key, len);
+		e->next = nc.hash[h % NC_HASH];
+		nc.hash[h % NC_HASH] = e;
+	}
+
+	free(e->name);
+	e->name = name ? strdup(name) : NULL;
+	return e;
+}
+
+/*
+ * Name cached for @key, NULL if it did not resolve or is not cached:
+ * @found tells which.
+ */
+const char *name_cache_get(int af, int len, const void *key, bool *found)
+{
+	__u32 h = nc_hash(af, len, key);
+	struct nc_rec r;
+	struct nc_ent *e;
+
+	*found = false;
+	if (len > NC_KEY_MAX)
+		return NULL;
+
+	e = nc_find(af, len, key, h);
+	if (!e) {
+		if (!nc.opened)
+			nc_open();
+		if (!nc.rec || !nc_file_get(af, len, key, h, &r))
+			return NULL;
+
+		r.name[NC_NAME_MAX - 1] = '\0';
+		e = nc_add(af, len, key, h, r.negative ? NULL : r.name);
+		if (!e)
+			return NULL;
+	}
+
+	*found = true;
+	return e->name;
+}
+
+/* Cache @name, or that @key did not resolve if NULL, for @ttl seconds */
+const char *name_cache_set(int af, int len, const void *key,
+			   const char *name, unsigned int ttl)
+{
+	__u32 h = nc_hash(af, len, key);
+	struct nc_ent *e;
+
+	if (len > NC_KEY_MAX)
+		return name;
+
+	if (!nc.opened)
+		nc_open();
+	if (nc.rec && nc.writable)
+		nc_file_set(af, len, key, h, name, ttl);
+
+	e = nc_add(af, len, key, h, name);
+	return e ? e->name : NULL;
+}
@@ -0,0 +1,216 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * name_resolve.c	Reverse lookups of many addresses at once.
+ *
+ * Addresses that are not in the name cache are handed to a pool of
+ * threads doing blocking getnameinfo() calls, so that a batch costs
+ * about the slowest lookup rather than the sum of them.  The batch is
+ * given up once no lookup has completed for NAME_RESOLVE_TIMEOUT ms,
+ * as happens without a reachable server: lookups still running are
+ * left behind and their addresses cached as unresolved for a short
+ * while, so that the next runs do not wait for them again.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "name_cache.h"
+
+#define NAME_RESOLVE_THREADS	32
+#define NAME_RESOLVE_TIMEOUT	2000
+#define NAME_RESOLVE_LATE_TTL	60
+
+enum {
+	NR_QUEUED,
+	NR_RUNNING,
+	NR_DONE,
+};
+
+struct nr_job {
+	struct name_query	q;
+	char			*name;
+	int			state;
+};
+
+/* Shared with the threads, freed by whoever drops the last reference */
+struct nr_batch {
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+	unsigned int	refs;
+	unsigned int	count;
+	unsigned int	next;
+	unsigned int	done;
+	int		abandoned;
+	struct nr_job	job[];
+};
+
+static void nr_put(struct nr_batch *b)
+{
+	unsigned int i;
+	int last;
+
+	last = --b->refs == 0;
+	pthread_mutex_unlock(&b->lock);
+	if (!last)
+		return;
+
+	for (i = 0; i < b->count; i++)
+		free(b->job[i].name);
+	pthread_cond_destroy(&b->cond);
+	pthread_mutex_destroy(&b->lock);
+	free(b);
+}
+
+static char *nr_lookup(const struct name_query *q)
+{
+	char host[NI_MAXHOST];
+	union {
+		struct sockaddr		sa;
+		struct sockaddr_in	sin;
+		struct sockaddr_in6	sin6;
+	} u = {};
+	socklen_t len;
+
+	if (q->af == AF_INET) {
+		u.sin.sin_family = AF_INET;
+		memcpy(&u.sin.sin_addr, q->addr, 4);
+		len = sizeof(u.sin);
+	} else {
+		u.sin6.sin6_family = AF_INET6;
+		memcpy(&u.sin6.sin6_addr, q->addr, 16);
+		len = sizeof(u.sin6);
+	}
+
+	if (getnameinfo(&u.sa, len, host, sizeof(host), NULL, 0,
+			NI_NAMEREQD))
+		return NULL;
+	return strdup(host);
+}
+
+static void *nr_worker(void *arg)
+{
+	struct nr_batch *b = arg;
+
+	pthread_mutex_lock(&b->lock);
+	while (!b->abandoned && b->next < b->count) {
+		struct nr_job *j = &b->job[b->next++];
+		char *name;
+
+		j->state = NR_RUNNING;
+		pthread_mutex_unlock(&b->lock);
+
+		name = nr_lookup(&j->q);
+
+		pthread_mutex_lock(&b->lock);
+		j->name = name;
+		j->state = NR_DONE;
+		b->done++;
+		pthread_cond_signal(&b->cond);
+	}
+	nr_put(b);
+	return NULL;
+}
+
+static void nr_deadline(struct timespec *ts)
+{
+	clock_gettime(CLOCK_REALTIME, ts);
+	ts->tv_sec += NAME_RESOLVE_TIMEOUT / 1000;
+	ts->tv_nsec += NAME_RESOLVE_TIMEOUT % 1000 * 1000000;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+/* Wait until all lookups are done or none completes for a while */
+static void nr_wait(struct nr_batch *b)
+{
+	unsigned int done = b->done;
+	struct timespec deadline;
+
+	nr_deadline(&deadline);
+	while (b->done < b->count) {
+		if (b->done != done) {
+			done = b->done;
+			nr_deadline(&deadline);
+		}
+		if (pthread_cond_timedwait(&b->cond, &b->lock,
+					   &deadline) == ETIMEDOUT &&
+		    b->done == done)
+			return;
+	}
+}
+
+/*
+ * Look up the names of the @n addresses at @q that are not cached yet,
+ * in parallel, and cache them for format_host() to find.
+ */
+void name_cache_resolve(const struct name_query *q, unsigned int n)
+{
+	pthread_attr_t attr;
+	struct nr_batch *b;
+	unsigned int i, nthreads;
+	bool found;
+
+	b = calloc(1, sizeof(*b) + n * sizeof(b->job[0]));
+	if (!b)
+		return;
+
+	for (i = 0; i < n; i++) {
+		name_cache_get(q[i].af, q[i].len, q[i].addr, &found);
+		if (!found)
+			b->job[b->count++].q = q[i];
+	}
+	if (!b->count) {
+		free(b);
+		return;
+	}
+
+	pthread_mutex_init(&b->lock, NULL);
+	pthread_cond_init(&b->cond, NULL);
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	nthreads = b->count < NAME_RESOLVE_THREADS ? b->count :
+						     NAME_RESOLVE_THREADS;
+	pthread_mutex_lock(&b->lock);
+	b->refs = 1;
+	for (i = 0; i < nthreads; i++) {
+		pthread_t tid;
+
+		if (pthread_create(&tid, &attr, nr_worker, b))
+			break;
+		b->refs++;
+	}
+	pthread_attr_destroy(&attr);
+
+	if (b->refs == 1) {
+		/* no threads, look up here */
+		b->refs++;
+		pthread_mutex_unlock(&b->lock);
+		nr_worker(b);
+		pthread_mutex_lock(&b->lock);
+	}
+	nr_wait(b);
+
+	for (i = 0; i < b->count; i++) {
+		const struct nr_job *j = &b->job[i];
+
+		if (j->state == NR_DONE)
+			name_cache_set(j->q.af, j->q.len, j->q.addr, j->name,
+				       j->name ? NAME_CACHE_TTL :
+						 NAME_CACHE_NEG_TTL);
+		else if (j->state == NR_RUNNING)
+			name_cache_set(j->q.af, j->q.len, j->q.addr, NULL,
+				       NAME_RESOLVE_LATE_TTL);
+	}
+
+	b->abandoned = 1;
+	nr_put(b);
+}
@@ -12,6 +12,7 @@
 #include "utils.h"
 #include "namespace.h"
 #include "libnetlink.h"
+#include "ll_map.h"
 
 static void bind_etc(const char *name)
 {
@@ -66,6 +67,7 @@ int netns_switch(char *name)
 		return -1;
 	}
 	close(netns);
+	ll_reset_map();
 
 	if (unshare(CLONE_NEWNS) < 0) {
 		fprintf(stderr, "unshare failed: %s\n", strerror(errno));
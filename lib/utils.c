@@ -35,6 +35,7 @@
 #include "utils.h"
 #include "ll_map.h"
 #include "namespace.h"
+#include "name_cache.h"
 
 int resolve_hosts;
 int timestamp_short;
@@ -1061,22 +1062,12 @@ const char *family_name(int family)
 }
 
 #ifdef RESOLVE_HOSTNAMES
-struct namerec {
-	struct namerec *next;
-	const char *name;
-	inet_prefix addr;
-};
-
-#define NHASH 257
-static struct namerec *nht[NHASH];
-
 static const char *resolve_address(const void *addr, int len, int af)
 {
-	struct namerec *n;
 	struct hostent *h_ent;
-	unsigned int hash;
 	static int notfirst;
-
+	const char *name;
+	bool found;
 
 	if (af == AF_INET6 && ((__u32 *)addr)[0] == 0 &&
 	    ((__u32 *)addr)[1] == 0 && ((__u32 *)addr)[2] == htonl(0xffff)) {
@@ -1085,33 +1076,20 @@ static const char *resolve_address(const void *addr, int len, int af)
 		len = 4;
 	}
 
-	hash = *(__u32 *)(addr + len - 4) % NHASH;
+	name = name_cache_get(af, len, addr, &found);
+	if (found)
+		return name;
 
-	for (n = nht[hash]; n; n = n->next) {
-		if (n->addr.family == af &&
-		    n->addr.bytelen == len &&
-		    memcmp(n->addr.data, addr, len) == 0)
-			return n->name;
-	}
-	n = malloc(sizeof(*n));
-	if (n == NULL)
-		return NULL;
-	n->addr.family = af;
-	n->addr.bytelen = len;
-	n->name = NULL;
-	memcpy(n->addr.data, addr, len);
-	n->next = nht[hash];
-	nht[hash] = n;
 	if (++notfirst == 1)
 		sethostent(1);
 	fflush(stdout);
 
+	/* Even if we fail, "negative" entry is remembered. */
 	h_ent = gethostbyaddr(addr, len, af);
 	if (h_ent != NULL)
-		n->name = strdup(h_ent->h_name);
-
-	/* Even if we fail, "negative" entry is remembered. */
-	return n->name;
+		return name_cache_set(af, len, addr, h_ent->h_name,
+				      NAME_CACHE_TTL);
+	return name_cache_set(af, len, addr, NULL, NAME_CACHE_NEG_TTL);
 }
 #endif
 
@@ -1317,7 +1295,7 @@ unsigned int print_name_and_link(const char *fmt,
 int cmdlineno;
 
 /* Like glibc getline but handle continuation lines and comments */
-static ssize_t getcmdline(char **linep, size_t *lenp, FILE *in)
+ssize_t getcmdline(char **linep, size_t *lenp, FILE *in)
 {
 	ssize_t cc;
 	char *cp;
@@ -1364,7 +1342,7 @@ static ssize_t getcmdline(char **linep, size_t *lenp, FILE *in)
 }
 
 /* split command line into argument vector */
-static int makeargs(char *line, char *argv[], int maxargs)
+int makeargs(char *line, char *argv[], int maxargs)
 {
 	static const char ws[] = " \t\r\n";
 	char *cp = line;
@@ -1707,8 +1685,9 @@ char *sprint_time64(__s64 time, char *buf)
 	return buf;
 }
 
-int do_batch(const char *name, bool force,
-	     int (*cmd)(int argc, char *argv[], void *data), void *data)
+static int __do_batch(const char *name, bool force,
+		      int (*cmd)(int argc, char *argv[], void *data),
+		      void *data, struct rtnl_handle *rth)
 {
 	char *line = NULL;
 	size_t len = 0;
@@ -1739,13 +1718,50 @@ int do_batch(const char *name, bool force,
 			if (!force)
 				break;
 		}
+
+		/* failures of earlier, pipelined commands */
+		if (rth && rtnl_pipeline_errors(rth)) {
+			ret = EXIT_FAILURE;
+			if (!force)
+				break;
+		}
 	}
 
+	if (rth && rtnl_pipeline_flush(rth))
+		ret = EXIT_FAILURE;
+
 	free(line);
 
 	return ret;
 }
 
+int do_batch(const char *name, bool force,
+	     int (*cmd)(int argc, char *argv[], void *data), void *data)
+{
+	return __do_batch(name, force, cmd, data, NULL);
+}
+
+/* Like do_batch(), but commands do not wait for the kernel to ACK their
+ * requests on @rth, up to @window of them may be outstanding. Without
+ * force, commands following a failed one may already have been applied
+ * by the time the failure is noticed.
+ */
+int do_batch_pipelined(const char *name, bool force,
+		       int (*cmd)(int argc, char *argv[], void *data),
+		       void *data, struct rtnl_handle *rth,
+		       unsigned int window)
+{
+	int ret;
+
+	if (rtnl_pipeline_start(rth, window, name ? : "-") < 0)
+		return EXIT_FAILURE;
+
+	ret = __do_batch(name, force, cmd, data, rth);
+
+	rtnl_pipeline_stop(rth);
+	return ret;
+}
+
 static int
 __parse_one_of(const char *msg, const char *realval,
 	       const char * const *list, size_t len, int *p_err,
@@ -233,7 +233,7 @@ static void load_info(void)
 		exit(1);
 
 	if (is_extended) {
-		ll_init_map(&rth);
+		ll_init_map();
 		filter_mask = IFLA_STATS_FILTER_BIT(filter_type);
 		if (rtnl_statsdump_req_filter(&rth, AF_UNSPEC,
 					      filter_mask, NULL, NULL) < 0) {
@@ -25,6 +25,7 @@
 #include <limits.h>
 #include <stdarg.h>
 #include <ctype.h>
+#include <pthread.h>
 
 #include "ss_util.h"
 #include "utils.h"
@@ -34,6 +35,7 @@
 #include "version.h"
 #include "rt_names.h"
 #include "cg_map.h"
+#include "name_cache.h"
 #include "selinux.h"
 
 #include <linux/tcp.h>
@@ -91,6 +93,7 @@
 
 #define BUF_CHUNK (1024 * 1024)	/* Buffer chunk allocation size */
 #define BUF_CHUNKS_MAX 5	/* Maximum number of allocated buffer chunks */
+#define STREAM_LINES 64		/* Default lines per render with --stream */
 #define LEN_ALIGN(x) (((x) + 1) & ~1)
 
 int preferred_family = AF_UNSPEC;
@@ -111,9 +114,15 @@ static int show_tipcinfo;
 static int show_tos;
 static int show_cgroup;
 static int show_inet_sockopt;
+static int stream_lines;
+static const char *netns_name;
 int oneline;
 
+static const char *ss_index_to_name(unsigned int ifindex);
+static bool netns_many(void);
+
 enum col_id {
+	COL_NETNS,
 	COL_NETID,
 	COL_STATE,
 	COL_RECVQ,
@@ -143,7 +152,8 @@ struct column {
 };
 
 static struct column columns[] = {
-	{ ALIGN_LEFT,	"Netid",		"",	0, 0, 0 },
+	{ ALIGN_LEFT,	"Netns",		"",	0, 0, 0 },
+	{ ALIGN_LEFT,	"Netid",		" ",	0, 0, 0 },
 	{ ALIGN_LEFT,	"State",		" ",	0, 0, 0 },
 	{ ALIGN_LEFT,	"Recv-Q",		" ",	0, 0, 0 },
 	{ ALIGN_LEFT,	"Send-Q",		" ",	0, 0, 0 },
@@ -179,9 +189,21 @@ static struct {
 	struct buf_token *cur;	/* Position of current token in chunk */
 	struct buf_chunk *head;	/* First chunk */
 	struct buf_chunk *tail;	/* Current chunk */
+	struct buf_chunk *spare;	/* Chunk kept across renders */
 	int chunks;		/* Number of allocated chunks */
+	int lines;		/* Number of complete lines */
 } buffer;
 
+/* Render when the buffer is full or, streaming, every stream_lines lines.
+ * Widths measured so far are kept, so columns only grow from one render
+ * to the next.
+ */
+static bool buf_full(void)
+{
+	return buffer.chunks >= BUF_CHUNKS_MAX ||
+	       (stream_lines && buffer.lines >= stream_lines);
+}
+
 static const char *TCP_PROTO = "tcp";
 static const char *UDP_PROTO = "udp";
 #ifdef HAVE_RPC
@@ -509,7 +531,7 @@ struct user_ent {
 	char		*socket_ctx;
 };
 
-#define USER_ENT_HASH_SIZE	256
+#define USER_ENT_HASH_SIZE	4096
 static struct user_ent *user_ent_hash[USER_ENT_HASH_SIZE];
 
 static int user_ent_hashfn(unsigned int ino)
@@ -519,6 +541,8 @@ static int user_ent_hashfn(unsigned int ino)
 	return val & (USER_ENT_HASH_SIZE - 1);
 }
 
+static pthread_mutex_t user_ent_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static void user_ent_add(unsigned int ino, char *task,
 					int pid, int tid, int fd,
 					char *task_ctx,
@@ -540,9 +564,90 @@ static void user_ent_add(unsigned int ino, char *task,
 	p->task_ctx = strdup(task_ctx);
 	p->socket_ctx = strdup(sock_ctx);
 
+	pthread_mutex_lock(&user_ent_lock);
 	pp = &user_ent_hash[user_ent_hashfn(ino)];
 	p->next = *pp;
 	*pp = p;
+	pthread_mutex_unlock(&user_ent_lock);
+}
+
+/* Inodes of the sockets printed so far. Their owners are only looked up
+ * when the output is rendered, so that /proc is scanned for the sockets
+ * that passed the filter rather than for all of them.
+ */
+static struct {
+	unsigned int	*ino;	/* open addressing, 0 marks a free slot */
+	char		**str;	/* formatted owners, once resolved */
+	unsigned int	size;
+	unsigned int	count;
+	bool		all;	/* take every socket found */
+} user_ent_want = { .all = true };
+
+static bool user_ent_defer;	/* print placeholders, resolve in render() */
+static int proc_threads;
+
+static unsigned int user_ent_want_slot(unsigned int ino)
+{
+	unsigned int i = (ino * 2654435761U) & (user_ent_want.size - 1);
+
+	while (user_ent_want.ino[i] && user_ent_want.ino[i] != ino)
+		i = (i + 1) & (user_ent_want.size - 1);
+	return i;
+}
+
+static void user_ent_want_add(unsigned int ino)
+{
+	unsigned int i;
+
+	if (2 * (user_ent_want.count + 1) > user_ent_want.size) {
+		unsigned int *old = user_ent_want.ino;
+		char **old_str = user_ent_want.str;
+		unsigned int j, n = user_ent_want.size;
+
+		user_ent_want.size = n ? 2 * n : 1024;
+		user_ent_want.ino = calloc(user_ent_want.size,
+					   sizeof(*user_ent_want.ino));
+		user_ent_want.str = calloc(user_ent_want.size,
+					   sizeof(*user_ent_want.str));
+		if (!user_ent_want.ino || !user_ent_want.str) {
+			fprintf(stderr, "ss: failed to malloc buffer\n");
+			abort();
+		}
+		for (i = 0; i < n; i++) {
+			if (!old[i])
+				continue;
+			j = user_ent_want_slot(old[i]);
+			user_ent_want.ino[j] = old[i];
+			user_ent_want.str[j] = old_str[i];
+		}
+		free(old);
+		free(old_str);
+	}
+
+	i = user_ent_want_slot(ino);
+	if (!user_ent_want.ino[i]) {
+		user_ent_want.ino[i] = ino;
+		user_ent_want.count++;
+	}
+}
+
+static bool user_ent_wanted(unsigned int ino)
+{
+	if (user_ent_want.all)
+		return true;
+	return user_ent_want.ino[user_ent_want_slot(ino)] == ino;
+}
+
+static void user_ent_want_clear(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < user_ent_want.size; i++) {
+		free(user_ent_want.str[i]);
+		user_ent_want.str[i] = NULL;
+		user_ent_want.ino[i] = 0;
+	}
+	user_ent_want.count = 0;
 }
 
 #define MAX_PATH_LEN	1024
@@ -552,22 +657,17 @@ static void user_ent_hash_build_task(char *path, int pid, int tid)
 	const char *no_ctx = "unavailable";
 	char task[16] = {'\0', };
 	char stat[MAX_PATH_LEN];
+	char *task_context = NULL;
 	int pos_id, pos_fd;
-	char *task_context;
 	struct dirent *d;
 	DIR *dir;
 
-	if (getpidcon(tid, &task_context) != 0)
-		task_context = strdup(no_ctx);
-
 	pos_id = strlen(path);	/* $PROC_ROOT/$ID/ */
 
 	snprintf(path + pos_id, MAX_PATH_LEN - pos_id, "fd/");
 	dir = opendir(path);
-	if (!dir) {
-		freecon(task_context);
+	if (!dir)
 		return;
-	}
 
 	pos_fd = strlen(path);	/* $PROC_ROOT/$ID/fd/ */
 
@@ -595,9 +695,15 @@ static void user_ent_hash_build_task(char *path, int pid, int tid)
 		if (sscanf(lnk, "socket:[%u]", &ino) != 1)
 			continue;
 
+		if (!user_ent_wanted(ino))
+			continue;
+
 		if (getfilecon(path, &sock_context) <= 0)
 			sock_context = strdup(no_ctx);
 
+		if (!task_context && getpidcon(tid, &task_context) != 0)
+			task_context = strdup(no_ctx);
+
 		if (task[0] == '\0') {
 			FILE *fp;
 
@@ -617,7 +723,8 @@ static void user_ent_hash_build_task(char *path, int pid, int tid)
 		freecon(sock_context);
 	}
 
-	freecon(task_context);
+	if (task_context)
+		freecon(task_context);
 	closedir(dir);
 }
 
@@ -636,35 +743,30 @@ static void user_ent_destroy(void)
 			free(p);
 			p = p_next;
 		}
+		user_ent_hash[cnt] = NULL;
 		cnt++;
 	}
 }
 
-static void user_ent_hash_build(void)
+/* Processes found in /proc, shared out between the scanning threads */
+static struct {
+	const char	*root;
+	int		*pid;
+	unsigned int	count;
+	unsigned int	next;
+} user_ent_pids;
+
+static void *user_ent_scan(void *arg)
 {
-	const char *root = getenv("PROC_ROOT") ? : "/proc/";
 	char name[MAX_PATH_LEN];
-	struct dirent *d;
-	int nameoff;
-	DIR *dir;
-
-	strlcpy(name, root, sizeof(name));
-
-	if (strlen(name) == 0 || name[strlen(name) - 1] != '/')
-		strcat(name, "/");
-
-	nameoff = strlen(name);
-
-	dir = opendir(name);
-	if (!dir)
-		return;
-
-	while ((d = readdir(dir)) != NULL) {
-		int pid;
+	unsigned int i;
 
-		if (sscanf(d->d_name, "%d%*c", &pid) != 1)
-			continue;
+	while ((i = __atomic_fetch_add(&user_ent_pids.next, 1,
+				       __ATOMIC_RELAXED)) < user_ent_pids.count) {
+		int pid = user_ent_pids.pid[i];
+		int nameoff;
 
+		nameoff = snprintf(name, sizeof(name), "%s", user_ent_pids.root);
 		snprintf(name + nameoff, sizeof(name) - nameoff, "%d/", pid);
 		user_ent_hash_build_task(name, pid, pid);
 
@@ -692,7 +794,68 @@ static void user_ent_hash_build(void)
 			closedir(task_dir);
 		}
 	}
+	return NULL;
+}
+
+static void user_ent_hash_build(void)
+{
+	const char *root = getenv("PROC_ROOT") ? : "/proc/";
+	char name[MAX_PATH_LEN];
+	unsigned int size = 0;
+	pthread_t *threads;
+	struct dirent *d;
+	int i, nthreads;
+	DIR *dir;
+
+	strlcpy(name, root, sizeof(name));
+
+	if (strlen(name) == 0 || name[strlen(name) - 1] != '/')
+		strcat(name, "/");
+
+	dir = opendir(name);
+	if (!dir)
+		return;
+
+	user_ent_pids.root = name;
+	user_ent_pids.count = user_ent_pids.next = 0;
+	while ((d = readdir(dir)) != NULL) {
+		int pid;
+
+		if (sscanf(d->d_name, "%d%*c", &pid) != 1)
+			continue;
+
+		if (user_ent_pids.count == size) {
+			int *pids;
+
+			size = size ? 2 * size : 1024;
+			pids = realloc(user_ent_pids.pid, size * sizeof(*pids));
+			if (!pids) {
+				fprintf(stderr, "ss: failed to malloc buffer\n");
+				abort();
+			}
+			user_ent_pids.pid = pids;
+		}
+		user_ent_pids.pid[user_ent_pids.count++] = pid;
+	}
 	closedir(dir);
+
+	nthreads = proc_threads;
+	if (nthreads <= 0)
+		nthreads = min(sysconf(_SC_NPROCESSORS_ONLN), 8L);
+	nthreads = min(nthreads, (int)user_ent_pids.count / 64 + 1);
+
+	threads = calloc(nthreads, sizeof(*threads));
+	for (i = 1; threads && i < nthreads; i++) {
+		if (pthread_create(&threads[i], NULL, user_ent_scan, NULL))
+			break;
+	}
+	user_ent_scan(NULL);
+	while (threads && --i > 0)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+	free(user_ent_pids.pid);
+	user_ent_pids.pid = NULL;
 }
 
 enum entry_types {
@@ -778,6 +941,65 @@ next:
 	return cnt;
 }
 
+/* Owners of socket @ino as printed in the process column */
+static int proc_ctx_format(unsigned int ino, char **buf)
+{
+	int type = USERS;
+
+	if (show_proc_ctx || show_sock_ctx)
+		type = (show_proc_ctx & show_sock_ctx) ?
+			PROC_SOCK_CTX : PROC_CTX;
+
+	if (find_entry(ino, buf, type) <= 0)
+		return 0;
+	return strlen(*buf) + strlen(" users:()");
+}
+
+/* Look up and format the owners of the sockets printed since the last
+ * render, and widen the process column for them.  If the buffer is full,
+ * more sockets follow: take the owners of all sockets in one scan.
+ */
+static void user_ent_resolve(void)
+{
+	unsigned int i;
+	int len;
+
+	if (!user_ent_defer || !user_ent_want.count)
+		return;
+
+	if (buf_full()) {
+		user_ent_want.all = true;
+		user_ent_defer = false;
+	} else {
+		user_ent_want.all = false;
+	}
+	user_ent_destroy();
+	user_ent_hash_build();
+
+	for (i = 0; i < user_ent_want.size; i++) {
+		if (!user_ent_want.ino[i])
+			continue;
+		len = proc_ctx_format(user_ent_want.ino[i],
+				      &user_ent_want.str[i]);
+		if (len > columns[COL_PROC].max_len)
+			columns[COL_PROC].max_len = len;
+	}
+}
+
+/* Print the owners of the socket whose inode @token stands for */
+static int user_ent_render(const struct buf_token *token)
+{
+	char ino[16] = "";
+	unsigned int i;
+
+	memcpy(ino, token->data + 1, min(token->len - 1, (int)sizeof(ino) - 1));
+	i = user_ent_want_slot(strtoul(ino, NULL, 10));
+	if (!user_ent_want.str[i])
+		return 0;
+
+	return printf(" users:(%s)", user_ent_want.str[i]);
+}
+
 static unsigned long long cookie_sk_get(const uint32_t *cookie)
 {
 	return (((unsigned long long)cookie[1] << 31) << 1) | cookie[0];
@@ -975,11 +1197,13 @@ static const char *tipc_netid_name(int type)
 /* Allocate and initialize a new buffer chunk */
 static struct buf_chunk *buf_chunk_new(void)
 {
-	struct buf_chunk *new = malloc(BUF_CHUNK);
+	struct buf_chunk *new = buffer.spare ? : malloc(BUF_CHUNK);
 
 	if (!new)
 		abort();
 
+	buffer.spare = NULL;
+
 	new->next = NULL;
 
 	/* This is also the last block */
@@ -1124,7 +1348,9 @@ static void field_flush(struct column *f)
 	chunk = buffer.tail;
 	pad = buffer.cur->len % 2;
 
-	if (buffer.cur->len > f->max_len)
+	/* Host name placeholders are measured once resolved */
+	if (buffer.cur->len > f->max_len &&
+	    !(buffer.cur->len && buffer.cur->data[0] == '\002'))
 		f->max_len = buffer.cur->len;
 
 	/* We need a new chunk if we can't store the next length descriptor.
@@ -1170,10 +1396,14 @@ static void buf_free_all(void)
 	for (buffer.tail = buffer.head; buffer.tail; ) {
 		tmp = buffer.tail;
 		buffer.tail = buffer.tail->next;
-		free(tmp);
+		if (!buffer.spare)
+			buffer.spare = tmp;
+		else
+			free(tmp);
 	}
 	buffer.head = NULL;
 	buffer.chunks = 0;
+	buffer.lines = 0;
 }
 
 /* Get current screen width. Returns -1 if TIOCGWINSZ fails and there's
@@ -1306,6 +1536,188 @@ newline:
 	}
 }
 
+/* Addresses printed since the last render while resolving host names, as
+ * "\002<index>" placeholders: they are looked up in parallel when the
+ * output is rendered, rather than one by one as sockets are printed.
+ */
+struct host_ent {
+	struct name_query	addr;
+	char			*str;		/* as printed, once resolved */
+	int			suffix[2];	/* longest text after it, local
+						 * and peer column, or -1
+						 */
+};
+
+static struct {
+	struct host_ent	*ent;
+	unsigned int	*slot;	/* open addressing, entry index + 1 */
+	unsigned int	size;
+	unsigned int	count;
+} host_want;
+
+static bool host_defer;
+
+static unsigned int host_want_slot(const struct name_query *q)
+{
+	unsigned int i, h = 2166136261U;
+
+	for (i = 0; i < q->len; i++)
+		h = (h ^ q->addr[i]) * 16777619U;
+
+	for (i = h & (host_want.size - 1); host_want.slot[i];
+	     i = (i + 1) & (host_want.size - 1)) {
+		const struct name_query *e = &host_want.ent[host_want.slot[i] - 1].addr;
+
+		if (e->af == q->af && !memcmp(e->addr, q->addr, q->len))
+			break;
+	}
+	return i;
+}
+
+/* Queue the address @data is, printed with @suffix_len more characters in
+ * the current column, and return its index.
+ */
+static unsigned int host_want_add(int af, const void *data, int suffix_len)
+{
+	struct name_query q = { .af = af, .len = af == AF_INET ? 4 : 16 };
+	struct host_ent *e;
+	unsigned int i;
+	int col;
+
+	memcpy(q.addr, data, q.len);
+
+	if (2 * (host_want.count + 1) > host_want.size) {
+		unsigned int n = host_want.size ? 2 * host_want.size : 1024;
+
+		free(host_want.slot);
+		host_want.ent = realloc(host_want.ent,
+					n / 2 * sizeof(*host_want.ent));
+		host_want.slot = calloc(n, sizeof(*host_want.slot));
+		if (!host_want.ent || !host_want.slot) {
+			fprintf(stderr, "ss: failed to malloc buffer\n");
+			abort();
+		}
+		host_want.size = n;
+		for (i = 0; i < host_want.count; i++)
+			host_want.slot[host_want_slot(&host_want.ent[i].addr)] = i + 1;
+	}
+
+	i = host_want_slot(&q);
+	if (!host_want.slot[i]) {
+		e = &host_want.ent[host_want.count];
+		e->addr = q;
+		e->str = NULL;
+		e->suffix[0] = e->suffix[1] = -1;
+		host_want.slot[i] = ++host_want.count;
+	}
+
+	e = &host_want.ent[host_want.slot[i] - 1];
+	col = current_field == &columns[COL_RADDR];
+	if (suffix_len > e->suffix[col])
+		e->suffix[col] = suffix_len;
+	return host_want.slot[i] - 1;
+}
+
+/* Look up the names of the queued addresses at once, format them and widen
+ * the address columns for them.  Addresses whose lookup did not finish in
+ * time are printed as numbers.
+ */
+static void host_want_resolve(void)
+{
+	struct name_query *q;
+	unsigned int i;
+	int col, len;
+
+	if (!host_want.count)
+		return;
+
+	q = malloc(host_want.count * sizeof(*q));
+	if (!q) {
+		fprintf(stderr, "ss: failed to malloc buffer\n");
+		abort();
+	}
+	for (i = 0; i < host_want.count; i++) {
+		q[i] = host_want.ent[i].addr;
+
+		/* as format_host() looks v4-mapped addresses up */
+		if (q[i].af == AF_INET6 &&
+		    IN6_IS_ADDR_V4MAPPED((struct in6_addr *)q[i].addr)) {
+			q[i].af = AF_INET;
+			q[i].len = 4;
+			memmove(q[i].addr, q[i].addr + 12, 4);
+		}
+	}
+	name_cache_resolve(q, host_want.count);
+
+	for (i = 0; i < host_want.count; i++) {
+		struct host_ent *e = &host_want.ent[i];
+		char buf[INET6_ADDRSTRLEN];
+		const char *ap;
+		bool found;
+
+		ap = name_cache_get(q[i].af, q[i].len, q[i].addr, &found);
+		if (!ap)
+			ap = rt_addr_n2a_r(e->addr.af, e->addr.len, e->addr.addr,
+					   buf, sizeof(buf));
+
+		/* Numeric IPv6 addresses should be bracketed */
+		if (e->addr.af == AF_INET6 && strchr(ap, ':')) {
+			if (asprintf(&e->str, "[%s]", ap) < 0)
+				e->str = NULL;
+		} else {
+			e->str = strdup(ap);
+		}
+		if (!e->str)
+			continue;
+
+		for (col = 0; col < 2; col++) {
+			struct column *c = &columns[col ? COL_RADDR : COL_ADDR];
+
+			if (e->suffix[col] < 0)
+				continue;
+			len = strlen(e->str) + e->suffix[col];
+			if (len > c->max_len)
+				c->max_len = len;
+		}
+	}
+	free(q);
+}
+
+/* Print the name of the address @token stands for, and what follows it */
+static int host_want_render(struct column *f, const struct buf_token *token,
+			    int printed)
+{
+	const char *str = "", *rest;
+	char idx[16] = "";
+	unsigned int i;
+	int len;
+
+	for (rest = token->data + 1;
+	     rest < token->data + token->len && isdigit(*rest); rest++)
+		;
+	memcpy(idx, token->data + 1,
+	       min(rest - token->data - 1, (long)sizeof(idx) - 1));
+	i = strtoul(idx, NULL, 10);
+	if (i < host_want.count && host_want.ent[i].str)
+		str = host_want.ent[i].str;
+
+	len = token->data + token->len - rest;
+	printed = print_left_spacing(f, strlen(str) + len, printed);
+	return printed + printf("%s%.*s", str, len, rest);
+}
+
+static void host_want_clear(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < host_want.count; i++)
+		free(host_want.ent[i].str);
+	if (host_want.count)
+		memset(host_want.slot, 0,
+		       host_want.size * sizeof(*host_want.slot));
+	host_want.count = 0;
+}
+
 /* Render buffered output with spacing and delimiters, then free up buffers */
 static void render(void)
 {
@@ -1321,6 +1733,8 @@ static void render(void)
 	/* Ensure end alignment of last token, it wasn't necessarily flushed */
 	buffer.tail->end += buffer.cur->len % 2;
 
+	user_ent_resolve();
+	host_want_resolve();
 	render_calc_width();
 
 	/* Rewind and replay */
@@ -1338,8 +1752,17 @@ static void render(void)
 			printed = 0;
 
 		/* Print field content from token data with spacing */
-		printed += print_left_spacing(f, token->len, printed);
-		printed += fwrite(token->data, 1, token->len, stdout);
+		if (token->len > 1 && token->data[0] == '\002') {
+			printed += host_want_render(f, token, printed);
+		} else {
+			printed += print_left_spacing(f, token->len, printed);
+			if (f - columns == COL_PROC && token->len > 1 &&
+			    token->data[0] == '\001')
+				printed += user_ent_render(token);
+			else
+				printed += fwrite(token->data, 1, token->len,
+						  stdout);
+		}
 		print_right_spacing(f, printed);
 
 		/* Go to next non-empty field, deal with end-of-line */
@@ -1361,18 +1784,26 @@ static void render(void)
 	if (line_started)
 		printf("\n");
 
+	user_ent_want_clear();
+	host_want_clear();
 	buf_free_all();
 	current_field = columns;
+
+	if (stream_lines)
+		fflush(stdout);
 }
 
-/* Move to next field, and render buffer if we reached the maximum number of
- * chunks, at the last field in a line.
+/* Move to next field, and render buffer if it's full, at the last field in
+ * a line.
  */
 static void field_next(void)
 {
-	if (field_is_last(current_field) && buffer.chunks >= BUF_CHUNKS_MAX) {
-		render();
-		return;
+	if (field_is_last(current_field)) {
+		buffer.lines++;
+		if (buf_full()) {
+			render();
+			return;
+		}
 	}
 
 	field_flush(current_field);
@@ -1399,25 +1830,26 @@ static void print_header(void)
 	}
 }
 
+static const char * const sstate_name[] = {
+	"UNKNOWN",
+	[SS_ESTABLISHED] = "ESTAB",
+	[SS_SYN_SENT] = "SYN-SENT",
+	[SS_SYN_RECV] = "SYN-RECV",
+	[SS_FIN_WAIT1] = "FIN-WAIT-1",
+	[SS_FIN_WAIT2] = "FIN-WAIT-2",
+	[SS_TIME_WAIT] = "TIME-WAIT",
+	[SS_CLOSE] = "UNCONN",
+	[SS_CLOSE_WAIT] = "CLOSE-WAIT",
+	[SS_LAST_ACK] = "LAST-ACK",
+	[SS_LISTEN] =	"LISTEN",
+	[SS_CLOSING] = "CLOSING",
+	[SS_NEW_SYN_RECV] = "UNDEF", /* Never returned by kernel */
+	[SS_BOUND_INACTIVE] = "UNDEF", /* Never returned by kernel */
+};
+
 static void sock_state_print(struct sockstat *s)
 {
 	const char *sock_name;
-	static const char * const sstate_name[] = {
-		"UNKNOWN",
-		[SS_ESTABLISHED] = "ESTAB",
-		[SS_SYN_SENT] = "SYN-SENT",
-		[SS_SYN_RECV] = "SYN-RECV",
-		[SS_FIN_WAIT1] = "FIN-WAIT-1",
-		[SS_FIN_WAIT2] = "FIN-WAIT-2",
-		[SS_TIME_WAIT] = "TIME-WAIT",
-		[SS_CLOSE] = "UNCONN",
-		[SS_CLOSE_WAIT] = "CLOSE-WAIT",
-		[SS_LAST_ACK] = "LAST-ACK",
-		[SS_LISTEN] =	"LISTEN",
-		[SS_CLOSING] = "CLOSING",
-		[SS_NEW_SYN_RECV] = "UNDEF", /* Never returned by kernel */
-		[SS_BOUND_INACTIVE] = "UNDEF", /* Never returned by kernel */
-	};
 
 	switch (s->local.family) {
 	case AF_UNIX:
@@ -1450,6 +1882,10 @@ static void sock_state_print(struct sockstat *s)
 		field_set(COL_STATE);		/* Empty Netid field */
 		out("`- %s", sctp_sstate_name[s->state]);
 	} else {
+		if (netns_name) {
+			field_set(COL_NETNS);
+			out("%s", netns_name);
+		}
 		field_set(COL_NETID);
 		out("%s", sock_name);
 		field_set(COL_STATE);
@@ -1647,14 +2083,30 @@ static const char *__resolve_service(int port)
 	if (!is_ephemeral(port)) {
 		static int notfirst;
 		struct servent *se;
+		const char *name;
+		__u8 key[16];
+		int len;
+		bool found;
+
+		/* the port in network order, then the protocol if known */
+		len = 2 + (dg_proto ? strlen(dg_proto) : 0);
+		if (len > sizeof(key))
+			len = sizeof(key);
+		*(__u16 *)key = htons(port);
+		memcpy(key + 2, dg_proto ? : "", len - 2);
+
+		name = name_cache_get(NAME_CACHE_SERVICE, len, key, &found);
+		if (found)
+			return name;
 
 		if (!notfirst) {
 			setservent(1);
 			notfirst = 1;
 		}
 		se = getservbyport(htons(port), dg_proto);
-		if (se)
-			return se->s_name;
+		return name_cache_set(NAME_CACHE_SERVICE, len, key,
+				      se ? se->s_name : NULL,
+				      NAME_CACHE_SERV_TTL);
 	}
 
 	return NULL;
@@ -1716,7 +2168,16 @@ static void inet_addr_print(const inet_prefix *a, int port,
 	const char *ap = buf;
 	const char *ifname = NULL;
 
-	if (a->family == AF_INET) {
+	if (ifindex)
+		ifname = ss_index_to_name(ifindex);
+
+	if (host_defer && (a->family == AF_INET || v6only ||
+			   memcmp(a->data, &in6addr_any, sizeof(in6addr_any)))) {
+		/* followed by "%ifname" if any, and ':' */
+		snprintf(buf, sizeof(buf), "\002%u",
+			 host_want_add(a->family, a->data,
+				       (ifname ? strlen(ifname) + 1 : 0) + 1));
+	} else if (a->family == AF_INET) {
 		ap = format_host(AF_INET, 4, a->data);
 	} else {
 		if (!v6only &&
@@ -1735,9 +2196,6 @@ static void inet_addr_print(const inet_prefix *a, int port,
 		}
 	}
 
-	if (ifindex)
-		ifname = ll_index_to_name(ifindex);
-
 	sock_addr_print(ap, ":", resolve_service(port), ifname);
 }
 
@@ -1909,6 +2367,38 @@ static void ssfilter_patch(char *a, int len, int reloc)
 		abort();
 }
 
+/* Host conditions the kernel can match: inet addresses and bare ports */
+static bool ssfilter_hostcond_offloadable(const struct aafilter *a)
+{
+	for (; a; a = a->next) {
+		if (a->addr.family != AF_UNSPEC &&
+		    a->addr.family != AF_INET &&
+		    a->addr.family != AF_INET6)
+			return false;
+	}
+	return true;
+}
+
+/* True if the bytecode for f selects exactly the sockets f selects.
+ * An AND with a branch the kernel can't evaluate is still compiled,
+ * the kernel then returns a superset that run_ssfilter() narrows down.
+ */
+static bool ssfilter_exact(const struct ssfilter *f)
+{
+	switch (f->type) {
+	case SSF_DCOND:
+	case SSF_SCOND:
+		return ssfilter_hostcond_offloadable((void *)f->pred);
+	case SSF_AND:
+	case SSF_OR:
+		return ssfilter_exact(f->pred) && ssfilter_exact(f->post);
+	case SSF_NOT:
+		return ssfilter_exact(f->pred);
+	default:
+		return true;
+	}
+}
+
 static int ssfilter_bytecompile(struct ssfilter *f, char **bytecode)
 {
 	switch (f->type) {
@@ -1927,9 +2417,12 @@ static int ssfilter_bytecompile(struct ssfilter *f, char **bytecode)
 		int  code = (f->type == SSF_DCOND ? INET_DIAG_BC_D_COND : INET_DIAG_BC_S_COND);
 		int len = 0;
 
+		if (!ssfilter_hostcond_offloadable(a))
+			return 0;
+
 		for (b = a; b; b = b->next) {
 			len += 4 + sizeof(struct inet_diag_hostcond);
-			if (a->addr.family == AF_INET6)
+			if (b->addr.family == AF_INET6)
 				len += 16;
 			else
 				len += 4;
@@ -1940,15 +2433,15 @@ static int ssfilter_bytecompile(struct ssfilter *f, char **bytecode)
 		*bytecode = ptr;
 		for (b = a; b; b = b->next) {
 			struct inet_diag_bc_op *op = (struct inet_diag_bc_op *)ptr;
-			int alen = (a->addr.family == AF_INET6 ? 16 : 4);
+			int alen = (b->addr.family == AF_INET6 ? 16 : 4);
 			int oplen = alen + 4 + sizeof(struct inet_diag_hostcond);
 			struct inet_diag_hostcond *cond = (struct inet_diag_hostcond *)(ptr+4);
 
 			*op = (struct inet_diag_bc_op){ code, oplen, oplen+4 };
-			cond->family = a->addr.family;
-			cond->port = a->port;
-			cond->prefix_len = a->addr.bitlen;
-			memcpy(cond->addr, a->addr.data, alen);
+			cond->family = b->addr.family;
+			cond->port = b->port;
+			cond->prefix_len = b->addr.bitlen;
+			memcpy(cond->addr, b->addr.data, alen);
 			ptr += oplen;
 			if (b->next) {
 				op = (struct inet_diag_bc_op *)ptr;
@@ -2002,10 +2495,23 @@ static int ssfilter_bytecompile(struct ssfilter *f, char **bytecode)
 
 		l1 = ssfilter_bytecompile(f->pred, &a1);
 		l2 = ssfilter_bytecompile(f->post, &a2);
+		/* Let the kernel check what it can, the rest is done by
+		 * run_ssfilter()
+		 */
 		if (!l1 || !l2) {
-			free(a1);
-			free(a2);
-			return 0;
+			if (!l1) {
+				free(a1);
+				a1 = a2;
+				l1 = l2;
+			} else {
+				free(a2);
+			}
+			if (!l1) {
+				free(a1);
+				return 0;
+			}
+			*bytecode = a1;
+			return l1;
 		}
 		if (!(a = malloc(l1+l2))) abort();
 		memcpy(a, a1, l1);
@@ -2040,6 +2546,9 @@ static int ssfilter_bytecompile(struct ssfilter *f, char **bytecode)
 		char *a1 = NULL, *a;
 		int l1;
 
+		/* The complement of a superset is no good */
+		if (!ssfilter_exact(f->pred))
+			return 0;
 		l1 = ssfilter_bytecompile(f->pred, &a1);
 		if (!l1) {
 			free(a1);
@@ -2054,8 +2563,20 @@ static int ssfilter_bytecompile(struct ssfilter *f, char **bytecode)
 	}
 		case SSF_DEVCOND:
 	{
-		/* bytecompile for SSF_DEVCOND not supported yet */
-		return 0;
+		struct aafilter *a = (void *)f->pred;
+		struct instr {
+			struct inet_diag_bc_op op;
+			__u32 iface;
+		};
+		int inslen = sizeof(struct instr);
+
+		if (!(*bytecode = malloc(inslen))) abort();
+		((struct instr *)*bytecode)[0] = (struct instr) {
+			{ INET_DIAG_BC_DEV_COND, inslen, inslen + 4 },
+			a->iface,
+		};
+
+		return inslen;
 	}
 		case SSF_MARKMASK:
 	{
@@ -2154,13 +2675,7 @@ static int xll_initted;
 
 static void xll_init(void)
 {
-	struct rtnl_handle rth;
-
-	if (rtnl_open(&rth, 0) < 0)
-		exit(1);
-
-	ll_init_map(&rth);
-	rtnl_close(&rth);
+	ll_init_map();
 	xll_initted = 1;
 }
 
@@ -2178,19 +2693,592 @@ static int xll_name_to_index(const char *dev)
 	return ll_name_to_index(dev);
 }
 
-void *parse_devcond(char *name)
-{
-	struct aafilter a = { .iface = 0 };
-	struct aafilter *res;
+/* Filter optimiser: an OR of port tests on one side is folded into as
+ * few ranges as possible, "sport = :80 or sport = :81 or sport = :82"
+ * becomes "sport >= :80 and sport <= :82".
+ */
+struct port_range {
+	long	lo;
+	long	hi;
+};
+
+enum {
+	PORT_NONE,
+	PORT_SRC,
+	PORT_DST,
+};
+
+static struct ssfilter *ssfilter_node(int type, void *pred, void *post)
+{
+	struct ssfilter *n = malloc(sizeof(*n));
+
+	if (!n)
+		abort();
+	n->type = type;
+	n->pred = pred;
+	n->post = post;
+	return n;
+}
+
+static void ssfilter_free(struct ssfilter *f)
+{
+	struct aafilter *a, *next;
+
+	switch (f->type) {
+	case SSF_AND:
+	case SSF_OR:
+		ssfilter_free(f->post);
+		/* fall through */
+	case SSF_NOT:
+		ssfilter_free(f->pred);
+		break;
+	default:
+		for (a = (void *)f->pred; a; a = next) {
+			next = a->next;
+			free(a);
+		}
+	}
+	free(f);
+}
+
+/* Free the OR nodes of f, not the terms they join */
+static void ssfilter_free_or(struct ssfilter *f)
+{
+	if (f->type != SSF_OR)
+		return;
+	ssfilter_free_or(f->pred);
+	ssfilter_free_or(f->post);
+	free(f);
+}
+
+static struct ssfilter *ssfilter_port_node(int type, long port)
+{
+	struct aafilter *a = calloc(1, sizeof(*a));
+
+	if (!a)
+		abort();
+	a->port = port;
+	return ssfilter_node(type, a, NULL);
+}
+
+/* Which port f tests and the range it accepts, PORT_NONE if f tests
+ * anything else
+ */
+static int ssfilter_port_range(const struct ssfilter *f, struct port_range *r)
+{
+	const struct aafilter *a = (void *)f->pred;
+	struct port_range r2;
+	int side;
+
+	switch (f->type) {
+	case SSF_SCOND:
+	case SSF_DCOND:
+		if (a->addr.family != AF_UNSPEC || a->addr.bitlen ||
+		    a->port == -1 || a->next)
+			return PORT_NONE;
+		r->lo = r->hi = a->port;
+		return f->type == SSF_SCOND ? PORT_SRC : PORT_DST;
+	case SSF_S_GE:
+	case SSF_D_GE:
+		r->lo = a->port;
+		r->hi = LONG_MAX;
+		return f->type == SSF_S_GE ? PORT_SRC : PORT_DST;
+	case SSF_S_LE:
+	case SSF_D_LE:
+		r->lo = LONG_MIN;
+		r->hi = a->port;
+		return f->type == SSF_S_LE ? PORT_SRC : PORT_DST;
+	case SSF_AND:
+		side = ssfilter_port_range(f->pred, r);
+		if (side == PORT_NONE ||
+		    ssfilter_port_range(f->post, &r2) != side)
+			return PORT_NONE;
+		if (r2.lo > r->lo)
+			r->lo = r2.lo;
+		if (r2.hi < r->hi)
+			r->hi = r2.hi;
+		return r->lo <= r->hi ? side : PORT_NONE;
+	default:
+		return PORT_NONE;
+	}
+}
+
+static struct ssfilter *ssfilter_range_node(int side, const struct port_range *r)
+{
+	bool src = side == PORT_SRC;
+
+	if (r->lo == r->hi && r->lo != -1)
+		return ssfilter_port_node(src ? SSF_SCOND : SSF_DCOND, r->lo);
+	if (r->lo == LONG_MIN)
+		return ssfilter_port_node(src ? SSF_S_LE : SSF_D_LE, r->hi);
+	if (r->hi == LONG_MAX)
+		return ssfilter_port_node(src ? SSF_S_GE : SSF_D_GE, r->lo);
+	return ssfilter_node(SSF_AND,
+			     ssfilter_port_node(src ? SSF_S_GE : SSF_D_GE, r->lo),
+			     ssfilter_port_node(src ? SSF_S_LE : SSF_D_LE, r->hi));
+}
+
+static int port_range_cmp(const void *a, const void *b)
+{
+	const struct port_range *r1 = a, *r2 = b;
+
+	return r1->lo < r2->lo ? -1 : r1->lo > r2->lo;
+}
+
+static void ssfilter_or_terms(struct ssfilter *f, struct ssfilter ***v, int *n)
+{
+	if (f->type == SSF_OR) {
+		ssfilter_or_terms(f->pred, v, n);
+		ssfilter_or_terms(f->post, v, n);
+		return;
+	}
+	*v = realloc(*v, (*n + 1) * sizeof(**v));
+	if (!*v)
+		abort();
+	(*v)[(*n)++] = f;
+}
+
+/* Sort and merge overlapping or adjacent ranges, return how many are left
+ * or 0 if they cover every port.
+ */
+static int port_ranges_merge(struct port_range *r, int n)
+{
+	int i, m = 0;
+
+	qsort(r, n, sizeof(*r), port_range_cmp);
+	for (i = 1; i < n; i++) {
+		if (r[m].hi == LONG_MAX || r[i].lo <= r[m].hi + 1) {
+			if (r[i].hi > r[m].hi)
+				r[m].hi = r[i].hi;
+		} else {
+			r[++m] = r[i];
+		}
+	}
+	m++;
+	if (m == 1 && r[0].lo == LONG_MIN && r[0].hi == LONG_MAX)
+		return 0;
+	return m;
+}
+
+static struct ssfilter *ssfilter_fold_ports(struct ssfilter *f)
+{
+	struct ssfilter **terms = NULL, **folded, *res = NULL;
+	struct port_range *r[2];
+	int n = 0, nr[2] = {}, merged[2], nfolded = 0;
+	int i, side;
+
+	ssfilter_or_terms(f, &terms, &n);
+	r[0] = malloc(n * sizeof(*r[0]));
+	r[1] = malloc(n * sizeof(*r[1]));
+	folded = malloc(n * sizeof(*folded));
+	if (!r[0] || !r[1] || !folded)
+		abort();
+
+	for (i = 0; i < n; i++) {
+		struct port_range tmp;
+
+		side = ssfilter_port_range(terms[i], &tmp);
+		if (side == PORT_NONE)
+			continue;
+		r[side - 1][nr[side - 1]++] = tmp;
+		folded[nfolded++] = terms[i];
+		terms[i] = NULL;
+	}
+
+	for (side = 0; side < 2; side++)
+		merged[side] = nr[side] ? port_ranges_merge(r[side], nr[side]) : 0;
+
+	if ((nr[0] && !merged[0]) || (nr[1] && !merged[1]) ||
+	    (merged[0] == nr[0] && merged[1] == nr[1])) {
+		/* Nothing to gain, keep the filter as it was written */
+		res = f;
+		goto out;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (terms[i])
+			res = res ? ssfilter_node(SSF_OR, res, terms[i]) : terms[i];
+	}
+	for (side = 0; side < 2; side++) {
+		for (i = 0; i < merged[side]; i++) {
+			struct ssfilter *t = ssfilter_range_node(side + 1,
+								 &r[side][i]);
+
+			res = res ? ssfilter_node(SSF_OR, res, t) : t;
+		}
+	}
+
+	/* The terms kept were moved into res, drop the rest of f */
+	ssfilter_free_or(f);
+	for (i = 0; i < nfolded; i++)
+		ssfilter_free(folded[i]);
+
+out:
+	free(folded);
+	free(terms);
+	free(r[0]);
+	free(r[1]);
+	return res;
+}
+
+static struct ssfilter *ssfilter_optimize(struct ssfilter *f)
+{
+	switch (f->type) {
+	case SSF_NOT:
+		f->pred = ssfilter_optimize(f->pred);
+		if (((struct ssfilter *)f->pred)->type == SSF_NOT) {
+			struct ssfilter *res = ((struct ssfilter *)f->pred)->pred;
+
+			free(f->pred);
+			free(f);
+			return res;
+		}
+		return f;
+	case SSF_AND:
+		f->pred = ssfilter_optimize(f->pred);
+		f->post = ssfilter_optimize(f->post);
+		return f;
+	case SSF_OR:
+		f->pred = ssfilter_optimize(f->pred);
+		f->post = ssfilter_optimize(f->post);
+		return ssfilter_fold_ports(f);
+	default:
+		return f;
+	}
+}
+
+/* Bytecode optimiser: a test failing onto a JMP goes straight to where
+ * the JMP leads, then JMPs nothing falls into or that only skip to the
+ * next instruction are dropped.
+ */
+struct bc_insn {
+	int	off;
+	int	len;
+	int	to;	/* absolute target when the test fails */
+	bool	jmp;
+	bool	live;
+};
+
+static int ssfilter_bc_ops(const char *bc, int len)
+{
+	int n = 0;
+
+	while (len > 0) {
+		const struct inet_diag_bc_op *op = (const void *)bc;
+
+		if (!op->yes)
+			break;
+		bc += op->yes;
+		len -= op->yes;
+		n++;
+	}
+	return n;
+}
+
+static int ssfilter_bc_optimize(char *bc, int len)
+{
+	struct bc_insn *ins;
+	int *at, n, i, j, pos;
+
+	n = ssfilter_bc_ops(bc, len);
+	ins = calloc(n, sizeof(*ins));
+	at = malloc((len / 4 + 1) * sizeof(*at));
+	if (!ins || !at)
+		abort();
+
+	for (i = 0, pos = 0; i < n; i++) {
+		struct inet_diag_bc_op *op = (void *)(bc + pos);
+
+		ins[i].off = pos;
+		ins[i].len = op->yes;
+		ins[i].to = op->code == INET_DIAG_BC_NOP ? -1 : pos + op->no;
+		ins[i].jmp = op->code == INET_DIAG_BC_JMP;
+		at[pos / 4] = i;
+		pos += op->yes;
+	}
+	if (pos != len)
+		goto out;
+
+	/* Jumps only go forward, so threading terminates */
+	for (i = 0; i < n; i++) {
+		while (ins[i].to >= 0 && ins[i].to < len &&
+		       ins[at[ins[i].to / 4]].jmp)
+			ins[i].to = ins[at[ins[i].to / 4]].to;
+	}
+
+	ins[0].live = true;
+	for (i = 0; i < n; i++) {
+		if (!ins[i].live)
+			continue;
+		if (!ins[i].jmp && i + 1 < n)
+			ins[i + 1].live = true;
+		if (ins[i].to >= 0 && ins[i].to < len)
+			ins[at[ins[i].to / 4]].live = true;
+	}
+
+	/* Nothing targets a JMP after threading, so a JMP to the next live
+	 * instruction can go.
+	 */
+	for (i = n - 1; i >= 0; i--) {
+		if (!ins[i].live || !ins[i].jmp)
+			continue;
+		for (j = i + 1; j < n && !ins[j].live; j++)
+			;
+		if (ins[i].to == (j < n ? ins[j].off : len))
+			ins[i].live = false;
+	}
+
+	/* Compact and relocate */
+	for (i = 0, pos = 0; i < n; i++) {
+		int off = ins[i].off;
+
+		if (!ins[i].live)
+			continue;
+		memmove(bc + pos, bc + off, ins[i].len);
+		ins[i].off = pos;
+		pos += ins[i].len;
+	}
+	for (i = 0; i < n; i++) {
+		struct inet_diag_bc_op *op = (void *)(bc + ins[i].off);
+		int to = ins[i].to;
+
+		if (!ins[i].live || to < 0)
+			continue;
+		if (to >= len)
+			to = pos + to - len;
+		else
+			to = ins[at[to / 4]].off;
+		op->no = to - ins[i].off;
+	}
+	len = pos;
+out:
+	free(ins);
+	free(at);
+	return len;
+}
+
+static int ssfilter_compile(struct ssfilter *f, char **bytecode)
+{
+	int len = ssfilter_bytecompile(f, bytecode);
+
+	return len ? ssfilter_bc_optimize(*bytecode, len) : 0;
+}
+
+/* Does any part of f end up in the bytecode? Mirrors ssfilter_bytecompile() */
+static bool ssfilter_offloaded(const struct ssfilter *f)
+{
+	switch (f->type) {
+	case SSF_DCOND:
+	case SSF_SCOND:
+		return ssfilter_hostcond_offloadable((void *)f->pred);
+	case SSF_AND:
+		return ssfilter_offloaded(f->pred) || ssfilter_offloaded(f->post);
+	case SSF_OR:
+		return ssfilter_offloaded(f->pred) && ssfilter_offloaded(f->post);
+	case SSF_NOT:
+		return ssfilter_exact(f->pred);
+	default:
+		return true;
+	}
+}
+
+static void ssfilter_print_hostcond(FILE *fp, bool src,
+				    const struct aafilter *a)
+{
+	const char *dir = src ? "src" : "dst";
+	const struct aafilter *b;
+
+	if (a->addr.family == AF_UNSPEC && !a->addr.bitlen && !a->next) {
+		if (a->port == -1)
+			fprintf(fp, "%s *", dir);
+		else
+			fprintf(fp, "%s = :%ld", src ? "sport" : "dport",
+				a->port);
+		return;
+	}
+
+	if (a->next)
+		fputc('(', fp);
+	for (b = a; b; b = b->next) {
+		char buf[INET6_ADDRSTRLEN];
+		char *pattern;
+
+		fprintf(fp, "%s%s ", b == a ? "" : " or ", dir);
+		switch (b->addr.family) {
+		case AF_INET:
+		case AF_INET6:
+			inet_ntop(b->addr.family, b->addr.data, buf, sizeof(buf));
+			fprintf(fp, "%s/%d", buf, b->addr.bitlen);
+			break;
+		case AF_UNIX:
+			memcpy(&pattern, b->addr.data, sizeof(pattern));
+			fputs(pattern ? : "*", fp);
+			break;
+		default:
+			fputc('*', fp);
+		}
+		if (b->addr.family == AF_UNIX)
+			continue;
+		if (b->port == -1)
+			fputs(":*", fp);
+		else
+			fprintf(fp, ":%ld", b->port);
+	}
+	if (a->next)
+		fputc(')', fp);
+}
+
+/* Print f in filter syntax, with kernel set only the part that is
+ * compiled into bytecode.
+ */
+static void ssfilter_print(FILE *fp, const struct ssfilter *f, bool kernel)
+{
+	const struct aafilter *a = (void *)f->pred;
+
+	switch (f->type) {
+	case SSF_AND:
+		if (kernel && !ssfilter_offloaded(f->post)) {
+			ssfilter_print(fp, f->pred, kernel);
+			break;
+		}
+		if (kernel && !ssfilter_offloaded(f->pred)) {
+			ssfilter_print(fp, f->post, kernel);
+			break;
+		}
+		/* fallthrough */
+	case SSF_OR:
+		fputc('(', fp);
+		ssfilter_print(fp, f->pred, kernel);
+		fputs(f->type == SSF_AND ? " and " : " or ", fp);
+		ssfilter_print(fp, f->post, kernel);
+		fputc(')', fp);
+		break;
+	case SSF_NOT:
+		fputs("! ", fp);
+		ssfilter_print(fp, f->pred, kernel);
+		break;
+	case SSF_S_AUTO:
+		fputs("autobound", fp);
+		break;
+	case SSF_SCOND:
+		ssfilter_print_hostcond(fp, true, a);
+		break;
+	case SSF_DCOND:
+		ssfilter_print_hostcond(fp, false, a);
+		break;
+	case SSF_S_GE:
+	case SSF_S_LE:
+	case SSF_D_GE:
+	case SSF_D_LE:
+		fprintf(fp, "%s %s :%ld",
+			f->type == SSF_S_GE || f->type == SSF_S_LE ?
+				"sport" : "dport",
+			f->type == SSF_S_GE || f->type == SSF_D_GE ? ">=" : "<=",
+			a->port);
+		break;
+	case SSF_DEVCOND:
+		fprintf(fp, "dev = %s", xll_index_to_name(a->iface));
+		break;
+	case SSF_MARKMASK:
+		fprintf(fp, "fwmark = 0x%x/0x%x", a->mark, a->mask);
+		break;
+	case SSF_CGROUPCOND:
+		fprintf(fp, "cgroup = id:%llu",
+			(unsigned long long)a->cgroup_id);
+		break;
+	}
+}
+
+/* Print the parts of f that only run_ssfilter() enforces */
+static void ssfilter_print_user(FILE *fp, const struct ssfilter *f, int *n)
+{
+	if (ssfilter_exact(f))
+		return;
+	if (f->type == SSF_AND) {
+		ssfilter_print_user(fp, f->pred, n);
+		ssfilter_print_user(fp, f->post, n);
+		return;
+	}
+	if ((*n)++)
+		fputs(" and ", fp);
+	ssfilter_print(fp, f, false);
+}
+
+static bool filter_report;
+
+static void ssfilter_report(FILE *fp, const struct ssfilter *f,
+			    int raw_len, int raw_ops)
+{
+	char *bc = NULL;
+	int len, n = 0;
+
+	fputs("Filter: ", fp);
+	ssfilter_print(fp, f, false);
+
+	fputs("\nKernel: ", fp);
+	if (ssfilter_offloaded(f))
+		ssfilter_print(fp, f, true);
+	else
+		fputs("none", fp);
+
+	fputs("\nUser space only: ", fp);
+	ssfilter_print_user(fp, f, &n);
+	if (!n)
+		fputs("none", fp);
+
+	len = ssfilter_compile((struct ssfilter *)f, &bc);
+	fprintf(fp, "\nBytecode: %d ops, %d bytes (unoptimised %d ops, %d bytes)\n",
+		ssfilter_bc_ops(bc, len), len, raw_ops, raw_len);
+	free(bc);
+}
+
+/* Optimise the parsed filter, and explain the result if asked to */
+static void ssfilter_prepare(struct filter *f)
+{
+	char *bc = NULL;
+	int len = 0, ops = 0;
+
+	if (!f->f) {
+		if (filter_report) {
+			printf("Filter: none\n");
+			exit(0);
+		}
+		return;
+	}
+
+	if (filter_report) {
+		len = ssfilter_bytecompile(f->f, &bc);
+		ops = ssfilter_bc_ops(bc, len);
+		free(bc);
+	}
+
+	f->f = ssfilter_optimize(f->f);
+
+	if (filter_report) {
+		ssfilter_report(stdout, f->f, len, ops);
+		exit(0);
+	}
+}
+
+void *parse_devcond(char *name)
+{
+	struct aafilter a = { .iface = 0 };
+	struct aafilter *res;
 
-	a.iface = xll_name_to_index(name);
+	/* names mean different devices in each namespace */
+	if (!netns_many())
+		a.iface = xll_name_to_index(name);
 	if (a.iface == 0) {
 		char *end;
 		unsigned long n;
 
 		n = strtoul(name, &end, 0);
-		if (!end || end == name || *end || n > UINT_MAX)
+		if (!end || end == name || *end || n > UINT_MAX) {
+			if (netns_many())
+				fprintf(stderr,
+					"Devices are matched by index in several namespaces\n");
 			return NULL;
+		}
 
 		a.iface = n;
 	}
@@ -2448,15 +3536,14 @@ static void proc_ctx_print(struct sockstat *s)
 {
 	char *buf;
 
-	if (show_proc_ctx || show_sock_ctx) {
-		if (find_entry(s->ino, &buf,
-				(show_proc_ctx & show_sock_ctx) ?
-				PROC_SOCK_CTX : PROC_CTX) > 0) {
-			out(" users:(%s)", buf);
-			free(buf);
-		}
-	} else if (show_processes || show_threads) {
-		if (find_entry(s->ino, &buf, USERS) > 0) {
+	if (show_proc_ctx || show_sock_ctx || show_processes || show_threads) {
+		if (user_ent_defer) {
+			/* stands in for the owners until render() */
+			if (s->ino) {
+				out("\001%u", s->ino);
+				user_ent_want_add(s->ino);
+			}
+		} else if (proc_ctx_format(s->ino, &buf)) {
 			out(" users:(%s)", buf);
 			free(buf);
 		}
@@ -2475,28 +3562,120 @@ static void inet_stats_print(struct sockstat *s, bool v6only)
 	proc_ctx_print(s);
 }
 
+/* Field tokenizer for the /proc/net tables, which are made of hex and
+ * decimal numbers. proc_scan() parses the conversions of fmt in order:
+ *   x	hex into an unsigned int
+ *   X	hex into an unsigned long long
+ *   d	decimal into an int
+ *   u	decimal into an unsigned int
+ * preceded by '*' to skip the field. Blanks before a number are skipped,
+ * any other character of fmt must match. It returns the number of fields
+ * stored, stopping at the first mismatch like sscanf(), and leaves *pp
+ * after the last field parsed.
+ */
+static const unsigned char proc_hex_digit[256] = {
+	['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+	['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+	['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+	['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+
+static int proc_scan(char **pp, const char *fmt, ...)
+{
+	const unsigned char *p = (const unsigned char *)*pp;
+	unsigned long long v;
+	int n = 0;
+	va_list ap;
+
+	va_start(ap, fmt);
+	for (; *fmt; fmt++) {
+		const unsigned char *start;
+		bool skip = false, neg = false;
+
+		if (*fmt == ' ')
+			continue;
+		if (*fmt != '*' && !strchr("xXdu", *fmt)) {
+			if (*p != *fmt)
+				break;
+			p++;
+			continue;
+		}
+		if (*fmt == '*') {
+			skip = true;
+			fmt++;
+		}
+
+		while (*p == ' ' || *p == '\t')
+			p++;
+		v = 0;
+		if (*fmt == 'x' || *fmt == 'X') {
+			for (start = p; proc_hex_digit[*p]; p++)
+				v = v << 4 | (proc_hex_digit[*p] - 1);
+		} else {
+			if (*p == '-') {
+				neg = true;
+				p++;
+			}
+			for (start = p; *p >= '0' && *p <= '9'; p++)
+				v = v * 10 + *p - '0';
+		}
+		if (p == start)
+			break;
+		if (neg)
+			v = -v;
+		if (skip)
+			continue;
+
+		switch (*fmt) {
+		case 'x':
+		case 'u':
+			*va_arg(ap, unsigned int *) = v;
+			break;
+		case 'X':
+			*va_arg(ap, unsigned long long *) = v;
+			break;
+		case 'd':
+			*va_arg(ap, int *) = v;
+			break;
+		}
+		n++;
+	}
+	va_end(ap);
+
+	*pp = (char *)p;
+	return n;
+}
+
+/* Exactly len hex digits, as in the IPv6 addresses of /proc/net */
+static __u32 proc_hex_n(char **pp, int len)
+{
+	const unsigned char *p = (const unsigned char *)*pp;
+	__u32 v = 0;
+
+	while (len-- && proc_hex_digit[*p])
+		v = v << 4 | (proc_hex_digit[*p++] - 1);
+	*pp = (char *)p;
+	return v;
+}
+
 static int proc_parse_inet_addr(char *loc, char *rem, int family, struct
 		sockstat * s)
 {
+	int i;
+
 	s->local.family = s->remote.family = family;
 	if (family == AF_INET) {
-		sscanf(loc, "%x:%x", s->local.data, (unsigned *)&s->lport);
-		sscanf(rem, "%x:%x", s->remote.data, (unsigned *)&s->rport);
+		proc_scan(&loc, "x:x", s->local.data, (unsigned *)&s->lport);
+		proc_scan(&rem, "x:x", s->remote.data, (unsigned *)&s->rport);
 		s->local.bytelen = s->remote.bytelen = 4;
 		return 0;
 	} else {
-		sscanf(loc, "%08x%08x%08x%08x:%x",
-		       s->local.data,
-		       s->local.data + 1,
-		       s->local.data + 2,
-		       s->local.data + 3,
-		       &s->lport);
-		sscanf(rem, "%08x%08x%08x%08x:%x",
-		       s->remote.data,
-		       s->remote.data + 1,
-		       s->remote.data + 2,
-		       s->remote.data + 3,
-		       &s->rport);
+		for (i = 0; i < 4; i++) {
+			s->local.data[i] = proc_hex_n(&loc, 8);
+			s->remote.data[i] = proc_hex_n(&rem, 8);
+		}
+		proc_scan(&loc, ":x", (unsigned *)&s->lport);
+		proc_scan(&rem, ":x", (unsigned *)&s->rport);
 		s->local.bytelen = s->remote.bytelen = 16;
 		return 0;
 	}
@@ -2790,11 +3969,1075 @@ static void sctp_timer_print(struct tcpstat *s)
 		    print_ms_timer(s->timeout), s->retrans);
 }
 
-static int tcp_show_line(char *line, const struct filter *f, int family)
-{
-	int rto = 0, ato = 0;
-	struct tcpstat s = {};
-	char *loc, *rem, *data;
+/* Aggregation: instead of printing each socket, fold it into the group of
+ * sockets sharing its --aggregate keys, and keep count, sum, extremes and a
+ * log2 histogram of each --stats field per group.
+ */
+enum {
+	AGG_NETID,
+	AGG_STATE,
+	AGG_FAMILY,
+	AGG_SRC,
+	AGG_DST,
+	AGG_SPORT,
+	AGG_DPORT,
+	AGG_DEV,
+	AGG_UID,
+	AGG_CONG,
+	AGG_KEY_MAX
+};
+
+#define AGG_SS_SIZE(f)	sizeof(((struct sockstat *)0)->f)
+#define AGG_ADDR_SIZE	sizeof(struct in6_addr)
+#define AGG_CONG_SIZE	16
+
+/* Largest packed key: every key above once, at its largest */
+#define AGG_KEY_SIZE	(AGG_SS_SIZE(type) + AGG_SS_SIZE(state) +	\
+			 AGG_SS_SIZE(local.family) + 2 * AGG_ADDR_SIZE + \
+			 AGG_SS_SIZE(lport) + AGG_SS_SIZE(rport) +	\
+			 IFNAMSIZ + AGG_SS_SIZE(uid) +			\
+			 AGG_CONG_SIZE)
+
+static const struct {
+	const char *name;
+	const char *label;
+	int len;	/* most bytes the key takes in a packed key */
+} agg_keys[AGG_KEY_MAX] = {
+	[AGG_NETID]	= { "netid",	"Netid",	AGG_SS_SIZE(type) },
+	[AGG_STATE]	= { "state",	"State",	AGG_SS_SIZE(state) },
+	[AGG_FAMILY]	= { "family",	"Family",
+			    AGG_SS_SIZE(local.family) },
+	[AGG_SRC]	= { "src",	"Local-Address", AGG_ADDR_SIZE },
+	[AGG_DST]	= { "dst",	"Peer-Address",	AGG_ADDR_SIZE },
+	[AGG_SPORT]	= { "sport",	"Local-Port",	AGG_SS_SIZE(lport) },
+	[AGG_DPORT]	= { "dport",	"Peer-Port",	AGG_SS_SIZE(rport) },
+	[AGG_DEV]	= { "dev",	"Dev",		IFNAMSIZ },
+	[AGG_UID]	= { "uid",	"Uid",		AGG_SS_SIZE(uid) },
+	[AGG_CONG]	= { "cong",	"Cong",		AGG_CONG_SIZE },
+};
+
+enum {
+	AGG_RTT,
+	AGG_RTTVAR,
+	AGG_MINRTT,
+	AGG_RTO,
+	AGG_CWND,
+	AGG_SSTHRESH,
+	AGG_MSS,
+	AGG_PMTU,
+	AGG_RETRANS,
+	AGG_LOST,
+	AGG_UNACKED,
+	AGG_DELIVERY_RATE,
+	AGG_BYTES_ACKED,
+	AGG_BYTES_RECEIVED,
+	AGG_RQ,
+	AGG_WQ,
+	AGG_STAT_MAX
+};
+
+static const struct {
+	const char *name;
+	const char *label;
+	bool usec;	/* kept in us, printed in ms */
+} agg_stats[AGG_STAT_MAX] = {
+	[AGG_RTT]		= { "rtt",		"rtt(ms)",	true },
+	[AGG_RTTVAR]		= { "rttvar",		"rttvar(ms)",	true },
+	[AGG_MINRTT]		= { "minrtt",		"minrtt(ms)",	true },
+	[AGG_RTO]		= { "rto",		"rto(ms)",	true },
+	[AGG_CWND]		= { "cwnd",		"cwnd" },
+	[AGG_SSTHRESH]		= { "ssthresh",		"ssthresh" },
+	[AGG_MSS]		= { "mss",		"mss" },
+	[AGG_PMTU]		= { "pmtu",		"pmtu" },
+	[AGG_RETRANS]		= { "retrans",		"retrans" },
+	[AGG_LOST]		= { "lost",		"lost" },
+	[AGG_UNACKED]		= { "unacked",		"unacked" },
+	[AGG_DELIVERY_RATE]	= { "delivery_rate",	"delivery_rate(bps)" },
+	[AGG_BYTES_ACKED]	= { "bytes_acked",	"bytes_acked" },
+	[AGG_BYTES_RECEIVED]	= { "bytes_received",	"bytes_received" },
+	[AGG_RQ]		= { "recv-q",		"Recv-Q" },
+	[AGG_WQ]		= { "send-q",		"Send-Q" },
+};
+
+#define AGG_HIST_MAX	65	/* bucket i holds values below 2^i */
+
+struct agg_stat {
+	unsigned long long	n;
+	unsigned long long	sum;
+	unsigned long long	min;
+	unsigned long long	max;
+	unsigned int		hist[AGG_HIST_MAX];
+};
+
+struct agg_group {
+	struct sockstat		s;	/* first socket seen, for the keys */
+	char			cong[AGG_CONG_SIZE];
+	char			dev[IFNAMSIZ];
+	unsigned char		key[AGG_KEY_SIZE];
+	int			keylen;
+	unsigned int		seq;	/* creation order, to break ties */
+	unsigned long long	count;
+	struct agg_stat		*stat;
+};
+
+static struct {
+	int			key[AGG_KEY_MAX];
+	int			nkeys;
+	int			stat[AGG_STAT_MAX];
+	int			nstats;
+	bool			info;	/* needs tcp_info and congestion */
+	struct agg_group	*group;
+	unsigned int		ngroups;
+	unsigned int		*hash;	/* group index + 1, 0 marks a free slot */
+	unsigned int		hsize;
+} agg;
+
+int json;
+
+static bool agg_enabled(void)
+{
+	return agg.nkeys || agg.nstats;
+}
+
+/* Parse the comma separated names in @arg into indexes in @list */
+static int agg_parse_list(const char *arg, int *list, int *n, int max,
+			  const char *(*name)(int))
+{
+	char *copy = strdup(arg), *tok;
+	int i, j, err = 0;
+
+	if (!copy)
+		return -1;
+
+	for (tok = strtok(copy, ","); tok; tok = strtok(NULL, ",")) {
+		for (i = 0; i < max; i++) {
+			if (strcmp(tok, name(i)) == 0)
+				break;
+		}
+		if (i == max) {
+			fprintf(stderr, "ss: unknown field \"%s\", one of:", tok);
+			for (i = 0; i < max; i++)
+				fprintf(stderr, " %s", name(i));
+			fprintf(stderr, "\n");
+			err = -1;
+			break;
+		}
+		for (j = 0; j < *n; j++) {
+			if (list[j] == i)
+				break;
+		}
+		if (j < *n) {
+			fprintf(stderr, "ss: field \"%s\" given twice\n", tok);
+			err = -1;
+			break;
+		}
+		list[(*n)++] = i;
+	}
+	free(copy);
+	return err;
+}
+
+static const char *agg_key_name(int i)
+{
+	return agg_keys[i].name;
+}
+
+static const char *agg_stat_name(int i)
+{
+	return agg_stats[i].name;
+}
+
+static int agg_parse_keys(const char *arg)
+{
+	int i;
+
+	if (agg_parse_list(arg, agg.key, &agg.nkeys, AGG_KEY_MAX,
+			   agg_key_name))
+		return -1;
+	for (i = 0; i < agg.nkeys; i++) {
+		if (agg.key[i] == AGG_CONG)
+			agg.info = true;
+	}
+	return 0;
+}
+
+static int agg_parse_stats(const char *arg)
+{
+	int i;
+
+	if (agg_parse_list(arg, agg.stat, &agg.nstats, AGG_STAT_MAX,
+			   agg_stat_name))
+		return -1;
+	for (i = 0; i < agg.nstats; i++) {
+		if (agg.stat[i] != AGG_RQ && agg.stat[i] != AGG_WQ)
+			agg.info = true;
+	}
+	return 0;
+}
+
+/* Value of stat @i for a socket, false if the socket doesn't have one */
+static bool agg_stat_value(int i, const struct sockstat *s,
+			   const struct tcp_info *info, unsigned long long *val)
+{
+	switch (i) {
+	case AGG_RQ:
+		*val = s->rq;
+		return true;
+	case AGG_WQ:
+		*val = s->wq;
+		return true;
+	}
+
+	if (!info)
+		return false;
+
+	switch (i) {
+	case AGG_RTT:
+		*val = info->tcpi_rtt;
+		break;
+	case AGG_RTTVAR:
+		*val = info->tcpi_rttvar;
+		break;
+	case AGG_MINRTT:
+		*val = info->tcpi_min_rtt;
+		break;
+	case AGG_RTO:
+		*val = info->tcpi_rto;
+		break;
+	case AGG_CWND:
+		*val = info->tcpi_snd_cwnd;
+		break;
+	case AGG_SSTHRESH:
+		if (info->tcpi_snd_ssthresh >= 0xFFFF)
+			return false;
+		*val = info->tcpi_snd_ssthresh;
+		break;
+	case AGG_MSS:
+		*val = info->tcpi_snd_mss;
+		break;
+	case AGG_PMTU:
+		*val = info->tcpi_pmtu;
+		break;
+	case AGG_RETRANS:
+		*val = info->tcpi_total_retrans;
+		break;
+	case AGG_LOST:
+		*val = info->tcpi_lost;
+		break;
+	case AGG_UNACKED:
+		*val = info->tcpi_unacked;
+		break;
+	case AGG_DELIVERY_RATE:
+		*val = info->tcpi_delivery_rate * 8;
+		break;
+	case AGG_BYTES_ACKED:
+		*val = info->tcpi_bytes_acked;
+		break;
+	case AGG_BYTES_RECEIVED:
+		*val = info->tcpi_bytes_received;
+		break;
+	default:
+		return false;
+	}
+	return true;
+}
+
+static void agg_key_add(unsigned char *key, int *len, const void *data,
+			int size, int max)
+{
+	if (size > max)
+		size = max;
+	memcpy(key + *len, data, size);
+	*len += size;
+}
+
+/* Lookup key of a socket: the values of the --aggregate fields, packed.
+ * Devices go by name, as an index means another device in each namespace.
+ */
+static int agg_key(const struct sockstat *s, const char *cong,
+		   const char *dev, unsigned char *key)
+{
+	int i, len = 0;
+
+	for (i = 0; i < agg.nkeys; i++) {
+		int max = agg_keys[agg.key[i]].len;
+
+		switch (agg.key[i]) {
+		case AGG_NETID:
+			agg_key_add(key, &len, &s->type, sizeof(s->type), max);
+			break;
+		case AGG_STATE:
+			agg_key_add(key, &len, &s->state, sizeof(s->state),
+				    max);
+			break;
+		case AGG_FAMILY:
+			agg_key_add(key, &len, &s->local.family,
+				    sizeof(s->local.family), max);
+			break;
+		case AGG_SRC:
+			agg_key_add(key, &len, s->local.data,
+				    s->local.bytelen, max);
+			break;
+		case AGG_DST:
+			agg_key_add(key, &len, s->remote.data,
+				    s->remote.bytelen, max);
+			break;
+		case AGG_SPORT:
+			agg_key_add(key, &len, &s->lport, sizeof(s->lport),
+				    max);
+			break;
+		case AGG_DPORT:
+			agg_key_add(key, &len, &s->rport, sizeof(s->rport),
+				    max);
+			break;
+		case AGG_DEV:
+			agg_key_add(key, &len, dev,
+				    strnlen(dev, IFNAMSIZ - 1) + 1, max);
+			break;
+		case AGG_UID:
+			agg_key_add(key, &len, &s->uid, sizeof(s->uid), max);
+			break;
+		case AGG_CONG:
+			agg_key_add(key, &len, cong,
+				    strnlen(cong, AGG_CONG_SIZE - 1) + 1, max);
+			break;
+		}
+	}
+	return len;
+}
+
+static unsigned int agg_hashfn(const unsigned char *key, int len)
+{
+	unsigned int h = 2166136261U;
+
+	while (len--)
+		h = (h ^ *key++) * 16777619U;
+	return h;
+}
+
+static unsigned int agg_slot(const unsigned char *key, int len)
+{
+	unsigned int i = agg_hashfn(key, len) & (agg.hsize - 1);
+
+	while (agg.hash[i]) {
+		struct agg_group *g = &agg.group[agg.hash[i] - 1];
+
+		if (g->keylen == len && !memcmp(g->key, key, len))
+			break;
+		i = (i + 1) & (agg.hsize - 1);
+	}
+	return i;
+}
+
+static struct agg_group *agg_group_get(const struct sockstat *s,
+				       const char *cong)
+{
+	unsigned char key[sizeof(agg.group->key)];
+	const char *dev = "";
+	struct agg_group *g;
+	unsigned int i;
+	int len;
+
+	if (s->iface)
+		dev = ss_index_to_name(s->iface);
+	len = agg_key(s, cong, dev, key);
+
+	if (2 * (agg.ngroups + 1) > agg.hsize) {
+		unsigned int n = agg.hsize ? 2 * agg.hsize : 256;
+
+		free(agg.hash);
+		agg.hash = calloc(n, sizeof(*agg.hash));
+		agg.group = realloc(agg.group, n / 2 * sizeof(*agg.group));
+		if (!agg.hash || !agg.group) {
+			fprintf(stderr, "ss: failed to malloc buffer\n");
+			abort();
+		}
+		agg.hsize = n;
+		for (i = 0; i < agg.ngroups; i++) {
+			g = &agg.group[i];
+			agg.hash[agg_slot(g->key, g->keylen)] = i + 1;
+		}
+	}
+
+	i = agg_slot(key, len);
+	if (agg.hash[i])
+		return &agg.group[agg.hash[i] - 1];
+
+	g = &agg.group[agg.ngroups];
+	memset(g, 0, sizeof(*g));
+	g->s = *s;
+	strlcpy(g->cong, cong, sizeof(g->cong));
+	strlcpy(g->dev, dev, sizeof(g->dev));
+	memcpy(g->key, key, len);
+	g->keylen = len;
+	g->seq = agg.ngroups;
+	if (agg.nstats) {
+		g->stat = calloc(agg.nstats, sizeof(*g->stat));
+		if (!g->stat) {
+			fprintf(stderr, "ss: failed to malloc buffer\n");
+			abort();
+		}
+	}
+	agg.hash[i] = ++agg.ngroups;
+	return g;
+}
+
+static void agg_add(const struct sockstat *s, const struct tcp_info *info,
+		    const char *cong)
+{
+	struct agg_group *g = agg_group_get(s, cong ? : "");
+	unsigned long long val;
+	int i;
+
+	g->count++;
+	for (i = 0; i < agg.nstats; i++) {
+		struct agg_stat *st = &g->stat[i];
+
+		if (!agg_stat_value(agg.stat[i], s, info, &val))
+			continue;
+		if (!st->n++ || val < st->min)
+			st->min = val;
+		if (val > st->max)
+			st->max = val;
+		st->sum += val;
+		st->hist[val ? 64 - __builtin_clzll(val) : 0]++;
+	}
+}
+
+static void agg_inet_sock(struct nlmsghdr *nlh, struct sockstat *s)
+{
+	struct inet_diag_msg *r = NLMSG_DATA(nlh);
+	struct rtattr *tb[INET_DIAG_MAX+1];
+	struct tcp_info *info = NULL;
+	const char *cong = NULL;
+
+	parse_rtattr_flags(tb, INET_DIAG_MAX, (struct rtattr *)(r+1),
+			   nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*r)),
+			   NLA_F_NESTED);
+
+	if (tb[INET_DIAG_PROTOCOL])
+		s->type = rta_getattr_u8(tb[INET_DIAG_PROTOCOL]);
+
+	if (tb[INET_DIAG_INFO]) {
+		int len = RTA_PAYLOAD(tb[INET_DIAG_INFO]);
+
+		/* workaround for older kernels with less fields */
+		info = alloca(sizeof(*info));
+		memset(info, 0, sizeof(*info));
+		memcpy(info, RTA_DATA(tb[INET_DIAG_INFO]),
+		       min(len, (int)sizeof(*info)));
+	}
+	if (tb[INET_DIAG_CONG])
+		cong = rta_getattr_str(tb[INET_DIAG_CONG]);
+
+	agg_add(s, info, cong);
+}
+
+/* Value below which a fraction @p of the samples falls, to the resolution
+ * of the histogram buckets.
+ */
+static unsigned long long agg_percentile(const struct agg_stat *st, double p)
+{
+	unsigned long long seen = 0, want = p * st->n + 0.5;
+	int i;
+
+	if (!want)
+		want = 1;
+	for (i = 0; i < AGG_HIST_MAX - 1; i++) {
+		seen += st->hist[i];
+		if (seen >= want)
+			break;
+	}
+	if (i == 0)
+		return 0;
+	return min(st->max, i == 64 ? ~0ULL : (1ULL << i) - 1);
+}
+
+static double agg_scale(int stat, double val)
+{
+	return agg_stats[stat].usec ? val / 1000 : val;
+}
+
+static int agg_sprint_val(char *buf, int len, int stat, double val)
+{
+	if (agg_stats[stat].usec)
+		return snprintf(buf, len, "%.3f", val / 1000);
+	return snprintf(buf, len, "%.0f", val);
+}
+
+static void agg_sprint_key(char *buf, int len, const struct agg_group *g,
+			   int key)
+{
+	const struct sockstat *s = &g->s;
+
+	switch (key) {
+	case AGG_NETID:
+		snprintf(buf, len, "%s", proto_name(s->type));
+		break;
+	case AGG_STATE:
+		snprintf(buf, len, "%s", sstate_name[s->state]);
+		break;
+	case AGG_FAMILY:
+		snprintf(buf, len, "%s", family_name(s->local.family));
+		break;
+	case AGG_SRC:
+		snprintf(buf, len, "%s", format_host(s->local.family,
+						       s->local.bytelen,
+						       s->local.data));
+		break;
+	case AGG_DST:
+		snprintf(buf, len, "%s", format_host(s->remote.family,
+						       s->remote.bytelen,
+						       s->remote.data));
+		break;
+	case AGG_SPORT:
+		snprintf(buf, len, "%d", s->lport);
+		break;
+	case AGG_DPORT:
+		snprintf(buf, len, "%d", s->rport);
+		break;
+	case AGG_DEV:
+		snprintf(buf, len, "%s", g->dev[0] ? g->dev : "*");
+		break;
+	case AGG_UID:
+		snprintf(buf, len, "%u", s->uid);
+		break;
+	case AGG_CONG:
+		snprintf(buf, len, "%s", g->cong[0] ? g->cong : "-");
+		break;
+	}
+}
+
+/* Text cell @col of group @g: keys, then count, then one summary per stat */
+static void agg_sprint_cell(char *buf, int len, const struct agg_group *g,
+			    int col)
+{
+	const struct agg_stat *st;
+	int stat, n;
+
+	if (col < agg.nkeys) {
+		agg_sprint_key(buf, len, g, agg.key[col]);
+		return;
+	}
+	if (col == agg.nkeys) {
+		snprintf(buf, len, "%llu", g->count);
+		return;
+	}
+
+	stat = agg.stat[col - agg.nkeys - 1];
+	st = &g->stat[col - agg.nkeys - 1];
+	if (!st->n) {
+		snprintf(buf, len, "-");
+		return;
+	}
+	n = agg_sprint_val(buf, len, stat, st->min);
+	n += snprintf(buf + n, len - n, "/");
+	if (agg_stats[stat].usec)
+		n += snprintf(buf + n, len - n, "%.3f",
+			      (double)st->sum / st->n / 1000);
+	else
+		n += snprintf(buf + n, len - n, "%.1f",
+			      (double)st->sum / st->n);
+	n += snprintf(buf + n, len - n, "/");
+	n += agg_sprint_val(buf + n, len - n, stat, agg_percentile(st, 0.5));
+	n += snprintf(buf + n, len - n, "/");
+	n += agg_sprint_val(buf + n, len - n, stat, agg_percentile(st, 0.99));
+	n += snprintf(buf + n, len - n, "/");
+	agg_sprint_val(buf + n, len - n, stat, st->max);
+}
+
+static const char *agg_col_label(int col)
+{
+	if (col < agg.nkeys)
+		return agg_keys[agg.key[col]].label;
+	if (col == agg.nkeys)
+		return "Count";
+	return agg_stats[agg.stat[col - agg.nkeys - 1]].label;
+}
+
+static int agg_cmp(const void *a, const void *b)
+{
+	const struct agg_group *ga = a, *gb = b;
+
+	if (ga->count != gb->count)
+		return ga->count < gb->count ? 1 : -1;
+	return ga->seq < gb->seq ? -1 : 1;
+}
+
+/* Keys are left aligned, numbers right aligned */
+static void agg_print_cell(int col, int width, const char *str)
+{
+	if (col < agg.nkeys)
+		printf("%s%-*s", col ? " " : "", width, str);
+	else
+		printf("%s%*s", col ? " " : "", width, str);
+}
+
+static void agg_print_hist(const struct agg_stat *st, int stat)
+{
+	char buf[64];
+	int i;
+
+	for (i = 0; i < AGG_HIST_MAX; i++) {
+		if (!st->hist[i])
+			continue;
+		agg_sprint_val(buf, sizeof(buf), stat,
+			       i ? (i == 64 ? ~0ULL : (1ULL << i) - 1) : 0);
+		printf(" <=%s:%u", buf, st->hist[i]);
+	}
+}
+
+static void agg_print_json(void)
+{
+	unsigned int i;
+	char buf[256];
+	int k, j;
+
+	new_json_obj(json);
+	for (i = 0; i < agg.ngroups; i++) {
+		const struct agg_group *g = &agg.group[i];
+
+		open_json_object(NULL);
+		for (k = 0; k < agg.nkeys; k++) {
+			int key = agg.key[k];
+
+			agg_sprint_key(buf, sizeof(buf), g, key);
+			if (key == AGG_SPORT || key == AGG_DPORT ||
+			    key == AGG_UID)
+				print_uint(PRINT_JSON, agg_keys[key].name,
+					   NULL, strtoul(buf, NULL, 10));
+			else
+				print_string(PRINT_JSON, agg_keys[key].name,
+					     NULL, buf);
+		}
+		print_lluint(PRINT_JSON, "count", NULL, g->count);
+
+		if (agg.nstats)
+			open_json_object("stats");
+		for (k = 0; k < agg.nstats; k++) {
+			const struct agg_stat *st = &g->stat[k];
+			int stat = agg.stat[k];
+
+			open_json_object(agg_stats[stat].name);
+			print_lluint(PRINT_JSON, "n", NULL, st->n);
+			if (st->n) {
+				print_float(PRINT_JSON, "min", NULL,
+					    agg_scale(stat, st->min));
+				print_float(PRINT_JSON, "avg", NULL,
+					    agg_scale(stat, (double)st->sum / st->n));
+				print_float(PRINT_JSON, "p50", NULL,
+					    agg_scale(stat, agg_percentile(st, 0.5)));
+				print_float(PRINT_JSON, "p90", NULL,
+					    agg_scale(stat, agg_percentile(st, 0.9)));
+				print_float(PRINT_JSON, "p99", NULL,
+					    agg_scale(stat, agg_percentile(st, 0.99)));
+				print_float(PRINT_JSON, "max", NULL,
+					    agg_scale(stat, st->max));
+			}
+			open_json_array(PRINT_JSON, "hist");
+			for (j = 0; j < AGG_HIST_MAX; j++) {
+				unsigned long long le;
+
+				if (!st->hist[j])
+					continue;
+				le = j ? (j == 64 ? ~0ULL : (1ULL << j) - 1) : 0;
+				open_json_object(NULL);
+				print_float(PRINT_JSON, "le", NULL,
+					    agg_scale(stat, le));
+				print_uint(PRINT_JSON, "count", NULL,
+					   st->hist[j]);
+				close_json_object();
+			}
+			close_json_array(PRINT_JSON, NULL);
+			close_json_object();
+		}
+		if (agg.nstats)
+			close_json_object();
+		close_json_object();
+	}
+	delete_json_obj();
+}
+
+/* Print the groups, largest first. With -e, text output also carries the
+ * histogram of each stat, as "<=bound:count" buckets.
+ */
+static void agg_print(void)
+{
+	int ncols = agg.nkeys + 1 + agg.nstats;
+	int *width = calloc(ncols, sizeof(*width));
+	unsigned int i;
+	char buf[256];
+	int c;
+
+	if (!width)
+		abort();
+
+	qsort(agg.group, agg.ngroups, sizeof(*agg.group), agg_cmp);
+
+	if (json) {
+		agg_print_json();
+		free(width);
+		return;
+	}
+
+	for (c = 0; c < ncols; c++) {
+		if (show_header)
+			width[c] = strlen(agg_col_label(c));
+		for (i = 0; i < agg.ngroups; i++) {
+			agg_sprint_cell(buf, sizeof(buf), &agg.group[i], c);
+			width[c] = max(width[c], (int)strlen(buf));
+		}
+	}
+
+	if (show_header) {
+		for (c = 0; c < ncols; c++)
+			agg_print_cell(c, width[c], agg_col_label(c));
+		printf("\n");
+	}
+
+	for (i = 0; i < agg.ngroups; i++) {
+		const struct agg_group *g = &agg.group[i];
+
+		for (c = 0; c < ncols; c++) {
+			agg_sprint_cell(buf, sizeof(buf), g, c);
+			agg_print_cell(c, width[c], buf);
+		}
+		printf("\n");
+
+		for (c = 0; show_details && c < agg.nstats; c++) {
+			if (!g->stat[c].n)
+				continue;
+			printf("\t%s", agg_stats[agg.stat[c]].label);
+			agg_print_hist(&g->stat[c], agg.stat[c]);
+			printf("\n");
+		}
+	}
+	free(width);
+}
+
+/* Interval sampling: the counters of each TCP socket are kept from one dump
+ * to the next, keyed by socket cookie, and the sockets with the highest
+ * rate of one counter are printed after each dump.
+ */
+enum {
+	TOP_BYTES_ACKED,
+	TOP_BYTES_RECEIVED,
+	TOP_BYTES_SENT,
+	TOP_BYTES_RETRANS,
+	TOP_SEGS_OUT,
+	TOP_SEGS_IN,
+	TOP_RETRANS,
+	TOP_DELIVERED,
+	TOP_METRIC_MAX
+};
+
+static const struct {
+	const char *name;
+	bool bytes;	/* printed as a bit rate */
+} top_metrics[TOP_METRIC_MAX] = {
+	[TOP_BYTES_ACKED]	= { "bytes_acked",	true },
+	[TOP_BYTES_RECEIVED]	= { "bytes_received",	true },
+	[TOP_BYTES_SENT]	= { "bytes_sent",	true },
+	[TOP_BYTES_RETRANS]	= { "bytes_retrans",	true },
+	[TOP_SEGS_OUT]		= { "segs_out" },
+	[TOP_SEGS_IN]		= { "segs_in" },
+	[TOP_RETRANS]		= { "retrans" },
+	[TOP_DELIVERED]		= { "delivered" },
+};
+
+/* Counters kept per socket: the ones always printed, then the sort key */
+enum {
+	TOP_VAL_TX,
+	TOP_VAL_RX,
+	TOP_VAL_RETRANS,
+	TOP_VAL_KEY,
+	TOP_VAL_MAX
+};
+
+struct top_ent {
+	unsigned long long	cookie;	/* 0 marks a free slot */
+	unsigned long long	val[TOP_VAL_MAX];
+};
+
+struct top_table {
+	struct top_ent		*ent;
+	unsigned int		size;
+	unsigned int		count;
+};
+
+struct top_sock {
+	double			rate[TOP_VAL_MAX];
+	struct sockstat		s;
+};
+
+static struct {
+	int			k;
+	int			metric;
+	unsigned int		interval;	/* ms */
+	unsigned int		count;
+	bool			primed;		/* prev holds a sample */
+	double			elapsed;	/* s, since the previous sample */
+	unsigned int		nsocks;
+	struct top_table	prev, cur;
+	struct top_sock		*heap;		/* min-heap on the sort key */
+	int			nheap;
+} top = {
+	.interval = 1000,
+};
+
+static int top_parse_metric(const char *arg)
+{
+	int i;
+
+	for (i = 0; i < TOP_METRIC_MAX; i++) {
+		if (strcmp(arg, top_metrics[i].name) == 0) {
+			top.metric = i;
+			return 0;
+		}
+	}
+	fprintf(stderr, "ss: unknown counter \"%s\", one of:", arg);
+	for (i = 0; i < TOP_METRIC_MAX; i++)
+		fprintf(stderr, " %s", top_metrics[i].name);
+	fprintf(stderr, "\n");
+	return -1;
+}
+
+static unsigned long long top_metric_value(int metric,
+					   const struct tcp_info *info)
+{
+	switch (metric) {
+	case TOP_BYTES_ACKED:
+		return info->tcpi_bytes_acked;
+	case TOP_BYTES_RECEIVED:
+		return info->tcpi_bytes_received;
+	case TOP_BYTES_SENT:
+		return info->tcpi_bytes_sent;
+	case TOP_BYTES_RETRANS:
+		return info->tcpi_bytes_retrans;
+	case TOP_SEGS_OUT:
+		return info->tcpi_segs_out;
+	case TOP_SEGS_IN:
+		return info->tcpi_segs_in;
+	case TOP_RETRANS:
+		return info->tcpi_total_retrans;
+	case TOP_DELIVERED:
+		return info->tcpi_delivered;
+	}
+	return 0;
+}
+
+static struct top_ent *top_slot(const struct top_table *t,
+				unsigned long long cookie)
+{
+	unsigned int i = (cookie * 0x9E3779B97F4A7C15ULL) >> 32;
+
+	for (i &= t->size - 1; t->ent[i].cookie; i = (i + 1) & (t->size - 1)) {
+		if (t->ent[i].cookie == cookie)
+			break;
+	}
+	return &t->ent[i];
+}
+
+/* Make room for @n entries at a load factor of at most 1/2 */
+static void top_table_reserve(struct top_table *t, unsigned int n)
+{
+	struct top_ent *old = t->ent;
+	unsigned int i, old_size = t->size;
+
+	if (2 * n <= t->size)
+		return;
+
+	while (2 * n > t->size)
+		t->size = t->size ? 2 * t->size : 1024;
+
+	t->ent = calloc(t->size, sizeof(*t->ent));
+	if (!t->ent) {
+		fprintf(stderr, "ss: failed to malloc buffer\n");
+		abort();
+	}
+	for (i = 0; i < old_size; i++) {
+		if (old[i].cookie)
+			*top_slot(t, old[i].cookie) = old[i];
+	}
+	free(old);
+}
+
+/* The sample just taken becomes the previous one */
+static void top_table_rotate(void)
+{
+	struct top_table t = top.prev;
+
+	top.prev = top.cur;
+	top.cur = t;
+	top.cur.count = 0;
+	if (top.cur.ent)
+		memset(top.cur.ent, 0, top.cur.size * sizeof(*top.cur.ent));
+	top_table_reserve(&top.cur, top.prev.count);
+}
+
+static void top_free(void)
+{
+	free(top.prev.ent);
+	free(top.cur.ent);
+	free(top.heap);
+}
+
+static bool top_heap_less(int a, int b)
+{
+	return top.heap[a].rate[TOP_VAL_KEY] < top.heap[b].rate[TOP_VAL_KEY];
+}
+
+static void top_heap_swap(int a, int b)
+{
+	struct top_sock tmp = top.heap[a];
+
+	top.heap[a] = top.heap[b];
+	top.heap[b] = tmp;
+}
+
+static void top_heap_down(int i)
+{
+	for (;;) {
+		int min = i, l = 2 * i + 1, r = l + 1;
+
+		if (l < top.nheap && top_heap_less(l, min))
+			min = l;
+		if (r < top.nheap && top_heap_less(r, min))
+			min = r;
+		if (min == i)
+			break;
+		top_heap_swap(i, min);
+		i = min;
+	}
+}
+
+static void top_heap_push(const double *rate, const struct sockstat *s)
+{
+	struct top_sock *e;
+	int i;
+
+	if (top.nheap == top.k) {
+		/* Full: replace the smallest, if this one is larger */
+		if (rate[TOP_VAL_KEY] <= top.heap[0].rate[TOP_VAL_KEY])
+			return;
+		e = &top.heap[0];
+		memcpy(e->rate, rate, sizeof(e->rate));
+		e->s = *s;
+		top_heap_down(0);
+		return;
+	}
+
+	i = top.nheap++;
+	e = &top.heap[i];
+	memcpy(e->rate, rate, sizeof(e->rate));
+	e->s = *s;
+	while (i && top_heap_less(i, (i - 1) / 2)) {
+		top_heap_swap(i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+static void top_inet_sock(struct nlmsghdr *nlh, struct sockstat *s)
+{
+	struct inet_diag_msg *r = NLMSG_DATA(nlh);
+	struct rtattr *tb[INET_DIAG_MAX+1];
+	const struct top_ent *old;
+	double rate[TOP_VAL_MAX];
+	struct tcp_info info = {};
+	struct top_ent *e;
+	int i;
+
+	parse_rtattr_flags(tb, INET_DIAG_MAX, (struct rtattr *)(r+1),
+			   nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*r)),
+			   NLA_F_NESTED);
+	if (!tb[INET_DIAG_INFO] || !s->sk)
+		return;
+
+	/* workaround for older kernels with less fields */
+	memcpy(&info, RTA_DATA(tb[INET_DIAG_INFO]),
+	       min(RTA_PAYLOAD(tb[INET_DIAG_INFO]), sizeof(info)));
+
+	top_table_reserve(&top.cur, top.cur.count + 1);
+	e = top_slot(&top.cur, s->sk);
+	if (e->cookie)
+		return;		/* seen twice in one dump */
+	e->cookie = s->sk;
+	e->val[TOP_VAL_TX] = info.tcpi_bytes_acked;
+	e->val[TOP_VAL_RX] = info.tcpi_bytes_received;
+	e->val[TOP_VAL_RETRANS] = info.tcpi_total_retrans;
+	e->val[TOP_VAL_KEY] = top_metric_value(top.metric, &info);
+	top.cur.count++;
+	top.nsocks++;
+
+	if (!top.primed)
+		return;
+
+	/* Sockets created since the previous sample count from zero */
+	old = top.prev.ent ? top_slot(&top.prev, s->sk) : NULL;
+	for (i = 0; i < TOP_VAL_MAX; i++) {
+		unsigned long long base = old && old->cookie ? old->val[i] : 0;
+
+		rate[i] = e->val[i] > base ?
+			  (e->val[i] - base) / top.elapsed : 0;
+	}
+	top_heap_push(rate, s);
+}
+
+static int top_cmp(const void *a, const void *b)
+{
+	const struct top_sock *ta = a, *tb = b;
+
+	if (ta->rate[TOP_VAL_KEY] == tb->rate[TOP_VAL_KEY])
+		return 0;
+	return ta->rate[TOP_VAL_KEY] < tb->rate[TOP_VAL_KEY] ? 1 : -1;
+}
+
+static void top_rate_print(const char *name, bool bytes, double rate)
+{
+	char b[64];
+
+	if (bytes)
+		out(" %s:%sbps", name, sprint_bw(b, rate * 8));
+	else
+		out(" %s:%.1f/s", name, rate);
+}
+
+static void top_print(void)
+{
+	int i;
+
+	qsort(top.heap, top.nheap, sizeof(*top.heap), top_cmp);
+
+	printf("%u sockets in %.3fs, top %d by %s\n",
+	       top.nsocks, top.elapsed, top.nheap,
+	       top_metrics[top.metric].name);
+	if (show_header)
+		print_header();
+
+	for (i = 0; i < top.nheap; i++) {
+		struct top_sock *e = &top.heap[i];
+
+		inet_stats_print(&e->s, false);
+		top_rate_print("tx", true, e->rate[TOP_VAL_TX]);
+		top_rate_print("rx", true, e->rate[TOP_VAL_RX]);
+		top_rate_print("retrans", false, e->rate[TOP_VAL_RETRANS]);
+		if (top.metric != TOP_BYTES_ACKED &&
+		    top.metric != TOP_BYTES_RECEIVED &&
+		    top.metric != TOP_RETRANS)
+			top_rate_print(top_metrics[top.metric].name,
+				       top_metrics[top.metric].bytes,
+				       e->rate[TOP_VAL_KEY]);
+	}
+	render();
+	printf("\n");
+	fflush(stdout);
+}
+
+static int tcp_show_line(char *line, const struct filter *f, int family)
+{
+	int rto = 0, ato = 0;
+	struct tcpstat s = {};
+	char *loc, *rem, *data;
 	char opt[256];
 	int n;
 	int hz = get_user_hz();
@@ -2813,14 +5056,15 @@ static int tcp_show_line(char *line, const struct filter *f, int family)
 		return 0;
 
 	opt[0] = 0;
-	n = sscanf(data, "%x %x:%x %x:%x %x %d %d %u %d %llx %d %d %d %u %d %[^\n]\n",
-		   &s.ss.state, &s.ss.wq, &s.ss.rq,
-		   &s.timer, &s.timeout, &s.retrans, &s.ss.uid, &s.probes,
-		   &s.ss.ino, &s.ss.refcnt, &s.ss.sk, &rto, &ato, &s.qack, &s.cwnd,
-		   &s.ssthresh, opt);
-
-	if (n < 17)
-		opt[0] = 0;
+	n = proc_scan(&data, "x x:x x:x x u d u d X d d d u d",
+		      &s.ss.state, &s.ss.wq, &s.ss.rq,
+		      &s.timer, &s.timeout, &s.retrans, &s.ss.uid, &s.probes,
+		      &s.ss.ino, &s.ss.refcnt, &s.ss.sk, &rto, &ato, &s.qack,
+		      &s.cwnd, &s.ssthresh);
+	if (n == 16) {
+		data += strspn(data, " ");
+		strlcpy(opt, data, sizeof(opt));
+	}
 
 	if (n < 12) {
 		rto = 0;
@@ -2838,6 +5082,11 @@ static int tcp_show_line(char *line, const struct filter *f, int family)
 	s.rto	    = s.rto != 3 * hz  ? s.rto / hz : 0;
 	s.ss.type   = IPPROTO_TCP;
 
+	if (agg_enabled()) {
+		agg_add(&s.ss, NULL, NULL);
+		return 0;
+	}
+
 	inet_stats_print(&s.ss, false);
 
 	if (show_options)
@@ -2855,31 +5104,108 @@ static int tcp_show_line(char *line, const struct filter *f, int family)
 	return 0;
 }
 
+/* /proc/net tables are read in large blocks straight from the file
+ * descriptor, and split in lines with memchr(), which is vectorised in
+ * the C library, rather than with fgets() one line at a time.
+ */
+#define PROC_READ_SIZE	(256 * 1024)
+
+struct proc_reader {
+	int	fd;
+	char	*buf;
+	size_t	size;
+	size_t	pos;	/* start of the next line */
+	size_t	end;	/* end of data read */
+	int	err;
+};
+
+static int proc_reader_init(struct proc_reader *r, FILE *fp)
+{
+	memset(r, 0, sizeof(*r));
+	r->fd = fileno(fp);
+	r->size = PROC_READ_SIZE;
+	r->buf = malloc(r->size);
+	return r->buf ? 0 : -1;
+}
+
+static void proc_reader_free(struct proc_reader *r)
+{
+	free(r->buf);
+	r->buf = NULL;
+}
+
+/* Next line without its newline, NULL at the end of the file or on error */
+static char *proc_reader_line(struct proc_reader *r)
+{
+	while (1) {
+		char *nl = memchr(r->buf + r->pos, '\n', r->end - r->pos);
+		ssize_t n;
+
+		if (nl) {
+			char *line = r->buf + r->pos;
+
+			*nl = 0;
+			r->pos = nl + 1 - r->buf;
+			return line;
+		}
+
+		/* Keep the partial line, and make room after it */
+		memmove(r->buf, r->buf + r->pos, r->end - r->pos);
+		r->end -= r->pos;
+		r->pos = 0;
+		if (r->end == r->size) {
+			char *buf = realloc(r->buf, 2 * r->size);
+
+			if (!buf) {
+				r->err = ENOMEM;
+				return NULL;
+			}
+			r->buf = buf;
+			r->size *= 2;
+		}
+
+		n = read(r->fd, r->buf + r->end, r->size - r->end);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0) {
+			r->err = errno;
+			return NULL;
+		}
+		if (n == 0) {
+			/* Truncated last line */
+			if (r->end)
+				r->err = EINVAL;
+			return NULL;
+		}
+		r->end += n;
+	}
+}
+
 static int generic_record_read(FILE *fp,
 			       int (*worker)(char*, const struct filter *, int),
 			       const struct filter *f, int fam)
 {
-	char line[256];
-
-	/* skip header */
-	if (fgets(line, sizeof(line), fp) == NULL)
-		goto outerr;
+	struct proc_reader r;
+	char *line;
 
-	while (fgets(line, sizeof(line), fp) != NULL) {
-		int n = strlen(line);
+	if (proc_reader_init(&r, fp))
+		return -1;
 
-		if (n == 0 || line[n-1] != '\n') {
-			errno = -EINVAL;
-			return -1;
-		}
-		line[n-1] = 0;
+	/* skip header */
+	if (proc_reader_line(&r) == NULL)
+		goto out;
 
+	while ((line = proc_reader_line(&r)) != NULL) {
 		if (worker(line, f, fam) < 0)
-			return 0;
+			break;
 	}
-outerr:
-
-	return ferror(fp) ? -1 : 0;
+out:
+	proc_reader_free(&r);
+	if (r.err) {
+		errno = r.err;
+		return -1;
+	}
+	return 0;
 }
 
 static void print_skmeminfo(struct rtattr *tb[], int attrtype)
@@ -3893,7 +6219,7 @@ static int tcpdiag_send(int fd, int protocol, struct filter *f)
 		req.r.idiag_ext |= (1<<(INET_DIAG_SKMEMINFO-1));
 	}
 
-	if (show_tcpinfo) {
+	if (show_tcpinfo || agg.info || top.k) {
 		req.r.idiag_ext |= (1<<(INET_DIAG_INFO-1));
 		req.r.idiag_ext |= (1<<(INET_DIAG_VEGASINFO-1));
 		req.r.idiag_ext |= (1<<(INET_DIAG_CONG-1));
@@ -3909,7 +6235,7 @@ static int tcpdiag_send(int fd, int protocol, struct filter *f)
 		.iov_len = sizeof(req)
 	};
 	if (f->f) {
-		bclen = ssfilter_bytecompile(f->f, &bc);
+		bclen = ssfilter_compile(f->f, &bc);
 		if (bclen) {
 			rta.rta_type = INET_DIAG_REQ_BYTECODE;
 			rta.rta_len = RTA_LENGTH(bclen);
@@ -3961,7 +6287,7 @@ static int sockdiag_send(int family, int fd, int protocol, struct filter *f)
 		req.r.idiag_ext |= (1<<(INET_DIAG_SKMEMINFO-1));
 	}
 
-	if (show_tcpinfo) {
+	if (show_tcpinfo || agg.info || top.k) {
 		req.r.idiag_ext |= (1<<(INET_DIAG_INFO-1));
 		req.r.idiag_ext |= (1<<(INET_DIAG_VEGASINFO-1));
 		req.r.idiag_ext |= (1<<(INET_DIAG_CONG-1));
@@ -3977,7 +6303,7 @@ static int sockdiag_send(int family, int fd, int protocol, struct filter *f)
 		.iov_len = sizeof(req)
 	};
 	if (f->f) {
-		bclen = ssfilter_bytecompile(f->f, &bc);
+		bclen = ssfilter_compile(f->f, &bc);
 		if (bclen) {
 			rta_bc.rta_type = INET_DIAG_REQ_BYTECODE;
 			rta_bc.rta_len = RTA_LENGTH(bclen);
@@ -4008,63 +6334,314 @@ static int sockdiag_send(int family, int fd, int protocol, struct filter *f)
 			return -1;
 		}
 
-		iov[iovlen++] = (struct iovec){ bpf_rta, bpf_rta->rta_len };
-		req.nlh.nlmsg_len += bpf_rta->rta_len;
-	}
-#endif
+		iov[iovlen++] = (struct iovec){ bpf_rta, bpf_rta->rta_len };
+		req.nlh.nlmsg_len += bpf_rta->rta_len;
+	}
+#endif
+
+	msg = (struct msghdr) {
+		.msg_name = (void *)&nladdr,
+		.msg_namelen = sizeof(nladdr),
+		.msg_iov = iov,
+		.msg_iovlen = iovlen,
+	};
+
+	if (sendmsg(fd, &msg, 0) < 0) {
+		free(bpf_rta);
+		close(fd);
+		return -1;
+	}
+
+	free(bpf_rta);
+
+	return 0;
+}
+
+struct inet_diag_arg {
+	struct filter *f;
+	int protocol;
+	struct rtnl_handle *rth;
+};
+
+/* SOCK_DESTROY requests are queued and sent in batches of up to
+ * killer.window, packed many to a datagram.  Only the last request of
+ * a batch asks for an ACK: sock_diag handles a datagram within
+ * sendmsg() and answers in order, so once that ACK is read every error
+ * for the batch has been too, and the sockets without one are gone.
+ * They are shown then, in dump order.
+ */
+#define KILL_CHUNK	32768
+#define KILL_ACK_COST	2048	/* receive queue cost of an error reply */
+#define KILL_WINDOW_MAX	(INT_MAX / KILL_ACK_COST)
+
+struct kill_ent {
+	struct nlmsghdr		*h;	/* copy of the dumped socket */
+	int			protocol;
+	int			error;
+};
+
+static struct {
+	struct rtnl_handle	*rth;
+	unsigned int		window;		/* requests per batch */
+	unsigned int		rate;		/* kills per second, 0: no limit */
+	char			*buf;		/* queued requests */
+	unsigned int		len;
+	struct kill_ent		*ent;
+	unsigned int		count;
+	__u32			seq;		/* of ent[0] */
+	unsigned long long	sent;
+	struct timespec		start;
+} killer = {
+	.window = 4096,
+};
+
+struct kill_req {
+	struct nlmsghdr		nlh;
+	struct inet_diag_req_v2	r;
+};
+
+static int kill_open(struct rtnl_handle *rth)
+{
+	int one = 1;
+	int size;
+
+	/* Errors do not need to carry the request back */
+	setsockopt(rth->fd, SOL_NETLINK, NETLINK_CAP_ACK, &one, sizeof(one));
+
+	/* Every request of a batch may fail, make room for all the errors */
+	size = rtnl_set_rcvbuf(rth, killer.window * KILL_ACK_COST);
+	if (size > 0 && killer.window > size / KILL_ACK_COST)
+		killer.window = size / KILL_ACK_COST ? : 1;
+
+	/* Spread the kills over ten batches a second */
+	if (killer.rate && killer.window > killer.rate / 10)
+		killer.window = killer.rate / 10 ? : 1;
+
+	killer.buf = malloc(killer.window * sizeof(struct kill_req));
+	killer.ent = calloc(killer.window, sizeof(*killer.ent));
+	if (!killer.buf || !killer.ent) {
+		fprintf(stderr, "ss: not enough memory for --kill\n");
+		free(killer.buf);
+		free(killer.ent);
+		return -1;
+	}
+
+	killer.rth = rth;
+	killer.len = killer.count = 0;
+	if (!killer.sent)
+		clock_gettime(CLOCK_MONOTONIC, &killer.start);
+	return 0;
+}
+
+static void kill_close(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < killer.count; i++)
+		free(killer.ent[i].h);
+	free(killer.buf);
+	free(killer.ent);
+	killer.buf = NULL;
+	killer.ent = NULL;
+	killer.rth = NULL;
+	killer.count = 0;
+}
+
+/* Hold the batch back until it fits within --kill-rate */
+static void kill_throttle(void)
+{
+	struct timespec now, delay;
+	double due;
+
+	if (!killer.rate)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	due = (double)killer.sent / killer.rate -
+	      (now.tv_sec - killer.start.tv_sec) -
+	      (now.tv_nsec - killer.start.tv_nsec) / 1e9;
+	if (due <= 0)
+		return;
+
+	delay.tv_sec = due;
+	delay.tv_nsec = (due - delay.tv_sec) * 1e9;
+	while (nanosleep(&delay, &delay) < 0 && errno == EINTR)
+		;
+}
+
+static int kill_send(void)
+{
+	unsigned int chunk = KILL_CHUNK / sizeof(struct kill_req) *
+			     sizeof(struct kill_req);
+	unsigned int off = 0;
+
+	while (off < killer.len) {
+		size_t len = MIN(chunk, killer.len - off);
+
+		if (send(killer.rth->fd, killer.buf + off, len, 0) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("SOCK_DESTROY send");
+			return -1;
+		}
+		off += len;
+	}
+	return 0;
+}
+
+/* Read replies up to the ACK of the last request, and note the errors */
+static int kill_collect(void)
+{
+	__u32 last = killer.seq + killer.count - 1;
+	char buf[16384];
+
+	for (;;) {
+		struct nlmsghdr *h = (struct nlmsghdr *)buf;
+		ssize_t len = recv(killer.rth->fd, buf, sizeof(buf), 0);
+
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == ENOBUFS)
+				fprintf(stderr, "ss: SOCK_DESTROY replies lost, %u sockets may or may not be closed\n",
+					killer.count);
+			else
+				perror("SOCK_DESTROY receive");
+			return -1;
+		}
+
+		for (; NLMSG_OK(h, len); h = NLMSG_NEXT(h, len)) {
+			struct nlmsgerr *err = NLMSG_DATA(h);
+			__u32 i = h->nlmsg_seq - killer.seq;
 
-	msg = (struct msghdr) {
-		.msg_name = (void *)&nladdr,
-		.msg_namelen = sizeof(nladdr),
-		.msg_iov = iov,
-		.msg_iovlen = iovlen,
-	};
+			if (h->nlmsg_type != NLMSG_ERROR ||
+			    h->nlmsg_len < NLMSG_LENGTH(sizeof(*err)) ||
+			    i >= killer.count)
+				continue;
 
-	if (sendmsg(fd, &msg, 0) < 0) {
-		free(bpf_rta);
-		close(fd);
-		return -1;
+			killer.ent[i].error = -err->error;
+			if (h->nlmsg_seq == last)
+				return 0;
+		}
 	}
+}
 
-	free(bpf_rta);
+static int inet_show_killed(struct nlmsghdr *h, int protocol);
 
-	return 0;
-}
+/* Send the queued requests and show the sockets they closed */
+static int kill_flush(void)
+{
+	int err = 0, error = 0;
+	unsigned int i;
 
-struct inet_diag_arg {
-	struct filter *f;
-	int protocol;
-	struct rtnl_handle *rth;
-};
+	if (!killer.count)
+		return 0;
+
+	((struct kill_req *)killer.buf)[killer.count - 1].nlh.nlmsg_flags |=
+		NLM_F_ACK;
+
+	kill_throttle();
+	killer.sent += killer.count;
+	if (kill_send() || kill_collect())
+		err = -1;
+
+	for (i = 0; i < killer.count; i++) {
+		struct kill_ent *e = &killer.ent[i];
+
+		switch (e->error) {
+		case 0:
+			if (!err && inet_show_killed(e->h, e->protocol) < 0)
+				err = -1;
+			break;
+		case EOPNOTSUPP:
+		case ENOENT:
+			/* Socket can't be closed, or is already closed. */
+			break;
+		default:
+			if (!error)
+				error = e->error;
+		}
+		free(e->h);
+	}
+	killer.count = killer.len = 0;
+
+	if (error) {
+		errno = error;
+		perror("SOCK_DESTROY answers");
+		err = -1;
+	}
+	return err;
+}
 
 static int kill_inet_sock(struct nlmsghdr *h, void *arg, struct sockstat *s)
 {
 	struct inet_diag_msg *d = NLMSG_DATA(h);
 	struct inet_diag_arg *diag_arg = arg;
-	struct rtnl_handle *rth = diag_arg->rth;
+	struct kill_ent *e;
+	struct kill_req *req;
 
-	DIAG_REQUEST(req, struct inet_diag_req_v2 r);
+	if (killer.count == killer.window && kill_flush() < 0)
+		return -1;
+
+	e = &killer.ent[killer.count];
+	e->h = malloc(h->nlmsg_len);
+	if (!e->h) {
+		fprintf(stderr, "ss: not enough memory for --kill\n");
+		return -1;
+	}
+	memcpy(e->h, h, h->nlmsg_len);
+	e->protocol = diag_arg->protocol;
+	e->error = 0;
 
-	req.nlh.nlmsg_type = SOCK_DESTROY;
-	req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
-	req.nlh.nlmsg_seq = ++rth->seq;
-	req.r.sdiag_family = d->idiag_family;
-	req.r.sdiag_protocol = diag_arg->protocol;
-	req.r.id = d->id;
+	req = (struct kill_req *)(killer.buf + killer.len);
+	memset(req, 0, sizeof(*req));
+	req->nlh.nlmsg_len = sizeof(*req);
+	req->nlh.nlmsg_type = SOCK_DESTROY;
+	req->nlh.nlmsg_flags = NLM_F_REQUEST;
+	req->nlh.nlmsg_seq = ++killer.rth->seq;
+	req->r.sdiag_family = d->idiag_family;
+	req->r.sdiag_protocol = diag_arg->protocol;
+	req->r.id = d->id;
 
 	if (diag_arg->protocol == IPPROTO_RAW) {
-		struct inet_diag_req_raw *raw = (void *)&req.r;
+		struct inet_diag_req_raw *raw = (void *)&req->r;
 
-		BUILD_BUG_ON(sizeof(req.r) != sizeof(*raw));
+		BUILD_BUG_ON(sizeof(req->r) != sizeof(*raw));
 		raw->sdiag_raw_protocol = s->raw_prot;
 	}
 
-	return rtnl_talk(rth, &req.nlh, NULL);
+	if (!killer.count)
+		killer.seq = req->nlh.nlmsg_seq;
+	killer.count++;
+	killer.len += sizeof(*req);
+	return 0;
+}
+
+static int inet_show_parsed(struct nlmsghdr *h, struct sockstat *s)
+{
+	if (agg_enabled()) {
+		agg_inet_sock(h, s);
+		return 0;
+	}
+	if (top.k) {
+		top_inet_sock(h, s);
+		return 0;
+	}
+
+	return inet_show_sock(h, s);
+}
+
+static int inet_show_killed(struct nlmsghdr *h, int protocol)
+{
+	struct sockstat s = {};
+
+	parse_diag_msg(h, &s);
+	s.type = protocol;
+	return inet_show_parsed(h, &s);
 }
 
 static int show_one_inet_sock(struct nlmsghdr *h, void *arg)
 {
-	int err;
 	struct inet_diag_arg *diag_arg = arg;
 	struct inet_diag_msg *r = NLMSG_DATA(h);
 	struct sockstat s = {};
@@ -4078,21 +6655,11 @@ static int show_one_inet_sock(struct nlmsghdr *h, void *arg)
 	if (diag_arg->f->f && run_ssfilter(diag_arg->f->f, &s) == 0)
 		return 0;
 
-	if (diag_arg->f->kill && kill_inet_sock(h, arg, &s) != 0) {
-		if (errno == EOPNOTSUPP || errno == ENOENT) {
-			/* Socket can't be closed, or is already closed. */
-			return 0;
-		} else {
-			perror("SOCK_DESTROY answers");
-			return -1;
-		}
-	}
-
-	err = inet_show_sock(h, &s);
-	if (err < 0)
-		return err;
+	/* Shown by kill_flush() once closed */
+	if (diag_arg->f->kill)
+		return kill_inet_sock(h, arg, &s);
 
-	return 0;
+	return inet_show_parsed(h, &s);
 }
 
 static int inet_show_netlink(struct filter *f, FILE *dump_fp, int protocol)
@@ -4110,6 +6677,11 @@ static int inet_show_netlink(struct filter *f, FILE *dump_fp, int protocol)
 			rtnl_close(&rth);
 			return -1;
 		}
+		if (kill_open(&rth2)) {
+			rtnl_close(&rth2);
+			rtnl_close(&rth);
+			return -1;
+		}
 		arg.rth = &rth2;
 	}
 
@@ -4130,7 +6702,10 @@ again:
 	if ((err = sockdiag_send(family, rth.fd, protocol, f)))
 		goto Exit;
 
-	if ((err = rtnl_dump_filter(&rth, show_one_inet_sock, &arg))) {
+	err = rtnl_dump_filter(&rth, show_one_inet_sock, &arg);
+	if (f->kill && kill_flush() && !err)
+		err = -1;
+	if (err) {
 		if (family != PF_UNSPEC) {
 			family = PF_UNSPEC;
 			goto again;
@@ -4144,8 +6719,10 @@ again:
 
 Exit:
 	rtnl_close(&rth);
-	if (arg.rth)
+	if (arg.rth) {
+		kill_close();
 		rtnl_close(arg.rth);
+	}
 	return err;
 }
 
@@ -4167,6 +6744,11 @@ static int tcp_show_netlink_file(struct filter *f)
 		struct sockstat s = {};
 
 		status = fread(buf, 1, sizeof(*h), fp);
+		/* Events saved with -E -D end without NLMSG_DONE */
+		if (status == 0 && feof(fp)) {
+			err = 0;
+			break;
+		}
 		if (status != sizeof(*h)) {
 			if (ferror(fp))
 				perror("Reading header from $TCPDIAG_FILE");
@@ -4210,6 +6792,11 @@ static int tcp_show_netlink_file(struct filter *f)
 		if (f && f->f && run_ssfilter(f->f, &s) == 0)
 			continue;
 
+		if (agg_enabled()) {
+			agg_inet_sock(h, &s);
+			continue;
+		}
+
 		err2 = inet_show_sock(h, &s);
 		if (err2 < 0) {
 			err = err2;
@@ -4224,8 +6811,6 @@ static int tcp_show_netlink_file(struct filter *f)
 static int tcp_show(struct filter *f)
 {
 	FILE *fp = NULL;
-	char *buf = NULL;
-	int bufsize = 1024*1024;
 
 	if (!filter_af_get(f, AF_INET) && !filter_af_get(f, AF_INET6))
 		return 0;
@@ -4240,21 +6825,10 @@ static int tcp_show(struct filter *f)
 		return 0;
 
 	/* Sigh... We have to parse /proc/net/tcp... */
-	while (bufsize >= 64*1024) {
-		if ((buf = malloc(bufsize)) != NULL)
-			break;
-		bufsize /= 2;
-	}
-	if (buf == NULL) {
-		errno = ENOMEM;
-		return -1;
-	}
-
 	if (f->families & FAMILY_MASK(AF_INET)) {
 		if ((fp = net_tcp_open()) == NULL)
 			goto outerr;
 
-		setbuffer(fp, buf, bufsize);
 		if (generic_record_read(fp, tcp_show_line, f, AF_INET))
 			goto outerr;
 		fclose(fp);
@@ -4262,20 +6836,17 @@ static int tcp_show(struct filter *f)
 
 	if ((f->families & FAMILY_MASK(AF_INET6)) &&
 	    (fp = net_tcp6_open()) != NULL) {
-		setbuffer(fp, buf, bufsize);
 		if (generic_record_read(fp, tcp_show_line, f, AF_INET6))
 			goto outerr;
 		fclose(fp);
 	}
 
-	free(buf);
 	return 0;
 
 outerr:
 	do {
 		int saved_errno = errno;
 
-		free(buf);
 		if (fp)
 			fclose(fp);
 		errno = saved_errno;
@@ -4323,8 +6894,6 @@ static int dgram_show_line(char *line, const struct filter *f, int family)
 {
 	struct sockstat s = {};
 	char *loc, *rem, *data;
-	char opt[256];
-	int n;
 
 	if (proc_inet_split_line(line, &loc, &rem, &data))
 		return -1;
@@ -4339,20 +6908,18 @@ static int dgram_show_line(char *line, const struct filter *f, int family)
 	if (f->f && run_ssfilter(f->f, &s) == 0)
 		return 0;
 
-	opt[0] = 0;
-	n = sscanf(data, "%x %x:%x %*x:%*x %*x %d %*d %u %d %llx %[^\n]\n",
-	       &s.state, &s.wq, &s.rq,
-	       &s.uid, &s.ino,
-	       &s.refcnt, &s.sk, opt);
-
-	if (n < 9)
-		opt[0] = 0;
+	proc_scan(&data, "x x:x *x:*x *x u *d u d X",
+		  &s.state, &s.wq, &s.rq,
+		  &s.uid, &s.ino,
+		  &s.refcnt, &s.sk);
 
 	s.type = dg_proto == UDP_PROTO ? IPPROTO_UDP : 0;
-	inet_stats_print(&s, false);
+	if (agg_enabled()) {
+		agg_add(&s, NULL, NULL);
+		return 0;
+	}
 
-	if (show_details && opt[0])
-		out(" opt:\"%s\"", opt);
+	inet_stats_print(&s, false);
 
 	return 0;
 }
@@ -4366,75 +6933,352 @@ static int udp_show(struct filter *f)
 
 	dg_proto = UDP_PROTO;
 
-	if (!getenv("PROC_NET_UDP") && !getenv("PROC_ROOT")
-	    && inet_show_netlink(f, NULL, IPPROTO_UDP) == 0)
-		return 0;
+	if (!getenv("PROC_NET_UDP") && !getenv("PROC_ROOT")
+	    && inet_show_netlink(f, NULL, IPPROTO_UDP) == 0)
+		return 0;
+
+	if (f->families&FAMILY_MASK(AF_INET)) {
+		if ((fp = net_udp_open()) == NULL)
+			goto outerr;
+		if (generic_record_read(fp, dgram_show_line, f, AF_INET))
+			goto outerr;
+		fclose(fp);
+	}
+
+	if ((f->families&FAMILY_MASK(AF_INET6)) &&
+	    (fp = net_udp6_open()) != NULL) {
+		if (generic_record_read(fp, dgram_show_line, f, AF_INET6))
+			goto outerr;
+		fclose(fp);
+	}
+	return 0;
+
+outerr:
+	do {
+		int saved_errno = errno;
+
+		if (fp)
+			fclose(fp);
+		errno = saved_errno;
+		return -1;
+	} while (0);
+}
+
+static int raw_show(struct filter *f)
+{
+	FILE *fp = NULL;
+
+	if (!filter_af_get(f, AF_INET) && !filter_af_get(f, AF_INET6))
+		return 0;
+
+	dg_proto = RAW_PROTO;
+
+	if (!getenv("PROC_NET_RAW") && !getenv("PROC_ROOT") &&
+	    inet_show_netlink(f, NULL, IPPROTO_RAW) == 0)
+		return 0;
+
+	if (f->families&FAMILY_MASK(AF_INET)) {
+		if ((fp = net_raw_open()) == NULL)
+			goto outerr;
+		if (generic_record_read(fp, dgram_show_line, f, AF_INET))
+			goto outerr;
+		fclose(fp);
+	}
+
+	if ((f->families&FAMILY_MASK(AF_INET6)) &&
+	    (fp = net_raw6_open()) != NULL) {
+		if (generic_record_read(fp, dgram_show_line, f, AF_INET6))
+			goto outerr;
+		fclose(fp);
+	}
+	return 0;
+
+outerr:
+	do {
+		int saved_errno = errno;
+
+		if (fp)
+			fclose(fp);
+		errno = saved_errno;
+		return -1;
+	} while (0);
+}
+
+/* Several namespaces at once (--all-netns, -N NS1,NS2,...): a pool of
+ * threads enters the namespaces with setns(), which only affects the
+ * calling thread, and captures the raw inet_diag dumps in memory. The
+ * main thread replays them in namespace name order as they complete.
+ */
+static const struct {
+	int	db;
+	int	protocol;
+	const char **dg_proto;
+} netns_tables[] = {
+	{ RAW_DB,	IPPROTO_RAW,	&RAW_PROTO },
+	{ UDP_DB,	IPPROTO_UDP,	&UDP_PROTO },
+	{ TCP_DB,	IPPROTO_TCP,	&TCP_PROTO },
+	{ DCCP_DB,	IPPROTO_DCCP },
+	{ SCTP_DB,	IPPROTO_SCTP },
+	{ MPTCP_DB,	IPPROTO_MPTCP },
+};
+
+struct netns_link {
+	unsigned int	index;
+	char		name[IFNAMSIZ];
+};
+
+struct netns_dump {
+	char	*name;
+	char	*buf[ARRAY_SIZE(netns_tables)];
+	size_t	len[ARRAY_SIZE(netns_tables)];
+	struct netns_link *links;	/* by index */
+	unsigned int	nlinks;
+	bool	done;
+};
+
+static struct {
+	struct netns_dump *ns;
+	unsigned int	count;
+	unsigned int	next;
+	struct filter	*f;
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+} netns_all = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+/* The namespace being replayed, whose devices are printed */
+static const struct netns_dump *netns_cur;
+
+static bool netns_many(void)
+{
+	return netns_all.count > 0;
+}
+
+static int netns_link_cmp(const void *a, const void *b)
+{
+	const struct netns_link *l1 = a, *l2 = b;
+
+	return (l1->index > l2->index) - (l1->index < l2->index);
+}
+
+static const char *ss_index_to_name(unsigned int ifindex)
+{
+	const struct netns_link *l, key = { .index = ifindex };
+
+	if (!netns_cur)
+		return ll_index_to_name(ifindex);
+
+	l = bsearch(&key, netns_cur->links, netns_cur->nlinks,
+		    sizeof(*l), netns_link_cmp);
+	return l ? l->name : ll_idx_n2a(ifindex);
+}
+
+static int netns_link_add(struct nlmsghdr *n, void *arg)
+{
+	struct netns_dump *ns = arg;
+	struct ifinfomsg *ifi = NLMSG_DATA(n);
+	struct rtattr *tb[IFLA_MAX + 1];
+	struct netns_link *l;
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi));
+
+	if (n->nlmsg_type != RTM_NEWLINK || len < 0)
+		return 0;
+	parse_rtattr_flags(tb, IFLA_MAX, IFLA_RTA(ifi), len, NLA_F_NESTED);
+	if (!tb[IFLA_IFNAME])
+		return 0;
+
+	l = realloc(ns->links, (ns->nlinks + 1) * sizeof(*l));
+	if (!l)
+		return -1;
+	ns->links = l;
+	l += ns->nlinks++;
+	l->index = ifi->ifi_index;
+	strlcpy(l->name, rta_getattr_str(tb[IFLA_IFNAME]), sizeof(l->name));
+	return 0;
+}
+
+/* Remember the device names of the namespace the thread is in */
+static void netns_dump_links(struct netns_dump *ns)
+{
+	struct rtnl_handle rth;
+
+	if (rtnl_open(&rth, 0) < 0)
+		return;
+	if (rtnl_linkdump_req_filter(&rth, AF_UNSPEC,
+				     RTEXT_FILTER_SKIP_STATS) >= 0)
+		rtnl_dump_filter(&rth, netns_link_add, ns);
+	rtnl_close(&rth);
+
+	qsort(ns->links, ns->nlinks, sizeof(*ns->links), netns_link_cmp);
+}
+
+static void netns_all_add(const char *name)
+{
+	struct netns_dump *ns;
+
+	ns = realloc(netns_all.ns, (netns_all.count + 1) * sizeof(*ns));
+	if (!ns) {
+		fprintf(stderr, "ss: failed to malloc buffer\n");
+		abort();
+	}
+	netns_all.ns = ns;
+	ns += netns_all.count++;
+	memset(ns, 0, sizeof(*ns));
+	ns->name = strdup(name);
+}
+
+static int netns_all_add_one(char *name, void *arg)
+{
+	netns_all_add(name);
+	return 0;
+}
+
+static int netns_dump_cmp(const void *a, const void *b)
+{
+	const struct netns_dump *n1 = a, *n2 = b;
+
+	return strcmp(n1->name, n2->name);
+}
+
+static void netns_dump_one(struct netns_dump *ns)
+{
+	unsigned int i;
+	int fd;
+
+	fd = netns_get_fd(ns->name);
+	if (fd < 0 || setns(fd, CLONE_NEWNET) < 0) {
+		fprintf(stderr, "Cannot open network namespace \"%s\": %s\n",
+			ns->name, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return;
+	}
+	close(fd);
+
+	netns_dump_links(ns);
+
+	for (i = 0; i < ARRAY_SIZE(netns_tables); i++) {
+		FILE *fp;
+
+		if (!(netns_all.f->dbs & (1 << netns_tables[i].db)))
+			continue;
+
+		fp = open_memstream(&ns->buf[i], &ns->len[i]);
+		if (!fp)
+			continue;
+		/* Tables the kernel can't dump are skipped, as they are
+		 * without a namespace list
+		 */
+		if (inet_show_netlink(netns_all.f, fp, netns_tables[i].protocol))
+			ns->len[i] = 0;
+		fclose(fp);
+	}
+}
+
+static void *netns_dump_worker(void *arg)
+{
+	unsigned int i;
+
+	while ((i = __atomic_fetch_add(&netns_all.next, 1,
+				       __ATOMIC_RELAXED)) < netns_all.count) {
+		netns_dump_one(&netns_all.ns[i]);
+
+		pthread_mutex_lock(&netns_all.lock);
+		netns_all.ns[i].done = true;
+		pthread_cond_broadcast(&netns_all.cond);
+		pthread_mutex_unlock(&netns_all.lock);
+	}
+	return NULL;
+}
+
+static int netns_replay(struct filter *f, int protocol, char *buf, size_t len)
+{
+	struct inet_diag_arg arg = { .f = f, .protocol = protocol };
+
+	while (len >= sizeof(struct nlmsghdr)) {
+		struct nlmsghdr *h = (struct nlmsghdr *)buf;
+		size_t msglen = NLMSG_ALIGN(h->nlmsg_len);
+		int err;
 
-	if (f->families&FAMILY_MASK(AF_INET)) {
-		if ((fp = net_udp_open()) == NULL)
-			goto outerr;
-		if (generic_record_read(fp, dgram_show_line, f, AF_INET))
-			goto outerr;
-		fclose(fp);
-	}
+		if (h->nlmsg_len < sizeof(*h) || msglen > len)
+			break;
 
-	if ((f->families&FAMILY_MASK(AF_INET6)) &&
-	    (fp = net_udp6_open()) != NULL) {
-		if (generic_record_read(fp, dgram_show_line, f, AF_INET6))
-			goto outerr;
-		fclose(fp);
+		/* Each family dumped ends with its own NLMSG_DONE */
+		if (h->nlmsg_type != NLMSG_DONE &&
+		    h->nlmsg_type != NLMSG_ERROR) {
+			err = show_one_inet_sock(h, &arg);
+			if (err < 0)
+				return err;
+		}
+		buf += msglen;
+		len -= msglen;
 	}
 	return 0;
-
-outerr:
-	do {
-		int saved_errno = errno;
-
-		if (fp)
-			fclose(fp);
-		errno = saved_errno;
-		return -1;
-	} while (0);
 }
 
-static int raw_show(struct filter *f)
+static int netns_show(struct filter *f)
 {
-	FILE *fp = NULL;
+	pthread_t *threads;
+	unsigned int i, j;
+	int nthreads, err = 0;
 
 	if (!filter_af_get(f, AF_INET) && !filter_af_get(f, AF_INET6))
 		return 0;
 
-	dg_proto = RAW_PROTO;
+	qsort(netns_all.ns, netns_all.count, sizeof(*netns_all.ns),
+	      netns_dump_cmp);
+	netns_all.f = f;
 
-	if (!getenv("PROC_NET_RAW") && !getenv("PROC_ROOT") &&
-	    inet_show_netlink(f, NULL, IPPROTO_RAW) == 0)
-		return 0;
+	nthreads = proc_threads;
+	if (nthreads <= 0)
+		nthreads = min(sysconf(_SC_NPROCESSORS_ONLN), 8L);
+	nthreads = min(nthreads, (int)netns_all.count);
 
-	if (f->families&FAMILY_MASK(AF_INET)) {
-		if ((fp = net_raw_open()) == NULL)
-			goto outerr;
-		if (generic_record_read(fp, dgram_show_line, f, AF_INET))
-			goto outerr;
-		fclose(fp);
+	/* Workers change their namespace, the main thread keeps its own */
+	threads = calloc(nthreads, sizeof(*threads));
+	if (!threads)
+		return -1;
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&threads[i], NULL, netns_dump_worker, NULL))
+			break;
 	}
-
-	if ((f->families&FAMILY_MASK(AF_INET6)) &&
-	    (fp = net_raw6_open()) != NULL) {
-		if (generic_record_read(fp, dgram_show_line, f, AF_INET6))
-			goto outerr;
-		fclose(fp);
+	if (i == 0) {
+		perror("pthread_create");
+		free(threads);
+		return -1;
 	}
-	return 0;
+	nthreads = i;
 
-outerr:
-	do {
-		int saved_errno = errno;
+	for (i = 0; i < netns_all.count; i++) {
+		struct netns_dump *ns = &netns_all.ns[i];
 
-		if (fp)
-			fclose(fp);
-		errno = saved_errno;
-		return -1;
-	} while (0);
+		pthread_mutex_lock(&netns_all.lock);
+		while (!ns->done)
+			pthread_cond_wait(&netns_all.cond, &netns_all.lock);
+		pthread_mutex_unlock(&netns_all.lock);
+
+		netns_name = ns->name;
+		netns_cur = ns;
+		for (j = 0; j < ARRAY_SIZE(netns_tables); j++) {
+			if (!err && ns->len[j]) {
+				if (netns_tables[j].dg_proto)
+					dg_proto = *netns_tables[j].dg_proto;
+				err = netns_replay(f, netns_tables[j].protocol,
+						   ns->buf[j], ns->len[j]);
+			}
+			free(ns->buf[j]);
+		}
+		free(ns->links);
+	}
+	netns_name = NULL;
+	netns_cur = NULL;
+
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	return err;
 }
 
 #define MAX_UNIX_REMEMBER (1024*1024/sizeof(struct sockstat))
@@ -4590,8 +7434,9 @@ static int unix_show_netlink(struct filter *f)
 
 static int unix_show(struct filter *f)
 {
+	struct proc_reader r;
 	FILE *fp;
-	char buf[256];
+	char *buf;
 	char name[128];
 	int  newformat = 0;
 	int  cnt;
@@ -4608,7 +7453,8 @@ static int unix_show(struct filter *f)
 
 	if ((fp = net_unix_open()) == NULL)
 		return -1;
-	if (!fgets(buf, sizeof(buf), fp)) {
+	if (proc_reader_init(&r, fp) || !(buf = proc_reader_line(&r))) {
+		proc_reader_free(&r);
 		fclose(fp);
 		return -1;
 	}
@@ -4617,17 +7463,25 @@ static int unix_show(struct filter *f)
 		newformat = 1;
 	cnt = 0;
 
-	while (fgets(buf, sizeof(buf), fp)) {
+	while ((buf = proc_reader_line(&r)) != NULL) {
 		struct sockstat *u, **insp;
 		int flags;
+		size_t len;
 
 		if (!(u = calloc(1, sizeof(*u))))
 			break;
 
-		if (sscanf(buf, "%x: %x %x %x %x %x %d %s",
-			   &u->rport, &u->rq, &u->wq, &flags, &u->type,
-			   &u->state, &u->ino, name) < 8)
-			name[0] = 0;
+		name[0] = 0;
+		if (proc_scan(&buf, "x: x x x x x d",
+			      &u->rport, &u->rq, &u->wq, &flags, &u->type,
+			      &u->state, &u->ino) == 7) {
+			buf += strspn(buf, " \t");
+			len = strcspn(buf, " \t");
+			if (len >= sizeof(name))
+				len = sizeof(name) - 1;
+			memcpy(name, buf, len);
+			name[len] = 0;
+		}
 
 		u->lport = u->ino;
 		u->local.family = u->remote.family = AF_UNIX;
@@ -4712,6 +7566,7 @@ static int unix_show(struct filter *f)
 			cnt = 0;
 		}
 	}
+	proc_reader_free(&r);
 	fclose(fp);
 	while (list) {
 		unix_stats_print(list, f);
@@ -4926,10 +7781,10 @@ static int packet_show_line(char *buf, const struct filter *f, int fam)
 	struct sockstat stat = {};
 	int type, prot, iface, state, rq, uid, ino;
 
-	sscanf(buf, "%llx %*d %d %x %d %d %u %u %u",
-			&sk,
-			&type, &prot, &iface, &state,
-			&rq, &uid, &ino);
+	proc_scan(&buf, "X *d d x d d u u u",
+		  &sk,
+		  &type, &prot, &iface, &state,
+		  &rq, &uid, &ino);
 
 	if (type == SOCK_RAW && !(f->dbs & (1<<PACKET_R_DB)))
 		return 0;
@@ -5508,6 +8363,8 @@ static int generic_show_sock(struct nlmsghdr *nlh, void *arg)
 	case AF_INET6:
 		inet_arg.rth = inet_arg.f->rth_for_killing;
 		ret = show_one_inet_sock(nlh, &inet_arg);
+		if (inet_arg.f->kill && kill_flush() && !ret)
+			ret = -1;
 		break;
 	case AF_UNIX:
 		ret = unix_show_sock(nlh, arg);
@@ -5533,7 +8390,293 @@ static int generic_show_sock(struct nlmsghdr *nlh, void *arg)
 	return ret;
 }
 
-static int handle_follow_request(struct filter *f)
+/* inet_diag bytecode only applies to dumps, so destroy notifications
+ * are selected with a classic BPF socket filter instead.  The program
+ * is built backwards from its accept and reject returns, so that every
+ * jump target is known when the jump is emitted.  Conditions it can't
+ * test accept, the filter then lets through a superset of the sockets
+ * run_ssfilter() selects.
+ */
+struct ev_bpf {
+	struct sock_filter	insn[BPF_MAXINSNS];
+	int			pos;	/* of the first instruction */
+	bool			fail;
+};
+
+#define EV_OFF(field)	(NLMSG_HDRLEN + offsetof(struct inet_diag_msg, field))
+
+static int ev_bpf_stmt(struct ev_bpf *p, __u16 code, __u32 k)
+{
+	if (p->pos == 0) {
+		p->fail = true;
+		return p->pos;
+	}
+	p->insn[--p->pos] = (struct sock_filter)BPF_STMT(code, k);
+	return p->pos;
+}
+
+/* Jump to instruction @yes if the test passes, to @no otherwise */
+static int ev_bpf_jump(struct ev_bpf *p, __u16 code, __u32 k, int yes, int no)
+{
+	int pos = p->pos - 1;
+
+	if (pos < 0 || yes - pos - 1 > 255 || no - pos - 1 > 255) {
+		p->fail = true;
+		return p->pos;
+	}
+	p->insn[pos] = (struct sock_filter)BPF_JUMP(code, k, yes - pos - 1,
+						    no - pos - 1);
+	return p->pos = pos;
+}
+
+/* Does the address at @off start with the first @bits of @addr? */
+static int ev_bpf_addr(struct ev_bpf *p, unsigned int off, const __u32 *addr,
+		       int bits, int yes, int no)
+{
+	int words = bits / 32;
+	int i;
+
+	if (bits % 32) {
+		__u32 mask = 0xffffffffU << (32 - bits % 32);
+
+		ev_bpf_jump(p, BPF_JMP | BPF_JEQ | BPF_K,
+			    ntohl(addr[words]) & mask, yes, no);
+		ev_bpf_stmt(p, BPF_ALU | BPF_AND | BPF_K, mask);
+		yes = ev_bpf_stmt(p, BPF_LD | BPF_W | BPF_ABS, off + 4 * words);
+	}
+	for (i = words - 1; i >= 0; i--) {
+		ev_bpf_jump(p, BPF_JMP | BPF_JEQ | BPF_K, ntohl(addr[i]),
+			    yes, no);
+		yes = ev_bpf_stmt(p, BPF_LD | BPF_W | BPF_ABS, off + 4 * i);
+	}
+	return yes;
+}
+
+/* Any of the prefixes in the list at @a, as in inet2_addr_match() */
+static int ev_bpf_hosts(struct ev_bpf *p, const struct aafilter *a,
+			unsigned int off, int yes, int no)
+{
+	const __u32 v4mapped[3] = { 0, 0, htonl(0xffff) };
+	int rest, next;
+
+	if (!a)
+		return no;
+
+	/* A miss on this prefix goes on with the rest of the list */
+	rest = next = ev_bpf_hosts(p, a->next, off, yes, no);
+	if (a->addr.family == AF_INET) {
+		next = ev_bpf_addr(p, off + 12, a->addr.data, a->addr.bitlen,
+				   yes, rest);
+		next = ev_bpf_addr(p, off, v4mapped, 96, next, rest);
+		ev_bpf_jump(p, BPF_JMP | BPF_JEQ | BPF_K, AF_INET6, next, rest);
+		next = ev_bpf_stmt(p, BPF_LD | BPF_B | BPF_ABS,
+				   EV_OFF(idiag_family));
+	}
+	return ev_bpf_addr(p, off, a->addr.data, a->addr.bitlen, yes, next);
+}
+
+static bool ev_bpf_exact(const struct ssfilter *f)
+{
+	switch (f->type) {
+	case SSF_DCOND:
+	case SSF_SCOND:
+		return ssfilter_hostcond_offloadable((void *)f->pred);
+	case SSF_AND:
+	case SSF_OR:
+		return ev_bpf_exact(f->pred) && ev_bpf_exact(f->post);
+	case SSF_NOT:
+		return ev_bpf_exact(f->pred);
+	case SSF_D_GE:
+	case SSF_D_LE:
+	case SSF_S_GE:
+	case SSF_S_LE:
+	case SSF_DEVCOND:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static int ev_bpf_cond(struct ev_bpf *p, const struct ssfilter *f,
+		       int yes, int no)
+{
+	const struct aafilter *a = (void *)f->pred;
+	bool src = f->type == SSF_SCOND || f->type == SSF_S_GE ||
+		   f->type == SSF_S_LE;
+	unsigned int port = src ? EV_OFF(id.idiag_sport) :
+				  EV_OFF(id.idiag_dport);
+	int entry;
+
+	switch (f->type) {
+	case SSF_DCOND:
+	case SSF_SCOND:
+		if (!ssfilter_hostcond_offloadable(a))
+			return yes;
+		entry = yes;
+		if (a->addr.bitlen)
+			entry = ev_bpf_hosts(p, a, src ? EV_OFF(id.idiag_src) :
+							 EV_OFF(id.idiag_dst),
+					     yes, no);
+		if (a->port != -1) {
+			ev_bpf_jump(p, BPF_JMP | BPF_JEQ | BPF_K, a->port,
+				    entry, no);
+			entry = ev_bpf_stmt(p, BPF_LD | BPF_H | BPF_ABS, port);
+		}
+		return entry;
+	case SSF_D_GE:
+	case SSF_S_GE:
+		if (a->port <= 0)
+			return yes;
+		if (a->port > 65535)
+			return no;
+		ev_bpf_jump(p, BPF_JMP | BPF_JGE | BPF_K, a->port, yes, no);
+		return ev_bpf_stmt(p, BPF_LD | BPF_H | BPF_ABS, port);
+	case SSF_D_LE:
+	case SSF_S_LE:
+		if (a->port < 0)
+			return no;
+		if (a->port >= 65535)
+			return yes;
+		ev_bpf_jump(p, BPF_JMP | BPF_JGT | BPF_K, a->port, no, yes);
+		return ev_bpf_stmt(p, BPF_LD | BPF_H | BPF_ABS, port);
+	case SSF_DEVCOND:
+		ev_bpf_jump(p, BPF_JMP | BPF_JEQ | BPF_K, ntohl(a->iface),
+			    yes, no);
+		return ev_bpf_stmt(p, BPF_LD | BPF_W | BPF_ABS,
+				   EV_OFF(id.idiag_if));
+	case SSF_AND:
+		entry = ev_bpf_cond(p, f->post, yes, no);
+		return ev_bpf_cond(p, f->pred, entry, no);
+	case SSF_OR:
+		entry = ev_bpf_cond(p, f->post, yes, no);
+		return ev_bpf_cond(p, f->pred, yes, entry);
+	case SSF_NOT:
+		if (!ev_bpf_exact(f->pred))
+			return yes;
+		return ev_bpf_cond(p, f->pred, no, yes);
+	default:
+		return yes;
+	}
+}
+
+/* Let through only the notifications that may pass the filter */
+static int follow_attach_filter(struct rtnl_handle *rth,
+				const struct ssfilter *f)
+{
+	struct sock_fprog prog;
+	struct ev_bpf *p;
+	int accept, entry;
+	int ret = 0;
+
+	p = calloc(1, sizeof(*p));
+	if (!p)
+		return -1;
+
+	p->pos = BPF_MAXINSNS;
+	ev_bpf_stmt(p, BPF_RET | BPF_K, 0);
+	accept = ev_bpf_stmt(p, BPF_RET | BPF_K, 0xffffffff);
+	entry = ev_bpf_cond(p, f, accept, accept + 1);
+	if (entry != p->pos)
+		ev_bpf_stmt(p, BPF_JMP | BPF_JA, entry - p->pos);
+
+	if (!p->fail && entry != accept) {
+		prog.len = BPF_MAXINSNS - p->pos;
+		prog.filter = p->insn + p->pos;
+		ret = setsockopt(rth->fd, SOL_SOCKET, SO_ATTACH_FILTER,
+				 &prog, sizeof(prog));
+	}
+	free(p);
+	return ret;
+}
+
+/* Notifications of sockets destroyed at a high rate need room */
+#define FOLLOW_RCVBUF	(32 * 1024 * 1024)
+
+static struct {
+	FILE			*dump_fp;	/* raw messages, -D */
+	bool			compact;
+	unsigned long long	lost;		/* not reported yet */
+	bool			overrun;
+	time_t			reported;
+} follow;
+
+static void follow_print_compact(const struct sockstat *s)
+{
+	char src[INET6_ADDRSTRLEN], dst[INET6_ADDRSTRLEN];
+
+	inet_ntop(s->local.family, s->local.data, src, sizeof(src));
+	inet_ntop(s->remote.family, s->remote.data, dst, sizeof(dst));
+	if (s->local.family == AF_INET6)
+		printf("%s %s [%s]:%d [%s]:%d\n", proto_name(s->type),
+		       sstate_name[s->state], src, s->lport, dst, s->rport);
+	else
+		printf("%s %s %s:%d %s:%d\n", proto_name(s->type),
+		       sstate_name[s->state], src, s->lport, dst, s->rport);
+}
+
+static int follow_show_event(struct rtnl_ctrl_data *ctrl,
+			     struct nlmsghdr *n, void *arg)
+{
+	struct inet_diag_msg *r = NLMSG_DATA(n);
+	struct filter *f = arg;
+	struct sockstat s = {};
+
+	if (!follow.dump_fp && !follow.compact)
+		return generic_show_sock(n, f);
+
+	if (n->nlmsg_type != SOCK_DIAG_BY_FAMILY ||
+	    n->nlmsg_len < NLMSG_LENGTH(sizeof(*r)) ||
+	    !(f->families & FAMILY_MASK(r->idiag_family)))
+		return 0;
+
+	parse_diag_msg(n, &s);
+	s.type = s.raw_prot;
+	if (f->f && run_ssfilter(f->f, &s) == 0)
+		return 0;
+
+	if (follow.dump_fp)
+		fwrite(n, 1, NLMSG_ALIGN(n->nlmsg_len), follow.dump_fp);
+	else
+		follow_print_compact(&s);
+	return 0;
+}
+
+static void follow_report(void)
+{
+	struct timespec now;
+
+	if (!follow.overrun)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+	if (now.tv_sec == follow.reported)
+		return;
+
+	if (follow.lost)
+		fprintf(stderr, "ss: %llu events dropped\n", follow.lost);
+	else
+		fprintf(stderr, "ss: events dropped\n");
+	follow.reported = now.tv_sec;
+	follow.lost = 0;
+	follow.overrun = false;
+}
+
+static int follow_overrun(struct rtnl_handle *rth, unsigned int lost,
+			  void *arg)
+{
+	follow.lost += lost;
+	follow.overrun = true;
+	return 0;
+}
+
+static int follow_batch_done(struct rtnl_handle *rth, void *arg)
+{
+	fflush(follow.dump_fp ? : stdout);
+	follow_report();
+	return 0;
+}
+
+static int handle_follow_request(struct filter *f, const char *dump_file)
 {
 	int ret = 0;
 	int groups = 0;
@@ -5557,20 +8700,87 @@ static int handle_follow_request(struct filter *f)
 	rth.dump = 0;
 	rth.local.nl_pid = 0;
 
+	rtnl_set_rcvbuf(&rth, FOLLOW_RCVBUF);
+	if (f->f && follow_attach_filter(&rth, f->f) < 0)
+		perror("ss: cannot filter events in the kernel");
+
+	if (dump_file) {
+		follow.dump_fp = stdout;
+		if (strcmp(dump_file, "-")) {
+			follow.dump_fp = fopen(dump_file, "w");
+			if (!follow.dump_fp) {
+				perror("fopen dump file");
+				rtnl_close(&rth);
+				return -1;
+			}
+		}
+	}
+
 	if (f->kill) {
 		if (rtnl_open_byproto(&rth2, groups, NETLINK_SOCK_DIAG)) {
 			rtnl_close(&rth);
 			return -1;
 		}
+		if (kill_open(&rth2)) {
+			rtnl_close(&rth2);
+			rtnl_close(&rth);
+			return -1;
+		}
 		f->rth_for_killing = &rth2;
 	}
 
-	if (rtnl_dump_filter(&rth, generic_show_sock, f))
+	if (rtnl_listen_batch(&rth, follow_show_event, follow_overrun,
+			      follow_batch_done, f) < 0)
 		ret = -1;
 
 	rtnl_close(&rth);
-	if (f->rth_for_killing)
+	if (f->rth_for_killing) {
+		kill_close();
 		rtnl_close(f->rth_for_killing);
+	}
+	return ret;
+}
+
+/* Dump TCP sockets every top.interval ms, and print the sockets with the
+ * highest rates since the previous dump.
+ */
+static int top_loop(struct filter *f)
+{
+	struct timespec prev, now, delay = {
+		.tv_sec = top.interval / 1000,
+		.tv_nsec = (top.interval % 1000) * 1000000,
+	};
+	unsigned int n;
+	int ret = -1;
+
+	dg_proto = TCP_PROTO;
+	top.heap = calloc(top.k, sizeof(*top.heap));
+	if (!top.heap)
+		goto out;
+
+	clock_gettime(CLOCK_MONOTONIC, &prev);
+	if (inet_show_netlink(f, NULL, IPPROTO_TCP))
+		goto out;
+	top_table_rotate();
+	top.primed = true;
+
+	for (n = 0; !top.count || n < top.count; n++) {
+		nanosleep(&delay, NULL);
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		top.elapsed = now.tv_sec - prev.tv_sec +
+			      (now.tv_nsec - prev.tv_nsec) / 1e9;
+		prev = now;
+
+		top.nsocks = top.nheap = 0;
+		if (inet_show_netlink(f, NULL, IPPROTO_TCP))
+			goto out;
+		top_table_rotate();
+		top_print();
+	}
+	ret = 0;
+out:
+	top_free();
 	return ret;
 }
 
@@ -5742,6 +8952,8 @@ static void _usage(FILE *dest)
 "   -m, --memory        show socket memory usage\n"
 "   -p, --processes     show process using socket\n"
 "   -T, --threads       show thread using socket\n"
+"       --proc-threads=N  scan /proc for socket owners, or dump namespaces,\n"
+"                       with N threads\n"
 "   -i, --info          show internal TCP information\n"
 "       --tipcinfo      show internal tipc socket information\n"
 "   -s, --summary       show socket usage summary\n"
@@ -5753,9 +8965,12 @@ static void _usage(FILE *dest)
 "       --bpf-map-id=MAP-ID    show a BPF socket-local storage map\n"
 #endif
 "   -E, --events        continually display sockets as they are destroyed\n"
+"       --compact       print events as NETID STATE LOCAL PEER lines\n"
 "   -Z, --context       display task SELinux security contexts\n"
 "   -z, --contexts      display task and socket SELinux security contexts\n"
-"   -N, --net           switch to the specified network namespace name\n"
+"   -N, --net           switch to the specified network namespace name,\n"
+"                       or dump each of a comma separated list of names\n"
+"       --all-netns     dump all named network namespaces\n"
 "\n"
 "   -4, --ipv4          display only IP version 4 sockets\n"
 "   -6, --ipv6          display only IP version 6 sockets\n"
@@ -5774,16 +8989,35 @@ static void _usage(FILE *dest)
 "       FAMILY := {inet|inet6|link|unix|netlink|vsock|tipc|xdp|help}\n"
 "\n"
 "   -K, --kill          forcibly close sockets, display what was closed\n"
+"       --kill-window=N close up to N sockets per batch, default 4096\n"
+"       --kill-rate=N   close no more than N sockets per second\n"
 "   -H, --no-header     Suppress header line\n"
 "   -Q, --no-queues     Suppress sending and receiving queue columns\n"
 "   -O, --oneline       socket's data printed on a single line\n"
 "       --inet-sockopt  show various inet socket options\n"
+"       --stream[=LINES] print every LINES lines (default 64) instead of\n"
+"                        sizing columns over the whole output\n"
+"       --aggregate=KEY[,KEY...]  count inet sockets per group of KEYs\n"
+"       KEY := {netid|state|family|src|dst|sport|dport|dev|uid|cong}\n"
+"       --stats=FIELD[,FIELD...]  summarise FIELDs per group\n"
+"       FIELD := {rtt|rttvar|minrtt|rto|cwnd|ssthresh|mss|pmtu|retrans|lost|\n"
+"                 unacked|delivery_rate|bytes_acked|bytes_received|recv-q|send-q}\n"
+"   -j, --json          print --aggregate and --stats output as JSON\n"
+"       --top=K         every interval, print the K TCP sockets with the\n"
+"                       highest rate of the --top-by counter\n"
+"       --top-by=COUNTER  bytes_acked (default), bytes_received, bytes_sent,\n"
+"                       bytes_retrans, segs_out, segs_in, retrans, delivered\n"
+"       --interval=MS   sampling interval for --top, default 1000\n"
+"       --count=N       stop --top after N intervals\n"
 "\n"
 "   -A, --query=QUERY, --socket=QUERY\n"
 "       QUERY := {all|inet|tcp|mptcp|udp|raw|unix|unix_dgram|unix_stream|unix_seqpacket|packet|packet_raw|packet_dgram|netlink|dccp|sctp|vsock_stream|vsock_dgram|tipc|xdp}[,QUERY]\n"
 "\n"
-"   -D, --diag=FILE     Dump raw information about TCP sockets to FILE\n"
+"   -D, --diag=FILE     Dump raw information about TCP sockets to FILE,\n"
+"                       or with -E, the destroyed sockets\n"
 "   -F, --filter=FILE   read filter information from FILE\n"
+"       --filter-report print how the filter is split between kernel\n"
+"                       and user space, then exit\n"
 "       FILTER := [ state STATE-FILTER ] [ EXPRESSION ]\n"
 "       STATE-FILTER := {all|connected|synchronized|bucket|big|TCP-STATES}\n"
 "         TCP-STATES := {established|syn-sent|syn-recv|fin-wait-{1,2}|time-wait|closed|close-wait|last-ack|listening|closing}\n"
@@ -5881,6 +9115,27 @@ wrong_state:
 #define OPT_BPF_MAPS 263
 #define OPT_BPF_MAP_ID 264
 
+#define OPT_PROC_THREADS 265
+
+#define OPT_STREAM 266
+
+#define OPT_AGGREGATE 267
+#define OPT_STATS 268
+
+#define OPT_TOP 269
+#define OPT_TOP_BY 270
+#define OPT_INTERVAL 271
+#define OPT_COUNT 272
+
+#define OPT_FILTER_REPORT 273
+
+#define OPT_ALL_NETNS 274
+
+#define OPT_KILL_WINDOW 275
+#define OPT_KILL_RATE 276
+
+#define OPT_COMPACT 277
+
 static const struct option long_opts[] = {
 	{ "numeric", 0, 0, 'n' },
 	{ "resolve", 0, 0, 'r' },
@@ -5921,12 +9176,26 @@ static const struct option long_opts[] = {
 	{ "tos", 0, 0, OPT_TOS },
 	{ "cgroup", 0, 0, OPT_CGROUP },
 	{ "kill", 0, 0, 'K' },
+	{ "kill-window", 1, 0, OPT_KILL_WINDOW },
+	{ "kill-rate", 1, 0, OPT_KILL_RATE },
 	{ "no-header", 0, 0, 'H' },
 	{ "no-queues", 0, 0, 'Q' },
 	{ "xdp", 0, 0, OPT_XDPSOCK},
 	{ "mptcp", 0, 0, 'M' },
 	{ "oneline", 0, 0, 'O' },
 	{ "inet-sockopt", 0, 0, OPT_INET_SOCKOPT },
+	{ "proc-threads", 1, 0, OPT_PROC_THREADS },
+	{ "stream", 2, 0, OPT_STREAM },
+	{ "aggregate", 1, 0, OPT_AGGREGATE },
+	{ "stats", 1, 0, OPT_STATS },
+	{ "json", 0, 0, 'j' },
+	{ "top", 1, 0, OPT_TOP },
+	{ "top-by", 1, 0, OPT_TOP_BY },
+	{ "interval", 1, 0, OPT_INTERVAL },
+	{ "count", 1, 0, OPT_COUNT },
+	{ "filter-report", 0, 0, OPT_FILTER_REPORT },
+	{ "all-netns", 0, 0, OPT_ALL_NETNS },
+	{ "compact", 0, 0, OPT_COMPACT },
 #ifdef ENABLE_BPF_SKSTORAGE_SUPPORT
 	{ "bpf-maps", 0, 0, OPT_BPF_MAPS},
 	{ "bpf-map-id", 1, 0, OPT_BPF_MAP_ID},
@@ -5946,7 +9215,7 @@ int main(int argc, char *argv[])
 	int state_filter = 0;
 
 	while ((ch = getopt_long(argc, argv,
-				 "dhalBetuwxnro460spTbEf:mMiA:D:F:vVzZN:KHQSO",
+				 "dhalBetuwxnro460spTbEf:mMiA:D:F:vVzZN:KHQSOj",
 				 long_opts, NULL)) != EOF) {
 		switch (ch) {
 		case 'n':
@@ -5974,10 +9243,81 @@ int main(int argc, char *argv[])
 		case 'T':
 			show_threads++;
 			break;
+		case OPT_PROC_THREADS:
+			if (get_integer(&proc_threads, optarg, 0) ||
+			    proc_threads <= 0) {
+				fprintf(stderr, "ss: invalid --proc-threads value\n");
+				exit(-1);
+			}
+			break;
 		case 'b':
 			show_options = 1;
 			show_bpf++;
 			break;
+		case OPT_AGGREGATE:
+			if (agg_parse_keys(optarg))
+				exit(-1);
+			break;
+		case OPT_STATS:
+			if (agg_parse_stats(optarg))
+				exit(-1);
+			break;
+		case 'j':
+			json = 1;
+			break;
+		case OPT_TOP:
+			if (get_integer(&top.k, optarg, 0) || top.k <= 0) {
+				fprintf(stderr, "ss: invalid --top value\n");
+				exit(-1);
+			}
+			break;
+		case OPT_TOP_BY:
+			if (top_parse_metric(optarg))
+				exit(-1);
+			break;
+		case OPT_INTERVAL:
+			if (get_unsigned(&top.interval, optarg, 0) ||
+			    !top.interval) {
+				fprintf(stderr, "ss: invalid --interval value\n");
+				exit(-1);
+			}
+			break;
+		case OPT_COMPACT:
+			follow.compact = true;
+			break;
+		case OPT_KILL_WINDOW:
+			if (get_unsigned(&killer.window, optarg, 0) ||
+			    !killer.window ||
+			    killer.window > KILL_WINDOW_MAX) {
+				fprintf(stderr,
+					"ss: --kill-window takes 1 to %u\n",
+					KILL_WINDOW_MAX);
+				exit(-1);
+			}
+			break;
+		case OPT_KILL_RATE:
+			if (get_unsigned(&killer.rate, optarg, 0)) {
+				fprintf(stderr, "ss: invalid --kill-rate value\n");
+				exit(-1);
+			}
+			break;
+		case OPT_COUNT:
+			if (get_unsigned(&top.count, optarg, 0)) {
+				fprintf(stderr, "ss: invalid --count value\n");
+				exit(-1);
+			}
+			break;
+		case OPT_FILTER_REPORT:
+			filter_report = true;
+			break;
+		case OPT_STREAM:
+			stream_lines = STREAM_LINES;
+			if (optarg && (get_integer(&stream_lines, optarg, 0) ||
+				       stream_lines <= 0)) {
+				fprintf(stderr, "ss: invalid --stream value\n");
+				exit(-1);
+			}
+			break;
 		case 'E':
 			follow_events = 1;
 			break;
@@ -6112,9 +9452,25 @@ int main(int argc, char *argv[])
 			show_proc_ctx++;
 			break;
 		case 'N':
+			if (strchr(optarg, ',')) {
+				char *ns;
+
+				for (ns = strtok(optarg, ","); ns;
+				     ns = strtok(NULL, ","))
+					netns_all_add(ns);
+				break;
+			}
 			if (netns_switch(optarg))
 				exit(1);
 			break;
+		case OPT_ALL_NETNS:
+			if (netns_foreach(netns_all_add_one, NULL))
+				exit(1);
+			if (!netns_all.count) {
+				fprintf(stderr, "ss: no network namespaces found\n");
+				exit(0);
+			}
+			break;
 		case OPT_TIPCINFO:
 			show_tipcinfo = 1;
 			break;
@@ -6160,8 +9516,16 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	if (show_processes || show_threads || show_proc_ctx || show_sock_ctx)
-		user_ent_hash_build();
+	/* Host names are looked up together when the output is rendered */
+	host_defer = resolve_hosts;
+
+	/* Events are rendered one at a time: resolve all owners upfront */
+	if (show_processes || show_threads || show_proc_ctx || show_sock_ctx) {
+		if (follow_events)
+			user_ent_hash_build();
+		else
+			user_ent_defer = true;
+	}
 
 	argc -= optind;
 	argv += optind;
@@ -6200,6 +9564,50 @@ int main(int argc, char *argv[])
 	filter_states_set(&current_filter, state_filter);
 	filter_merge_defaults(&current_filter);
 
+	if (json && top.k) {
+		fprintf(stderr, "ss: --top has no JSON output\n");
+		exit(-1);
+	}
+	if (json && !agg_enabled()) {
+		fprintf(stderr, "ss: --json needs --aggregate or --stats\n");
+		exit(-1);
+	}
+	if (agg_enabled()) {
+		if (follow_events) {
+			fprintf(stderr, "ss: --aggregate can't be used with --events\n");
+			exit(-1);
+		}
+		/* Only inet sockets are folded, don't print the others */
+		current_filter.dbs &= INET_DBM;
+	}
+	if (follow.compact || (follow_events && dump_tcpdiag)) {
+		if (!follow_events || current_filter.kill) {
+			fprintf(stderr, "ss: --compact and -D select the --events format, without --kill\n");
+			exit(-1);
+		}
+		/* Only inet sockets are reported, one per line */
+		current_filter.dbs &= INET_DBM;
+		show_header = 0;
+	}
+	if (top.k) {
+		if (follow_events || agg_enabled()) {
+			fprintf(stderr, "ss: --top can't be used with --events, --aggregate or --stats\n");
+			exit(-1);
+		}
+		/* Counters come from tcp_info */
+		current_filter.dbs &= 1 << TCP_DB;
+	}
+	if (netns_all.count) {
+		if (follow_events || top.k || current_filter.kill) {
+			fprintf(stderr, "ss: --events, --top and --kill work in a single namespace\n");
+			exit(-1);
+		}
+		/* Only inet tables are dumped across namespaces */
+		current_filter.dbs &= INET_DBM;
+	} else {
+		columns[COL_NETNS].disabled = 1;
+	}
+
 #ifdef HAVE_RPC
 	if (!numeric && resolve_hosts &&
 	    (current_filter.dbs & (UNIX_DBM|INET_L4_DBM)))
@@ -6219,7 +9627,7 @@ int main(int argc, char *argv[])
 		exit(0);
 	}
 
-	if (dump_tcpdiag) {
+	if (dump_tcpdiag && !follow_events) {
 		FILE *dump_fp = stdout;
 
 		if (!(current_filter.dbs & (1<<TCP_DB))) {
@@ -6240,6 +9648,7 @@ int main(int argc, char *argv[])
 
 	if (ssfilter_parse(&current_filter.f, argc, argv, filter_fp))
 		usage();
+	ssfilter_prepare(&current_filter);
 
 	if (!show_processes)
 		columns[COL_PROC].disabled = 1;
@@ -6255,13 +9664,21 @@ int main(int argc, char *argv[])
 	if (!(current_filter.states & (current_filter.states - 1)))
 		columns[COL_STATE].disabled = 1;
 
-	if (show_header)
+	if (show_header && !agg_enabled() && !top.k)
 		print_header();
 
 	fflush(stdout);
 
 	if (follow_events)
-		exit(handle_follow_request(&current_filter));
+		exit(handle_follow_request(&current_filter, dump_tcpdiag));
+
+	if (top.k)
+		exit(top_loop(&current_filter));
+
+	if (netns_all.count) {
+		netns_show(&current_filter);
+		current_filter.dbs = 0;
+	}
 
 	if (current_filter.dbs & (1<<NETLINK_DB))
 		netlink_show(&current_filter);
@@ -6288,14 +9705,17 @@ int main(int argc, char *argv[])
 	if (current_filter.dbs & (1<<MPTCP_DB))
 		mptcp_show(&current_filter);
 
-	if (show_processes || show_threads || show_proc_ctx || show_sock_ctx)
-		user_ent_destroy();
-
 #ifdef ENABLE_BPF_SKSTORAGE_SUPPORT
 	bpf_map_opts_destroy();
 #endif
 
 	render();
 
+	if (agg_enabled())
+		agg_print();
+
+	if (show_processes || show_threads || show_proc_ctx || show_sock_ctx)
+		user_ent_destroy();
+
 	return 0;
 }
@@ -0,0 +1,654 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * disttable.c	Build, convert and benchmark netem distribution tables.
+ *
+ * "empirical" makes the table of a trace of values, such as packet
+ * delays, in one pass and bounded memory: the mean and deviation are
+ * accumulated with Welford's method and the values counted in a fixed
+ * number of bins whose width doubles whenever a value falls outside of
+ * them.  The table is then read off the cumulative counts.
+ *
+ * "convert" rewrites a table, text or binary, in the other format;
+ * "bench" compares the table of a trace with the one of its exact
+ * quantiles, and how long each format takes to load.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <linux/types.h>
+#include <linux/pkt_sched.h>
+
+#include "netem_dist.h"
+
+#define TABLESIZE	4096
+#define TABLEFACTOR	NETEM_DIST_SCALE
+#define NBINS		(1 << 20)
+#define NFIRST		65536
+
+struct trace {
+	/* Welford */
+	unsigned long	n;
+	double		mean;
+	double		m2;
+	/* histogram of lo + [0, NBINS) * width */
+	double		lo;
+	double		width;
+	__u32		*bins;
+	/* first values, until the histogram is sized */
+	double		*first;
+	unsigned int	nfirst;
+};
+
+static int binary;
+static int tablesize = TABLESIZE;
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"Usage: disttable [ -b ] [ -n SIZE ] empirical [ FILE ]\n"
+		"       disttable [ -b ] convert [ FILE ]\n"
+		"       disttable [ -n SIZE ] bench FILE [ ROUNDS ]\n"
+		"where  -b     writes a binary table (.bdist) instead of text\n"
+		"       -n     sets the number of entries, %d by default\n",
+		TABLESIZE);
+	exit(1);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static FILE *open_input(const char *name)
+{
+	FILE *fp;
+
+	if (!name || strcmp(name, "-") == 0)
+		return stdin;
+	fp = fopen(name, "r");
+	if (!fp) {
+		perror(name);
+		exit(1);
+	}
+	return fp;
+}
+
+/*
+ * Call @fn for every number in @fp, skipping comment lines; returns
+ * how many there were.
+ */
+static unsigned long read_values(FILE *fp, void (*fn)(void *, double),
+				 void *arg)
+{
+	unsigned long n = 0;
+	char *line = NULL;
+	size_t len = 0;
+
+	while (getline(&line, &len, fp) != -1) {
+		char *p, *endp;
+
+		if (*line == '#')
+			continue;
+		for (p = line; ; p = endp) {
+			double x = strtod(p, &endp);
+
+			if (endp == p)
+				break;
+			if (!isfinite(x))
+				continue;
+			fn(arg, x);
+			n++;
+		}
+	}
+	free(line);
+	return n;
+}
+
+static void hist_count(struct trace *t, double x)
+{
+	long b;
+
+	/* widen until x is covered, merging pairs of bins */
+	for (;;) {
+		int down;
+		long i;
+
+		b = floor((x - t->lo) / t->width);
+		if (b >= 0 && b < NBINS)
+			break;
+
+		/* pairs go to the low half, or the high one going down */
+		down = b < 0;
+		for (i = 0; i < NBINS / 2; i++) {
+			long j = down ? NBINS / 2 - 1 - i : i;
+			__u32 c = t->bins[2 * j] + t->bins[2 * j + 1];
+
+			t->bins[2 * j] = t->bins[2 * j + 1] = 0;
+			t->bins[down ? NBINS / 2 + j : j] = c;
+		}
+		if (down)
+			t->lo -= NBINS * t->width;
+		t->width *= 2;
+	}
+	t->bins[b]++;
+}
+
+static void hist_init(struct trace *t)
+{
+	double min = t->first[0], max = t->first[0];
+	unsigned int i;
+
+	for (i = 1; i < t->nfirst; i++) {
+		if (t->first[i] < min)
+			min = t->first[i];
+		if (t->first[i] > max)
+			max = t->first[i];
+	}
+
+	/* twice the range seen so far, centred on it */
+	t->width = 2 * (max - min) / NBINS;
+	if (t->width == 0)
+		t->width = (fabs(min) > 1 ? fabs(min) : 1) / NBINS;
+	t->lo = min - (max - min) / 2;
+
+	t->bins = calloc(NBINS, sizeof(*t->bins));
+	if (!t->bins) {
+		perror("histogram alloc");
+		exit(3);
+	}
+	for (i = 0; i < t->nfirst; i++)
+		hist_count(t, t->first[i]);
+	free(t->first);
+	t->first = NULL;
+}
+
+static void trace_add(void *arg, double x)
+{
+	struct trace *t = arg;
+	double d = x - t->mean;
+
+	t->n++;
+	t->mean += d / t->n;
+	t->m2 += d * (x - t->mean);
+
+	if (t->bins) {
+		hist_count(t, x);
+		return;
+	}
+	if (!t->first) {
+		t->first = malloc(NFIRST * sizeof(*t->first));
+		if (!t->first) {
+			perror("alloc");
+			exit(3);
+		}
+	}
+	t->first[t->nfirst++] = x;
+	if (t->nfirst == NFIRST)
+		hist_init(t);
+}
+
+static double trace_sigma(const struct trace *t)
+{
+	return t->n > 1 ? sqrt(t->m2 / (t->n - 1)) : 0;
+}
+
+static __s16 scale(double x, double mu, double sigma)
+{
+	double v = rint((x - mu) / sigma * TABLEFACTOR);
+
+	if (v < SHRT_MIN)
+		v = SHRT_MIN;
+	if (v > SHRT_MAX)
+		v = SHRT_MAX;
+	return v;
+}
+
+/* Entry i is the value of quantile (i + 1/2) / size */
+static __s16 *trace_table(struct trace *t)
+{
+	double mu = t->mean, sigma = trace_sigma(t);
+	unsigned long long cum = 0;
+	__s16 *table;
+	long b = 0;
+	int i;
+
+	if (t->n < 2 || sigma == 0) {
+		fprintf(stderr, "Not enough distinct values read\n");
+		exit(2);
+	}
+	if (!t->bins)
+		hist_init(t);
+
+	table = malloc(tablesize * sizeof(*table));
+	if (!table) {
+		perror("table alloc");
+		exit(3);
+	}
+
+	for (i = 0; i < tablesize; i++) {
+		double target = (i + 0.5) / tablesize * t->n;
+
+		while (b < NBINS - 1 && cum + t->bins[b] < target)
+			cum += t->bins[b++];
+		table[i] = scale(t->lo + t->width *
+				 (b + (target - cum) / (t->bins[b] ? : 1)),
+				 mu, sigma);
+	}
+	return table;
+}
+
+static __s16 *empirical(FILE *fp)
+{
+	struct trace t = {};
+	__s16 *table;
+
+	read_values(fp, trace_add, &t);
+	table = trace_table(&t);
+	free(t.bins);
+	free(t.first);
+	return table;
+}
+
+struct values {
+	double		*x;
+	unsigned long	n;
+	unsigned long	size;
+};
+
+static void values_add(void *arg, double x)
+{
+	struct values *v = arg;
+
+	if (v->n == v->size) {
+		v->size = v->size ? 2 * v->size : 65536;
+		v->x = realloc(v->x, v->size * sizeof(*v->x));
+		if (!v->x) {
+			perror("alloc");
+			exit(3);
+		}
+	}
+	v->x[v->n++] = x;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* The same table from the sorted values, to check the histogram with */
+static __s16 *exact(FILE *fp)
+{
+	struct values v = {};
+	double sum = 0, sq = 0, mu, sigma;
+	unsigned long k;
+	__s16 *table;
+	int i;
+
+	read_values(fp, values_add, &v);
+	if (v.n < 2) {
+		fprintf(stderr, "Not enough values read\n");
+		exit(2);
+	}
+	qsort(v.x, v.n, sizeof(*v.x), cmp_double);
+
+	for (k = 0; k < v.n; k++)
+		sum += v.x[k];
+	mu = sum / v.n;
+	for (k = 0; k < v.n; k++)
+		sq += (v.x[k] - mu) * (v.x[k] - mu);
+	sigma = sqrt(sq / (v.n - 1));
+
+	table = malloc(tablesize * sizeof(*table));
+	if (!table) {
+		perror("table alloc");
+		exit(3);
+	}
+	for (i = 0; i < tablesize; i++) {
+		double pos = (i + 0.5) / tablesize * v.n - 0.5;
+		unsigned long lo = pos < 0 ? 0 : pos;
+		unsigned long hi = lo + 1 < v.n ? lo + 1 : lo;
+		double f = pos - lo;
+
+		if (f < 0)
+			f = 0;
+		table[i] = scale(v.x[lo] + f * (v.x[hi] - v.x[lo]), mu, sigma);
+	}
+	free(v.x);
+	return table;
+}
+
+/* Parse a table as tc does, text or binary */
+static __s16 *read_table(FILE *fp, int *size)
+{
+	__s16 *table = malloc(NETEM_DIST_MAX * sizeof(*table));
+	char *buf = NULL;
+	size_t len = 0, n;
+	int count;
+
+	if (!table) {
+		perror("table alloc");
+		exit(3);
+	}
+
+	/* slurp it, text tables are small too */
+	for (n = 0; ; ) {
+		size_t r;
+
+		if (n == len) {
+			len = len ? 2 * len : 65536;
+			buf = realloc(buf, len + 1);
+			if (!buf) {
+				perror("alloc");
+				exit(3);
+			}
+		}
+		r = fread(buf + n, 1, len - n, fp);
+		if (r == 0)
+			break;
+		n += r;
+	}
+	buf[n] = '\0';
+
+	count = netem_dist_valid(buf, n);
+	if (count < 0 && n >= sizeof(__le32) &&
+	    le32toh(*(__le32 *)buf) == NETEM_DIST_MAGIC) {
+		fprintf(stderr, "Invalid binary table\n");
+		exit(2);
+	}
+	if (count >= 0) {
+		const __le16 *p = (const __le16 *)(buf +
+			le16toh(((struct netem_dist_hdr *)buf)->hdr_len));
+		int i;
+
+		if (count > NETEM_DIST_MAX)
+			goto too_big;
+		for (i = 0; i < count; i++)
+			table[i] = le16toh(p[i]);
+	} else {
+		char *line, *next;
+
+		count = 0;
+		for (line = buf; *line; line = next) {
+			char *p, *endp;
+
+			next = strchr(line, '\n');
+			if (next)
+				*next++ = '\0';
+			else
+				next = line + strlen(line);
+			if (*line == '#')
+				continue;
+			for (p = line; ; p = endp) {
+				long x = strtol(p, &endp, 0);
+
+				if (endp == p)
+					break;
+				if (count == NETEM_DIST_MAX)
+					goto too_big;
+				table[count++] = x;
+			}
+		}
+	}
+	free(buf);
+
+	if (count == 0) {
+		fprintf(stderr, "Empty table\n");
+		exit(2);
+	}
+	*size = count;
+	return table;
+too_big:
+	fprintf(stderr, "Table has more than %d entries\n", NETEM_DIST_MAX);
+	exit(2);
+}
+
+static void write_binary(FILE *fp, const __s16 *table, int size)
+{
+	struct netem_dist_hdr h = {
+		.magic = htole32(NETEM_DIST_MAGIC),
+		.version = htole16(NETEM_DIST_VERSION),
+		.hdr_len = htole16(sizeof(h)),
+		.count = htole32(size),
+	};
+	__le16 *data = malloc(size * sizeof(*data));
+	int i;
+
+	if (!data) {
+		perror("alloc");
+		exit(3);
+	}
+	for (i = 0; i < size; i++)
+		data[i] = htole16(table[i]);
+	h.check = htole32(netem_dist_check(data, size * sizeof(*data)));
+
+	if (fwrite(&h, sizeof(h), 1, fp) != 1 ||
+	    fwrite(data, sizeof(*data), size, fp) != (size_t)size) {
+		perror("write");
+		exit(1);
+	}
+	free(data);
+}
+
+static void write_text(FILE *fp, const __s16 *table, int size,
+		       const char *what)
+{
+	int i;
+
+	fprintf(fp, "# This is the distribution table for the %s distribution.\n",
+		what);
+	for (i = 0; i < size; i++)
+		fprintf(fp, " %d%s", table[i], i % 8 == 7 ? "\n" : "");
+	if (size % 8)
+		fputc('\n', fp);
+}
+
+static void write_table(FILE *fp, const __s16 *table, int size,
+			const char *what)
+{
+	if (binary)
+		write_binary(fp, table, size);
+	else
+		write_text(fp, table, size, what);
+	if (fflush(fp)) {
+		perror("write");
+		exit(1);
+	}
+}
+
+/* tc's loaders, in the time they take */
+static int load_text(const char *name, __s16 *data)
+{
+	FILE *f = fopen(name, "r");
+	char *line = NULL;
+	size_t len;
+	int n = 0;
+
+	if (!f)
+		return -1;
+	while (getline(&line, &len, f) != -1) {
+		char *p, *endp;
+
+		if (*line == '\n' || *line == '#')
+			continue;
+		for (p = line; ; p = endp) {
+			long x = strtol(p, &endp, 0);
+
+			if (endp == p)
+				break;
+			if (n >= NETEM_DIST_MAX)
+				break;
+			data[n++] = x;
+		}
+	}
+	free(line);
+	fclose(f);
+	return n;
+}
+
+static int load_binary(const char *name, __s16 *data)
+{
+	struct stat st;
+	void *map;
+	int fd, n;
+
+	fd = open(name, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+	/* tc hands the entries to the kernel in place */
+	n = netem_dist_valid(map, st.st_size);
+	munmap(map, st.st_size);
+	return n;
+}
+
+static double time_load(int (*load)(const char *, __s16 *),
+			const char *name, int rounds, int size)
+{
+	__s16 *data = malloc(NETEM_DIST_MAX * sizeof(*data));
+	double start;
+	int i;
+
+	if (!data) {
+		perror("alloc");
+		exit(3);
+	}
+	start = now();
+	for (i = 0; i < rounds; i++) {
+		if (load(name, data) != size) {
+			fprintf(stderr, "%s: failed to load\n", name);
+			exit(1);
+		}
+	}
+	free(data);
+	return (now() - start) / rounds;
+}
+
+static int bench(const char *trace, int rounds)
+{
+	char dir[] = "/tmp/disttableXXXXXX";
+	char text[PATH_MAX], bin[PATH_MAX];
+	double t0, t_stream, t_exact, err = 0;
+	__s16 *streamed, *ref;
+	int i, maxerr = 0;
+	FILE *fp;
+
+	fp = open_input(trace);
+	t0 = now();
+	streamed = empirical(fp);
+	t_stream = now() - t0;
+	fclose(fp);
+
+	fp = open_input(trace);
+	t0 = now();
+	ref = exact(fp);
+	t_exact = now() - t0;
+	fclose(fp);
+
+	for (i = 0; i < tablesize; i++) {
+		int d = abs(streamed[i] - ref[i]);
+
+		err += d;
+		if (d > maxerr)
+			maxerr = d;
+	}
+	printf("build: streaming %.3fs, sorted %.3fs\n", t_stream, t_exact);
+	printf("fidelity: %d entries, mean error %.3f, max error %d (1/%d sigma)\n",
+	       tablesize, err / tablesize, maxerr, TABLEFACTOR);
+
+	if (!mkdtemp(dir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	snprintf(text, sizeof(text), "%s/trace.dist", dir);
+	snprintf(bin, sizeof(bin), "%s/trace.bdist", dir);
+
+	fp = fopen(text, "w");
+	if (!fp) {
+		perror(text);
+		return 1;
+	}
+	write_text(fp, streamed, tablesize, "empirical");
+	fclose(fp);
+	fp = fopen(bin, "w");
+	if (!fp) {
+		perror(bin);
+		return 1;
+	}
+	write_binary(fp, streamed, tablesize);
+	fclose(fp);
+
+	printf("load: text %.1fus, binary %.1fus\n",
+	       time_load(load_text, text, rounds, tablesize) * 1e6,
+	       time_load(load_binary, bin, rounds, tablesize) * 1e6);
+
+	unlink(text);
+	unlink(bin);
+	rmdir(dir);
+	free(streamed);
+	free(ref);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	__s16 *table;
+	int opt, size;
+
+	while ((opt = getopt(argc, argv, "bn:h")) != -1) {
+		switch (opt) {
+		case 'b':
+			binary = 1;
+			break;
+		case 'n':
+			tablesize = atoi(optarg);
+			if (tablesize <= 0 || tablesize > NETEM_DIST_MAX) {
+				fprintf(stderr, "Table size must be 1 to %d\n",
+					NETEM_DIST_MAX);
+				return 1;
+			}
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc < 1 || argc > 3)
+		usage();
+
+	if (strcmp(argv[0], "empirical") == 0 && argc <= 2) {
+		table = empirical(open_input(argv[1]));
+		write_table(stdout, table, tablesize, "empirical");
+	} else if (strcmp(argv[0], "convert") == 0 && argc <= 2) {
+		table = read_table(open_input(argv[1]), &size);
+		write_table(stdout, table, size, "converted");
+	} else if (strcmp(argv[0], "bench") == 0 && argc >= 2) {
+		return bench(argv[1], argc > 2 ? atoi(argv[2]) : 1000);
+	} else {
+		usage();
+	}
+	free(table);
+	return 0;
+}
@@ -9,6 +9,8 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <ctype.h>
 #include <net/if.h>
 
 #include <linux/if_arp.h>
@@ -20,6 +22,7 @@
 
 #include "utils.h"
 #include "tc_util.h"
+#include "tc_common.h"
 #include "rt_names.h"
 
 /* maximum length of options string */
@@ -474,64 +477,76 @@ err:
 	return -1;
 }
 
-static int __flower_parse_ip_addr(char *str, int family,
-				  int addr4_type, int mask4_type,
-				  int addr6_type, int mask6_type,
-				  struct nlmsghdr *n)
+static int flower_add_ip_addr(inet_prefix *addr, int family,
+			      int addr4_type, int mask4_type,
+			      int addr6_type, int mask6_type,
+			      struct nlmsghdr *n)
 {
-	int ret;
-	inet_prefix addr;
 	int bits;
 	int i;
 
-	ret = get_prefix(&addr, str, family);
-	if (ret)
-		return -1;
-
-	if (family && (addr.family != family)) {
+	if (family && (addr->family != family)) {
 		fprintf(stderr, "Illegal \"eth_type\" for ip address\n");
 		return -1;
 	}
 
-	addattr_l(n, MAX_MSG, addr.family == AF_INET ? addr4_type : addr6_type,
-		  addr.data, addr.bytelen);
+	addattr_l(n, MAX_MSG, addr->family == AF_INET ? addr4_type : addr6_type,
+		  addr->data, addr->bytelen);
 
-	memset(addr.data, 0xff, addr.bytelen);
-	bits = addr.bitlen;
-	for (i = 0; i < addr.bytelen / 4; i++) {
+	memset(addr->data, 0xff, addr->bytelen);
+	bits = addr->bitlen;
+	for (i = 0; i < addr->bytelen / 4; i++) {
 		if (!bits) {
-			addr.data[i] = 0;
+			addr->data[i] = 0;
 		} else if (bits / 32 >= 1) {
 			bits -= 32;
 		} else {
-			addr.data[i] <<= 32 - bits;
-			addr.data[i] = htonl(addr.data[i]);
+			addr->data[i] <<= 32 - bits;
+			addr->data[i] = htonl(addr->data[i]);
 			bits = 0;
 		}
 	}
 
-	addattr_l(n, MAX_MSG, addr.family == AF_INET ? mask4_type : mask6_type,
-		  addr.data, addr.bytelen);
+	addattr_l(n, MAX_MSG, addr->family == AF_INET ? mask4_type : mask6_type,
+		  addr->data, addr->bytelen);
 
 	return 0;
 }
 
+static int __flower_parse_ip_addr(char *str, int family,
+				  int addr4_type, int mask4_type,
+				  int addr6_type, int mask6_type,
+				  struct nlmsghdr *n)
+{
+	inet_prefix addr;
+
+	if (get_prefix(&addr, str, family))
+		return -1;
+
+	return flower_add_ip_addr(&addr, family, addr4_type, mask4_type,
+				  addr6_type, mask6_type, n);
+}
+
+static int flower_ip_family(__be16 eth_type)
+{
+	if (eth_type == htons(ETH_P_IP))
+		return AF_INET;
+	if (eth_type == htons(ETH_P_IPV6))
+		return AF_INET6;
+	if (!eth_type)
+		return AF_UNSPEC;
+	return -1;
+}
+
 static int flower_parse_ip_addr(char *str, __be16 eth_type,
 				int addr4_type, int mask4_type,
 				int addr6_type, int mask6_type,
 				struct nlmsghdr *n)
 {
-	int family;
+	int family = flower_ip_family(eth_type);
 
-	if (eth_type == htons(ETH_P_IP)) {
-		family = AF_INET;
-	} else if (eth_type == htons(ETH_P_IPV6)) {
-		family = AF_INET6;
-	} else if (!eth_type) {
-		family = AF_UNSPEC;
-	} else {
+	if (family < 0)
 		return -1;
-	}
 
 	return __flower_parse_ip_addr(str, family, addr4_type, mask4_type,
 				      addr6_type, mask6_type, n);
@@ -3355,8 +3370,569 @@ static int flower_print_opt(const struct filter_util *qu, FILE *f,
 	return 0;
 }
 
+/*
+ * Bulk loading of filters from a rule table: "tc filter compile ...
+ * flower FILE". The header line names a flower key, "action", "classid"
+ * or "handle" per column and each further line is a filter, with its
+ * values in those columns, separated by tabs or, if the header has none,
+ * commas. Columns are resolved to their parser once from the header, so
+ * rows are not matched keyword by keyword, and the filters are queued
+ * into large buffers and pipelined. Actions are parsed once per distinct
+ * text and their attributes copied into the following rows.
+ */
+
+#define FLOWER_LOAD_COLS	32
+#define FLOWER_LOAD_WINDOW	1024
+#define FLOWER_LOAD_BUF		(256 * 1024)
+#define FLOWER_ACT_HASH		256
+
+enum {
+	FLOWER_NEED_IP		= 1,	/* protocol ip or ipv6 */
+	FLOWER_NEED_VLAN	= 2,	/* protocol 802.1q or 802.1ad */
+	FLOWER_NEED_IP_PROTO	= 4,	/* an ip_proto column */
+};
+
+struct flower_act {
+	struct flower_act	*next;
+	char			*text;
+	unsigned int		len;
+	char			attr[];
+};
+
+struct flower_load {
+	const char		*name;
+	int			batch_lineno;	/* inside a batch */
+	__be16			tc_proto;
+	__u8			ip_proto;	/* of the current row */
+	__u32			flags;
+	char			sep;
+	unsigned int		ncols;
+	const struct flower_col	*col[FLOWER_LOAD_COLS];
+	unsigned int		order[FLOWER_LOAD_COLS];
+	struct flower_act	*act[FLOWER_ACT_HASH];
+};
+
+struct flower_col {
+	const char	*name;
+	int		(*parse)(struct flower_load *fl, char *str,
+				 struct nlmsghdr *n);
+	int		need;
+	bool		first;		/* parsed before the other columns */
+};
+
+static int flower_col_handle(struct flower_load *fl, char *str,
+			     struct nlmsghdr *n)
+{
+	struct tcmsg *t = NLMSG_DATA(n);
+
+	return get_u32(&t->tcm_handle, str, 0);
+}
+
+static int flower_col_classid(struct flower_load *fl, char *str,
+			      struct nlmsghdr *n)
+{
+	__u32 classid;
+
+	if (get_tc_classid(&classid, str))
+		return -1;
+	return addattr32(n, MAX_MSG, TCA_FLOWER_CLASSID, classid);
+}
+
+static int flower_col_indev(struct flower_load *fl, char *str,
+			    struct nlmsghdr *n)
+{
+	if (check_ifname(str))
+		return -1;
+	return addattrstrz(n, MAX_MSG, TCA_FLOWER_INDEV, str);
+}
+
+static int flower_col_dst_mac(struct flower_load *fl, char *str,
+			      struct nlmsghdr *n)
+{
+	return flower_parse_eth_addr(str, TCA_FLOWER_KEY_ETH_DST,
+				     TCA_FLOWER_KEY_ETH_DST_MASK, n);
+}
+
+static int flower_col_src_mac(struct flower_load *fl, char *str,
+			      struct nlmsghdr *n)
+{
+	return flower_parse_eth_addr(str, TCA_FLOWER_KEY_ETH_SRC,
+				     TCA_FLOWER_KEY_ETH_SRC_MASK, n);
+}
+
+static int flower_col_vlan_id(struct flower_load *fl, char *str,
+			      struct nlmsghdr *n)
+{
+	__u16 vid;
+
+	if (get_u16(&vid, str, 10) || vid & ~0xfff)
+		return -1;
+	return addattr16(n, MAX_MSG, TCA_FLOWER_KEY_VLAN_ID, vid);
+}
+
+static int flower_col_vlan_prio(struct flower_load *fl, char *str,
+				struct nlmsghdr *n)
+{
+	__u8 prio;
+
+	if (get_u8(&prio, str, 10) || prio & ~0x7)
+		return -1;
+	return addattr8(n, MAX_MSG, TCA_FLOWER_KEY_VLAN_PRIO, prio);
+}
+
+static int flower_col_ip_proto(struct flower_load *fl, char *str,
+			       struct nlmsghdr *n)
+{
+	return flower_parse_ip_proto(str, fl->tc_proto,
+				     TCA_FLOWER_KEY_IP_PROTO, &fl->ip_proto, n);
+}
+
+static int flower_col_ip_tos(struct flower_load *fl, char *str,
+			     struct nlmsghdr *n)
+{
+	return flower_parse_ip_tos_ttl(str, TCA_FLOWER_KEY_IP_TOS,
+				       TCA_FLOWER_KEY_IP_TOS_MASK, n);
+}
+
+static int flower_col_ip_ttl(struct flower_load *fl, char *str,
+			     struct nlmsghdr *n)
+{
+	return flower_parse_ip_tos_ttl(str, TCA_FLOWER_KEY_IP_TTL,
+				       TCA_FLOWER_KEY_IP_TTL_MASK, n);
+}
+
+/*
+ * Unlike get_prefix(), get_prefix_1() does not exit on a bad address,
+ * so that it fails only the row it is in.
+ */
+static int flower_load_ip_addr(struct flower_load *fl, char *str,
+			       int addr4_type, int mask4_type,
+			       int addr6_type, int mask6_type,
+			       struct nlmsghdr *n)
+{
+	int family = flower_ip_family(fl->tc_proto);
+	inet_prefix addr;
+
+	if (family < 0 || get_prefix_1(&addr, str, family))
+		return -1;
+
+	return flower_add_ip_addr(&addr, family, addr4_type, mask4_type,
+				  addr6_type, mask6_type, n);
+}
+
+static int flower_col_dst_ip(struct flower_load *fl, char *str,
+			     struct nlmsghdr *n)
+{
+	return flower_load_ip_addr(fl, str,
+				   TCA_FLOWER_KEY_IPV4_DST,
+				   TCA_FLOWER_KEY_IPV4_DST_MASK,
+				   TCA_FLOWER_KEY_IPV6_DST,
+				   TCA_FLOWER_KEY_IPV6_DST_MASK, n);
+}
+
+static int flower_col_src_ip(struct flower_load *fl, char *str,
+			     struct nlmsghdr *n)
+{
+	return flower_load_ip_addr(fl, str,
+				   TCA_FLOWER_KEY_IPV4_SRC,
+				   TCA_FLOWER_KEY_IPV4_SRC_MASK,
+				   TCA_FLOWER_KEY_IPV6_SRC,
+				   TCA_FLOWER_KEY_IPV6_SRC_MASK, n);
+}
+
+static int flower_col_dst_port(struct flower_load *fl, char *str,
+			       struct nlmsghdr *n)
+{
+	return flower_parse_port(str, fl->ip_proto, FLOWER_ENDPOINT_DST, n);
+}
+
+static int flower_col_src_port(struct flower_load *fl, char *str,
+			       struct nlmsghdr *n)
+{
+	return flower_parse_port(str, fl->ip_proto, FLOWER_ENDPOINT_SRC, n);
+}
+
+static int flower_col_tcp_flags(struct flower_load *fl, char *str,
+				struct nlmsghdr *n)
+{
+	return flower_parse_tcp_flags(str, TCA_FLOWER_KEY_TCP_FLAGS,
+				      TCA_FLOWER_KEY_TCP_FLAGS_MASK, n);
+}
+
+static unsigned int flower_act_hash(const char *str)
+{
+	unsigned int h = 5381;
+
+	while (*str)
+		h = h * 33 + (unsigned char)*str++;
+	return h % FLOWER_ACT_HASH;
+}
+
+static int flower_col_action(struct flower_load *fl, char *str,
+			     struct nlmsghdr *n)
+{
+	unsigned int h = flower_act_hash(str);
+	unsigned int start = NLMSG_ALIGN(n->nlmsg_len);
+	char *largv[MAX_ARGS], **args = largv, *copy;
+	struct flower_act *a;
+	int largc;
+
+	for (a = fl->act[h]; a; a = a->next) {
+		if (strcmp(a->text, str))
+			continue;
+		if (start + a->len > MAX_MSG)
+			return -1;
+		memcpy((char *)n + start, a->attr, a->len);
+		n->nlmsg_len = start + a->len;
+		return 0;
+	}
+
+	/* makeargs() splits its input in place */
+	copy = strdup(str);
+	if (!copy)
+		return -1;
+	largc = makeargs(copy, largv, MAX_ARGS);
+	if (parse_action(&largc, &args, TCA_FLOWER_ACT, n) ||
+	    largc) {
+		free(copy);
+		return -1;
+	}
+	free(copy);
+
+	a = malloc(sizeof(*a) + n->nlmsg_len - start);
+	if (!a)
+		return 0;
+	a->text = strdup(str);
+	if (!a->text) {
+		free(a);
+		return 0;
+	}
+	a->len = n->nlmsg_len - start;
+	memcpy(a->attr, (char *)n + start, a->len);
+	a->next = fl->act[h];
+	fl->act[h] = a;
+	return 0;
+}
+
+static const struct flower_col flower_cols[] = {
+	{ "handle",	flower_col_handle },
+	{ "classid",	flower_col_classid },
+	{ "flowid",	flower_col_classid },
+	{ "action",	flower_col_action },
+	{ "indev",	flower_col_indev },
+	{ "dst_mac",	flower_col_dst_mac },
+	{ "src_mac",	flower_col_src_mac },
+	{ "vlan_id",	flower_col_vlan_id, FLOWER_NEED_VLAN },
+	{ "vlan_prio",	flower_col_vlan_prio, FLOWER_NEED_VLAN },
+	{ "ip_proto",	flower_col_ip_proto, FLOWER_NEED_IP, true },
+	{ "ip_tos",	flower_col_ip_tos, FLOWER_NEED_IP },
+	{ "ip_ttl",	flower_col_ip_ttl, FLOWER_NEED_IP },
+	{ "dst_ip",	flower_col_dst_ip, FLOWER_NEED_IP },
+	{ "src_ip",	flower_col_src_ip, FLOWER_NEED_IP },
+	{ "dst_port",	flower_col_dst_port, FLOWER_NEED_IP_PROTO },
+	{ "src_port",	flower_col_src_port, FLOWER_NEED_IP_PROTO },
+	{ "tcp_flags",	flower_col_tcp_flags, FLOWER_NEED_IP_PROTO },
+};
+
+static char *flower_load_trim(char *str)
+{
+	char *end;
+
+	while (isspace(*str))
+		str++;
+	end = str + strlen(str);
+	while (end > str && isspace(end[-1]))
+		*--end = '\0';
+	return str;
+}
+
+/* Split @line into its cells, returns how many there are */
+static unsigned int flower_load_split(char *line, char sep, char **cell,
+				      unsigned int max)
+{
+	unsigned int i = 0;
+	char *end;
+
+	for (;;) {
+		if (i == max)
+			return max + 1;
+		end = strchr(line, sep);
+		if (end)
+			*end = '\0';
+		cell[i++] = flower_load_trim(line);
+		if (!end)
+			return i;
+		line = end + 1;
+	}
+}
+
+static int flower_load_header(struct flower_load *fl, char *line)
+{
+	char *cell[FLOWER_LOAD_COLS];
+	bool ip_proto = false;
+	unsigned int i, j, k;
+	int need = 0;
+
+	fl->sep = strchr(line, '\t') ? '\t' : ',';
+	fl->ncols = flower_load_split(line, fl->sep, cell, FLOWER_LOAD_COLS);
+	if (fl->ncols > FLOWER_LOAD_COLS) {
+		fprintf(stderr, "More than %u columns\n", FLOWER_LOAD_COLS);
+		return -1;
+	}
+
+	for (i = 0; i < fl->ncols; i++) {
+		for (j = 0; j < ARRAY_SIZE(flower_cols); j++) {
+			if (strcmp(cell[i], flower_cols[j].name) == 0)
+				break;
+		}
+		if (j == ARRAY_SIZE(flower_cols)) {
+			fprintf(stderr, "Unknown column \"%s\"\n", cell[i]);
+			return -1;
+		}
+		for (k = 0; k < i; k++) {
+			if (fl->col[k]->parse == flower_cols[j].parse) {
+				fprintf(stderr, "Duplicate column \"%s\"\n",
+					cell[i]);
+				return -1;
+			}
+		}
+		fl->col[i] = &flower_cols[j];
+		need |= flower_cols[j].need;
+		if (flower_cols[j].parse == flower_col_ip_proto)
+			ip_proto = true;
+	}
+
+	if (need & FLOWER_NEED_IP && fl->tc_proto != htons(ETH_P_IP) &&
+	    fl->tc_proto != htons(ETH_P_IPV6)) {
+		fprintf(stderr, "IP keys need protocol ip or ipv6\n");
+		return -1;
+	}
+	if (need & FLOWER_NEED_VLAN && !eth_type_vlan(fl->tc_proto, false)) {
+		fprintf(stderr, "VLAN keys need protocol 802.1q or 802.1ad\n");
+		return -1;
+	}
+	if (need & FLOWER_NEED_IP_PROTO && !ip_proto) {
+		fprintf(stderr, "Ports and TCP flags need an \"ip_proto\" column\n");
+		return -1;
+	}
+
+	/* ip_proto decides how ports are sent */
+	for (i = 0, k = 0; i < fl->ncols; i++) {
+		if (fl->col[i]->first)
+			fl->order[k++] = i;
+	}
+	for (i = 0; i < fl->ncols; i++) {
+		if (!fl->col[i]->first)
+			fl->order[k++] = i;
+	}
+	return 0;
+}
+
+struct flower_req {
+	struct nlmsghdr	n;
+	struct tcmsg	t;
+	char		buf[MAX_MSG];
+};
+
+/* Build the filter of a row, empty cells are left out */
+static int flower_load_row(struct flower_load *fl, char *line,
+			   struct flower_req *req)
+{
+	char *cell[FLOWER_LOAD_COLS];
+	struct rtattr *tail;
+	unsigned int i, n;
+
+	n = flower_load_split(line, fl->sep, cell, fl->ncols);
+	if (n != fl->ncols) {
+		fprintf(stderr, "Expected %u columns, got %s%u\n", fl->ncols,
+			n > fl->ncols ? "more than " : "", MIN(n, fl->ncols));
+		return -1;
+	}
+
+	fl->ip_proto = 0xff;
+	tail = addattr_nest(&req->n, MAX_MSG, TCA_OPTIONS);
+	for (i = 0; i < fl->ncols; i++) {
+		const struct flower_col *c = fl->col[fl->order[i]];
+		char *str = cell[fl->order[i]];
+
+		if (!*str)
+			continue;
+		if (c->parse(fl, str, &req->n)) {
+			fprintf(stderr, "Illegal \"%s\"\n", c->name);
+			return -1;
+		}
+	}
+
+	if (addattr32(&req->n, MAX_MSG, TCA_FLOWER_FLAGS, fl->flags))
+		return -1;
+	if (fl->tc_proto != htons(ETH_P_ALL) &&
+	    addattr16(&req->n, MAX_MSG, TCA_FLOWER_KEY_ETH_TYPE, fl->tc_proto))
+		return -1;
+	addattr_nest_end(&req->n, tail);
+	return 0;
+}
+
+static int flower_load(struct flower_load *fl, FILE *fp,
+		       const struct nlmsghdr *tmpl, bool own_pipe)
+{
+	struct flower_req req = {};
+	unsigned int used = 0;
+	char *line = NULL;
+	size_t len = 0;
+	int ret, err = 0;
+
+	while (getcmdline(&line, &len, fp) != -1) {
+		/* trailing cells may be empty, only drop the newline */
+		line[strcspn(line, "\r\n")] = '\0';
+		if (!line[strspn(line, " \t")])
+			continue;
+
+		if (!fl->ncols) {
+			if (flower_load_header(fl, line)) {
+				fprintf(stderr, "Invalid header at %s:%d\n",
+					fl->name, cmdlineno);
+				err = -1;
+				break;
+			}
+			continue;
+		}
+
+		/* attribute padding is not written, clear the last row */
+		memcpy(&req, tmpl, tmpl->nlmsg_len);
+		if (used > tmpl->nlmsg_len)
+			memset((char *)&req + tmpl->nlmsg_len, 0,
+			       used - tmpl->nlmsg_len);
+		used = sizeof(req);
+		if (flower_load_row(fl, line, &req)) {
+			fprintf(stderr, "Invalid rule at %s:%d\n", fl->name,
+				cmdlineno);
+			err = -1;
+			continue;
+		}
+
+		used = req.n.nlmsg_len;
+		if (!own_pipe) {
+			int lineno = cmdlineno;
+
+			cmdlineno = fl->batch_lineno;
+			ret = rtnl_talk(&rth, &req.n, NULL);
+			cmdlineno = lineno;
+		} else {
+			ret = rtnl_talk(&rth, &req.n, NULL);
+		}
+		if (ret < 0) {
+			fprintf(stderr, "We have an error talking to the kernel\n");
+			err = -1;
+			break;
+		}
+	}
+
+	free(line);
+	return err;
+}
+
+static void flower_load_free(struct flower_load *fl)
+{
+	struct flower_act *a, *next;
+	unsigned int h;
+
+	for (h = 0; h < FLOWER_ACT_HASH; h++) {
+		for (a = fl->act[h]; a; a = next) {
+			next = a->next;
+			free(a->text);
+			free(a);
+		}
+	}
+}
+
+static void flower_load_explain(void)
+{
+	fprintf(stderr,
+		"Usage: tc filter compile dev STRING [ parent CLASSID ] pref PRIO\n"
+		"                 protocol PROTO flower FILE [ skip_sw | skip_hw ]\n"
+		"                 [ pipeline WINDOW ]\n"
+		"FILE holds a header line of column names, then one filter per line:\n"
+		"COLUMN := { handle | classid | action | indev | dst_mac | src_mac |\n"
+		"            vlan_id | vlan_prio | ip_proto | ip_tos | ip_ttl |\n"
+		"            dst_ip | src_ip | dst_port | src_port | tcp_flags }\n");
+}
+
+static int flower_compile_opt(const struct filter_util *qu, int argc,
+			      char **argv, struct nlmsghdr *n)
+{
+	struct tcmsg *t = NLMSG_DATA(n);
+	struct flower_load fl = {};
+	unsigned int window = FLOWER_LOAD_WINDOW;
+	int saved = cmdlineno, err = -1;
+	bool own_pipe;
+	FILE *fp;
+
+	if (argc < 1 || matches(*argv, "help") == 0) {
+		flower_load_explain();
+		return -1;
+	}
+	fl.name = *argv;
+
+	while (NEXT_ARG_OK()) {
+		NEXT_ARG_FWD();
+		if (matches(*argv, "skip_hw") == 0) {
+			fl.flags |= TCA_CLS_FLAGS_SKIP_HW;
+		} else if (matches(*argv, "skip_sw") == 0) {
+			fl.flags |= TCA_CLS_FLAGS_SKIP_SW;
+		} else if (matches(*argv, "pipeline") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&window, *argv, 0) || !window)
+				invarg("invalid pipeline window", *argv);
+		} else {
+			fprintf(stderr, "What is \"%s\"?\n", *argv);
+			flower_load_explain();
+			return -1;
+		}
+	}
+
+	if (!TC_H_MAJ(t->tcm_info)) {
+		fprintf(stderr, "Compiled filters need a \"pref\"\n");
+		return -1;
+	}
+	fl.tc_proto = TC_H_MIN(t->tcm_info);
+
+	fp = strcmp(fl.name, "-") ? fopen(fl.name, "r") : stdin;
+	if (!fp) {
+		fprintf(stderr, "Cannot open \"%s\": %s\n", fl.name,
+			strerror(errno));
+		return -1;
+	}
+
+	/* Pipeline the rules unless a batch already does; errors then
+	 * refer to lines of the rule file, not of the batch.
+	 */
+	own_pipe = !rth.pipe;
+	if (own_pipe) {
+		rtnl_set_rcvbuf(&rth, window * 2048);
+		if (rtnl_pipeline_start(&rth, window, fl.name) < 0 ||
+		    rtnl_pipeline_buffer(&rth, FLOWER_LOAD_BUF) < 0)
+			goto out;
+	}
+
+	fl.batch_lineno = saved;
+	cmdlineno = 0;
+	err = flower_load(&fl, fp, n, own_pipe);
+
+	if (own_pipe && rtnl_pipeline_flush(&rth))
+		err = -1;
+out:
+	if (own_pipe)
+		rtnl_pipeline_stop(&rth);
+	cmdlineno = saved;
+	flower_load_free(&fl);
+	if (fp != stdin)
+		fclose(fp);
+	return err;
+}
+
 struct filter_util flower_filter_util = {
 	.id = "flower",
 	.parse_fopt = flower_parse_opt,
 	.print_fopt = flower_print_opt,
+	.compile_fopt = flower_compile_opt,
 };
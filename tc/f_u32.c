@@ -16,11 +16,13 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <string.h>
+#include <errno.h>
 #include <linux/if.h>
 #include <linux/if_ether.h>
 
 #include "utils.h"
 #include "tc_util.h"
+#include "tc_common.h"
 
 static void explain(void)
 {
@@ -1382,8 +1384,842 @@ static int u32_print_opt(const struct filter_util *qu, FILE *f, struct rtattr *o
 	return 0;
 }
 
+/*
+ * Rule compiler: "tc filter compile ... u32 FILE" reads a list of u32
+ * filters, one per line with the options of "tc filter add ... u32",
+ * and installs them as a tree of hash tables so that a packet is only
+ * compared with a few of them instead of with each in turn.
+ *
+ * A run of consecutive rules that all match every bit of some hash key
+ * moves to a hash table, linked from a node taking its place; a packet
+ * that matches nothing in the table goes on with the node after the
+ * link, so the first matching rule still wins.  The run may skip rules
+ * that do not match the key if no packet can match both.  Buckets
+ * holding more than a few rules are compiled again, on another key,
+ * and so are the rules that do not match the key.  The kernel follows
+ * no more than TC_U32_MAXDEPTH links, so lists that deep are not split
+ * further.
+ */
+
+#define U32C_MIN_HASH	8	/* compare fewer rules in turn */
+#define U32C_MAX_HOIST	64	/* rules a table may move ahead of */
+#define U32C_MAX_NODE	0xFFF	/* per bucket */
+#define U32C_MAX_HTID	0x7FF	/* from 800: on, the kernel picks them */
+#define U32C_RESERVE	64	/* tables kept for full lists */
+#define U32C_WINDOW	1024
+#define U32C_BUF	(256 * 1024)
+
+struct u32c_rule {
+	struct rtattr		*opt;	/* TCA_OPTIONS contents */
+	int			len;
+	struct tc_u32_sel	*sel;	/* in opt, NULL if none */
+	int			lineno;
+};
+
+struct u32c_table;
+
+struct u32c_ent {
+	struct u32c_rule	*rule;	/* NULL for a link */
+	struct u32c_table	*link;
+};
+
+struct u32c_list {
+	struct u32c_ent		*ent;
+	unsigned int		n;
+	unsigned int		size;
+	struct u32c_table	*more;	/* linked from the last node */
+	unsigned int		depth;	/* links followed to reach it */
+};
+
+struct u32c_table {
+	__u32			htid;
+	unsigned int		divisor;
+	__u32			hmask;	/* host order */
+	int			off;
+	int			lineno;	/* of its first rule */
+	struct u32c_list	bucket[];
+};
+
+struct u32c {
+	struct u32c_rule	*rule;
+	unsigned int		nrules;
+	struct u32c_table	**table;
+	unsigned int		ntables;
+	unsigned int		next_htid;
+	struct u32c_list	root;
+};
+
+/* Bits of the word at @off that @r matches, and their values */
+static __u32 u32c_key(const struct u32c_rule *r, int off, __u32 *val)
+{
+	__u32 mask = 0;
+	int i;
+
+	*val = 0;
+	if (!r->sel)
+		return 0;
+
+	for (i = 0; i < r->sel->nkeys; i++) {
+		const struct tc_u32_key *k = &r->sel->keys[i];
+
+		if (k->off != off || k->offmask)
+			continue;
+		mask |= ntohl(k->mask);
+		*val |= ntohl(k->val & k->mask);
+	}
+	return mask;
+}
+
+/* Whether @r matches all bits of @hmask at @off, and in which bucket */
+static bool u32c_hashed(const struct u32c_rule *r, int off, __u32 hmask,
+			unsigned int *bucket)
+{
+	__u32 val;
+
+	if ((u32c_key(r, off, &val) & hmask) != hmask)
+		return false;
+	if (bucket)
+		*bucket = (val & hmask) >> (ffs(hmask) - 1);
+	return true;
+}
+
+/*
+ * Pick the byte, at any nibble of a word the rules match, that splits
+ * them best: the fewest rules left out of the table and the smallest
+ * buckets.  Returns false if no key is worth a table.
+ */
+static bool u32c_pick_key(struct u32c_rule **r, unsigned int n,
+			  int *off_p, __u32 *hmask_p)
+{
+	unsigned int size[256], i, b, h, used, noffs = 0;
+	double cost, best = n / 2.0;
+	bool found = false;
+	int offs[64], k, shift;
+
+	for (i = 0; i < n; i++) {
+		if (!r[i]->sel)
+			continue;
+		for (k = 0; k < r[i]->sel->nkeys; k++) {
+			const struct tc_u32_key *key = &r[i]->sel->keys[k];
+			unsigned int j;
+
+			if (key->offmask)
+				continue;
+			for (j = 0; j < noffs && offs[j] != key->off; j++)
+				;
+			if (j == noffs && noffs < ARRAY_SIZE(offs))
+				offs[noffs++] = key->off;
+		}
+	}
+
+	for (k = 0; k < noffs; k++) {
+		for (shift = 0; shift <= 24; shift += 4) {
+			__u32 hmask = 0xffU << shift;
+			double sq = 0;
+
+			memset(size, 0, sizeof(size));
+			for (i = h = used = 0; i < n; i++) {
+				if (!u32c_hashed(r[i], offs[k], hmask, &b))
+					continue;
+				if (!size[b]++)
+					used++;
+				h++;
+			}
+			if (h < U32C_MIN_HASH || used < 2)
+				continue;
+
+			for (b = 0; b < 256; b++)
+				sq += (double)size[b] * size[b];
+			cost = (n - h) + sq / h;
+			if (cost < best) {
+				best = cost;
+				*off_p = offs[k];
+				*hmask_p = hmask;
+				found = true;
+			}
+		}
+	}
+	return found;
+}
+
+static struct u32c_table *u32c_new_table(struct u32c *c, unsigned int divisor,
+					  unsigned int depth, int lineno)
+{
+	struct u32c_table *t, **tables;
+	unsigned int b;
+
+	if (c->next_htid > U32C_MAX_HTID) {
+		fprintf(stderr, "Too many hash tables, at line %d\n", lineno);
+		return NULL;
+	}
+
+	t = calloc(1, sizeof(*t) + divisor * sizeof(t->bucket[0]));
+	tables = realloc(c->table, (c->ntables + 1) * sizeof(*c->table));
+	if (!t || !tables) {
+		fprintf(stderr, "Out of memory\n");
+		free(t);
+		return NULL;
+	}
+	c->table = tables;
+	c->table[c->ntables++] = t;
+
+	t->htid = c->next_htid++ << 20;
+	t->divisor = divisor;
+	t->lineno = lineno;
+	for (b = 0; b < divisor; b++)
+		t->bucket[b].depth = depth;
+	return t;
+}
+
+static int u32c_push(struct u32c_list *l, struct u32c_rule *r,
+		     struct u32c_table *link)
+{
+	if (l->n == l->size) {
+		l->size = l->size ? 2 * l->size : 16;
+		l->ent = realloc(l->ent, l->size * sizeof(*l->ent));
+		if (!l->ent) {
+			fprintf(stderr, "Out of memory\n");
+			return -1;
+		}
+	}
+	l->ent[l->n].rule = r;
+	l->ent[l->n].link = link;
+	l->n++;
+	return 0;
+}
+
+/* The list that nodes appended to @l go to */
+static struct u32c_list *u32c_tail(struct u32c_list *l)
+{
+	while (l->more)
+		l = &l->more->bucket[0];
+	return l;
+}
+
+/* Depth of the buckets of a table linked next from @l */
+static unsigned int u32c_link_depth(struct u32c_list *l)
+{
+	l = u32c_tail(l);
+	return l->depth + 1 + (l->n == U32C_MAX_NODE - 1);
+}
+
+static int u32c_append(struct u32c *c, struct u32c_list *l,
+		       struct u32c_rule *r, struct u32c_table *link)
+{
+	int lineno = r ? r->lineno : link->lineno;
+
+	/* A full list goes on in a table of one bucket, linked last,
+	 * unless the kernel would not follow the link
+	 */
+	l = u32c_tail(l);
+	if (l->n == U32C_MAX_NODE) {
+		fprintf(stderr, "Too many rules in one hash bucket, at line %d\n",
+			lineno);
+		return -1;
+	}
+	if (l->n == U32C_MAX_NODE - 1 && l->depth < TC_U32_MAXDEPTH) {
+		l->more = u32c_new_table(c, 1, l->depth + 1, lineno);
+		if (!l->more)
+			return -1;
+		if (u32c_push(l, NULL, l->more))
+			return -1;
+		l = &l->more->bucket[0];
+	}
+
+	return u32c_push(l, r, link);
+}
+
+static int u32c_append_rules(struct u32c *c, struct u32c_list *l,
+			     struct u32c_rule **r, unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		if (u32c_append(c, l, r[i], NULL))
+			return -1;
+	}
+	return 0;
+}
+
+static int u32c_compile(struct u32c *c, struct u32c_rule **r, unsigned int n,
+			struct u32c_list *l);
+
+/* Move @n rules matching all of @hmask at @off to a new table linked from @l */
+static int u32c_table(struct u32c *c, struct u32c_rule **r, unsigned int n,
+		      int off, __u32 hmask, struct u32c_list *l)
+{
+	unsigned int count[256] = {}, start[256], i, b = 0, used = 0, divisor;
+	unsigned int depth = u32c_link_depth(l);
+	int shift = ffs(hmask) - 1;
+	struct u32c_rule **sorted;
+	struct u32c_table *t;
+	int err = 0;
+
+	for (i = 0; i < n; i++) {
+		u32c_hashed(r[i], off, hmask, &b);
+		if (!count[b]++)
+			used++;
+	}
+	if (used < 2)
+		return u32c_compile(c, r, n, l);
+
+	/* Out of tables, but for those continuing full lists, or too
+	 * deep for the kernel to follow one more link
+	 */
+	if (c->next_htid + U32C_RESERVE > U32C_MAX_HTID ||
+	    depth > TC_U32_MAXDEPTH)
+		return u32c_append_rules(c, l, r, n);
+
+	/* The fewest buckets that keep rules of different values apart */
+	for (divisor = 2; divisor < 256; divisor *= 2) {
+		unsigned char taken[256] = {};
+		unsigned int u = 0;
+
+		for (b = 0; b < 256; b++)
+			if (count[b] && !taken[b & (divisor - 1)]++)
+				u++;
+		if (u == used)
+			break;
+	}
+
+	t = u32c_new_table(c, divisor, depth, r[0]->lineno);
+	if (!t)
+		return -1;
+	t->hmask = (__u32)(divisor - 1) << shift;
+	t->off = off;
+
+	sorted = malloc(n * sizeof(*sorted));
+	if (!sorted) {
+		fprintf(stderr, "Out of memory\n");
+		return -1;
+	}
+
+	/* Sort the rules into buckets, keeping their order */
+	memset(count, 0, sizeof(count));
+	for (i = 0; i < n; i++) {
+		u32c_hashed(r[i], off, t->hmask, &b);
+		count[b]++;
+	}
+	for (b = i = 0; b < divisor; i += count[b++])
+		start[b] = i;
+	for (i = 0; i < n; i++) {
+		u32c_hashed(r[i], off, t->hmask, &b);
+		sorted[start[b]++] = r[i];
+	}
+
+	for (b = i = 0; b < divisor && !err; i += count[b++]) {
+		if (count[b])
+			err = u32c_compile(c, sorted + i, count[b],
+					   &t->bucket[b]);
+	}
+	free(sorted);
+
+	return err ? : u32c_append(c, l, NULL, t);
+}
+
+/* Whether no packet can match both @a and @b */
+static bool u32c_disjoint(const struct u32c_rule *a, const struct u32c_rule *b)
+{
+	int i, j;
+
+	if (!a->sel || !b->sel)
+		return false;
+
+	for (i = 0; i < a->sel->nkeys; i++) {
+		const struct tc_u32_key *ka = &a->sel->keys[i];
+
+		for (j = 0; j < b->sel->nkeys; j++) {
+			const struct tc_u32_key *kb = &b->sel->keys[j];
+
+			if (ka->off == kb->off && !ka->offmask &&
+			    !kb->offmask &&
+			    (ka->val ^ kb->val) & ka->mask & kb->mask)
+				return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Length of the run of rules from r[0] that match all of @hmask at @off.
+ * Rules of the run may move ahead of the other rules in between if no
+ * packet can match both: when the run is long enough for a table, they
+ * are reordered so that the run comes first.
+ */
+static unsigned int u32c_run(struct u32c_rule **r, unsigned int n, int off,
+			     __u32 hmask)
+{
+	struct u32c_rule *skip[U32C_MAX_HOIST];
+	unsigned int i, j, k, run = 0, nskip = 0;
+
+	for (j = 0; j < n; j++) {
+		if (!u32c_hashed(r[j], off, hmask, NULL)) {
+			if (nskip == U32C_MAX_HOIST)
+				break;
+			skip[nskip++] = r[j];
+			continue;
+		}
+		for (k = 0; k < nskip; k++) {
+			if (!u32c_disjoint(skip[k], r[j]))
+				break;
+		}
+		if (k < nskip)
+			break;
+		run++;
+	}
+
+	if (run < U32C_MIN_HASH) {
+		for (i = 0; i < n && u32c_hashed(r[i], off, hmask, NULL); i++)
+			;
+		return i;
+	}
+
+	for (i = k = 0; i < j; i++) {
+		if (u32c_hashed(r[i], off, hmask, NULL))
+			r[k++] = r[i];
+	}
+	memcpy(r + run, skip, nskip * sizeof(*skip));
+	return run;
+}
+
+/* Lay out @n rules, in order, from the end of list @l */
+static int u32c_compile(struct u32c *c, struct u32c_rule **r, unsigned int n,
+			struct u32c_list *l)
+{
+	unsigned int i, j;
+	__u32 hmask;
+	int off, err;
+
+	if (n < U32C_MIN_HASH || !u32c_pick_key(r, n, &off, &hmask))
+		return u32c_append_rules(c, l, r, n);
+
+	for (i = 0; i < n; i += j) {
+		if (u32c_hashed(r[i], off, hmask, NULL)) {
+			j = u32c_run(r + i, n - i, off, hmask);
+			if (j >= U32C_MIN_HASH)
+				err = u32c_table(c, r + i, j, off, hmask, l);
+			else
+				err = u32c_compile(c, r + i, j, l);
+		} else {
+			for (j = 1; i + j < n; j++) {
+				if (u32c_hashed(r[i + j], off, hmask, NULL))
+					break;
+			}
+			err = u32c_compile(c, r + i, j, l);
+		}
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
+/* Nodes a packet matching nothing in @l is compared with, on average
+ * over the buckets and at worst.
+ */
+static double u32c_miss(const struct u32c_list *l, unsigned int *worst)
+{
+	double cost = 0;
+	unsigned int i, b;
+
+	*worst = 0;
+	for (i = 0; i < l->n; i++) {
+		const struct u32c_table *t = l->ent[i].link;
+		unsigned int w, max = 0;
+		double sum = 0;
+
+		cost++;
+		(*worst)++;
+		if (!t)
+			continue;
+
+		for (b = 0; b < t->divisor; b++) {
+			sum += u32c_miss(&t->bucket[b], &w);
+			if (w > max)
+				max = w;
+		}
+		cost += sum / t->divisor;
+		*worst += max;
+	}
+	return cost;
+}
+
+/* Add up the nodes compared to reach each rule of @l */
+static double u32c_depth(const struct u32c_list *l, double base)
+{
+	unsigned int i, b, w;
+	double sum = 0;
+
+	for (i = 0; i < l->n; i++) {
+		const struct u32c_table *t = l->ent[i].link;
+		double miss = 0;
+
+		base++;
+		if (!t) {
+			sum += base;
+			continue;
+		}
+
+		for (b = 0; b < t->divisor; b++) {
+			sum += u32c_depth(&t->bucket[b], base);
+			miss += u32c_miss(&t->bucket[b], &w);
+		}
+		base += miss / t->divisor;
+	}
+	return sum;
+}
+
+static void u32c_report(const struct u32c *c)
+{
+	unsigned int worst;
+
+	u32c_miss(&c->root, &worst);
+
+	new_json_obj(json);
+	open_json_object(NULL);
+	print_uint(PRINT_ANY, "rules", "%u rules", c->nrules);
+	print_uint(PRINT_ANY, "tables", " in %u hash tables", c->ntables);
+	print_uint(PRINT_ANY, "nodes", ", %u nodes", c->nrules + c->ntables);
+	print_nl();
+	print_float(PRINT_ANY, "depth_avg", "lookup depth: average %.1f",
+		    c->nrules ? u32c_depth(&c->root, 0) / c->nrules : 0);
+	print_uint(PRINT_ANY, "depth_max", ", worst %u", worst);
+	print_float(PRINT_ANY, "linear_depth_avg", " (in turn: average %.1f",
+		    (c->nrules + 1) / 2.0);
+	print_uint(PRINT_ANY, "linear_depth_max", ", worst %u)", c->nrules);
+	print_nl();
+	close_json_object();
+	delete_json_obj();
+}
+
+struct u32c_req {
+	struct nlmsghdr	n;
+	struct tcmsg	t;
+	char		buf[MAX_MSG];
+};
+
+static int u32c_send(struct u32c_req *req, int lineno, bool own_pipe)
+{
+	if (own_pipe)
+		cmdlineno = lineno;
+	if (rtnl_talk(&rth, &req->n, NULL) < 0) {
+		fprintf(stderr, "We have an error talking to the kernel\n");
+		return -1;
+	}
+	return 0;
+}
+
+static int u32c_put_table(const struct nlmsghdr *tmpl,
+			  const struct u32c_table *t, bool own_pipe)
+{
+	struct u32c_req req;
+	struct rtattr *tail;
+
+	memcpy(&req, tmpl, tmpl->nlmsg_len);
+	req.t.tcm_handle = t->htid;
+	tail = addattr_nest(&req.n, sizeof(req), TCA_OPTIONS);
+	addattr32(&req.n, sizeof(req), TCA_U32_DIVISOR, t->divisor);
+	addattr_nest_end(&req.n, tail);
+
+	return u32c_send(&req, t->lineno, own_pipe);
+}
+
+/* Install the rules of @l, in bucket @htid, and the tables they link to */
+static int u32c_put_list(const struct nlmsghdr *tmpl,
+			 const struct u32c_list *l, __u32 htid, bool own_pipe)
+{
+	struct {
+		struct tc_u32_sel sel;
+		struct tc_u32_key keys[1];
+	} sel;
+	struct u32c_req req;
+	struct rtattr *tail;
+	unsigned int i, b;
+	int lineno;
+
+	for (i = 0; i < l->n; i++) {
+		const struct u32c_ent *e = &l->ent[i];
+
+		/* Fill tables before they are linked to.  The kernel finds
+		 * tables by walking a list of them, newest first: create
+		 * each just before it is filled.
+		 */
+		if (e->link) {
+			if (u32c_put_table(tmpl, e->link, own_pipe))
+				return -1;
+			for (b = 0; b < e->link->divisor; b++) {
+				if (u32c_put_list(tmpl, &e->link->bucket[b],
+						  e->link->htid | b << 12,
+						  own_pipe))
+					return -1;
+			}
+		}
+
+		/* The full handle spares the kernel a walk of all tables */
+		memcpy(&req, tmpl, tmpl->nlmsg_len);
+		req.t.tcm_handle = (htid == TC_U32_ROOT ? 0 : htid) | (i + 1);
+		tail = addattr_nest(&req.n, sizeof(req), TCA_OPTIONS);
+		addattr32(&req.n, sizeof(req), TCA_U32_HASH, htid);
+
+		memset(&sel, 0, sizeof(sel));
+		sel.sel.nkeys = 1;
+		if (e->link) {
+			sel.sel.hmask = htonl(e->link->hmask);
+			sel.sel.hoff = e->link->off;
+			addattr32(&req.n, sizeof(req), TCA_U32_LINK,
+				  e->link->htid);
+			addattr_l(&req.n, sizeof(req), TCA_U32_SEL, &sel,
+				  sizeof(sel));
+			lineno = e->link->lineno;
+		} else {
+			if (addraw_l(&req.n, sizeof(req), e->rule->opt,
+				     e->rule->len))
+				return -1;
+			if (!e->rule->sel)
+				addattr_l(&req.n, sizeof(req), TCA_U32_SEL,
+					  &sel, sizeof(sel));
+			lineno = e->rule->lineno;
+		}
+		addattr_nest_end(&req.n, tail);
+
+		if (u32c_send(&req, lineno, own_pipe))
+			return -1;
+	}
+	return 0;
+}
+
+/* Parse one rule into @r, as "tc filter add ... u32" would */
+static int u32c_parse_rule(const struct filter_util *qu, int argc,
+			   char **argv, struct u32c_rule *r)
+{
+	struct tcmsg *t;
+	struct rtattr *tb[TCA_MAX + 1], *opt[TCA_U32_MAX + 1];
+	struct u32c_req req = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcmsg)),
+	};
+
+	if (u32_parse_opt(qu, NULL, argc, argv, &req.n))
+		return -1;
+
+	t = NLMSG_DATA(&req.n);
+	parse_rtattr(tb, TCA_MAX, TCA_RTA(t),
+		     req.n.nlmsg_len - NLMSG_LENGTH(sizeof(*t)));
+	if (!tb[TCA_OPTIONS]) {
+		fprintf(stderr, "Empty rule\n");
+		return -1;
+	}
+	parse_rtattr_nested(opt, TCA_U32_MAX, tb[TCA_OPTIONS]);
+
+	if (t->tcm_handle || opt[TCA_U32_HASH] || opt[TCA_U32_LINK] ||
+	    opt[TCA_U32_DIVISOR]) {
+		fprintf(stderr,
+			"\"order\", \"ht\", \"sample\", \"link\" and \"divisor\" are up to the compiler\n");
+		return -1;
+	}
+	if (opt[TCA_U32_SEL]) {
+		struct tc_u32_sel *sel = RTA_DATA(opt[TCA_U32_SEL]);
+
+		if (sel->hmask || sel->flags & (TC_U32_OFFSET |
+						TC_U32_VAROFFSET)) {
+			fprintf(stderr,
+				"\"hashkey\" and \"offset\" are up to the compiler\n");
+			return -1;
+		}
+	}
+
+	r->len = RTA_PAYLOAD(tb[TCA_OPTIONS]);
+	r->opt = malloc(r->len);
+	if (!r->opt) {
+		fprintf(stderr, "Out of memory\n");
+		return -1;
+	}
+	memcpy(r->opt, RTA_DATA(tb[TCA_OPTIONS]), r->len);
+
+	/* Point into the copy */
+	parse_rtattr(opt, TCA_U32_MAX, r->opt, r->len);
+	r->sel = opt[TCA_U32_SEL] ? RTA_DATA(opt[TCA_U32_SEL]) : NULL;
+	return 0;
+}
+
+static int u32c_read(const struct filter_util *qu, const char *name,
+		     struct u32c *c)
+{
+	int saved = cmdlineno, err = 0;
+	char *line = NULL;
+	size_t len = 0;
+	FILE *fp;
+
+	fp = strcmp(name, "-") ? fopen(name, "r") : stdin;
+	if (!fp) {
+		fprintf(stderr, "Cannot open \"%s\": %s\n", name,
+			strerror(errno));
+		return -1;
+	}
+
+	cmdlineno = 0;
+	while (getcmdline(&line, &len, fp) != -1) {
+		char *largv[MAX_ARGS];
+		struct u32c_rule *r;
+		int largc;
+
+		largc = makeargs(line, largv, MAX_ARGS);
+		if (!largc)
+			continue;
+
+		if (c->nrules % 1024 == 0) {
+			r = realloc(c->rule, (c->nrules + 1024) *
+					     sizeof(*c->rule));
+			if (!r) {
+				fprintf(stderr, "Out of memory\n");
+				err = -1;
+				break;
+			}
+			c->rule = r;
+		}
+		r = &c->rule[c->nrules];
+		r->lineno = cmdlineno;
+		if (u32c_parse_rule(qu, largc, largv, r)) {
+			fprintf(stderr, "Invalid rule at %s:%d\n", name,
+				r->lineno);
+			err = -1;
+			continue;
+		}
+		c->nrules++;
+	}
+
+	free(line);
+	if (fp != stdin)
+		fclose(fp);
+	cmdlineno = saved;
+	return err;
+}
+
+static void u32c_free_list(struct u32c_list *l)
+{
+	free(l->ent);
+}
+
+static void u32c_free(struct u32c *c)
+{
+	unsigned int i, b;
+
+	for (i = 0; i < c->ntables; i++) {
+		for (b = 0; b < c->table[i]->divisor; b++)
+			u32c_free_list(&c->table[i]->bucket[b]);
+		free(c->table[i]);
+	}
+	for (i = 0; i < c->nrules; i++)
+		free(c->rule[i].opt);
+	u32c_free_list(&c->root);
+	free(c->table);
+	free(c->rule);
+}
+
+static void u32c_explain(void)
+{
+	fprintf(stderr,
+		"Usage: tc filter compile dev STRING [ parent CLASSID ] pref PRIO\n"
+		"                 [ protocol PROTO ] u32 FILE [ ht HTID ]\n"
+		"                 [ pipeline WINDOW ] [ dry-run ]\n"
+		"FILE holds one filter per line, with the options of \"tc filter add ... u32\"\n");
+}
+
+static int u32_compile_opt(const struct filter_util *qu, int argc, char **argv,
+			   struct nlmsghdr *n)
+{
+	struct tcmsg *t = NLMSG_DATA(n);
+	unsigned int window = U32C_WINDOW;
+	struct u32c c = { .next_htid = 1 };
+	struct u32c_rule **r = NULL;
+	bool dry_run = false, own_pipe;
+	const char *file;
+	unsigned int i;
+	int err = -1;
+
+	if (argc < 1 || matches(*argv, "help") == 0) {
+		u32c_explain();
+		return -1;
+	}
+	file = *argv;
+
+	while (NEXT_ARG_OK()) {
+		NEXT_ARG_FWD();
+		if (strcmp(*argv, "ht") == 0) {
+			__u32 ht;
+
+			NEXT_ARG();
+			if (get_u32_handle(&ht, *argv) || !TC_U32_HTID(ht) ||
+			    TC_U32_HASH(ht) || TC_U32_NODE(ht) ||
+			    TC_U32_USERHTID(ht) > U32C_MAX_HTID) {
+				fprintf(stderr, "Illegal \"ht\"\n");
+				return -1;
+			}
+			c.next_htid = TC_U32_USERHTID(ht);
+		} else if (matches(*argv, "pipeline") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&window, *argv, 0) || !window)
+				invarg("invalid pipeline window", *argv);
+		} else if (strcmp(*argv, "dry-run") == 0) {
+			dry_run = true;
+		} else {
+			fprintf(stderr, "What is \"%s\"?\n", *argv);
+			u32c_explain();
+			return -1;
+		}
+	}
+
+	if (!TC_H_MAJ(t->tcm_info)) {
+		fprintf(stderr, "Compiled filters need a \"pref\"\n");
+		return -1;
+	}
+
+	if (u32c_read(qu, file, &c))
+		goto out;
+
+	r = calloc(c.nrules ? : 1, sizeof(*r));
+	if (!r) {
+		fprintf(stderr, "Out of memory\n");
+		goto out;
+	}
+	for (i = 0; i < c.nrules; i++)
+		r[i] = &c.rule[i];
+	if (u32c_compile(&c, r, c.nrules, &c.root))
+		goto out;
+
+	if (!dry_run) {
+		/* Pipeline the rules unless a batch already does; errors
+		 * then refer to lines of the rule file, not of the batch.
+		 */
+		own_pipe = !rth.pipe;
+		if (own_pipe) {
+			rtnl_set_rcvbuf(&rth, window * 2048);
+			if (rtnl_pipeline_start(&rth, window, file) < 0 ||
+			    rtnl_pipeline_buffer(&rth, U32C_BUF) < 0)
+				goto out;
+		}
+
+		if (!u32c_put_list(n, &c.root, TC_U32_ROOT, own_pipe))
+			err = 0;
+
+		if (own_pipe) {
+			if (rtnl_pipeline_flush(&rth))
+				err = -1;
+			rtnl_pipeline_stop(&rth);
+		}
+		if (err)
+			goto out;
+	}
+
+	u32c_report(&c);
+	err = 0;
+out:
+	free(r);
+	u32c_free(&c);
+	return err;
+}
+
 struct filter_util u32_filter_util = {
 	.id = "u32",
 	.parse_fopt = u32_parse_opt,
 	.print_fopt = u32_print_opt,
+	.compile_fopt = u32_compile_opt,
 };
@@ -15,8 +15,11 @@
 #include <arpa/inet.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "utils.h"
+#include "netem_dist.h"
 #include "tc_util.h"
 #include "tc_common.h"
 
@@ -116,14 +119,108 @@ static void print_corr(bool present, __u32 value)
 	}
 }
 
+/* Distribution tables loaded so far, for the other qdiscs of a batch */
+struct netem_dist {
+	struct netem_dist	*next;
+	char			*type;
+	const __s16		*data;
+	int			size;
+};
+
+static struct netem_dist *netem_dists;
+
+/* Was the text table @name changed after the binary one of @st? */
+static bool dist_text_newer(const char *name, const struct stat *st)
+{
+	struct stat text;
+
+	if (stat(name, &text) < 0)
+		return false;
+	if (text.st_mtim.tv_sec != st->st_mtim.tv_sec)
+		return text.st_mtim.tv_sec > st->st_mtim.tv_sec;
+	return text.st_mtim.tv_nsec > st->st_mtim.tv_nsec;
+}
+
+/*
+ * Map the binary table of a distribution, see netem_dist.h.  Its
+ * entries are used in place on little endian hosts.  Returns 1 if
+ * there is none, or if the text table was edited since it was built.
+ */
+static int get_distribution_bin(const char *type, struct netem_dist *d)
+{
+	char name[128], text[128];
+	struct stat st;
+	void *map;
+	int fd, n;
+
+	snprintf(name, sizeof(name), "%s/%s.bdist", get_tc_lib(), type);
+	fd = open(name, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		if (errno == ENOENT)
+			return 1;
+		fprintf(stderr, "%s: %s\n", name, strerror(errno));
+		return -1;
+	}
+
+	if (fstat(fd, &st) < 0) {
+		fprintf(stderr, "%s: %s\n", name, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	snprintf(text, sizeof(text), "%s/%s.dist", get_tc_lib(), type);
+	if (dist_text_newer(text, &st)) {
+		close(fd);
+		return 1;
+	}
+	if (st.st_size == 0) {
+		fprintf(stderr, "%s: empty distribution table\n", name);
+		close(fd);
+		return -1;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "%s: %s\n", name, strerror(errno));
+		return -1;
+	}
+
+	n = netem_dist_valid(map, st.st_size);
+	if (n <= 0 || n > MAX_DIST) {
+		fprintf(stderr, "%s: invalid distribution table\n", name);
+		munmap(map, st.st_size);
+		return -1;
+	}
+
+	d->data = (const __s16 *)((char *)map +
+				  le16toh(((struct netem_dist_hdr *)map)->hdr_len));
+	d->size = n;
+#if __BYTE_ORDER == __BIG_ENDIAN
+	{
+		__s16 *data = malloc(n * sizeof(*data));
+		int i;
+
+		if (!data) {
+			munmap(map, st.st_size);
+			return -1;
+		}
+		for (i = 0; i < n; i++)
+			data[i] = le16toh(d->data[i]);
+		d->data = data;
+		munmap(map, st.st_size);
+	}
+#endif
+	return 0;
+}
+
 /*
  * Simplistic file parser for distribution data.
  * Format is:
  *	# comment line(s)
  *	data0 data1 ...
  */
-static int get_distribution(const char *type, __s16 *data, int maxdata)
+static int get_distribution_text(const char *type, struct netem_dist *d)
 {
+	__s16 *data;
 	FILE *f;
 	int n;
 	long x;
@@ -139,6 +236,12 @@ static int get_distribution(const char *type, __s16 *data, int maxdata)
 		return -1;
 	}
 
+	data = calloc(MAX_DIST, sizeof(data[0]));
+	if (data == NULL) {
+		fclose(f);
+		return -1;
+	}
+
 	n = 0;
 	while (getline(&line, &len, f) != -1) {
 		char *p, *endp;
@@ -151,7 +254,7 @@ static int get_distribution(const char *type, __s16 *data, int maxdata)
 			if (endp == p)
 				break;
 
-			if (n >= maxdata) {
+			if (n >= MAX_DIST) {
 				fprintf(stderr, "%s: too much data\n",
 					name);
 				n = -1;
@@ -163,7 +266,47 @@ static int get_distribution(const char *type, __s16 *data, int maxdata)
  error:
 	free(line);
 	fclose(f);
-	return n;
+	if (n <= 0) {
+		free(data);
+		return -1;
+	}
+	d->data = data;
+	d->size = n;
+	return 0;
+}
+
+/*
+ * Entries of the table of distribution @type, from its binary file if
+ * there is one and it is not older than the text one, else from the
+ * text one.
+ */
+static const __s16 *get_distribution(const char *type, int *size)
+{
+	struct netem_dist *d;
+	int err;
+
+	for (d = netem_dists; d; d = d->next) {
+		if (strcmp(d->type, type) == 0)
+			goto found;
+	}
+
+	d = calloc(1, sizeof(*d));
+	if (!d)
+		return NULL;
+	d->type = strdup(type);
+	err = d->type ? get_distribution_bin(type, d) : -1;
+	if (err > 0)
+		err = get_distribution_text(type, d);
+	if (err) {
+		free(d->type);
+		free(d);
+		return NULL;
+	}
+	d->next = netem_dists;
+	netem_dists = d;
+found:
+	*size = d->size;
+	return d->data;
 }
 
 #define NEXT_IS_NUMBER() (NEXT_ARG_OK() && isdigit(argv[1][0]))
@@ -185,8 +328,8 @@ static int netem_parse_opt(const struct qdisc_util *qu, int argc, char **argv,
 	struct tc_netem_gemodel gemodel;
 	struct tc_netem_rate rate = {};
 	struct tc_netem_slot slot = {};
-	__s16 *dist_data = NULL;
-	__s16 *slot_dist_data = NULL;
+	const __s16 *dist_data = NULL;
+	const __s16 *slot_dist_data = NULL;
 	__u16 loss_type = NETEM_LOSS_UNSPEC;
 	int present[__TCA_NETEM_MAX] = {};
 	__s64 latency64 = 0;
@@ -414,15 +557,9 @@ random_loss_model:
 			}
 		} else if (matches(*argv, "distribution") == 0) {
 			NEXT_ARG();
-			dist_data = calloc(MAX_DIST, sizeof(dist_data[0]));
+			dist_data = get_distribution(*argv, &dist_size);
 			if (dist_data == NULL)
 				return -1;
-
-			dist_size = get_distribution(*argv, dist_data, MAX_DIST);
-			if (dist_size <= 0) {
-				free(dist_data);
-				return -1;
-			}
 		} else if (matches(*argv, "rate") == 0) {
 			++present[TCA_NETEM_RATE];
 			NEXT_ARG();
@@ -479,14 +616,10 @@ random_loss_model:
 				if (strcmp(*argv, "distribution") == 0) {
 					present[TCA_NETEM_SLOT] = 1;
 					NEXT_ARG();
-					slot_dist_data = calloc(MAX_DIST, sizeof(slot_dist_data[0]));
+					slot_dist_data = get_distribution(*argv,
+									  &slot_dist_size);
 					if (!slot_dist_data)
 						return -1;
-					slot_dist_size = get_distribution(*argv, slot_dist_data, MAX_DIST);
-					if (slot_dist_size <= 0) {
-						free(slot_dist_data);
-						return -1;
-					}
 					NEXT_ARG();
 					if (get_time64(&slot.dist_delay, *argv)) {
 						explain1("slot delay");
@@ -644,7 +777,6 @@ random_loss_model:
 			      TCA_NETEM_DELAY_DIST,
 			      dist_data, dist_size * sizeof(dist_data[0])) < 0)
 			return -1;
-		free(dist_data);
 	}
 
 	if (slot_dist_data) {
@@ -652,7 +784,6 @@ random_loss_model:
 			      TCA_NETEM_SLOT_DIST,
 			      slot_dist_data, slot_dist_size * sizeof(slot_dist_data[0])) < 0)
 			return -1;
-		free(slot_dist_data);
 	}
 	tail->rta_len = (void *) NLMSG_TAIL(n) - (void *) tail;
 	return 0;
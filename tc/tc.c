@@ -31,6 +31,7 @@ int show_graph;
 int timestamp;
 
 int batch_mode;
+static unsigned int batch_window;
 int force;
 bool use_names;
 int json;
@@ -190,14 +191,16 @@ static void usage(void)
 {
 	fprintf(stderr,
 		"Usage:	tc [ OPTIONS ] OBJECT { COMMAND | help }\n"
-		"	tc [-force] -batch filename\n"
+		"	tc [-force] [-pipeline window] -batch filename\n"
 		"where  OBJECT := { qdisc | class | filter | chain |\n"
 		"		    action | monitor | exec }\n"
 		"       OPTIONS := { -V[ersion] | -s[tatistics] | -d[etails] | -r[aw] |\n"
 		"		    -o[neline] | -j[son] | -p[retty] | -c[olor]\n"
 		"		    -b[atch] [filename] | -n[etns] name | -N[umeric] |\n"
 		"		     -nm | -nam[es] | { -cf | -conf } path\n"
-		"		     -br[ief] | -echo }\n");
+		"		     -br[ief] | -echo |\n"
+		"		     -in[terval] ms [ -cou[nt] n ] [ -del[ta] ] [ -ew[ma] ms ]\n"
+		"		     [ -to[p] k ] }\n");
 }
 
 static int do_cmd(int argc, char **argv)
@@ -243,7 +246,11 @@ static int batch(const char *name)
 		return -1;
 	}
 
-	ret = do_batch(name, force, tc_batch_cmd, NULL);
+	if (batch_window)
+		ret = do_batch_pipelined(name, force, tc_batch_cmd, NULL,
+					 &rth, batch_window);
+	else
+		ret = do_batch(name, force, tc_batch_cmd, NULL);
 
 	rtnl_close(&rth);
 	return ret;
@@ -260,6 +267,8 @@ int main(int argc, char **argv)
 	while (argc > 1) {
 		if (argv[1][0] != '-')
 			break;
+		if (argv[1][1] == '-' && argv[1][2])
+			argv[1]++;
 		if (matches(argv[1], "-stats") == 0 ||
 			 matches(argv[1], "-statistics") == 0) {
 			++show_stats;
@@ -290,6 +299,10 @@ int main(int argc, char **argv)
 			if (argc <= 1)
 				missarg("batch file");
 			batch_file = argv[1];
+		} else if (matches(argv[1], "-pipeline") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&batch_window, argv[1], 0))
+				invarg("invalid pipeline window", argv[1]);
 		} else if (matches(argv[1], "-netns") == 0) {
 			NEXT_ARG();
 			if (netns_switch(argv[1]))
@@ -317,6 +330,26 @@ int main(int argc, char **argv)
 			++brief;
 		} else if (strcmp(argv[1], "-echo") == 0) {
 			++echo_request;
+		} else if (matches(argv[1], "-interval") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&sample_interval, argv[1], 0) ||
+			    !sample_interval)
+				invarg("invalid interval", argv[1]);
+		} else if (matches(argv[1], "-count") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&sample_count, argv[1], 0))
+				invarg("invalid count", argv[1]);
+		} else if (matches(argv[1], "-delta") == 0) {
+			sample_delta = 1;
+		} else if (matches(argv[1], "-ewma") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&sample_ewma, argv[1], 0))
+				invarg("invalid EWMA time constant", argv[1]);
+		} else if (matches(argv[1], "-top") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&sample_top, argv[1], 0) ||
+			    !sample_top)
+				invarg("invalid top count", argv[1]);
 		} else {
 			fprintf(stderr,
 				"Option \"%s\" is unknown, try \"tc -help\".\n",
@@ -328,6 +361,17 @@ int main(int argc, char **argv)
 
 	_SL_ = oneline ? "\\" : "\n";
 
+	if ((sample_count || sample_delta || sample_ewma || sample_top) &&
+	    !sample_interval) {
+		fprintf(stderr, "Sampling options need \"-interval\".\n");
+		return -1;
+	}
+	if (sample_interval && (batch_file || show_graph)) {
+		fprintf(stderr,
+			"\"-interval\" cannot be used with \"-batch\" or \"-graph\".\n");
+		return -1;
+	}
+
 	check_enable_color(color, json);
 
 	if (batch_file)
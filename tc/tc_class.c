@@ -20,20 +20,6 @@
 #include "tc_common.h"
 #include "list.h"
 
-struct graph_node {
-	struct hlist_node hlist;
-	__u32 id;
-	__u32 parent_id;
-	struct graph_node *parent_node;
-	struct graph_node *right_node;
-	void *data;
-	int data_len;
-	int nodes_count;
-};
-
-static struct hlist_head cls_list = {};
-static struct hlist_head root_cls_list = {};
-
 static void usage(void);
 
 static void usage(void)
@@ -136,7 +122,7 @@ static int tc_class_modify(int cmd, unsigned int flags, int argc, char **argv)
 	}
 
 	if (d[0])  {
-		ll_init_map(&rth);
+		ll_init_map();
 
 		req.t.tcm_ifindex = ll_name_to_index(d);
 		if (!req.t.tcm_ifindex)
@@ -153,143 +139,321 @@ static int filter_ifindex;
 static __u32 filter_qdisc;
 static __u32 filter_classid;
 
-static void graph_node_add(__u32 parent_id, __u32 id, void *data,
-		int len)
+/*
+ * Class tree of "tc -g class show": the dumped classes are looked up by
+ * id through a hash to link each to its parent in one pass, children
+ * are sorted by id and the tree is walked without recursion, with a
+ * stack and an indentation prefix as deep as the tree.
+ */
+struct graph_node {
+	struct hlist_node hlist;	/* in graph.hash */
+	__u32 id;
+	__u32 parent_id;
+	__u32 leaf;
+	int ifindex;
+	struct graph_node **child;
+	unsigned int nchild;
+	unsigned int size;
+	void *data;
+	int data_len;
+};
+
+#define GRAPH_HASH	16384
+
+static struct {
+	struct hlist_head *hash;
+	struct graph_node **node;	/* in dump order */
+	unsigned int count;
+	unsigned int size;
+} graph;
+
+static unsigned int graph_hash(int ifindex, __u32 id)
 {
-	struct graph_node *node = calloc(1, sizeof(struct graph_node));
+	return (id ^ (id >> 16) ^ ifindex * 0x9e3779b1U) % GRAPH_HASH;
+}
 
-	node->id         = id;
-	node->parent_id  = parent_id;
+static struct graph_node *graph_node_find(int ifindex, __u32 id)
+{
+	struct hlist_node *n;
 
-	if (data && len) {
-		node->data       = malloc(len);
-		node->data_len   = len;
-		memcpy(node->data, data, len);
+	hlist_for_each(n, &graph.hash[graph_hash(ifindex, id)]) {
+		struct graph_node *node = container_of(n, struct graph_node,
+						       hlist);
+
+		if (node->id == id && node->ifindex == ifindex)
+			return node;
 	}
+	return NULL;
+}
 
-	if (parent_id == TC_H_ROOT)
-		hlist_add_head(&node->hlist, &root_cls_list);
-	else
-		hlist_add_head(&node->hlist, &cls_list);
+static int graph_child_add(struct graph_node *parent, struct graph_node *node)
+{
+	if (parent->nchild == parent->size) {
+		unsigned int size = parent->size ? parent->size * 2 : 4;
+		struct graph_node **child;
+
+		child = realloc(parent->child, size * sizeof(*child));
+		if (!child)
+			return -1;
+		parent->child = child;
+		parent->size = size;
+	}
+	parent->child[parent->nchild++] = node;
+	return 0;
 }
 
-static void graph_indent(char *buf, struct graph_node *node, int is_newline,
-		int add_spaces)
+static int graph_node_add(const struct tcmsg *t, void *data, int len)
 {
-	char spaces[100] = {0};
+	struct graph_node *node;
 
-	while (node && node->parent_node) {
-		node->parent_node->right_node = node;
-		node = node->parent_node;
+	if (!graph.hash) {
+		graph.hash = calloc(GRAPH_HASH, sizeof(*graph.hash));
+		if (!graph.hash)
+			goto oom;
+	}
+	if (graph.count == graph.size) {
+		unsigned int size = graph.size ? graph.size * 2 : 256;
+		struct graph_node **v;
+
+		v = realloc(graph.node, size * sizeof(*v));
+		if (!v)
+			goto oom;
+		graph.node = v;
+		graph.size = size;
 	}
-	while (node && node->right_node) {
-		if (node->hlist.next)
-			strcat(buf, "|    ");
-		else
-			strcat(buf, "     ");
 
-		node = node->right_node;
+	node = calloc(1, sizeof(*node));
+	if (!node)
+		goto oom;
+	node->id = t->tcm_handle;
+	node->parent_id = t->tcm_parent;
+	node->leaf = t->tcm_info;
+	node->ifindex = t->tcm_ifindex;
+	if (data && len) {
+		node->data = malloc(len);
+		if (!node->data) {
+			free(node);
+			goto oom;
+		}
+		node->data_len = len;
+		memcpy(node->data, data, len);
 	}
 
-	if (is_newline) {
-		if (node->hlist.next && node->nodes_count)
-			strcat(buf, "|    |");
-		else if (node->hlist.next)
-			strcat(buf, "|     ");
-		else if (node->nodes_count)
-			strcat(buf, "     |");
-		else if (!node->hlist.next)
-			strcat(buf, "      ");
+	hlist_add_head(&node->hlist,
+		       &graph.hash[graph_hash(node->ifindex, node->id)]);
+	graph.node[graph.count++] = node;
+	return 0;
+oom:
+	fprintf(stderr, "Out of memory\n");
+	return -1;
+}
+
+static int graph_node_cmp(const void *a, const void *b)
+{
+	const struct graph_node *x = *(struct graph_node * const *)a;
+	const struct graph_node *y = *(struct graph_node * const *)b;
+
+	if (x->ifindex != y->ifindex)
+		return x->ifindex < y->ifindex ? -1 : 1;
+	if (x->id != y->id)
+		return x->id < y->id ? -1 : 1;
+	return 0;
+}
+
+/* Link every class to its parent, classes without one are roots */
+static int graph_link(struct graph_node *root)
+{
+	unsigned int i;
+
+	for (i = 0; i < graph.count; i++) {
+		struct graph_node *node = graph.node[i];
+		struct graph_node *parent = NULL;
+
+		if (node->parent_id != TC_H_ROOT)
+			parent = graph_node_find(node->ifindex, node->parent_id);
+		if (!parent || parent == node)
+			parent = root;
+		if (graph_child_add(parent, node)) {
+			fprintf(stderr, "Out of memory\n");
+			return -1;
+		}
 	}
-	if (add_spaces > 0) {
-		sprintf(spaces, "%-*s", add_spaces, "");
-		strcat(buf, spaces);
+
+	for (i = 0; i < graph.count; i++) {
+		struct graph_node *node = graph.node[i];
+
+		if (node->nchild > 1)
+			qsort(node->child, node->nchild, sizeof(*node->child),
+			      graph_node_cmp);
 	}
+	qsort(root->child, root->nchild, sizeof(*root->child),
+	      graph_node_cmp);
+	return 0;
 }
 
-static void graph_cls_show(FILE *fp, char *buf, struct hlist_head *root_list,
-		int level)
+static void graph_node_show(FILE *fp, const struct graph_node *cls,
+			    const char *prefix, bool last, bool root)
 {
-	struct hlist_node *n, *tmp_cls;
-	char cls_id_str[256] = {};
 	struct rtattr *tb[TCA_MAX + 1];
 	const struct qdisc_util *q;
-	char str[300] = {};
-
-	hlist_for_each_safe(n, tmp_cls, root_list) {
-		struct hlist_node *c, *tmp_chld;
-		struct hlist_head children = {};
-		struct graph_node *cls = container_of(n, struct graph_node,
-				hlist);
-
-		hlist_for_each_safe(c, tmp_chld, &cls_list) {
-			struct graph_node *child = container_of(c,
-					struct graph_node, hlist);
-
-			if (cls->id == child->parent_id) {
-				hlist_del(c);
-				hlist_add_head(c, &children);
-				cls->nodes_count++;
-				child->parent_node = cls;
-			}
+	char cls_id_str[256];
+
+	print_tc_classid(cls_id_str, sizeof(cls_id_str), cls->id);
+	parse_rtattr_flags(tb, TCA_MAX, (struct rtattr *)cls->data,
+			   cls->data_len, NLA_F_NESTED);
+
+	if (is_json_context()) {
+		open_json_object(NULL);
+		if (tb[TCA_KIND])
+			print_string(PRINT_JSON, "class", NULL,
+				     rta_getattr_str(tb[TCA_KIND]));
+		print_string(PRINT_JSON, "handle", NULL, cls_id_str);
+		if (root && !filter_ifindex)
+			print_string(PRINT_JSON, "dev", NULL,
+				     ll_index_to_name(cls->ifindex));
+		if (cls->leaf)
+			print_0xhex(PRINT_JSON, "leaf", NULL, cls->leaf >> 16);
+	} else {
+		fprintf(fp, "%s+---(%s)", prefix, cls_id_str);
+		if (!tb[TCA_KIND]) {
+			fprintf(fp, " [unknown qdisc kind] \n");
+			return;
 		}
+		fprintf(fp, " %s ", rta_getattr_str(tb[TCA_KIND]));
+	}
+	if (!tb[TCA_KIND])
+		return;
 
-		graph_indent(buf, cls, 0, 0);
+	q = get_qdisc_kind(rta_getattr_str(tb[TCA_KIND]));
+	if (q && q->print_copt)
+		q->print_copt(q, fp, tb[TCA_OPTIONS]);
 
-		print_tc_classid(cls_id_str, sizeof(cls_id_str), cls->id);
-		snprintf(str, sizeof(str),
-			 "+---(%s)", cls_id_str);
-		strcat(buf, str);
+	if (is_json_context()) {
+		struct rtattr *xstats = NULL;
 
-		parse_rtattr_flags(tb, TCA_MAX, (struct rtattr *)cls->data,
-				   cls->data_len, NLA_F_NESTED);
+		if (!show_stats)
+			return;
+		open_json_object("stats");
+		print_tcstats_attr(fp, tb, "", &xstats);
+		if (q && (xstats || tb[TCA_XSTATS]) && q->print_xstats)
+			q->print_xstats(q, fp, xstats ? : tb[TCA_XSTATS]);
+		close_json_object();
+		return;
+	}
 
-		if (tb[TCA_KIND] == NULL) {
-			strcat(buf, " [unknown qdisc kind] ");
-		} else {
-			const char *kind = rta_getattr_str(tb[TCA_KIND]);
+	/* Statistics line up with the kind, within the branches */
+	if (q && show_stats) {
+		int cls_indent = strlen(q->id) - 2 + strlen(cls_id_str);
+		const char *branch = !last && cls->nchild ? "|    |" :
+				     !last ? "|     " :
+				     cls->nchild ? "     |" : "      ";
+		struct rtattr *stats = NULL;
+		char *buf;
+
+		if ((tb[TCA_STATS] || tb[TCA_STATS2]) &&
+		    asprintf(&buf, "%s%s%*s", prefix, branch, cls_indent,
+			     "") >= 0) {
+			fprintf(fp, "\n");
+			print_tcstats_attr(fp, tb, buf, &stats);
+			free(buf);
+		}
+		if (!last || cls->nchild)
+			fprintf(fp, "\n%s%s", prefix, branch);
+	}
+	fprintf(fp, "\n");
+}
 
-			sprintf(str, " %s ", kind);
-			strcat(buf, str);
-			fprintf(fp, "%s", buf);
-			buf[0] = '\0';
+struct graph_frame {
+	const struct graph_node *node;
+	unsigned int next;		/* child to show */
+};
 
-			q = get_qdisc_kind(kind);
-			if (q && q->print_copt) {
-				q->print_copt(q, fp, tb[TCA_OPTIONS]);
-			}
-			if (q && show_stats) {
-				int cls_indent = strlen(q->id) - 2 +
-					strlen(cls_id_str);
-				struct rtattr *stats = NULL;
-
-				graph_indent(buf, cls, 1, cls_indent);
-
-				if (tb[TCA_STATS] || tb[TCA_STATS2]) {
-					fprintf(fp, "\n");
-					print_tcstats_attr(fp, tb, buf, &stats);
-					buf[0] = '\0';
-				}
-				if (cls->hlist.next || cls->nodes_count) {
-					strcat(buf, "\n");
-					graph_indent(buf, cls, 1, 0);
-				}
+static void graph_cls_show(FILE *fp)
+{
+	struct graph_node root = {};
+	struct graph_frame *stack = NULL;
+	char *prefix = NULL;
+	unsigned int size = 0;
+	int depth = 0;
+
+	if (!graph.count || graph_link(&root))
+		goto out;
+
+	stack = malloc(sizeof(*stack));
+	prefix = strdup("");
+	if (!stack || !prefix)
+		goto oom;
+	size = 1;
+	stack[0] = (struct graph_frame) { .node = &root };
+
+	for (;;) {
+		struct graph_frame *f = &stack[depth];
+		const struct graph_node *cls;
+		bool last;
+
+		if (f->next == f->node->nchild) {
+			/* done with the class last shown one level up */
+			if (--depth < 0)
+				break;
+			prefix[depth * 5] = '\0';
+			if (is_json_context()) {
+				close_json_array(PRINT_JSON, NULL);
+				close_json_object();
+			} else if (stack[depth].next ==
+				   stack[depth].node->nchild) {
+				fprintf(fp, "%s\n", prefix);
 			}
+			continue;
 		}
-		free(cls->data);
-		fprintf(fp, "%s\n", buf);
-		buf[0] = '\0';
-
-		graph_cls_show(fp, buf, &children, level + 1);
-		if (!cls->hlist.next) {
-			graph_indent(buf, cls, 0, 0);
-			strcat(buf, "\n");
+
+		cls = f->node->child[f->next++];
+		last = f->next == f->node->nchild;
+		graph_node_show(fp, cls, prefix, last, depth == 0);
+
+		if (!cls->nchild) {
+			if (is_json_context())
+				close_json_object();
+			else if (last)
+				fprintf(fp, "%s\n", prefix);
+			continue;
 		}
 
-		fprintf(fp, "%s", buf);
-		buf[0] = '\0';
-		free(cls);
+		if (depth + 1 == size) {
+			struct graph_frame *s;
+			char *p;
+
+			s = realloc(stack, 2 * size * sizeof(*stack));
+			if (!s)
+				goto oom;
+			stack = s;
+			p = realloc(prefix, 2 * size * 5 + 1);
+			if (!p)
+				goto oom;
+			prefix = p;
+			size *= 2;
+		}
+		strcat(prefix, last ? "     " : "|    ");
+		stack[++depth] = (struct graph_frame) { .node = cls };
+		if (is_json_context())
+			open_json_array(PRINT_JSON, "children");
+	}
+	goto out;
+oom:
+	fprintf(stderr, "Out of memory\n");
+out:
+	free(prefix);
+	free(stack);
+	free(root.child);
+	while (graph.count) {
+		struct graph_node *node = graph.node[--graph.count];
+
+		free(node->child);
+		free(node->data);
+		free(node);
 	}
+	free(graph.node);
+	free(graph.hash);
+	memset(&graph, 0, sizeof(graph));
 }
 
 int print_class(struct nlmsghdr *n, void *arg)
@@ -311,10 +475,8 @@ int print_class(struct nlmsghdr *n, void *arg)
 		return -1;
 	}
 
-	if (show_graph) {
-		graph_node_add(t->tcm_parent, t->tcm_handle, TCA_RTA(t), len);
-		return 0;
-	}
+	if (show_graph)
+		return graph_node_add(t, TCA_RTA(t), len);
 
 	if (filter_qdisc && TC_H_MAJ(t->tcm_handle^filter_qdisc))
 		return 0;
@@ -329,6 +491,9 @@ int print_class(struct nlmsghdr *n, void *arg)
 		return -1;
 	}
 
+	if (tc_sampling())
+		return tc_sample_add(RTM_NEWTCLASS, t, tb);
+
 	open_json_object(NULL);
 	if (n->nlmsg_type == RTM_DELTCLASS)
 		print_null(PRINT_ANY, "deleted", "deleted ", NULL);
@@ -389,7 +554,6 @@ static int tc_class_list(int argc, char **argv)
 {
 	struct tcmsg t = { .tcm_family = AF_UNSPEC };
 	char d[IFNAMSIZ] = {};
-	char buf[1024] = {0};
 
 	filter_qdisc = 0;
 	filter_classid = 0;
@@ -437,7 +601,7 @@ static int tc_class_list(int argc, char **argv)
 		argc--; argv++;
 	}
 
-	ll_init_map(&rth);
+	ll_init_map();
 
 	if (d[0]) {
 		t.tcm_ifindex = ll_name_to_index(d);
@@ -446,6 +610,19 @@ static int tc_class_list(int argc, char **argv)
 		filter_ifindex = t.tcm_ifindex;
 	}
 
+	if (sample_interval) {
+		struct {
+			struct nlmsghdr n;
+			struct tcmsg t;
+		} req = {
+			.n.nlmsg_type = RTM_GETTCLASS,
+			.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcmsg)),
+			.t = t,
+		};
+
+		return tc_sample_run(&req.n, print_class);
+	}
+
 	if (rtnl_dump_request(&rth, RTM_GETTCLASS, &t, sizeof(t)) < 0) {
 		perror("Cannot send dump request");
 		return 1;
@@ -456,10 +633,9 @@ static int tc_class_list(int argc, char **argv)
 		delete_json_obj();
 		return 1;
 	}
-	delete_json_obj();
-
 	if (show_graph)
-		graph_cls_show(stdout, &buf[0], &root_cls_list, 0);
+		graph_cls_show(stdout);
+	delete_json_obj();
 
 	return 0;
 }
@@ -26,4 +26,14 @@ int parse_size_table(int *p_argc, char ***p_argv, struct tc_sizespec *s);
 int check_size_table_opts(struct tc_sizespec *s);
 
 extern int show_graph;
+extern unsigned int sample_interval;
+extern unsigned int sample_count;
+extern unsigned int sample_top;
+extern unsigned int sample_ewma;
+extern int sample_delta;
+
+int tc_sample_add(int type, const struct tcmsg *t, struct rtattr *tb[]);
+int tc_sample_run(struct nlmsghdr *req, rtnl_filter_t filter);
+bool tc_sampling(void);
+
 extern bool use_names;
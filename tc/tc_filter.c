@@ -34,6 +34,8 @@ static void usage(void)
 		"\n"
 		"       tc filter show [ dev STRING ] [ root | ingress | egress | parent CLASSID ]\n"
 		"       tc filter show [ block BLOCK_INDEX ]\n"
+		"       tc filter compile [ dev STRING | block BLOCK_INDEX ] [ parent CLASSID ]\n"
+		"       pref PRIO [ protocol PROTO ] [ chain CHAIN_INDEX ] FILTER_TYPE FILE [ OPTIONS ]\n"
 		"Where:\n"
 		"FILTER_TYPE := { u32 | bpf | fw | route | etc. }\n"
 		"FILTERID := ... format depends on classifier, see there\n"
@@ -53,7 +55,8 @@ struct tc_filter_req {
 	char			buf[MAX_MSG];
 };
 
-static int tc_filter_modify(int cmd, unsigned int flags, int argc, char **argv)
+static int tc_filter_modify(int cmd, unsigned int flags, bool compile,
+			    int argc, char **argv)
 {
 	struct {
 		struct nlmsghdr	n;
@@ -188,7 +191,7 @@ static int tc_filter_modify(int cmd, unsigned int flags, int argc, char **argv)
 		addattr_l(&req.n, sizeof(req), TCA_KIND, k, strlen(k)+1);
 
 	if (d[0])  {
-		ll_init_map(&rth);
+		ll_init_map();
 
 		req.t.tcm_ifindex = ll_name_to_index(d);
 		if (req.t.tcm_ifindex == 0) {
@@ -200,6 +203,23 @@ static int tc_filter_modify(int cmd, unsigned int flags, int argc, char **argv)
 		req.t.tcm_block_index = block_index;
 	}
 
+	if (compile) {
+		if (!q || !q->compile_fopt) {
+			fprintf(stderr, "Filter type \"%s\" cannot compile rules\n",
+				k);
+			return -1;
+		}
+		if (fhandle) {
+			fprintf(stderr,
+				"Compiled filters get their handles from the compiler\n");
+			return -1;
+		}
+		if (est.ewma_log)
+			addattr_l(&req.n, sizeof(req), TCA_RATE, &est,
+				  sizeof(est));
+		return q->compile_fopt(q, argc, argv, &req.n) ? 1 : 0;
+	}
+
 	if (q) {
 		if (q->parse_fopt(q, fhandle, argc, argv, &req.n))
 			return 1;
@@ -277,6 +297,12 @@ int print_filter(struct nlmsghdr *n, void *arg)
 		return -1;
 	}
 
+	if (tc_sampling()) {
+		if (n->nlmsg_type != RTM_NEWTFILTER)
+			return 0;
+		return tc_sample_add(RTM_NEWTFILTER, t, tb);
+	}
+
 	open_json_object(NULL);
 
 	if (n->nlmsg_type == RTM_DELTFILTER || n->nlmsg_type == RTM_DELCHAIN)
@@ -539,7 +565,7 @@ static int tc_filter_get(int cmd, unsigned int flags, int argc, char **argv)
 	}
 
 	if (d[0])  {
-		ll_init_map(&rth);
+		ll_init_map();
 
 		req.t.tcm_ifindex = ll_name_to_index(d);
 		if (!req.t.tcm_ifindex)
@@ -704,7 +730,7 @@ static int tc_filter_list(int cmd, int argc, char **argv)
 
 	req.t.tcm_info = TC_H_MAKE(prio<<16, protocol);
 
-	ll_init_map(&rth);
+	ll_init_map();
 
 	if (d[0]) {
 		req.t.tcm_ifindex = ll_name_to_index(d);
@@ -733,6 +759,9 @@ static int tc_filter_list(int cmd, int argc, char **argv)
 		addattr_l(&req.n, MAX_MSG, TCA_DUMP_FLAGS, &flags, sizeof(flags));
 	}
 
+	if (sample_interval)
+		return tc_sample_run(&req.n, print_filter);
+
 	if (rtnl_dump_request_n(&rth, &req.n) < 0) {
 		perror("Cannot send dump request");
 		return 1;
@@ -755,14 +784,19 @@ int do_filter(int argc, char **argv)
 		return tc_filter_list(RTM_GETTFILTER, 0, NULL);
 	if (matches(*argv, "add") == 0)
 		return tc_filter_modify(RTM_NEWTFILTER, NLM_F_EXCL|NLM_F_CREATE,
-					argc-1, argv+1);
+					false, argc-1, argv+1);
 	if (matches(*argv, "change") == 0)
-		return tc_filter_modify(RTM_NEWTFILTER, 0, argc-1, argv+1);
-	if (matches(*argv, "replace") == 0)
-		return tc_filter_modify(RTM_NEWTFILTER, NLM_F_CREATE, argc-1,
+		return tc_filter_modify(RTM_NEWTFILTER, 0, false, argc-1,
 					argv+1);
+	if (matches(*argv, "replace") == 0)
+		return tc_filter_modify(RTM_NEWTFILTER, NLM_F_CREATE, false,
+					argc-1, argv+1);
 	if (matches(*argv, "delete") == 0)
-		return tc_filter_modify(RTM_DELTFILTER, 0,  argc-1, argv+1);
+		return tc_filter_modify(RTM_DELTFILTER, 0, false, argc-1,
+					argv+1);
+	if (matches(*argv, "compile") == 0)
+		return tc_filter_modify(RTM_NEWTFILTER, NLM_F_EXCL|NLM_F_CREATE,
+					true, argc-1, argv+1);
 	if (matches(*argv, "get") == 0)
 		return tc_filter_get(RTM_GETTFILTER, 0,  argc-1, argv+1);
 	if (matches(*argv, "list") == 0 || matches(*argv, "show") == 0
@@ -783,9 +817,9 @@ int do_chain(int argc, char **argv)
 		return tc_filter_list(RTM_GETCHAIN, 0, NULL);
 	if (matches(*argv, "add") == 0) {
 		return tc_filter_modify(RTM_NEWCHAIN, NLM_F_EXCL | NLM_F_CREATE,
-					argc - 1, argv + 1);
+					false, argc - 1, argv + 1);
 	} else if (matches(*argv, "delete") == 0) {
-		return tc_filter_modify(RTM_DELCHAIN, 0,
+		return tc_filter_modify(RTM_DELCHAIN, 0, false,
 					argc - 1, argv + 1);
 	} else if (matches(*argv, "get") == 0) {
 		return tc_filter_get(RTM_GETCHAIN, 0,
@@ -103,7 +103,7 @@ int do_tcmonitor(int argc, char **argv)
 	if (rtnl_open(&rth, groups) < 0)
 		exit(1);
 
-	ll_init_map(&rth);
+	ll_init_map();
 
 	if (rtnl_listen(&rth, accept_tcmsg, (void *)stdout) < 0) {
 		rtnl_close(&rth);
@@ -193,7 +193,7 @@ static int tc_qdisc_modify(int cmd, unsigned int flags, int argc, char **argv)
 	if (d[0])  {
 		int idx;
 
-		ll_init_map(&rth);
+		ll_init_map();
 
 		idx = ll_name_to_index(d);
 		if (!idx)
@@ -246,6 +246,9 @@ int print_qdisc(struct nlmsghdr *n, void *arg)
 		return -1;
 	}
 
+	if (tc_sampling())
+		return tc_sample_add(RTM_NEWQDISC, t, tb);
+
 	open_json_object(NULL);
 
 	if (n->nlmsg_type == RTM_DELQDISC)
@@ -411,7 +414,7 @@ static int tc_qdisc_list(int argc, char **argv)
 		argc--; argv++;
 	}
 
-	ll_init_map(&rth);
+	ll_init_map();
 
 	if (d[0]) {
 		req.t.tcm_ifindex = ll_name_to_index(d);
@@ -424,6 +427,9 @@ static int tc_qdisc_list(int argc, char **argv)
 		addattr(&req.n, 256, TCA_DUMP_INVISIBLE);
 	}
 
+	if (sample_interval)
+		return tc_sample_run(&req.n, print_qdisc);
+
 	if (rtnl_dump_request_n(&rth, &req.n) < 0) {
 		perror("Cannot send request");
 		return 1;
@@ -0,0 +1,528 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * tc_sample.c	Periodic sampling of qdisc, class and filter counters.
+ *
+ * Each sample is a single dump.  The counters of every object are kept
+ * in a flat array together with a hash index keyed by object type,
+ * device, handle, parent and, for filters, priority and protocol; the
+ * array of the previous sample is looked up to turn the new counters
+ * into deltas and rates, then becomes free space for the next one.
+ * Memory stays proportional to the number of objects and names are
+ * only formatted for what is printed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <sys/time.h>
+#include <errno.h>
+
+#include "utils.h"
+#include "rt_names.h"
+#include "tc_util.h"
+#include "tc_common.h"
+
+unsigned int sample_interval;
+unsigned int sample_count;
+unsigned int sample_top;
+unsigned int sample_ewma;
+int sample_delta;
+
+struct tc_sample {
+	__u32	type;
+	__u32	ifindex;
+	__u32	handle;
+	__u32	parent;
+	__u32	info;		/* priority and protocol of a filter */
+	char	kind[16];
+	__u64	bytes;
+	__u64	packets;
+	__u32	drops;
+	__u32	overlimits;
+	__u32	requeues;
+	__u32	backlog;
+	__u32	qlen;
+	int	fresh;		/* no previous counters */
+	__u64	d_bytes;
+	__u64	d_packets;
+	__u32	d_drops;
+	__u32	d_overlimits;
+	__u32	d_requeues;
+	double	bps;		/* rates in bytes, packets, ... per second */
+	double	pps;
+	double	dps;
+	double	ops;
+	double	rps;
+};
+
+struct tc_sample_set {
+	struct tc_sample	*s;
+	unsigned int		n;
+	unsigned int		size;
+	__u32			*index;	/* slot + 1, 0 if free */
+	unsigned int		mask;
+};
+
+static struct {
+	struct tc_sample_set	set[2];
+	struct tc_sample_set	*cur;
+	struct tc_sample_set	*prev;
+	int			running;
+	int			err;
+	char			stamp[40];	/* time of the sample, for JSON */
+} smp;
+
+static __u32 tc_sample_hash(const struct tc_sample *s)
+{
+	__u32 h = s->type * 0x9e3779b1U;
+
+	h = (h ^ s->ifindex) * 0x9e3779b1U;
+	h = (h ^ s->handle) * 0x9e3779b1U;
+	h = (h ^ s->parent) * 0x9e3779b1U;
+	h = (h ^ s->info) * 0x9e3779b1U;
+	return h ^ (h >> 16);
+}
+
+static const struct tc_sample *tc_sample_find(const struct tc_sample_set *set,
+					      const struct tc_sample *key)
+{
+	__u32 i = tc_sample_hash(key);
+
+	if (!set->index)
+		return NULL;
+	for (;; i++) {
+		__u32 slot = set->index[i & set->mask];
+		const struct tc_sample *s;
+
+		if (!slot)
+			return NULL;
+		s = &set->s[slot - 1];
+		if (s->type == key->type && s->ifindex == key->ifindex &&
+		    s->handle == key->handle && s->parent == key->parent &&
+		    s->info == key->info)
+			return s;
+	}
+}
+
+/* Index the objects of @set once the dump that filled it is over */
+static int tc_sample_index(struct tc_sample_set *set)
+{
+	unsigned int size = 64, i;
+
+	while (size < 2 * set->n)
+		size <<= 1;
+	if (size - 1 != set->mask) {
+		free(set->index);
+		set->index = malloc(size * sizeof(*set->index));
+		if (!set->index)
+			return -1;
+		set->mask = size - 1;
+	}
+	memset(set->index, 0, size * sizeof(*set->index));
+
+	for (i = 0; i < set->n; i++) {
+		__u32 h = tc_sample_hash(&set->s[i]);
+
+		while (set->index[h & set->mask])
+			h++;
+		set->index[h & set->mask] = i + 1;
+	}
+	return 0;
+}
+
+static void tc_sample_read_stats2(struct tc_sample *s, struct rtattr *stats)
+{
+	struct rtattr *tbs[TCA_STATS_MAX + 1];
+	__u64 packets64 = 0, packets64_hw = 0;
+
+	parse_rtattr_nested(tbs, TCA_STATS_MAX, stats);
+	parse_packets64(stats, &packets64, &packets64_hw);
+
+	if (tbs[TCA_STATS_BASIC]) {
+		struct gnet_stats_basic bs = {0};
+
+		memcpy(&bs, RTA_DATA(tbs[TCA_STATS_BASIC]),
+		       MIN(RTA_PAYLOAD(tbs[TCA_STATS_BASIC]), sizeof(bs)));
+		s->bytes = bs.bytes;
+		s->packets = packets64 ? : bs.packets;
+	}
+	if (tbs[TCA_STATS_QUEUE]) {
+		struct gnet_stats_queue q = {0};
+
+		memcpy(&q, RTA_DATA(tbs[TCA_STATS_QUEUE]),
+		       MIN(RTA_PAYLOAD(tbs[TCA_STATS_QUEUE]), sizeof(q)));
+		s->drops = q.drops;
+		s->overlimits = q.overlimits;
+		s->requeues = q.requeues;
+		s->backlog = q.backlog;
+		s->qlen = q.qlen;
+	}
+}
+
+/* Attribute holding the actions of each classifier that can have some */
+static const struct {
+	const char	*kind;
+	int		act;
+} tc_sample_acts[] = {
+	{ "basic",	TCA_BASIC_ACT },
+	{ "bpf",	TCA_BPF_ACT },
+	{ "cgroup",	TCA_CGROUP_ACT },
+	{ "flow",	TCA_FLOW_ACT },
+	{ "flower",	TCA_FLOWER_ACT },
+	{ "fw",		TCA_FW_ACT },
+	{ "matchall",	TCA_MATCHALL_ACT },
+	{ "route",	TCA_ROUTE4_ACT },
+	{ "u32",	TCA_U32_ACT },
+};
+
+/*
+ * Filters have no counters of their own, only those of their actions.
+ * Take bytes and packets from the first action, which sees every packet
+ * the filter matched, and add up drops and overlimits of all of them.
+ */
+static void tc_sample_read_filter(struct tc_sample *s, struct rtattr *tb[])
+{
+	struct rtattr *tbo[TCA_ACT_MAX + 1], *tba[TCA_ACT_MAX_PRIO + 1];
+	const char *kind = rta_getattr_str(tb[TCA_KIND]);
+	struct rtattr *acts = NULL;
+	int i, first = 1;
+
+	if (!tb[TCA_OPTIONS])
+		return;
+	for (i = 0; i < ARRAY_SIZE(tc_sample_acts); i++) {
+		if (strcmp(kind, tc_sample_acts[i].kind) == 0) {
+			acts = parse_rtattr_one_nested(tc_sample_acts[i].act,
+						       tb[TCA_OPTIONS]);
+			break;
+		}
+	}
+	if (!acts)
+		return;
+
+	parse_rtattr_nested(tba, TCA_ACT_MAX_PRIO, acts);
+
+	for (i = 0; i <= TCA_ACT_MAX_PRIO; i++) {
+		struct tc_sample a = {};
+
+		if (!tba[i])
+			continue;
+		parse_rtattr_nested(tbo, TCA_ACT_MAX, tba[i]);
+		if (!tbo[TCA_ACT_STATS])
+			continue;
+		tc_sample_read_stats2(&a, tbo[TCA_ACT_STATS]);
+		if (first) {
+			s->bytes = a.bytes;
+			s->packets = a.packets;
+			first = 0;
+		}
+		s->drops += a.drops;
+		s->overlimits += a.overlimits;
+	}
+}
+
+static void tc_sample_read(struct tc_sample *s, struct rtattr *tb[])
+{
+	if (tb[TCA_STATS2]) {
+		tc_sample_read_stats2(s, tb[TCA_STATS2]);
+	} else if (tb[TCA_STATS]) {
+		struct tc_stats st = {};
+
+		memcpy(&st, RTA_DATA(tb[TCA_STATS]),
+		       MIN(RTA_PAYLOAD(tb[TCA_STATS]), sizeof(st)));
+		s->bytes = st.bytes;
+		s->packets = st.packets;
+		s->drops = st.drops;
+		s->overlimits = st.overlimits;
+		s->backlog = st.backlog;
+		s->qlen = st.qlen;
+	}
+}
+
+/*
+ * Record the counters of a qdisc, class or filter from the dump being
+ * sampled, in place of printing it.  @type is its RTM_NEW* message type.
+ */
+int tc_sample_add(int type, const struct tcmsg *t, struct rtattr *tb[])
+{
+	struct tc_sample_set *set = smp.cur;
+	struct tc_sample *s;
+
+	if (set->n == set->size) {
+		unsigned int size = set->size ? 2 * set->size : 256;
+
+		s = realloc(set->s, size * sizeof(*s));
+		if (!s) {
+			smp.err = -ENOMEM;
+			return -1;
+		}
+		set->s = s;
+		set->size = size;
+	}
+
+	s = &set->s[set->n++];
+	memset(s, 0, sizeof(*s));
+	s->type = type;
+	s->ifindex = t->tcm_ifindex;
+	s->handle = t->tcm_handle;
+	s->parent = t->tcm_parent;
+	strncpy(s->kind, rta_getattr_str(tb[TCA_KIND]), sizeof(s->kind) - 1);
+	if (type == RTM_NEWTFILTER) {
+		s->info = t->tcm_info;
+		tc_sample_read_filter(s, tb);
+	} else {
+		tc_sample_read(s, tb);
+	}
+	return 0;
+}
+
+bool tc_sampling(void)
+{
+	return smp.running;
+}
+
+static double tc_sample_ewma(double avg, double val, double alpha, int fresh)
+{
+	return fresh ? val : avg + alpha * (val - avg);
+}
+
+/* Turn the counters of @s into deltas and rates against @p over @dt s */
+static void tc_sample_update(struct tc_sample *s, const struct tc_sample *p,
+			     double dt)
+{
+	double alpha = 1.0;
+
+	/* replaced by another object, or counters reset */
+	if (!p || strcmp(s->kind, p->kind) || s->bytes < p->bytes ||
+	    s->packets < p->packets) {
+		s->fresh = 1;
+		return;
+	}
+
+	s->d_bytes = s->bytes - p->bytes;
+	s->d_packets = s->packets - p->packets;
+	s->d_drops = s->drops - p->drops;
+	s->d_overlimits = s->overlimits - p->overlimits;
+	s->d_requeues = s->requeues - p->requeues;
+
+	if (sample_ewma)
+		alpha = 1.0 - exp(-dt * 1000.0 / sample_ewma);
+
+	s->bps = tc_sample_ewma(p->bps, s->d_bytes / dt, alpha, p->fresh);
+	s->pps = tc_sample_ewma(p->pps, s->d_packets / dt, alpha, p->fresh);
+	s->dps = tc_sample_ewma(p->dps, s->d_drops / dt, alpha, p->fresh);
+	s->ops = tc_sample_ewma(p->ops, s->d_overlimits / dt, alpha, p->fresh);
+	s->rps = tc_sample_ewma(p->rps, s->d_requeues / dt, alpha, p->fresh);
+}
+
+static void tc_sample_show(const struct tc_sample *s)
+{
+	char abuf[64];
+
+	open_json_object(NULL);
+	if (s->type == RTM_NEWQDISC) {
+		print_string(PRINT_ANY, "kind", "qdisc %s", s->kind);
+		sprintf(abuf, "%x:", s->handle >> 16);
+		print_string(PRINT_ANY, "handle", " %s ", abuf);
+	} else if (s->type == RTM_NEWTFILTER) {
+		print_string(PRINT_ANY, "filter", "filter %s", s->kind);
+		print_uint(PRINT_ANY, "pref", " pref %u", TC_H_MAJ(s->info) >> 16);
+		if (TC_H_MIN(s->info))
+			print_string(PRINT_ANY, "protocol", " protocol %s",
+				     ll_proto_n2a(TC_H_MIN(s->info), abuf,
+						  sizeof(abuf)));
+		print_0xhex(PRINT_ANY, "handle", " handle %#llx ", s->handle);
+	} else {
+		print_string(PRINT_ANY, "class", "class %s", s->kind);
+		print_tc_classid(abuf, sizeof(abuf), s->handle);
+		print_string(PRINT_ANY, "handle", " %s ", abuf);
+	}
+	print_devname(PRINT_ANY, s->ifindex);
+	if (smp.stamp[0])
+		print_string(PRINT_JSON, "timestamp", NULL, smp.stamp);
+
+	if (s->parent == TC_H_ROOT) {
+		print_bool(PRINT_ANY, "root", "root", true);
+	} else if (s->parent) {
+		print_tc_classid(abuf, sizeof(abuf), s->parent);
+		print_string(PRINT_ANY, "parent", "parent %s", abuf);
+	}
+
+	if (sample_delta) {
+		print_lluint(PRINT_ANY, "bytes", " sent %llu bytes",
+			     s->d_bytes);
+		print_lluint(PRINT_ANY, "packets", " %llu pkt", s->d_packets);
+		print_uint(PRINT_ANY, "drops", " (dropped %u", s->d_drops);
+		print_uint(PRINT_ANY, "overlimits", ", overlimits %u",
+			   s->d_overlimits);
+		print_uint(PRINT_ANY, "requeues", " requeues %u)",
+			   s->d_requeues);
+	} else {
+		print_lluint(PRINT_JSON, "rate", NULL, llrint(s->bps));
+		tc_print_rate(PRINT_FP, NULL, " rate %s", llrint(s->bps));
+		print_lluint(PRINT_ANY, "pps", " %llupps", llrint(s->pps));
+		print_float(PRINT_ANY, "drop_rate", " dropped %.1f/s", s->dps);
+		print_float(PRINT_ANY, "overlimit_rate", " overlimits %.1f/s",
+			    s->ops);
+		print_float(PRINT_ANY, "requeue_rate", " requeues %.1f/s",
+			    s->rps);
+	}
+	if (s->type != RTM_NEWTFILTER) {
+		print_size(PRINT_ANY, "backlog", " backlog %s", s->backlog);
+		print_uint(PRINT_ANY, "qlen", " %up", s->qlen);
+	}
+	close_json_object();
+	print_nl();
+}
+
+static int tc_sample_cmp(const void *a, const void *b)
+{
+	const struct tc_sample *x = *(const struct tc_sample **)a;
+	const struct tc_sample *y = *(const struct tc_sample **)b;
+
+	if (x->d_drops != y->d_drops)
+		return x->d_drops < y->d_drops ? 1 : -1;
+	if (x->d_bytes != y->d_bytes)
+		return x->d_bytes < y->d_bytes ? 1 : -1;
+	return 0;
+}
+
+static int tc_sample_print(struct tc_sample_set *set)
+{
+	const struct tc_sample **top = NULL;
+	unsigned int i, n = 0;
+
+	if (sample_top) {
+		top = malloc((set->n + 1) * sizeof(*top));
+		if (!top)
+			return -1;
+		for (i = 0; i < set->n; i++) {
+			if (!set->s[i].fresh)
+				top[n++] = &set->s[i];
+		}
+		qsort(top, n, sizeof(*top), tc_sample_cmp);
+		if (n > sample_top)
+			n = sample_top;
+	}
+
+	smp.stamp[0] = '\0';
+	if (timestamp && json) {
+		struct timeval tv;
+
+		gettimeofday(&tv, NULL);
+		strftime(smp.stamp, sizeof(smp.stamp) - 8, "%Y-%m-%dT%H:%M:%S",
+			 localtime(&tv.tv_sec));
+		sprintf(smp.stamp + strlen(smp.stamp), ".%06ld",
+			(long)tv.tv_usec);
+	} else if (timestamp) {
+		print_timestamp(stdout);
+	}
+
+	new_json_obj(json);
+	if (top) {
+		for (i = 0; i < n; i++)
+			tc_sample_show(top[i]);
+	} else {
+		for (i = 0; i < set->n; i++) {
+			if (!set->s[i].fresh)
+				tc_sample_show(&set->s[i]);
+		}
+	}
+	delete_json_obj();
+	if (!json)
+		printf("\n");
+	fflush(stdout);
+
+	free(top);
+	return 0;
+}
+
+static double tc_sample_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void tc_sample_sleep(double until)
+{
+	struct timespec ts = {
+		.tv_sec = until,
+		.tv_nsec = (until - (time_t)until) * 1e9,
+	};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+	       EINTR)
+		;
+}
+
+/*
+ * Dump with @req every sample_interval ms, sample_count times or for
+ * ever if 0, and print how the counters of the objects passed to
+ * tc_sample_add() by @filter changed in between.  The first dump only
+ * gives the counters to start from.
+ */
+int tc_sample_run(struct nlmsghdr *req, rtnl_filter_t filter)
+{
+	unsigned int i, dumps = 0, samples = 0;
+	double start, last = 0, now;
+	int ret = 0;
+
+	smp.prev = &smp.set[0];
+	smp.cur = &smp.set[1];
+	smp.running = 1;
+	start = tc_sample_now();
+
+	for (;;) {
+		struct tc_sample_set *set;
+
+		smp.cur->n = 0;
+		smp.err = 0;
+		now = tc_sample_now();
+		if (rtnl_dump_request_n(&rth, req) < 0) {
+			perror("Cannot send dump request");
+			ret = 1;
+			break;
+		}
+		if (rtnl_dump_filter(&rth, filter, NULL) < 0 || smp.err) {
+			fprintf(stderr, "Dump terminated\n");
+			ret = 1;
+			break;
+		}
+
+		set = smp.cur;
+		for (i = 0; i < set->n; i++)
+			tc_sample_update(&set->s[i],
+					 dumps ? tc_sample_find(smp.prev,
+								&set->s[i])
+					       : NULL,
+					 now - last);
+		if (dumps++) {
+			if (tc_sample_print(set) < 0) {
+				ret = 1;
+				break;
+			}
+			if (++samples == sample_count)
+				break;
+		}
+		if (tc_sample_index(set) < 0) {
+			ret = 1;
+			break;
+		}
+
+		smp.cur = smp.prev;
+		smp.prev = set;
+		last = now;
+		tc_sample_sleep(start + dumps * (sample_interval / 1000.0));
+	}
+
+	smp.running = 0;
+	for (i = 0; i < 2; i++) {
+		free(smp.set[i].s);
+		free(smp.set[i].index);
+	}
+	memset(&smp, 0, sizeof(smp));
+	return ret;
+}
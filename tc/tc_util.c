@@ -706,8 +706,8 @@ static void print_tcstats_basic_hw(struct rtattr **tbs, const char *prefix,
 	print_lluint(PRINT_ANY, "hw_packets", " %llu pkt", packets64_hw);
 }
 
-static void parse_packets64(const struct rtattr *nest, __u64 *p_packets64,
-			    __u64 *p_packets64_hw)
+void parse_packets64(const struct rtattr *nest, __u64 *p_packets64,
+		     __u64 *p_packets64_hw)
 {
 	unsigned short prev_type = __TCA_STATS_MAX;
 	const struct rtattr *pos;
@@ -53,6 +53,8 @@ struct filter_util {
 			  int argc, char **argv, struct nlmsghdr *n);
 	int (*print_fopt)(const struct filter_util *qu,
 			  FILE *f, struct rtattr *opt, __u32 fhandle);
+	int (*compile_fopt)(const struct filter_util *qu,
+			    int argc, char **argv, struct nlmsghdr *n);
 };
 
 struct action_util {
@@ -92,6 +94,8 @@ char *sprint_linklayer(unsigned int linklayer, char *buf);
 void print_tcstats_attr(FILE *fp, struct rtattr *tb[],
 			const char *prefix, struct rtattr **xstats);
 void print_tcstats2_attr(struct rtattr *rta, const char *prefix, struct rtattr **xstats);
+void parse_packets64(const struct rtattr *nest, __u64 *p_packets64,
+		     __u64 *p_packets64_hw);
 
 int get_tc_classid(__u32 *h, const char *str);
 int print_tc_classid(char *buf, int len, __u32 h);
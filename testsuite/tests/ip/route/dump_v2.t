@@ -0,0 +1,66 @@
+#!/bin/sh
+
+. lib/generic.sh
+
+ts_log "[Testing indexed and compressed route dumps]"
+
+DEV="$(rand_dev)"
+ts_ip "$0" "Add $DEV dummy interface" link add dev $DEV type dummy
+ts_ip "$0" "Set $DEV into UP state" link set up dev $DEV
+
+for i in `seq 1 50`; do
+	"$IP" route add 10.2.$i.0/24 dev $DEV
+done
+ts_ip "$0" "Add route 10.3.0.0/16" route add 10.3.0.0/16 dev $DEV metric 7
+ts_ip "$0" "Add route 2001:db8::/64" -6 route add 2001:db8::/64 dev $DEV
+
+V2=`mktemp`
+LZ=`mktemp`
+BAD=`mktemp`
+BEFORE=`mktemp`
+"$IP" route save dev $DEV format v2 > $V2
+"$IP" route save dev $DEV compress > $LZ
+"$IP" route show dev $DEV > $BEFORE
+
+ts_ip "$0" "Show one /24 of the v2 dump" route showdump to 10.2.7.0/24 < $V2
+test_on "^10.2.7.0/24 dev $DEV"
+test_lines_count 1
+
+for f in $V2 $LZ; do
+	ts_ip "$0" "Flush routes of $DEV" route flush dev $DEV
+	ts_ip "$0" "Restore routes of $DEV" route restore < $f
+	"$IP" route show dev $DEV > $STD_OUT
+	if ! diff -u $BEFORE $STD_OUT > $BAD; then
+		ts_err "$0: routes restored from $f differ"
+		ts_err_cat $BAD
+	else
+		echo "$0: routes restored from $f match, as expected"
+	fi
+done
+
+head -c $((`wc -c < $LZ` / 2)) $LZ > $BAD
+"$IP" route showdump < $BAD 2> $STD_ERR > $STD_OUT
+if [ $? -eq 0 ]; then
+	ts_err "$0: truncated dump accepted"
+elif ! grep -q "^Corrupt route dump$" $STD_ERR; then
+	ts_err "$0: truncated dump not reported"
+	ts_err_cat $STD_ERR
+else
+	echo "$0: truncated dump rejected, as expected"
+fi
+
+# clobber the start of the first block, right after the 8 byte header
+cp $LZ $BAD
+head -c 32 /dev/zero | tr '\0' '\377' | dd of=$BAD bs=1 seek=8 conv=notrunc 2> /dev/null
+"$IP" route showdump < $BAD 2> $STD_ERR > $STD_OUT
+if [ $? -eq 0 ]; then
+	ts_err "$0: corrupt compressed block accepted"
+elif ! grep -q "^Corrupt route dump block at 8$" $STD_ERR; then
+	ts_err "$0: corrupt compressed block not reported"
+	ts_err_cat $STD_ERR
+else
+	echo "$0: corrupt compressed block rejected, as expected"
+fi
+
+rm -f $V2 $LZ $BAD $BEFORE
+ts_ip "$0" "Del $DEV dummy interface" link del dev $DEV
@@ -0,0 +1,28 @@
+#!/bin/sh
+
+. lib/generic.sh
+
+ts_log "[Testing pipelined batch mode]"
+
+ts_ip "$0" "Set lo into UP state" link set up dev lo
+
+BATCHFILE=`mktemp`
+for i in `seq 1 100`; do
+	echo "route add 10.1.$i.0/24 dev lo" >> $BATCHFILE
+done
+echo "route add 10.1.42.0/24 dev lo" >> $BATCHFILE
+echo "route add 10.2.0.0/24 dev lo" >> $BATCHFILE
+
+"$IP" -force -pipeline 16 -b $BATCHFILE 2> $STD_ERR > $STD_OUT
+if [ $? -eq 0 ]; then
+	ts_err "$0: pipelined batch passed when it should have failed"
+elif ! grep -q "Command failed $BATCHFILE:101" $STD_ERR; then
+	ts_err "$0: failure not reported against line 101"
+	ts_err_cat $STD_ERR
+else
+	echo "$0: pipelined batch failed on line 101, as expected"
+fi
+rm -f $BATCHFILE
+
+ts_ip "$0" "Show routes added by the batch" -4 route show root 10.0.0.0/8
+test_lines_count 101
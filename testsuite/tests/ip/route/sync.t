@@ -0,0 +1,41 @@
+#!/bin/sh
+
+. lib/generic.sh
+
+ts_log "[Testing route sync]"
+
+DEV="$(rand_dev)"
+ts_ip "$0" "Add $DEV dummy interface" link add dev $DEV type dummy
+ts_ip "$0" "Set $DEV into UP state" link set up dev $DEV
+
+ts_ip "$0" "Add route 10.1.1.0/24" route add 10.1.1.0/24 dev $DEV
+ts_ip "$0" "Add route 10.1.2.0/24" route add 10.1.2.0/24 dev $DEV metric 5
+ts_ip "$0" "Add route 10.1.3.0/24" route add 10.1.3.0/24 dev $DEV
+
+DUMP=`mktemp`
+"$IP" route save dev $DEV > $DUMP
+
+ts_ip "$0" "Del route 10.1.1.0/24" route del 10.1.1.0/24 dev $DEV
+ts_ip "$0" "Add route 10.1.4.0/24" route add 10.1.4.0/24 dev $DEV
+ts_ip "$0" "Change route 10.1.3.0/24" route change 10.1.3.0/24 dev $DEV mtu 1300
+
+ts_ip "$0" "Show what sync would change" route sync $DUMP dryrun dev $DEV
+test_on "^delete 10.1.4.0/24 scope link"
+test_on "^add 10.1.1.0/24 scope link"
+test_on "^replace 10.1.3.0/24 scope link"
+test_on "^1 to add, 1 to replace, 1 to delete, 1 unchanged$"
+test_lines_count 4
+
+ts_ip "$0" "Sync routes of $DEV" route sync $DUMP dev $DEV
+ts_ip "$0" "Show routes of $DEV" -4 route show dev $DEV
+test_on "^10.1.1.0/24 scope link $"
+test_on "^10.1.2.0/24 scope link metric 5 $"
+test_on "^10.1.3.0/24 scope link $"
+test_lines_count 3
+
+ts_ip "$0" "Sync routes of $DEV again" route sync $DUMP dryrun dev $DEV
+test_on "^0 to add, 0 to replace, 0 to delete, 3 unchanged$"
+test_lines_count 1
+
+rm -f $DUMP
+ts_ip "$0" "Del $DEV dummy interface" link del dev $DEV
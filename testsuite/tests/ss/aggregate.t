@@ -0,0 +1,44 @@
+#!/bin/sh
+
+. lib/generic.sh
+
+# % ./misc/ss -Htna
+# LISTEN  0    128    0.0.0.0:22       0.0.0.0:*
+# ESTAB   0    0     10.0.0.1:22      10.0.0.1:36266
+# ESTAB   0    0     10.0.0.1:36266   10.0.0.1:22
+# ESTAB   0    0     10.0.0.1:22      10.0.0.2:50312
+export TCPDIAG_FILE="$(dirname $0)/ss1.dump"
+
+ts_log "[Testing aggregation]"
+
+ts_ss "$0" "Aggregate by state and sport" -Htna --aggregate=state,sport
+test_on "^ESTAB  22    2$"
+test_on "^LISTEN 22    1$"
+test_on "^ESTAB  36266 1$"
+test_lines_count 3
+
+ts_ss "$0" "Aggregate with filter" -Htna --aggregate=src dport = 22
+test_on "^10.0.0.1 1$"
+test_lines_count 1
+
+ts_ss "$0" "Aggregate header" -tna --aggregate=src
+test_on "^Local-Address Count$"
+test_on "^10.0.0.1          3$"
+
+ts_ss "$0" "Stats of all sockets" -Htna --stats=send-q
+test_on "^4 0/32.0/0/128/128$"
+
+ts_ss "$0" "Stats as JSON" -Htna -j --aggregate=state --stats=send-q
+test_on '"state":"LISTEN","count":1,"stats":\{"send-q":\{"n":1,"min":128'
+test_on '"hist":\[\{"le":255,"count":1\}\]'
+
+"$SS" -Htna --aggregate=src,dst,src,dst,src,dst,src,dst,src,dst \
+	2> $STD_ERR > $STD_OUT
+if [ $? -eq 0 ]; then
+	ts_err "$0: repeated --aggregate key accepted"
+elif ! grep -q 'field "src" given twice' $STD_ERR; then
+	ts_err "$0: repeated --aggregate key not reported"
+	ts_err_cat $STD_ERR
+else
+	echo "$0: repeated --aggregate key rejected, as expected"
+fi
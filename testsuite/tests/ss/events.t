@@ -0,0 +1,67 @@
+#!/bin/sh
+
+. lib/generic.sh
+
+# Destroyed sockets saved by ss -E -D, with no NLMSG_DONE at the end
+export TCPDIAG_FILE="$(dirname $0)/events.dump"
+
+ts_log "[Testing saved events]"
+
+ts_ss "$0" "Replay saved events" -Htn
+test_on "^UNCONN 1 +0 +\[::1\]:45998 +\[::1\]:7002"
+test_on "^UNCONN 1 +0 +\[::ffff:127.0.0.1\]:46536 +\[::ffff:127.0.0.1\]:7002"
+test_lines_count 2
+
+ts_ss "$0" "Filter saved events" -Htn src [::1]
+test_on "\[::1\]:45998"
+test_lines_count 1
+
+command -v perl > /dev/null || exit 0
+
+# Live events go through service name lookup without -n
+unset TCPDIAG_FILE
+$IP link set lo up
+$SS -EHt > $STD_OUT 2> $STD_ERR &
+SSPID=$!
+sleep 0.3
+perl -MSocket -e '
+	socket(S, PF_INET, SOCK_STREAM, 0) or die "socket: $!";
+	bind(S, pack_sockaddr_in(7003, INADDR_LOOPBACK)) or die "bind: $!";
+	listen(S, 1) or die "listen: $!";
+	socket(T, PF_INET, SOCK_STREAM, 0) or die "socket: $!";
+	connect(T, pack_sockaddr_in(7003, INADDR_LOOPBACK)) or die "connect: $!";
+	accept(C, S);'
+sleep 0.3
+kill $SSPID 2> /dev/null
+{ wait $SSPID; } 2> /dev/null
+echo "$0: Show live events"
+cat $STD_OUT
+test_on "^UNCONN 1 +0 +127.0.0.1:[0-9]+ +127.0.0.1:[^ ]+ *$"
+
+# A host that resolves to several addresses is a list in the socket
+# filter, the miss on 127.0.0.2 has to go on to 127.0.0.1
+command -v unshare > /dev/null || exit 0
+HOSTS=$(mktemp)
+printf '127.0.0.2 ss-multi\n127.0.0.1 ss-multi\n' > $HOSTS
+unshare -m sh -c "mount --bind $HOSTS /etc/hosts &&
+		  exec $SS -EHtn dst ss-multi and dport = :7004" \
+	> $STD_OUT 2> $STD_ERR &
+SSPID=$!
+sleep 0.3
+perl -MSocket=:DEFAULT,inet_pton,pack_sockaddr_in6 -e '
+	socket(S, PF_INET, SOCK_STREAM, 0) or die "socket: $!";
+	bind(S, pack_sockaddr_in(7004, INADDR_LOOPBACK)) or die "bind: $!";
+	listen(S, 2) or die "listen: $!";
+	socket(T, PF_INET, SOCK_STREAM, 0) or die "socket: $!";
+	connect(T, pack_sockaddr_in(7004, INADDR_LOOPBACK)) or die "connect: $!";
+	socket(U, PF_INET6, SOCK_STREAM, 0) or exit 0;
+	connect(U, pack_sockaddr_in6(7004, inet_pton(AF_INET6, "::ffff:127.0.0.1")))
+		or die "connect: $!";'
+sleep 0.3
+kill $SSPID 2> /dev/null
+{ wait $SSPID; } 2> /dev/null
+rm -f $HOSTS
+echo "$0: Show live events of a host with several addresses"
+cat $STD_OUT
+test_on "^UNCONN [0-9]+ +[0-9]+ +127.0.0.1:[0-9]+ +127.0.0.1:7004 *$"
+test_on "^UNCONN [0-9]+ +[0-9]+ +\[::ffff:127.0.0.1\]:[0-9]+ +\[::ffff:127.0.0.1\]:7004 *$"
@@ -0,0 +1,42 @@
+#!/bin/sh
+
+. lib/generic.sh
+
+ts_log "[Testing --kill]"
+
+$SS -K --kill-window=1048576 2> $STD_ERR > $STD_OUT
+if [ $? -eq 0 ]; then
+	ts_err "$0: --kill-window accepted a window above 1048575"
+else
+	echo "$0: too large a --kill-window rejected, as expected"
+fi
+
+command -v perl > /dev/null || ts_skip
+
+$IP link set lo up
+
+# Listen on ports 4460 to 4464
+perl -MSocket -e '
+	for $port (4460 .. 4464) {
+		socket($s{$port}, PF_INET, SOCK_STREAM, 0) or die "socket: $!";
+		bind($s{$port}, pack_sockaddr_in($port, INADDR_ANY))
+			or die "bind: $!";
+		listen($s{$port}, 1) or die "listen: $!";
+	}
+	sleep 10;' &
+PID=$!
+sleep 0.3
+
+ts_ss "$0" "Show the listeners" -Htln "sport >= :4460 and sport <= :4464"
+test_lines_count 5
+
+ts_ss "$0" "Close the listeners, two per batch" -HtlnK --kill-window=2 \
+	"sport >= :4460 and sport <= :4464"
+test_on "^LISTEN .* 0.0.0.0:4460 "
+test_on "^LISTEN .* 0.0.0.0:4464 "
+test_lines_count 5
+
+ts_ss "$0" "Show the listeners left" -Htln "sport >= :4460 and sport <= :4464"
+test_lines_count 0
+
+kill $PID
@@ -0,0 +1,44 @@
+#!/bin/sh
+
+. lib/generic.sh
+
+# % ./misc/ss -Hta
+# LISTEN  0    128    0.0.0.0:ssh      0.0.0.0:*
+# ESTAB   0    0     10.0.0.1:ssh     10.0.0.1:36266
+# ESTAB   0    0     10.0.0.1:36266   10.0.0.1:ssh
+# ESTAB   0    0     10.0.0.1:ssh     10.0.0.2:50312
+export TCPDIAG_FILE="$(dirname $0)/ss1.dump"
+
+ts_log "[Testing the name cache file]"
+
+OLD_CACHE=/var/cache/iproute2/names
+HAD_OLD_CACHE=
+[ -e $OLD_CACHE ] && HAD_OLD_CACHE=1
+
+unset IPROUTE2_NAME_CACHE
+ts_ss "$0" "Resolve services without a cache file" -Hta
+test_on "^LISTEN .* 0.0.0.0:ssh "
+if [ -z "$HAD_OLD_CACHE" ] && [ -e $OLD_CACHE ]; then
+	ts_err "$0: $OLD_CACHE written without IPROUTE2_NAME_CACHE"
+fi
+
+TMPD="$(mktemp -d)"
+export IPROUTE2_NAME_CACHE="$TMPD/cache/names"
+ts_ss "$0" "Resolve services into a cache file" -Hta
+test_on "^LISTEN .* 0.0.0.0:ssh "
+
+if [ ! -f "$IPROUTE2_NAME_CACHE" ]; then
+	ts_err "$0: cache file not created"
+elif [ "$(stat -c %a "$IPROUTE2_NAME_CACHE")" != 600 ] ||
+     [ "$(stat -c %a "$TMPD/cache")" != 700 ]; then
+	ts_err "$0: cache file or directory readable by others"
+elif ! grep -aq ssh "$IPROUTE2_NAME_CACHE"; then
+	ts_err "$0: service name not kept in the cache file"
+else
+	echo "$0: cache file created private to its user, as expected"
+fi
+
+ts_ss "$0" "Resolve services from the cache file" -Hta
+test_on "^ESTAB .* 10.0.0.1:36266 +10.0.0.1:ssh"
+
+rm -rf "$TMPD"
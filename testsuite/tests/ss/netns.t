@@ -0,0 +1,46 @@
+#!/bin/sh
+
+. lib/generic.sh
+
+ts_log "[Testing device names across namespaces]"
+
+command -v perl > /dev/null || ts_skip
+
+NS1=ss-netns-a
+NS2=ss-netns-b
+
+# Listen on port 4455, bound to the device given as argument
+LISTEN='
+	socket(S, PF_INET, SOCK_STREAM, 0) or die "socket: $!";
+	setsockopt(S, SOL_SOCKET, 25, $ARGV[0]) or die "device: $!";
+	bind(S, pack_sockaddr_in(4455, INADDR_ANY)) or die "bind: $!";
+	listen(S, 1) or die "listen: $!";
+	sleep 10;'
+
+ts_ip "$0" "Add new netns $NS1" netns add $NS1
+ts_ip "$0" "Add new netns $NS2" netns add $NS2
+
+# Interface 1 is lo in one namespace and loop in the other
+ts_ip "$0" "Set lo up in $NS1" -n $NS1 link set lo up
+ts_ip "$0" "Rename lo in $NS2" -n $NS2 link set lo name loop
+ts_ip "$0" "Set loop up in $NS2" -n $NS2 link set loop up
+
+$IP netns exec $NS1 perl -MSocket -e "$LISTEN" lo &
+PID1=$!
+$IP netns exec $NS2 perl -MSocket -e "$LISTEN" loop &
+PID2=$!
+sleep 1
+
+ts_ss "$0" "Show listeners of $NS1 and $NS2" -N $NS1,$NS2 -Htln
+test_on "^$NS1 +LISTEN .* 0.0.0.0%lo:4455 "
+test_on "^$NS2 +LISTEN .* 0.0.0.0%loop:4455 "
+
+ts_ss "$0" "Aggregate listeners of $NS1 and $NS2 by device" \
+	-N $NS1,$NS2 -Htln --aggregate=dev
+test_on "^loop "
+
+kill $PID1 $PID2
+wait
+
+ts_ip "$0" "Delete netns $NS1" netns del $NS1
+ts_ip "$0" "Delete netns $NS2" netns del $NS2
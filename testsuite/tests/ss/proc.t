@@ -0,0 +1,17 @@
+#!/bin/sh
+
+. lib/generic.sh
+
+# /proc/net fallback, as used when sock_diag is not available
+export PROC_NET_TCP=/dev/null
+export PROC_NET_TCP6="$(dirname $0)/proc_net_tcp6"
+
+ts_log "[Testing /proc/net parser]"
+
+ts_ss "$0" "Parse tcp6 table" -Htan
+test_on "^LISTEN 1 +0 +\[::1\]:7777 +\*:\*"
+test_on "^ESTAB +0 +36 +\[::ffff:10.0.0.1\]:22 +\[::ffff:10.0.0.2\]:50344"
+test_lines_count 2
+
+ts_ss "$0" "Parse tcp6 timers and uid" -Htanoe sport = :22
+test_on "timer:\(on,200ms,0\) uid:1000 ino:12472848"
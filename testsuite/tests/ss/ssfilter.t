@@ -46,3 +46,15 @@ test_on "ESTAB 0      0      10.0.0.1:22 10.0.0.2:50312"
 
 ts_ss "$0" "Match (src or src) and dst" -Htna '( src 0.0.0.0 or src 10.0.0.1 ) and dst 10.0.0.2'
 test_on "ESTAB 0      0      10.0.0.1:22 10.0.0.2:50312"
+
+ts_ss "$0" "Match folded sport range" -Htna 'sport = :21 or sport = :22 or sport = :23'
+test_lines_count 3
+
+ts_ss "$0" "Report folded sport range" -Htna --filter-report 'sport = :21 or sport = :22 or sport = :23'
+test_on "^Kernel: \(sport >= :21 and sport <= :23\)$"
+test_on "^User space only: none$"
+test_on "^Bytecode: 2 ops, 16 bytes \(unoptimised 5 ops, 56 bytes\)$"
+
+ts_ss "$0" "Report device offload" -Htna --filter-report '! ! dev = lo and dport = :22'
+test_on "^Filter: \(dev = lo and dport = :22\)$"
+test_on "^User space only: none$"
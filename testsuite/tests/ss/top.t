@@ -0,0 +1,44 @@
+#!/bin/sh
+
+. lib/generic.sh
+
+ts_log "[Testing --top]"
+
+command -v perl > /dev/null || ts_skip
+
+$SS --top=2 -j 2> $STD_ERR > $STD_OUT
+if [ $? -eq 0 ]; then
+	ts_err "$0: --top accepted -j"
+else
+	echo "$0: -j rejected with --top, as expected"
+fi
+
+$IP link set lo up
+
+# Send to a local listener on port 4456 for two seconds
+perl -MSocket -e '
+	socket(S, PF_INET, SOCK_STREAM, 0) or die "socket: $!";
+	bind(S, pack_sockaddr_in(4456, INADDR_LOOPBACK)) or die "bind: $!";
+	listen(S, 1) or die "listen: $!";
+	if (fork()) {
+		accept(C, S);
+		while (sysread(C, $b, 65536)) {}
+		exit;
+	}
+	socket(T, PF_INET, SOCK_STREAM, 0) or die "socket: $!";
+	connect(T, pack_sockaddr_in(4456, INADDR_LOOPBACK)) or die "connect: $!";
+	$d = "x" x 4096;
+	$end = time + 2;
+	while (time < $end) {
+		syswrite(T, $d);
+		select(undef, undef, undef, 0.001);
+	}' &
+PID=$!
+sleep 0.3
+
+ts_ss "$0" "Show the top sender" --top=1 --interval=300 --count=1 \
+	sport = :4456 or dport = :4456
+test_on "^2 sockets in .* top 1 by bytes_acked"
+test_on ":4456 +tx:[1-9][0-9.]*[KMG]bps "
+
+wait $PID
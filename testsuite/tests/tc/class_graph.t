@@ -0,0 +1,21 @@
+#!/bin/sh
+. lib/generic.sh
+
+DEV="$(rand_dev)"
+ts_ip "$0" "Add $DEV dummy interface" link add dev $DEV type dummy
+ts_tc "$0" "Add htb qdisc" qdisc add dev $DEV root handle 1: htb
+ts_tc "$0" "Add class 1:1" class add dev $DEV parent 1: classid 1:1 htb rate 10mbit
+ts_tc "$0" "Add class 1:20" class add dev $DEV parent 1:1 classid 1:20 htb rate 1mbit
+ts_tc "$0" "Add class 1:10" class add dev $DEV parent 1:1 classid 1:10 htb rate 1mbit
+ts_tc "$0" "Add class 1:100" class add dev $DEV parent 1:10 classid 1:100 htb rate 1mbit
+
+ts_tc "$0" "Show class graph" -g class show dev $DEV
+test_on "^\+---\(1:1\) htb"
+test_on "^     \+---\(1:10\) htb"
+test_on "^     \|    \+---\(1:100\) htb"
+test_lines_count 7
+
+ts_tc "$0" "Show class graph as JSON" -g -j class show dev $DEV
+test_on '"handle":"1:1",.*"children":\[\{"class":"htb","handle":"1:10",.*"children":\[\{"class":"htb","handle":"1:100"'
+
+ts_ip "$0" "Del $DEV dummy interface" link del dev $DEV
@@ -0,0 +1,31 @@
+#!/bin/sh
+. lib/generic.sh
+
+DEV="$(rand_dev)"
+ts_ip "$0" "Add $DEV dummy interface" link add dev $DEV type dummy
+ts_ip "$0" "Enable $DEV" link set $DEV up
+ts_tc "$0" "Add ingress qdisc" qdisc add dev $DEV clsact
+
+TMP="$(mktemp)"
+echo "ip_proto,dst_ip,dst_port,classid" >> "$TMP"
+echo "tcp,192.0.2.1,80,1:10" >> "$TMP"
+echo "udp,192.0.2.0/24,,1:20" >> "$TMP"
+echo "tcp,192.0.2.x,80,1:30" >> "$TMP"
+
+"$TC" filter compile dev $DEV ingress protocol ip pref 10 flower "$TMP" \
+	2> $STD_ERR > $STD_OUT
+if [ $? -eq 0 ]; then
+	ts_err "$0: compile passed with an invalid row"
+elif ! grep -q "Invalid rule at $TMP:4" $STD_ERR; then
+	ts_err "$0: compile did not report the invalid row"
+else
+	echo "$0: invalid row rejected, as expected"
+fi
+
+ts_tc "$0" "Show flower filters" filter show dev $DEV ingress
+test_on "dst_ip 192.0.2.1"
+test_on "dst_port 80"
+test_on "dst_ip 192.0.2.0/24"
+
+rm "$TMP"
+ts_ip "$0" "Del $DEV dummy interface" link del dev $DEV
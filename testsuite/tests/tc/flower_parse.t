@@ -0,0 +1,45 @@
+#!/bin/sh
+. lib/generic.sh
+
+# Rule tables refused while they are parsed, before any filter is sent,
+# so no flower classifier is needed.
+
+TMP="$(mktemp)"
+
+# compile_fails DESC PROTO ERROR: compile $TMP and expect ERROR
+compile_fails()
+{
+	"$TC" filter compile dev lo ingress protocol $2 pref 10 \
+		flower "$TMP" 2> $STD_ERR > $STD_OUT
+	if [ $? -eq 0 ]; then
+		ts_err "$0: compile passed with $1"
+	elif ! grep -q "$3" $STD_ERR; then
+		ts_err "$0: compile did not report $1:"
+		ts_err_cat $STD_ERR
+	else
+		echo "$0: $1 rejected, as expected"
+	fi
+}
+
+echo "dst_ip,dst_mask" > "$TMP"
+compile_fails "an unknown column" ip 'Unknown column "dst_mask"'
+
+echo "dst_ip,classid,dst_ip" > "$TMP"
+compile_fails "a duplicate column" ip 'Duplicate column "dst_ip"'
+
+echo "dst_ip,classid" > "$TMP"
+compile_fails "IP keys without protocol ip" all \
+	"IP keys need protocol ip or ipv6"
+
+echo "dst_ip,dst_port" > "$TMP"
+compile_fails "ports without ip_proto" ip 'need an "ip_proto" column'
+
+echo "ip_proto,dst_ip,dst_port,classid" > "$TMP"
+echo "tcp,192.0.2.x,80,1:10" >> "$TMP"
+echo "" >> "$TMP"
+echo "udp,192.0.2.1" >> "$TMP"
+compile_fails "an invalid address" ip "Invalid rule at $TMP:2"
+compile_fails "a short row" ip "Invalid rule at $TMP:4"
+compile_fails "the width of a short row" ip "Expected 4 columns, got 2"
+
+rm "$TMP"
@@ -0,0 +1,94 @@
+#!/bin/sh
+. lib/generic.sh
+
+# Distribution tables are read before anything is sent to the kernel,
+# so no netem qdisc is needed.
+
+DISTTABLE=../netem/disttable
+[ -x $DISTTABLE ] || ts_skip "disttable not built"
+
+DIR="$(mktemp -d)"
+
+# run_ok DESC CMD...: run CMD, stdout is kept in $STD_OUT
+run_ok()
+{
+	DESC="$1"
+	shift
+	if "$@" > $STD_OUT 2> $STD_ERR; then
+		echo "$0: $DESC succeeded"
+	else
+		ts_err "$0: $DESC failed:"
+		ts_err_cat $STD_ERR
+	fi
+}
+
+# run_fails DESC ERROR CMD...: expect CMD to fail and report ERROR
+run_fails()
+{
+	DESC="$1"
+	ERROR="$2"
+	shift 2
+	if "$@" > $STD_OUT 2> $STD_ERR; then
+		ts_err "$0: $DESC passed"
+	elif ! grep -q "$ERROR" $STD_ERR; then
+		ts_err "$0: $DESC did not report \"$ERROR\":"
+		ts_err_cat $STD_ERR
+	else
+		echo "$0: $DESC rejected, as expected"
+	fi
+}
+
+# entries of the text tables $1 and $2
+same_entries()
+{
+	grep -hv '^#' "$1" | tr -s ' \t' '\n\n' | grep -v '^$' > $DIR/a
+	grep -hv '^#' "$2" | tr -s ' \t' '\n\n' | grep -v '^$' > $DIR/b
+	if [ ! -s $DIR/a ] || ! cmp -s $DIR/a $DIR/b; then
+		ts_err "$0: $3 changed the table"
+	else
+		echo "$0: $3 kept the table"
+	fi
+}
+
+awk 'BEGIN { for (i = 0; i < 1000; i++) print (i * 37) % 101 + i / 10 }' \
+	> $DIR/trace
+run_ok "Build a table" $DISTTABLE -n 64 empirical $DIR/trace
+cp $STD_OUT $DIR/t.dist
+
+run_ok "Convert it to binary" $DISTTABLE -b convert $DIR/t.dist
+cp $STD_OUT $DIR/t.bdist
+run_ok "Convert it back" $DISTTABLE convert $DIR/t.bdist
+cp $STD_OUT $DIR/back.dist
+same_entries $DIR/t.dist $DIR/back.dist "The round trip"
+
+run_ok "Convert it to binary again" $DISTTABLE -b convert $DIR/back.dist
+if cmp -s $STD_OUT $DIR/t.bdist; then
+	echo "$0: binary tables are identical"
+else
+	ts_err "$0: binary tables differ"
+fi
+
+# flip the bits of the first entry, after the 16 bytes of header
+cp $DIR/t.bdist $DIR/bad.bdist
+printf '\377' | dd of=$DIR/bad.bdist bs=1 seek=16 conv=notrunc 2> /dev/null
+run_fails "Convert a table with a bad checksum" "Invalid binary table" \
+	$DISTTABLE convert $DIR/bad.bdist
+
+export TC_LIB_DIR=$DIR
+run_fails "Load a table with a bad checksum" "invalid distribution table" \
+	$TC qdisc add dev lo root netem delay 10ms 1ms distribution bad
+
+# a text table edited after the binary one is used instead of it
+touch -d 2000-01-01 $DIR/bad.bdist
+cp $DIR/t.dist $DIR/bad.dist
+$TC qdisc add dev lo root netem delay 10ms 1ms distribution bad \
+	> $STD_OUT 2> $STD_ERR
+if grep -q "distribution table\|No distribution data" $STD_ERR; then
+	ts_err "$0: the newer text table was not used:"
+	ts_err_cat $STD_ERR
+else
+	echo "$0: the newer text table was used"
+fi
+$TC qdisc del dev lo root 2> /dev/null
+
+rm -rf $DIR
@@ -0,0 +1,30 @@
+#!/bin/sh
+. lib/generic.sh
+
+DEV="$(rand_dev)"
+ts_ip "$0" "Add $DEV dummy interface" link add dev $DEV type dummy
+ts_tc "$0" "Add htb qdisc" qdisc add dev $DEV root handle 1: htb
+ts_tc "$0" "Add class 1:1" class add dev $DEV parent 1: classid 1:1 htb rate 10mbit
+ts_tc "$0" "Add class 1:10" class add dev $DEV parent 1:1 classid 1:10 htb rate 1mbit
+
+ts_tc "$0" "Sample class rates" -interval 100 -count 2 class show dev $DEV
+test_on "^class htb 1:10 dev $DEV parent 1:1 rate 0bit 0pps dropped 0.0/s"
+test_lines_count 6
+
+ts_tc "$0" "Sample qdisc deltas" --interval 100 --count 1 --delta qdisc show dev $DEV
+test_on "^qdisc htb 1: dev $DEV root sent 0 bytes 0 pkt \(dropped 0, overlimits 0 requeues 0\)"
+
+ts_tc "$0" "Sample top class as JSON" -j -interval 100 -count 1 -top 1 class show dev $DEV
+test_on '^\[{"class":"htb","handle":"1:[0-9]*","dev":"'$DEV'",.*"drop_rate":0,'
+test_lines_count 1
+
+ts_tc "$0" "Sample with timestamps as JSON" -j -timestamp -interval 100 -count 1 qdisc show dev $DEV
+test_on '^\[{"kind":"htb","handle":"1:","dev":"'$DEV'","timestamp":"[0-9-]*T[0-9:.]*",'
+test_lines_count 1
+
+ts_tc "$0" "Add matchall filter" filter add dev $DEV parent 1: protocol ip pref 10 matchall classid 1:10 action gact pass
+ts_tc "$0" "Sample filter deltas" -interval 100 -count 1 -delta filter show dev $DEV
+test_on "^filter matchall pref 10 protocol ip handle 0x1 dev $DEV parent 1: sent 0 bytes 0 pkt \(dropped 0, overlimits 0 requeues 0\)"
+test_lines_count 2
+
+ts_ip "$0" "Del $DEV dummy interface" link del dev $DEV
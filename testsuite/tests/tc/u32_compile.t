@@ -0,0 +1,54 @@
+#!/bin/sh
+. lib/generic.sh
+
+DEV="$(rand_dev)"
+ts_ip "$0" "Add $DEV dummy interface" link add dev $DEV type dummy
+ts_ip "$0" "Enable $DEV" link set $DEV up
+ts_tc "$0" "Add htb qdisc" qdisc add dev $DEV root handle 1: htb
+
+TMP="$(mktemp)"
+echo "# host routes" >> "$TMP"
+for i in 1 2 3 4 5 6 7 8 9; do
+	echo "match ip dst 10.0.0.$i/32 classid 1:$i" >> "$TMP"
+done
+
+ts_tc "$0" "Compile u32 rules" \
+	filter compile dev $DEV parent 1: protocol ip prio 10 u32 "$TMP"
+test_on "9 rules in 1 hash tables, 10 nodes"
+ts_tc "$0" "Show u32 filters" filter show dev $DEV parent 1:
+test_on "fh 1:5:1 order 1 key ht 1 bkt 5 flowid 1:5"
+
+echo "match ip dst 10.0.0.10/32 classid 1:10 link 1:" >> "$TMP"
+"$TC" filter compile dev $DEV parent 1: protocol ip prio 20 u32 "$TMP" \
+	2> $STD_ERR > $STD_OUT
+if [ $? -eq 0 ]; then
+	ts_err "$0: compile passed with an invalid rule"
+elif ! grep -q "Invalid rule at $TMP:11" $STD_ERR; then
+	ts_err "$0: compile did not report the invalid rule"
+else
+	echo "$0: invalid rule rejected, as expected"
+fi
+
+# more rules than a bucket holds, with no key to hash them on
+ts_tc "$0" "Replace htb qdisc" qdisc del dev $DEV root
+ts_tc "$0" "Add htb qdisc" qdisc add dev $DEV root handle 1: htb
+: > "$TMP"
+i=0
+while [ $i -lt 5000 ]; do
+	i=$((i + 1))
+	echo "match ip dst 10.0.0.1/32 classid 1:$i" >> "$TMP"
+done
+
+ts_tc "$0" "Compile a long u32 list" \
+	filter compile dev $DEV parent 1: protocol ip prio 30 u32 "$TMP"
+test_on "5000 rules in 1 hash tables, 5001 nodes"
+"$TC" filter show dev $DEV parent 1: prio 30 > $STD_OUT 2> $STD_ERR
+n="$(grep -c flowid $STD_OUT)"
+if [ "$n" -ne 5000 ]; then
+	ts_err "$0: $n of 5000 rules installed"
+else
+	echo "$0: all 5000 rules installed"
+fi
+
+rm "$TMP"
+ts_ip "$0" "Del $DEV dummy interface" link del dev $DEV
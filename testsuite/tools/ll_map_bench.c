@@ -0,0 +1,87 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * ll_map_bench.c	Link cache lookup cost versus number of links
+ *
+ * Fills the ll_map cache with synthetic RTM_NEWLINK messages and times
+ * random ll_index_to_name() and ll_name_to_index() lookups. With the
+ * cache tables growing along with the number of links, the cost per
+ * lookup should stay flat.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <net/if.h>
+#include <linux/if_arp.h>
+
+#include "libnetlink.h"
+#include "ll_map.h"
+
+#define LOOKUPS		1000000
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void add_links(unsigned int from, unsigned int to)
+{
+	struct {
+		struct nlmsghdr		n;
+		struct ifinfomsg	ifi;
+		char			buf[64];
+	} req;
+	char name[IFNAMSIZ];
+	unsigned int i;
+
+	for (i = from; i <= to; i++) {
+		memset(&req, 0, sizeof(req));
+		req.n.nlmsg_len = NLMSG_LENGTH(sizeof(req.ifi));
+		req.n.nlmsg_type = RTM_NEWLINK;
+		req.ifi.ifi_index = i;
+		req.ifi.ifi_type = ARPHRD_ETHER;
+		snprintf(name, sizeof(name), "veth%u", i);
+		addattrstrz(&req.n, sizeof(req), IFLA_IFNAME, name);
+		ll_remember_index(&req.n, NULL);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	static const unsigned int sizes[] = {
+		100, 1000, 10000, 100000, 1000000,
+	};
+	unsigned int i, k, links = 0;
+	char name[IFNAMSIZ];
+	unsigned long sum = 0;
+
+	srandom(1);
+	printf("%10s %14s %14s\n", "links", "index->name", "name->index");
+
+	for (k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+		double t0, t1, t2;
+
+		add_links(links + 1, sizes[k]);
+		links = sizes[k];
+
+		t0 = now();
+		for (i = 0; i < LOOKUPS; i++)
+			sum += strlen(ll_index_to_name(random() % links + 1));
+		t1 = now();
+		for (i = 0; i < LOOKUPS; i++) {
+			snprintf(name, sizeof(name), "veth%lu",
+				 random() % links + 1);
+			sum += ll_name_to_index(name);
+		}
+		t2 = now();
+
+		printf("%10u %11.1f ns %11.1f ns\n", links,
+		       (t1 - t0) * 1e9 / LOOKUPS, (t2 - t1) * 1e9 / LOOKUPS);
+	}
+
+	return sum ? 0 : 1;
+}
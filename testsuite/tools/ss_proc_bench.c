@@ -0,0 +1,128 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * ss_proc_bench.c	Cost of the ss /proc/net fallback parser
+ *
+ * Writes a synthetic /proc/net/tcp6 table, or uses a captured one, and
+ * times each given ss binary reading it through PROC_NET_TCP6: with a
+ * port filter that matches nothing, counting sockets per state, which
+ * parses every field but prints nothing, and printing every socket to
+ * /dev/null.
+ *
+ * Usage: ss_proc_bench [-n LINES] [-f FILE] SS [SS...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/wait.h>
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void write_table(const char *path, unsigned int lines)
+{
+	FILE *fp = fopen(path, "w");
+	unsigned int i;
+
+	if (!fp) {
+		perror(path);
+		exit(1);
+	}
+
+	fprintf(fp, "  sl  local_address                         remote_address                        st tx_queue rx_queue tr tm->when retrnsmt   uid  timeout inode\n");
+	for (i = 0; i < lines; i++) {
+		unsigned int lport = i % 10 ? 443 : 1024 + i % 60000;
+		unsigned int rport = 1024 + (i * 7) % 64000;
+		unsigned int state = i % 10 ? 0x01 : 0x0A;
+
+		fprintf(fp, "%6u: 0000000000000000FFFF0000%08X:%04X 0000000000000000FFFF0000%08X:%04X %02X %08X:%08X 00:00000000 00000000  %4u        0 %u 1 %016llx 20 4 30 10 -1\n",
+			i, 0x0100000A, lport, 0x0200000A + (i >> 16) * 256 + (i & 0xff),
+			state == 0x0A ? 0 : rport, state, i % 3 ? 0 : 1448, i % 5,
+			1000 + i % 4, 100000 + i, 0xffff888000000000ULL + i * 2048ULL);
+	}
+	fclose(fp);
+}
+
+static double run(const char *ss, char *const argv[])
+{
+	double t0 = now();
+	int status;
+	pid_t pid;
+
+	pid = fork();
+	if (pid == 0) {
+		int fd = open("/dev/null", O_WRONLY);
+
+		dup2(fd, 1);
+		execv(ss, argv);
+		perror(ss);
+		_exit(127);
+	}
+	if (pid < 0 || waitpid(pid, &status, 0) < 0 ||
+	    !WIFEXITED(status) || WEXITSTATUS(status)) {
+		fprintf(stderr, "%s failed\n", ss);
+		exit(1);
+	}
+	return now() - t0;
+}
+
+int main(int argc, char **argv)
+{
+	char path[] = "/tmp/ss_proc_benchXXXXXX";
+	const char *file = NULL;
+	unsigned int lines = 1000000;
+	int opt, fd;
+
+	while ((opt = getopt(argc, argv, "n:f:")) != -1) {
+		switch (opt) {
+		case 'n':
+			lines = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			file = optarg;
+			break;
+		default:
+			fprintf(stderr, "Usage: ss_proc_bench [-n LINES] [-f FILE] SS [SS...]\n");
+			return 1;
+		}
+	}
+
+	if (!file) {
+		fd = mkstemp(path);
+		if (fd < 0) {
+			perror("mkstemp");
+			return 1;
+		}
+		close(fd);
+		write_table(path, lines);
+		file = path;
+	}
+
+	setenv("PROC_NET_TCP", "/dev/null", 1);
+	setenv("PROC_NET_TCP6", file, 1);
+
+	printf("%-30s %12s %12s %12s\n", "ss", "filtered", "aggregated",
+	       "printed");
+	for (; optind < argc; optind++) {
+		char *filtered[] = { "ss", "-Htan", "sport", "=", ":1", NULL };
+		char *aggregated[] = { "ss", "-Htan", "--aggregate=state", NULL };
+		char *printed[] = { "ss", "-Htan", NULL };
+		const char *ss = argv[optind];
+
+		printf("%-30s %10.3f s %10.3f s %10.3f s\n", ss,
+		       run(ss, filtered), run(ss, aggregated), run(ss, printed));
+	}
+
+	if (file == path)
+		unlink(path);
+	return 0;
+}